@@ -0,0 +1,81 @@
+#ifndef EVENTCHANNEL_H
+#define EVENTCHANNEL_H
+
+#include <pthread.h>
+#include <time.h>
+#include <staple/Type.h>
+
+/**
+ * Hand-off of the published events (TCPTA, FLV and their partial records)
+ * from the parser threads to the Java publisher.
+ *
+ * The parsers append compact binary records to the batch being filled, so
+ * no JNI call is made on the packet path. The batches are handed over to
+ * Java by the flush thread, one JNI call per batch (the batch memory is
+ * exposed to Java as a direct ByteBuffer).
+ *
+ * Record layout (host byte order, no padding):
+ *    int32 eventType (StapleJniImpl::eventTypes)
+ *    int32 length
+ *    length bytes of event text (not NUL-terminated)
+ */
+class EventChannel
+{
+public:
+	unsigned long long producerStalls;	// Number of times a parser waited for a free batch
+	unsigned long long droppedEvents;	// Events longer than a whole batch (never published)
+
+	EventChannel();
+	~EventChannel();
+
+	/**
+	 * Append an event to the batch being filled (thread-safe). Waits
+	 * only if all the other batches are still queued for publishing.
+	 */
+	void publish(int eventType, const char* event, unsigned long length);
+
+	/**
+	 * Wait for a full batch until the given (CLOCK_MONOTONIC) deadline.
+	 * If there is none at the deadline (or after stop), the batch being
+	 * filled is handed over as it is (and partial is set). Returns the
+	 * index of the batch to publish, or -1 if there is no event to publish.
+	 */
+	int next(const struct timespec& deadline, bool& partial);
+
+	/**
+	 * Give a batch returned by next back to the parsers (once Java is
+	 * done with its data).
+	 */
+	void release(int batch);
+
+	/**
+	 * Make next return without waiting (the queued events are still
+	 * returned).
+	 */
+	void stop();
+	bool stopped() const { return stopping; }
+
+	Byte* data(int batch) { return batches[batch]; }
+	unsigned long size(int batch) const { return batchLen[batch]; }
+	unsigned long capacity() const { return EVENT_BATCH_SIZE; }
+
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t queuedCond;	// Signalled when a batch is queued or at stop
+	pthread_cond_t releasedCond;	// Signalled when a batch is released
+
+	// The batches are used round-robin: the one being filled is preceded
+	// by the queued ones (the first of which may be under publishing)
+	Byte* batches[EVENT_BATCH_NUM];
+	unsigned long batchLen[EVENT_BATCH_NUM];
+	unsigned short filling;
+	unsigned short queued;
+	bool stopping;
+
+	void queueFilling();
+
+	EventChannel(const EventChannel&);
+	void operator=(const EventChannel&);
+};
+
+#endif
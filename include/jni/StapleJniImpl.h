@@ -24,7 +24,7 @@ public:
 
 
 
-	StapleJniImpl() : lastPerfmonROP(0)
+	StapleJniImpl()
 	{
 		// Default log is sdtout
 		logStream.rdbuf(std::cout.rdbuf());
@@ -35,22 +35,13 @@ public:
 			std::string pcapdumpfile, std::string tempfileprefix, int slot_Time, const char * logFileName, bool ignore_L2_DupPackets,
 			int logLevel, std::string log_Directory, std::string log_Prefix, bool noHTTP, char * inputDumpFileName,
 			bool publishToHazelcast, bool writeOutputToFile, int flushPeriod);
-	void writeLog(bool p_isFinal);
-	int publishEvent(int eventType, std::string event);
+	int publishEvents(JNIEnv* env, jobject events, const Byte* data, unsigned long length);
 	void flush();
 	JNIEnv* JNU_GetEnv();
 	jstring JNU_NewStringUTF(JNIEnv* env, jboolean* hasException, std::string str);
 	jvalue JNU_CallMethodByName(JNIEnv* env, jboolean* hasException,
 			const char* name, const char* descriptor, ...);
 	void throwJavaException(const char *message);
-
-	// Perfmon log files
-	std::ofstream     flvfile;
-	std::ofstream     flvpartialfile;
-	std::ofstream     tcptafile;
-	std::ofstream     tcptapartialfile;
-	// The ROP number of the last Perfmon log file
-	unsigned long     lastPerfmonROP;
 };
 
 #endif
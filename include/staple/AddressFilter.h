@@ -0,0 +1,71 @@
+#ifndef ADDRESSFILTER_H
+#define ADDRESSFILTER_H
+
+#include <stdint.h>
+#include <vector>
+#include <staple/Type.h>
+
+// Compiled network filters of one net (and address family)
+// -------------------------------------------------------
+// The prefixes are expanded into a multibit trie of ADDRFILTER_STRIDE bits per level, whose entries hold the lowest
+// filter id of the prefixes covering them. The lookup of an address is therefore at most 32/ADDRFILTER_STRIDE
+// (128/ADDRFILTER_STRIDE for IPv6) table reads and returns the first matching filter in configuration order (the
+// result of a linear scan of the filters).
+class AddressFilter {
+
+public:
+   static const uint32_t NONE = 0xffffffff;                 // Filter id of the unmatched addresses
+
+   AddressFilter();
+
+   void Clear();
+   // Add the prefix IP/mask (contiguous mask) as the given filter
+   void AddPrefix(uint32_t, uint32_t, uint32_t);
+   // Add the prefix of the given length of an address in network byte order (e.g., IPv6) as the given filter
+   void AddPrefix(const uint8_t*, unsigned short, uint32_t);
+   unsigned long NodeNum() const {return nodes.size() >> ADDRFILTER_STRIDE;}
+
+   // Lowest id of the filters matching the address (NONE if there is no such filter)
+   uint32_t Find(uint32_t p_IP) const
+   {
+      const Entry* pEntry = &nodes[p_IP >> (32-ADDRFILTER_STRIDE)];
+      for (unsigned short shift = 32-2*ADDRFILTER_STRIDE; pEntry->child != 0; shift -= ADDRFILTER_STRIDE)
+      {
+         pEntry = &nodes[(pEntry->child << ADDRFILTER_STRIDE) + ((p_IP >> shift) & ((1 << ADDRFILTER_STRIDE)-1))];
+      }
+      return pEntry->filterId;
+   }
+   // Lowest id of the filters matching an address in network byte order (the address is as long as the prefixes added)
+   uint32_t Find(const uint8_t* p_IP) const
+   {
+      const Entry* pEntry = &nodes[Chunk(p_IP, 0)];
+      for (unsigned short level = 1; pEntry->child != 0; level++)
+      {
+         pEntry = &nodes[(pEntry->child << ADDRFILTER_STRIDE) + Chunk(p_IP, level)];
+      }
+      return pEntry->filterId;
+   }
+
+private:
+   struct Entry {
+      uint32_t       child;                                 // Index of the next level node (0: leaf)
+      uint32_t       filterId;                              // Lowest id of the filters covering the entry (NONE: no filter)
+   };
+   std::vector<Entry>   nodes;                              // Trie nodes of 2^ADDRFILTER_STRIDE entries (node 0: root)
+
+   void SetFilter(uint32_t, uint32_t);
+
+   // The address bits resolved at a level of the trie
+   static uint32_t Chunk(const uint8_t* p_IP, unsigned short p_level)
+   {
+      if (ADDRFILTER_STRIDE == 8) return p_IP[p_level];
+      uint32_t chunk = 0;
+      for (unsigned short bit = p_level*ADDRFILTER_STRIDE; bit < (p_level+1)*ADDRFILTER_STRIDE; bit++)
+      {
+         chunk = (chunk << 1) | ((p_IP[bit >> 3] >> (7 - (bit & 7))) & 1);
+      }
+      return chunk;
+   }
+};
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include <string.h>
+#include <stdint.h>
+#include <utility>
+#include <tuple>
+#include <functional>
+#include <staple/Type.h>
+
+// Associative array of flows (TCP connections, IP sessions, users) with the interface of std::unordered_map
+// ---------------------------------------------------------------------------------------------------------
+// Each entry is a separately allocated node that is freed when the entry is erased, so references and iterators to
+// an entry stay valid until that entry is erased: inserting or erasing other entries (and resizing the table) does not
+// invalidate them, and end() does not change either. The nodes are chained in insertion order for the iteration (its
+// cost follows the live entries), and indexed by an open-addressed hash table (linear probing, backward shift deletion)
+// of node pointers that doubles at a load factor of 1/2 and halves below 1/8. The nodes keep their hash, so keys are
+// compared on a hash match only.
+// H has to be a well mixed hash (the low bits select the cell), E the key equality.
+template <class K, class V, class H = std::hash<K>, class E = std::equal_to<K> >
+class FlowTable {
+
+public:
+   typedef K                     key_type;
+   typedef V                     mapped_type;
+   typedef std::pair<const K,V>  value_type;
+
+   // Statistics
+   unsigned long long lookups;                              // Number of keys looked up
+   unsigned long long probes;                               // Number of cells visited by the lookups
+
+private:
+   class Node {
+   public:
+      uint64_t       hash;                                  // (in front of the key, as the probes compare both)
+      Node*          prev;                                  // Iteration order (insertion order)
+      Node*          next;
+      value_type     value;
+
+      Node(uint64_t p_hash, const value_type& p_value) : hash(p_hash), value(p_value) {}
+      Node(uint64_t p_hash, const K& p_key) : hash(p_hash), value(std::piecewise_construct, std::forward_as_tuple(p_key), std::forward_as_tuple()) {}
+   };
+
+public:
+   template <class T, class N>
+   class Iterator {
+   public:
+      Iterator() : node(NULL) {}
+      Iterator(N* p_node) : node(p_node) {}
+      template <class T2, class N2>
+      Iterator(const Iterator<T2,N2>& x) : node(x.node) {}
+
+      T& operator*() const {return node->value;}
+      T* operator->() const {return &(node->value);}
+      Iterator& operator++() {node = node->next; return *this;}
+      Iterator operator++(int) {Iterator old(*this); node = node->next; return old;}
+      template <class T2, class N2>
+      bool operator==(const Iterator<T2,N2>& x) const {return (node == x.node);}
+      template <class T2, class N2>
+      bool operator!=(const Iterator<T2,N2>& x) const {return (node != x.node);}
+
+   private:
+      N*             node;                                  // NULL: end
+
+      template <class T2, class N2> friend class Iterator;
+      friend class FlowTable;
+   };
+   typedef Iterator<value_type, Node>              iterator;
+   typedef Iterator<const value_type, const Node>  const_iterator;
+
+   FlowTable() : lookups(0), probes(0), cells(NULL), mask(0), first(NULL), last(NULL), count(0) {}
+   ~FlowTable() {clear();}
+
+   unsigned long size() const {return count;}
+   bool empty() const {return (count == 0);}
+   // Memory held by the hash table and the nodes [bytes]
+   unsigned long long MemoryUsage() const
+   {
+      return ((cells == NULL) ? 0 : (unsigned long long)(mask+1)*sizeof(Node*)) + (unsigned long long)count*sizeof(Node);
+   }
+
+   iterator begin() {return iterator(first);}
+   iterator end() {return iterator();}
+   const_iterator begin() const {return const_iterator(first);}
+   const_iterator end() const {return const_iterator();}
+
+   iterator find(const K& p_key)
+   {
+      return iterator(Find(p_key, H()(p_key)));
+   }
+
+   std::pair<iterator,bool> insert(const value_type& p_value)
+   {
+      uint64_t hash = H()(p_value.first);
+      Node* node = Find(p_value.first, hash);
+      if (node != NULL) return std::make_pair(iterator(node), false);
+
+      node = new Node(hash, p_value);
+      Add(node);
+      return std::make_pair(iterator(node), true);
+   }
+
+   V& operator[](const K& p_key)
+   {
+      uint64_t hash = H()(p_key);
+      Node* node = Find(p_key, hash);
+      if (node == NULL)
+      {
+         // The value is constructed in place (no copy of a default constructed temporary)
+         node = new Node(hash, p_key);
+         Add(node);
+      }
+      return node->value.second;
+   }
+
+   void erase(iterator p_index)
+   {
+      Node* node = p_index.node;
+      Unlink(node);
+      if (node->prev != NULL) node->prev->next = node->next;
+      else first = node->next;
+      if (node->next != NULL) node->next->prev = node->prev;
+      else last = node->prev;
+      delete node;
+      count--;
+      // Give back the cells of a table that has become sparse (the load factor goes back to about 1/4)
+      if ((8*count < mask+1) && (mask+1 > FLOWTABLE_MIN_CELLS)) Resize((mask+1)/2);
+   }
+
+   unsigned long erase(const K& p_key)
+   {
+      iterator index = find(p_key);
+      if (index == end()) return 0;
+      erase(index);
+      return 1;
+   }
+
+   void clear()
+   {
+      while (first != NULL)
+      {
+         Node* node = first;
+         first = node->next;
+         delete node;
+      }
+      last = NULL;
+      count = 0;
+      if (cells != NULL) delete [] cells;
+      cells = NULL;
+      mask = 0;
+   }
+
+private:
+   Node**               cells;                              // Hash table (NULL: empty cell)
+   unsigned long        mask;                               // Number of cells - 1 (power of two)
+   Node*                first;                              // Oldest entry
+   Node*                last;                               // Newest entry
+   unsigned long        count;                              // Number of entries
+
+   FlowTable(const FlowTable&);
+   FlowTable& operator=(const FlowTable&);
+
+   Node* Find(const K& p_key, uint64_t p_hash)
+   {
+      lookups++;
+      if (cells == NULL) return NULL;
+      unsigned long probeNum = 0;
+      Node* found = NULL;
+      for (unsigned long i = p_hash & mask; cells[i] != NULL; i = (i+1) & mask)
+      {
+         probeNum++;
+         Node* node = cells[i];
+         if ((node->hash == p_hash) && E()(node->value.first, p_key))
+         {
+            found = node;
+            break;
+         }
+      }
+      probes += probeNum;
+      return found;
+   }
+
+   void Link(Node* p_node)
+   {
+      unsigned long i = p_node->hash & mask;
+      while (cells[i] != NULL) i = (i+1) & mask;
+      cells[i] = p_node;
+   }
+
+   void Unlink(Node* p_node)
+   {
+      // Find the cell of the node
+      unsigned long i = p_node->hash & mask;
+      while (cells[i] != p_node) i = (i+1) & mask;
+      // Backward shift deletion: move up the following cells that would not be found otherwise
+      unsigned long j = i;
+      while (true)
+      {
+         j = (j+1) & mask;
+         if (cells[j] == NULL) break;
+         unsigned long home = cells[j]->hash & mask;
+         // Is the home cell cyclically outside of (i,j]?
+         bool move = (i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j));
+         if (move)
+         {
+            cells[i] = cells[j];
+            i = j;
+         }
+      }
+      cells[i] = NULL;
+   }
+
+   // Index a new node and append it to the iteration order
+   void Add(Node* p_node)
+   {
+      // Keep the load factor at most 1/2
+      if (cells == NULL) Resize(FLOWTABLE_MIN_CELLS);
+      else if (2*(count+1) > mask+1) Resize(2*(mask+1));
+      Link(p_node);
+      p_node->prev = last;
+      p_node->next = NULL;
+      if (last != NULL) last->next = p_node;
+      else first = p_node;
+      last = p_node;
+      count++;
+   }
+
+   // Rebuild the hash table with the given number of cells (the nodes stay where they are)
+   void Resize(unsigned long p_cellNum)
+   {
+      if (cells != NULL) delete [] cells;
+      cells = new Node*[p_cellNum];
+      memset(cells, 0, p_cellNum*sizeof(Node*));
+      mask = p_cellNum - 1;
+      for (Node* node=first;node!=NULL;node=node->next) Link(node);
+   }
+};
+
+#endif
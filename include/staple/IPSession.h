@@ -46,6 +46,7 @@ public:
    typedef std::map<TCPConnId,unsigned char,TCPConnIdTraits> TCPReg;
 #endif
    TCPReg tcpReg;                             // List of the TCP connections of the user
+   TimerWheelLink<IPAddressId> timeoutLink;   // Position in the IP session timeout wheel of the parser
    Staple* pStaple;                           // Pointer to staple (not a reference because hash tables need a default constructor)
 
    IPSession() : pStaple(NULL) {}
@@ -0,0 +1,64 @@
+#ifndef IPV6REGISTRY_H
+#define IPV6REGISTRY_H
+
+#include <pthread.h>
+#include <staple/Type.h>
+#include <staple/FlowTable.h>
+
+// Registry of the IPv6 addresses seen
+// -----------------------------------
+// The flow keys, the packets and the filters hold 32-bit addresses, so an IPv6 address is represented by a handle:
+// the registry interns the addresses of the matching packets at decoding and gives the same handle to an address as
+// long as it is seen. The handles are never reused (and 0 is never assigned), so a key of an expired address cannot
+// match a new one. The addresses not seen for IPV6_ADDRESS_TIMEOUT are forgotten: the registry counts the time in
+// epochs of STATUS_LOG_PERIOD seconds of trace time (the addresses are stamped with the capture time of their
+// packets, so a decoder running ahead of the parser does not matter), and the status log of any Staple instance
+// calls Expire. The
+// registry is shared by all the Staple instances of the process (the decoder and the parser shards may run on
+// different threads), so the epoch is advanced once per period by whichever caller comes first, and the others skip.
+class IPv6Registry {
+
+public:
+   IPv6Registry();
+   ~IPv6Registry();
+
+   // Handle of an IPv6 address (a new handle is assigned at its first occurrence), seen at the latest epoch
+   u_int32_t Intern(const u_int8_t*);
+   // Handles of the source and destination addresses of a packet captured at the given trace time (one mutex hold)
+   void Intern(const u_int8_t*, const u_int8_t*, u_int32_t&, u_int32_t&, time_t);
+   // The address of a handle (false if the handle is unknown or expired)
+   bool Lookup(u_int32_t, IPv6Address&);
+   // Forget the addresses not seen for IPV6_ADDRESS_TIMEOUT if a new epoch has started by the given trace time
+   // (returns immediately if the epoch is not over or another thread is expiring the addresses)
+   void Expire(time_t);
+
+   unsigned long AddressNum() const;
+   unsigned long long MemoryUsage() const;                  // Registry tables [bytes]
+
+private:
+   struct HandleHash {
+      size_t operator()(u_int32_t x) const {return MixHash64(x);}
+   };
+   struct Entry {
+      u_int32_t         handle;
+      unsigned long     lastEpoch;                          // The last epoch the address was seen in (0: before the first Expire)
+   };
+   typedef FlowTable<IPv6Address,Entry,IPv6AddressHash> HandleMap;
+   typedef FlowTable<u_int32_t,IPv6Address,HandleHash> AddressMap;
+
+   u_int32_t InternLocked(const u_int8_t*, unsigned long);
+
+   mutable pthread_mutex_t mutex;
+   pthread_mutex_t      expiryMutex;                        // Held by the thread expiring the addresses
+   HandleMap            handles;                            // Address -> handle
+   AddressMap           addresses;                          // Handle -> address (for printing)
+   u_int32_t            nextHandle;
+   unsigned long        epoch;                              // Trace time / STATUS_LOG_PERIOD of the latest Expire (0: not called yet)
+
+   IPv6Registry(const IPv6Registry&);
+   IPv6Registry& operator=(const IPv6Registry&);
+};
+
+extern IPv6Registry ipv6Registry;
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef L2DUPLICATEFILTER_H
+#define L2DUPLICATEFILTER_H
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <staple/Type.h>
+
+// An L2 frame kept for duplicate detection
+class L2DuplicateRecord {
+
+public:
+   uint64_t          hash;                                  // Hash of the frame content
+   unsigned long long storagePos;                           // Position of the frame content in the storage ring (not wrapped)
+   struct timeval    time;                                  // Capture time of the frame
+   unsigned long     savedL2PacketLength;                   // Number of captured bytes
+   unsigned long     origL2PacketLength;                    // Number of bytes in the full packet
+   unsigned short    dupCount;                              // Number of duplicates seen
+   bool              isIP;                                  // True if packet is an IP packet (needed for statistics)
+};
+
+// L2 duplicate packet detector: the frames seen in the last L2_DUPLICATE_TDIFF seconds are kept in arrival order in a record
+// ring (their content in a byte ring) and indexed by an open-addressed hash table, so neither the lookup nor the expiry
+// allocates memory or walks a tree
+class L2DuplicateFilter {
+
+public:
+   // Statistics
+   unsigned long long lookups;                              // Number of frames looked up
+   unsigned long long probes;                               // Number of hash table cells visited by the lookups
+   unsigned long long evictions;                            // Number of frames dropped before their time because the rings were full
+
+   L2DuplicateFilter();
+   ~L2DuplicateFilter();
+
+   void Clear();
+   // Forget the frames captured more than L2_DUPLICATE_TDIFF before the given time (the oldest ones first, as they arrived)
+   void Expire(const struct timeval&);
+   // Find an earlier copy of the frame (NULL if it is a new frame)
+   L2DuplicateRecord* Find(const Byte*, unsigned long, unsigned long);
+   // Store a new frame (after an unsuccessful Find() of the same frame)
+   L2DuplicateRecord* Insert(const Byte*, unsigned long, unsigned long, const struct timeval&);
+
+private:
+   L2DuplicateRecord*   records;                            // Record ring (L2DUP_MAX_RECORDS records, allocated at the first insert)
+   unsigned long long   recordHead;                         // Index of the oldest record (not wrapped)
+   unsigned long long   recordTail;                         // Index after the newest record (not wrapped)
+   uint32_t*            table;                              // Hash table of record ring slots + 1 (0: empty cell), linear probing
+   Byte*                storage;                            // Frame content ring (L2DUP_STORAGE_SIZE bytes)
+   unsigned long long   storageTail;                        // Position after the newest frame content (not wrapped)
+   uint64_t             lastHash;                           // Hash of the frame looked up last (reused by Insert)
+
+   static uint64_t Hash(const Byte*, unsigned long);
+   void RemoveOldest();
+};
+
+#endif
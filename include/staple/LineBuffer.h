@@ -0,0 +1,64 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <string.h>
+#include <string>
+#include <staple/Type.h>
+
+// Reusable text buffer of one log record with fast formatting of its fields (table-driven integer and IPv4 address
+// formatting, fixed-6 doubles). The output is byte-identical to the iostream/printf formatting of the log records
+// (doubles are printed like printf("%f"), i.e. std::fixed with precision 6)
+class LineBuffer {
+
+public:
+   LineBuffer();
+   ~LineBuffer();
+
+   void Clear() { len = 0; }
+   const char* Data() const { return buffer; }
+   unsigned long Size() const { return len; }
+   std::string Str() const { return std::string(buffer, len); }
+
+   LineBuffer& Append(const char* p_str, unsigned long p_len)
+   {
+      memcpy(Reserve(p_len), p_str, p_len);
+      len += p_len;
+      return *this;
+   }
+   LineBuffer& AppendUnsigned(unsigned long long);
+   LineBuffer& AppendSigned(long long);
+   LineBuffer& AppendFixed6(long double);
+   LineBuffer& AppendIPAddress(u_int8_t, const DoubleWord&);
+
+   LineBuffer& operator<<(char p_char) { *Reserve(1) = p_char; len++; return *this; }
+   LineBuffer& operator<<(const char*);
+   LineBuffer& operator<<(const std::string& p_str) { return Append(p_str.data(), p_str.size()); }
+   LineBuffer& operator<<(unsigned short p_value) { return AppendUnsigned(p_value); }
+   LineBuffer& operator<<(unsigned int p_value) { return AppendUnsigned(p_value); }
+   LineBuffer& operator<<(unsigned long p_value) { return AppendUnsigned(p_value); }
+   LineBuffer& operator<<(unsigned long long p_value) { return AppendUnsigned(p_value); }
+   LineBuffer& operator<<(short p_value) { return AppendSigned(p_value); }
+   LineBuffer& operator<<(int p_value) { return AppendSigned(p_value); }
+   LineBuffer& operator<<(long p_value) { return AppendSigned(p_value); }
+   LineBuffer& operator<<(long long p_value) { return AppendSigned(p_value); }
+   LineBuffer& operator<<(double p_value) { return AppendFixed6(p_value); }
+   LineBuffer& operator<<(long double p_value) { return AppendFixed6(p_value); }
+
+private:
+   char*             buffer;
+   unsigned long     len;
+   unsigned long     capacity;
+
+   // Make room for the given number of bytes at the end of the line
+   char* Reserve(unsigned long p_len)
+   {
+      if (len + p_len > capacity) Grow(len + p_len);
+      return buffer + len;
+   }
+   void Grow(unsigned long);
+
+   LineBuffer(const LineBuffer&);
+   void operator=(const LineBuffer&);
+};
+
+#endif
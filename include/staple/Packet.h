@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <iostream>
 #include <list>
+#include <new>
 
 #include <staple/Type.h>
 
@@ -17,6 +18,30 @@ struct StapleStub
 
 class L2Packet;
 
+// Reference counted payload buffer: a decoded packet and its copies buffered for TCP reassembly share the same slab
+// (the count is updated atomically, as the copies may be deleted by another thread than the one reusing the slab)
+class PayloadBuffer {
+
+public:
+   Byte*             data;                      // Points right behind the object (allocated together with it)
+   unsigned long     size;
+
+   static PayloadBuffer* New(unsigned long p_size)
+   {
+      return new (::operator new(sizeof(PayloadBuffer) + p_size)) PayloadBuffer(p_size);
+   }
+   void Ref() { __sync_fetch_and_add(&refCount, 1); }
+   void Unref() { if (__sync_sub_and_fetch(&refCount, 1) == 0) ::operator delete(this); }
+   bool Shared() const { return refCount > 1; }
+
+private:
+   volatile long     refCount;
+
+   PayloadBuffer(unsigned long p_size) : data(reinterpret_cast<Byte*>(this + 1)), size(p_size), refCount(1) {}
+   PayloadBuffer(const PayloadBuffer&);
+   void operator=(const PayloadBuffer&);
+};
+
 // Base class for layer 3 packets
 // ------------------------------
 class L3Packet : public StapleStub {
@@ -33,6 +58,7 @@ public:
    Byte*             payload;                   /* (L4!) payload data */
    unsigned short    payloadSavedLen;
    L2Packet*         pL2Packet;
+   PayloadBuffer*    payloadSlab;               // Payload buffer kept by pooled packets and shared with their copies (payload points into it)
 
    virtual ~L3Packet();
    L3Packet(Staple & s)
@@ -41,14 +67,31 @@ public:
       payload = NULL;
       payloadSavedLen = 0;
       pL2Packet = NULL;
+      payloadSlab = NULL;
    };
    L3Packet(const L3Packet& p) : StapleStub(p.staple)
    {
       l3Type = p.l3Type;
       payloadSavedLen = p.payloadSavedLen;
-      payload = new Byte[payloadSavedLen];
-      memcpy(payload, p.payload, payloadSavedLen);
       pL2Packet = NULL;
+      if (p.SlabPayload() && (payloadSavedLen >= PAYLOAD_SHARE_MIN_LEN))
+      {
+         // Share the slab of the original packet instead of copying the payload
+         payloadSlab = p.payloadSlab;
+         payloadSlab->Ref();
+         payload = p.payload;
+      }
+      else
+      {
+         payloadSlab = NULL;
+         payload = new Byte[payloadSavedLen];
+         memcpy(payload, p.payload, payloadSavedLen);
+      }
+   }
+   // True if the payload is stored in the payload slab (and not in a separately allocated buffer)
+   bool SlabPayload() const
+   {
+      return (payloadSlab != NULL) && (payload == payloadSlab->data);
    }
    virtual void Init()
    {
@@ -127,8 +170,10 @@ public:
    static const char MF = 0x01;
    static const char DF = 0x02;
 
-   DoubleWord        srcIP;
+   DoubleWord        srcIP;             /* IPv6: handle of the address in the IPv6 registry */
    DoubleWord        dstIP;
+   Byte              IPVersion;         /* 4 or 6 */
+   u_int32_t         tunnelId;          /* GTP-U TEID of the tunnel the packet was decapsulated from if the flows are keyed by tunnel (0 otherwise) */
    bool              match;             /* True if packet IP matches the filters */
    Byte              direction;         /* 0: NetA->NetB - 1: NetB->NetA */
    unsigned short    IPPktLen;
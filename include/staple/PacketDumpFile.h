@@ -4,6 +4,7 @@
 #include <map>
 #include <zlib.h>
 #include <staple/Packet.h>
+#include <staple/L2DuplicateFilter.h>
 
 class Staple;
 
@@ -34,26 +35,6 @@ public:
    };
 };
 
-// Entry for L2 duplicate packet detection registry
-class L2RawPacket {
-
-public:
-   unsigned short savedL2PacketLength;                      // Number of captured bytes
-   unsigned short origL2PacketLength;                       // Number of bytes in the full packet
-   Byte* data;                                              // Pointer to the packet data (incl. L2 header) (needed to double check CRC32 lookup by exact comparison)
-   unsigned short dupCount;                                 // Number of duplicates seen
-   bool           isIP;                                     // True if packet is an IP packet (needed for statistics)
-   
-   L2RawPacket()
-   {
-      savedL2PacketLength = 0;
-      origL2PacketLength = 0;
-      data = NULL;
-      dupCount = 0;
-      isIP = false;
-   }
-};
-
 // PacketDumpFile class
 class PacketDumpFile {
 
@@ -74,10 +55,25 @@ typedef enum {    LINKTYPE_ETH,
    std::list<DumpFileListEntry>              inputFileList;
    std::list<DumpFileListEntry>::iterator    actFileIndex;
 
+   // L2 duplicate packet filtering info
+   L2DuplicateFilter                         l2DuplicateFilter;
+   // Duplicate statistics are counted here: in the stats of the Staple by default, in counters of the reading thread
+   // if the packets are read on a separate thread (see PacketReader)
+   unsigned long*                            pPacketsDuplicated;
+   unsigned long*                            pIPPacketsDuplicated;
+
 protected:
 
    // Status variables on the actual file opened
-   gzFile             inFile;
+   gzFile             inFile;                               // Input file read through zlib (NULL if the file is mapped)
+   Byte*              inMap;                                // Mapped uncompressed input file (NULL if read through zlib)
+   unsigned long      inMapSize;
+   Byte*              inBlock;                              // Buffer of the data read through zlib (INPUT_BLOCK_SIZE bytes)
+   const Byte*        inData;                               // Input data available in memory (the mapped file or the block)
+   unsigned long      inDataLen;                            // Number of bytes available at inData
+   unsigned long      inDataPos;                            // Read position in inData
+   unsigned long long inDataOffset;                         // Input file offset of inData (uncompressed)
+   const Byte*        packetData;                           // Raw L2 data of the actual packet (valid until the next read)
    gzFile             outFile;
    unsigned long      outfileSlotNum;
    unsigned short     byteOrderChange;
@@ -93,25 +89,12 @@ protected:
    unsigned long      savedL2PacketLength;
    unsigned long      origL2PacketLength;
 
-   // L2 duplicate packet filtering info
-   std::multimap<unsigned long, L2RawPacket> l2RawPacketReg;         // L2 raw packet registry for fast CRC-based lookup
-   typedef struct
-   {
-      struct timeval time;
-      std::multimap<unsigned long, L2RawPacket>::iterator regIndex;  // Iterator to the L2 packet in the registry
-   } L2RawPacketListEntry;
-   std::list<L2RawPacketListEntry> l2RawPacketList;                  // L2 packet list for time-based history management
    
    Staple&        staple;
    
 public:
                   ~PacketDumpFile();
-                  PacketDumpFile(Staple& s)
-                   : staple(s)
-                  {
-                     inFile = NULL;
-                     outFile = NULL;
-                  }
+                  PacketDumpFile(Staple&);
    ErrorCode      CreateInputFileList(char*);
    ErrorCode      FirstInputFile();
    ErrorCode      NextInputFile();
@@ -121,9 +104,13 @@ public:
    void           CloseInputFile();
    void           WriteActualPacket();
    void           CloseOutputFile();
+
+protected:
+   const Byte*    ReadInput(unsigned long);
+   unsigned long long InputPosition() const { return inDataOffset+inDataPos; }
 };
 
-// GLOBAL function for decoding IP packets (TODO: inheritance)
-L3Packet* DecodeIPPacket(char*, unsigned short, Staple&);
+// GLOBAL function for decoding IP packets (TODO: inheritance); the time is the capture time of the packet
+L3Packet* DecodeIPPacket(char*, unsigned short, time_t, Staple&);
 
 #endif
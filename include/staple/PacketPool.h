@@ -0,0 +1,46 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <vector>
+#include <staple/Type.h>
+#include <staple/Packet.h>
+
+// Pool of the decoded packet objects: released packets (and their payload slabs) are recycled by the decoder,
+// so reading a packet needs no heap operation in steady state (not thread-safe: used by the reading thread only)
+class PacketPool {
+
+public:
+   unsigned long long allocations;            // Number of packet objects and payload slabs allocated from the heap
+
+   PacketPool(Staple&);
+   ~PacketPool();
+
+   // Get an initialized packet object (recycled if possible)
+   EthernetPacket* NewEthernetPacket();
+   L2Packet*       NewL2Packet();
+   IPPacket*       NewIPPacket();
+   TCPPacket*      NewTCPPacket();
+   UDPPacket*      NewUDPPacket();
+   ICMPPacket*     NewICMPPacket();
+
+   // Get the payload slab of a pooled L3 packet with at least the given capacity
+   Byte* PayloadSlab(L3Packet*, unsigned short);
+
+   // Give back a packet (the L2 and L3 packets are released together)
+   void Release(L2Packet*);
+   void Release(L3Packet*);
+
+private:
+   Staple&                       staple;
+   std::vector<EthernetPacket*>  freeEthernetPackets;
+   std::vector<L2Packet*>        freeL2Packets;
+   std::vector<IPPacket*>        freeIPPackets;
+   std::vector<TCPPacket*>       freeTCPPackets;
+   std::vector<UDPPacket*>       freeUDPPackets;
+   std::vector<ICMPPacket*>      freeICMPPackets;
+
+   template <class T> T* Get(std::vector<T*>&);
+   template <class T> void Put(std::vector<T*>&, T*);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PACKETREADER_H
+#define PACKETREADER_H
+
+#include <pthread.h>
+#include <vector>
+#include <staple/Packet.h>
+#include <staple/SPSCRing.h>
+
+class Staple;
+
+void* PacketReaderLauncher(void*);
+
+// Packets read and decoded at once by the reader thread
+class PacketBatch {
+
+public:
+   L2Packet*         packets[READER_BATCH_SIZE];
+   unsigned short    num;                                     // Number of packets in the batch
+   bool              last;                                    // True if the input ended with this batch
+   unsigned long     packetsDuplicated[DUPSTATS_MAX+1];       // Duplicate statistics counted while the batch was filled
+   unsigned long     ipPacketsDuplicated[DUPSTATS_MAX+1];
+
+   PacketBatch() : num(0), last(false)
+   {
+      for (int i=0;i<=DUPSTATS_MAX;i++) {packetsDuplicated[i] = 0; ipPacketsDuplicated[i] = 0;}
+   }
+};
+
+// Pipelined input: a reader thread reads, filters (L2 duplicates) and decodes the packets of the input dumpfiles
+// and passes them in batches to the parser thread. Parsed batches are passed back so that the reader thread can
+// give their packets back to the packet pool (the pool is used by the reader thread only). The L2 duplicate statistics
+// are counted by the reader thread on its own and passed with the batches, the parser thread adds them to the stats
+// of the Staple.
+class PacketReader {
+
+public:
+   unsigned long long readerStalls;                           // Number of times the reader waited for a parsed batch (parser is the bottleneck)
+   unsigned long long parserStalls;                           // Number of times the parser waited for a decoded batch (reader is the bottleneck)
+
+   PacketReader(Staple&);                                     // The first input dumpfile has to be opened already
+   ~PacketReader();
+
+   L2Packet* ReadPacket();                                    // Next packet (NULL at the end of the input); it is owned by the reader
+   void Detach();                                             // Take over the ownership of the packet returned last
+
+private:
+   Staple&                                      staple;
+   pthread_t                                    thread;
+   std::vector<PacketBatch*>                    batches;      // All batches (for cleanup)
+   SPSCRing<PacketBatch, READER_RING_SIZE>      fullBatches;  // Decoded batches (reader -> parser)
+   SPSCRing<PacketBatch, READER_RING_SIZE>      freeBatches;  // Parsed batches (parser -> reader)
+   PacketBatch*                                 actBatch;     // Batch being parsed
+   unsigned short                               actIndex;     // Index of the next packet in actBatch
+   bool                                         finished;     // True if the last batch has been parsed
+   std::atomic<bool>                            stopping;     // True if the reader thread has to stop before the end of the input
+   unsigned long                                packetsDuplicated[DUPSTATS_MAX+1];   // Duplicate statistics of the reader thread (not passed yet)
+   unsigned long                                ipPacketsDuplicated[DUPSTATS_MAX+1];
+
+   void Run();
+
+   friend void* PacketReaderLauncher(void*);
+};
+
+#endif
@@ -1,7 +1,8 @@
 #ifndef PACKETTRAINLIST_H
 #define PACKETTRAINLIST_H
 
-#include <list>
+#include <ostream>
+#include <sys/time.h>
 
 #include <staple/Type.h>
 #include <staple/Packet.h>
@@ -9,15 +10,15 @@
 class PacketTrainTCPPacket
 {
 public:
-   unsigned long      seq;               // Sequence number [bytes]
-   unsigned long      len;               // Payload length [bytes]
-   struct timeval     t;                 // Capture time (first transmission) [s]
-   bool               signAMP;           // True if lossInfo is a valid estimate for AMP loss
-   bool               signBMP;           // True if lossInfo is a valid estimate for BMP loss
-   bool               ampLossCandidate;  // True, if both an original transmission and a retransmission were seen
-   bool               reordered;         // True if the packet was reordered (for SACK retransmit validation)
-   char               lossInfo;          // Estimation of the type of the loss the first transmission experienced
-   char               lossTSInfo;        // Loss verification based on TCP timestamps (can only detect AMP losses, only valid if TS info is present in TCP)
+   unsigned long      seq;                    // Sequence number [bytes]
+   struct timeval     t;                      // Capture time (first transmission) [s]
+   unsigned short     len;                    // Payload length [bytes]
+   bool               signAMP:1;              // True if lossInfo is a valid estimate for AMP loss
+   bool               signBMP:1;              // True if lossInfo is a valid estimate for BMP loss
+   bool               ampLossCandidate:1;     // True, if both an original transmission and a retransmission were seen
+   bool               reordered:1;            // True if the packet was reordered (for SACK retransmit validation)
+   unsigned char      lossInfo:2;             // Estimation of the type of the loss the first transmission experienced
+   unsigned char      lossTSInfo:1;           // Loss verification based on TCP timestamps (can only detect AMP losses, only valid if TS info is present in TCP)
 
    // lossInfo
    static const char NOT_LOST = 0x00;
@@ -42,62 +43,54 @@ public:
    }
 };
 
-// Packet train
-// ------------
-// Contains information on a continous packet train
-class PacketTrain {
+// Packet train list
+// -----------------
+// Contains the packets seen in one direction of a TCP connection, ordered by SEQ, in a contiguous ring
+// (packets are removed from the front only). Packet trains are the maximal runs of consecutive packets:
+// a train ends where the next packet does not start at the end of the previous one.
+class PacketTrainList {
 public:
-   unsigned long     firstSeq;          // Sequence number of the first byte in the packet train
-   unsigned long     lastSeq;           // Sequence number of the first byte BEYOND the packet train
-   std::list<PacketTrainTCPPacket> packetList;     // List of packets in the packet train
+   unsigned long          firstSeq;               // Sequence number of the first byte in the list (0 if empty)
+   unsigned long          lastSeq;                // Sequence number of the first byte BEYOND the list (0 if empty)
 
-   void Init()
-   {
-      firstSeq = 0;
-      lastSeq = 0;
-      packetList.clear();
-   }
+   static const unsigned long NONE = (unsigned long)-1;
 
-   // Needed for sorting (by firstSeq)
-   bool operator <(const PacketTrain& x) const
-   {
-      return (firstSeq < x.firstSeq);
-   };
-   // Needed for finding
-   bool operator ==(const PacketTrain& x) const
-   {
-      return ((firstSeq == x.firstSeq) && (lastSeq == x.lastSeq));
-   };
+   PacketTrainList();
+   PacketTrainList(const PacketTrainList&);
+   PacketTrainList& operator =(const PacketTrainList&);
+   ~PacketTrainList();
 
-   bool TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq);
-   std::list<PacketTrainTCPPacket>::iterator TestPacket (unsigned long p_firstSeq, unsigned long p_lastSeq);
-   std::list<PacketTrainTCPPacket>::iterator TestPacketSeq (unsigned long p_seq);
-   bool InsertPacketToFront (PacketTrainTCPPacket& p_packet);
-   bool InsertPacketToBack (PacketTrainTCPPacket& p_packet);
-   bool RemoveFirstPacket();
-   void Print(std::ostream& outStream) const;
-};
+   void Init();
 
-// Packet train list
-// -----------------
-// Contains a list of packet trains
-class PacketTrainList {
-public:
-   unsigned long          firstSeq;
-   unsigned long          lastSeq;
-   std::list<PacketTrain> packetTrainList;        // List of packet trains
+   bool Empty() const {return (size == 0);}
+   unsigned long Size() const {return size;}
+   unsigned long Capacity() const {return capacity;}
+   // The i-th packet of the list (0: first packet)
+   PacketTrainTCPPacket& Packet(unsigned long i) {return packets[(head+i) & (capacity-1)];}
+   const PacketTrainTCPPacket& Packet(unsigned long i) const {return packets[(head+i) & (capacity-1)];}
+   PacketTrainTCPPacket& Front() {return Packet(0);}
+
+   // Returns true if the input data range at least PARTIALLY OVERLAPS with the packets in the list
+   bool TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq) const;
+   // Index of the packet with the given starting and ending SEQ (NONE if not found)
+   unsigned long FindPacket (unsigned long p_firstSeq, unsigned long p_lastSeq) const;
+   // Index of the packet with the given starting SEQ (NONE if not found)
+   unsigned long FindPacketSeq (unsigned long p_seq) const;
+   // Returns true if the i-th packet is the last one in its packet train
+   bool IsTrainEnd (unsigned long i) const;
 
-   void Init()
-   {
-      firstSeq = 0;
-      lastSeq = 0;
-      packetTrainList.clear();
-   }
-   
-   std::list<PacketTrain>::iterator TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq);
    bool InsertPacket (PacketTrainTCPPacket& p_packet);
    bool RemoveFirstPacket();
    void Print(std::ostream& outStream) const;
+
+private:
+   PacketTrainTCPPacket*  packets;                // Packet ring (capacity is a power of two, allocated at the first insert)
+   unsigned long          capacity;               // Number of records in the ring
+   unsigned long          head;                   // Ring index of the first packet
+   unsigned long          size;                   // Number of packets in the list
+
+   unsigned long LowerBound (unsigned long p_seq) const;
+   void Grow();
 };
 
 #endif
@@ -6,8 +6,13 @@
 #include <ostream>
 #include <staple/Packet.h>
 #include <staple/Staple.h>
+#include <staple/TimerWheel.h>
+#include <staple/PerfmonWriter.h>
+#include <staple/LineBuffer.h>
 #include <staple/http/HTTPEngine.h>
 
+class EventChannel;
+
 void* ParserThreadLauncher(void*);
 
 // Parser class
@@ -19,8 +24,10 @@ public:
    TCPConnReg::iterator       tcpIndex;                        // Cached index for fast TCP connection lookup
 
    struct timeval    lastIPPacketTime;
-   struct timeval    lastTCPTimeoutCheck;
-   struct timeval    lastIPTimeoutCheck;
+   struct timeval    lastTimeoutCheck;                         // The time of the last TCP/IP timeout check
+   bool              timeoutFullScan;                          // True if the whole registries have to be checked at the next timeout check (after a major timestamp reordering)
+   TimerWheel<TCPConnId>   tcpTimerWheel;                      // TCP connections by the second of their last packet
+   TimerWheel<IPAddressId> ipTimerWheel;                       // IP sessions by the second of their last packet
    
    struct timeval    lastStatusLogTime;                        // The time of the last status log
 
@@ -28,17 +35,27 @@ public:
    std::ostream*     perfmonTCPTAPartialFile;                  // Perfmon partial TCPTA log file
    std::ostream*     perfmonFLVFile;                           // Perfmon FLV log file
    std::ostream*     perfmonFLVPartialFile;                    // Perfmon partial FLV log file
+   PerfmonWriter*    perfmonWriter;                            // Asynchronous writer of the perfmon logfiles (used instead of the above streams if set)
+
+   EventChannel*     eventChannel;                             // Hand-off of the records published to Hazelcast (if hazelcastPublish is set)
 
    bool hazelcastPublish;
    bool writeToFile;
 
 
 
-   pthread_mutex_t   perfmonFileMutex;                         // MUTEX used for writing/modifying perfmon logfiles
-   
+   pthread_mutex_t   perfmonFileMutex;                         // MUTEX used for writing the perfmon log streams
+   pthread_mutex_t*  pPerfmonFileMutex;                        // MUTEX actually locked at perfmon writes (another parser's perfmonFileMutex if the perfmon files are shared)
+   bool              writeStatusLog;                           // True if the periodic status log is written by this parser (false for parser shards)
+   RotationService*  pTraceClock;                              // Rotation service driven by the trace time of this parser (NULL if the ROPs follow the wall clock)
+
    Parser(Staple&);
    void Init();
    void ParsePacket(L2Packet*);
+   void ParsePackets(L2Packet**, unsigned long);
+   void UpdateTraceTime(L2Packet*);
+   void PeriodicTasks();
+   void ParseL3Packet(L2Packet*);
    void HighestSeqTCPDataPacket(TCPPacket&, TCPConnReg::iterator&, IPSession&);
    void NewTCPPayload(TCPPacket&, TCPConnId&);
    void AssembleTCPPayload(TCPConnReg::iterator&, TCPPacket&);
@@ -55,9 +72,17 @@ public:
    void ApplyHistorySizeLimits(TCPConnReg::iterator&, unsigned short);
    bool RemovePacketFromHistory(TCPConnReg::iterator&, unsigned short);
    void FinishConnections();
+   void CheckTimeouts();
    bool PrintTCPStatistics (TCPConnReg::iterator&, std::ostream&);
    bool PrintTCPTAStatistics (TCPConnReg::iterator&, TCPTransaction&, unsigned short, bool, bool);
+   bool HasPerfmonLog(std::ostream*) const;
+   void WritePerfmonRecord(PerfmonWriter::LogType, std::ostream*, const LineBuffer&);
    void PrintOverallStatistics (std::ostream&);
+   void PrintOverallStatistics (std::ostream&, const HTTPStats&);
+   void CountConnectionState (unsigned long&, unsigned long*, unsigned long*, TCPConnMemory&);
+   void WriteStatusLog (unsigned long, const unsigned long*, const unsigned long*, const TCPConnMemory&, const HTTPStats&);
+   const HTTPStats& GetHTTPStats() const;
+   const HTTPStats& FinishHTTPSessions();
 
    Staple&           staple;
 
@@ -68,6 +93,7 @@ public:
 
 private:
    HTTPEngine httpEngine;
+   LineBuffer perfmonLine;                                     // The perfmon record being formatted
 };
 
 #endif
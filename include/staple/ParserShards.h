@@ -0,0 +1,93 @@
+#ifndef PARSERSHARDS_H
+#define PARSERSHARDS_H
+
+#include <pthread.h>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+#include <staple/Packet.h>
+#include <staple/Staple.h>
+#include <staple/Parser.h>
+
+void* ParserShardLauncher(void*);
+
+// Stream buffer serializing the log output of the parser threads into a common target buffer
+class LockedStreamBuf : public std::streambuf {
+
+public:
+   LockedStreamBuf(std::streambuf* p_target) : target(p_target)
+   {
+      pthread_mutex_init(&mutex, NULL);
+   }
+   ~LockedStreamBuf()
+   {
+      pthread_mutex_destroy(&mutex);
+   }
+
+protected:
+   virtual int overflow(int c);
+   virtual std::streamsize xsputn(const char*, std::streamsize);
+   virtual int sync();
+
+private:
+   std::streambuf*   target;
+   pthread_mutex_t   mutex;
+};
+
+// One parser thread with its own registries, stats and parser (the IP sessions of a client are always handled by the same shard)
+class ParserShard {
+
+public:
+   Staple            staple;                                  // Registries, stats and parser of the shard
+   pthread_t         thread;
+   bool              running;                                 // True if the thread is started and not joined yet
+
+   // Packet queue filled by the reader thread (packets are deleted by the shard after parsing)
+   L2Packet*         queue[SHARD_QUEUE_SIZE];
+   unsigned long     queueHead;                               // Index of the oldest queued packet
+   unsigned long     queueLen;                                // Number of queued packets
+   bool              finished;                                // True if no more packets will be queued
+   bool              busy;                                    // True while the shard parses the packets taken from the queue
+   pthread_mutex_t   queueMutex;
+   pthread_cond_t    queueNotEmpty;
+   pthread_cond_t    queueNotFull;
+   pthread_cond_t    queueDrained;                            // Signalled when the shard has parsed all packets taken
+
+   pthread_mutex_t   statsMutex;                              // Held by the shard thread while parsing (the reader locks it to read the stats of the shard)
+
+   std::vector<L2Packet*> pending;                            // Packets collected by the reader thread, not queued yet (accessed by the reader thread only)
+
+   ParserShard();
+   ~ParserShard();
+};
+
+// Flow-sharded parsing: packets read by one thread are parsed by several parser threads
+class ParserShards {
+
+public:
+   ParserShards(Staple&, Parser&, unsigned short, bool);
+   ~ParserShards();
+
+   void Dispatch(L2Packet*);
+   void Finish();
+   void PrintOverallStatistics(std::ostream&);
+   void WriteCounters();
+
+private:
+   Staple&                    master;                         // Staple of the reader thread (merged stats are stored here)
+   Parser&                    masterParser;                   // Parser owning the perfmon files and writing the status log
+   std::vector<ParserShard*>  shards;
+   LockedStreamBuf            logBuf;                         // Log stream buffer shared by the master and the shards
+   std::streambuf*            origLogBuf;                     // Original log stream buffer of the master
+   bool                       http;                           // True if HTTP logs and counters are written
+   time_t                     lastFlushTime;                  // Trace time of the last handover of all partial batches
+
+   unsigned short ShardIndex(const L2Packet*) const;
+   void FlushPending(ParserShard&);
+   void FlushAllPending();
+   void WaitIdle();
+   void MergeStats();
+   void WriteStatusLog();
+};
+
+#endif
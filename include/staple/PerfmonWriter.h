@@ -0,0 +1,82 @@
+#ifndef PERFMONWRITER_H
+#define PERFMONWRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <staple/Type.h>
+#include <staple/RotationService.h>
+
+class Staple;
+
+void* PerfmonWriterLauncher(void*);
+
+// Asynchronous writer of the perfmon logfiles (TCPTA, partial TCPTA, FLV and partial FLV)
+// The parser threads append their records to a lock-free multi-producer byte ring, while a dedicated writer thread
+// drains the ring into large per-file buffers and closes/renames the files at the ROP boundaries (the parsers never
+// block on disk I/O or on the rotation, only if the ring is full)
+// The ROP boundaries are given by the rotation service as marker records in the ring, so each record is written to
+// the logfile of the ROP it was queued in
+class PerfmonWriter : public RotatingSink {
+
+public:
+   // Logfile types (same order as StapleJniImpl::eventTypes)
+   typedef enum
+   {
+      TCPTA,
+      TCPTA_PARTIAL,
+      FLV,
+      FLV_PARTIAL,
+      LOG_TYPE_NUM,
+      ROP_MARKER = LOG_TYPE_NUM                                // Not a logfile: start of a new ROP in the ring
+   } LogType;
+
+   std::atomic<unsigned long long> producerStalls;             // Number of times a parser thread waited for room in the ring
+   unsigned long long              droppedRecords;             // Records longer than the whole ring (never written)
+
+   PerfmonWriter(Staple&);
+   ~PerfmonWriter();
+
+   // Open the logfiles of the actual ROP and launch the writer thread (false if a logfile could not be opened)
+   bool Start();
+   // Queue a record to be appended to the given logfile (thread-safe, may be called by several parser threads)
+   void Write(LogType, const char*, unsigned long);
+   // Write out the queued records, stop the writer thread and rename the last logfiles to their final names
+   void Finish();
+
+   void Run();
+
+   // Queue the marker of the new ROP (called by the rotation service)
+   void PrepareROP(unsigned long);
+   void Retire() {}
+
+private:
+   Staple&                    staple;
+   pthread_t                  thread;
+   bool                       running;                         // True if the writer thread is started and not joined yet
+   std::atomic<bool>          stopping;                        // Set by Finish (release): the writer thread exits when the ring is empty
+   unsigned long              lastPerfmonROP;                  // The ROP number of the actual logfiles
+
+   // Record ring: each record is an 8-byte header (payload length and type+1, zero until the record is complete)
+   // followed by the payload, padded to 8 bytes (the consumed area is zeroed by the writer thread)
+   Byte*                      ring;
+   std::atomic<uint64_t>      head;                            // Bytes reserved by the producers
+   char                       pad[64];                         // Keep the producer and consumer counters on different cache lines
+   std::atomic<uint64_t>      tail;                            // Bytes consumed by the writer thread
+
+   // Logfiles (accessed by the writer thread only after Start)
+   int                        fd[LOG_TYPE_NUM];
+   Byte*                      buffer[LOG_TYPE_NUM];
+   unsigned long              bufferLen[LOG_TYPE_NUM];
+
+   bool Drain();
+   void AdvanceROP(unsigned long);
+   void Append(unsigned short, const Byte*, unsigned long);
+   void FlushBuffer(unsigned short);
+   bool Rotate(bool);
+
+   PerfmonWriter(const PerfmonWriter&);
+   void operator=(const PerfmonWriter&);
+};
+
+#endif
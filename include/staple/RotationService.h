@@ -0,0 +1,85 @@
+#ifndef ROTATIONSERVICE_H
+#define ROTATIONSERVICE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+#include <staple/Type.h>
+
+void* RotationServiceLauncher(void*);
+
+// Logfile rotated at the ROP boundaries with the help of the rotation service
+// The writer of the logfile only switches to the file prepared by the service, and hands the old one back to the
+// service to be closed and renamed
+class RotatingSink {
+
+public:
+   virtual ~RotatingSink() {}
+
+   // Prepare the file of the new ROP (called by the service thread right before the new ROP number is published)
+   virtual void PrepareROP(unsigned long) = 0;
+   // Close and rename the file handed back by the writer, if any (called by the service thread)
+   virtual void Retire() = 0;
+};
+
+// Single thread owning the rotation of the logfiles: it keeps the actual ROP number up to date (so the writers can
+// check the ROP boundary without a system call), prepares the files of the new ROP and closes/renames the old ones
+// (so the writers never wait for open, close or rename)
+// By default the ROPs follow the wall clock. In trace clock mode they follow the trace time instead: the thread
+// parsing the packets switches the ROP synchronously, so the records of reprocessed traces are put into the same
+// logfiles as in a live run
+class RotationService {
+
+public:
+   static RotationService& Instance();
+
+   // The number of the actual ROP (seconds since the epoch / PERFMON_ROP, 0 until the trace clock is started)
+   unsigned long ROP() const { return rop.load(std::memory_order_acquire); }
+   // The time the clock was started at (0 until the trace clock is started) [s]
+   time_t StartTime() const { return startTime.load(std::memory_order_acquire); }
+
+   // Switch to trace clock mode (before any logfile is opened)
+   void SetTraceClock();
+   // True if the given trace time is in a later ROP than the actual one (trace clock mode)
+   bool IsNewROP(time_t p_sec) const { return p_sec >= nextBoundary; }
+   // Switch to the ROP of the given trace time if it is a later one (called by the thread driving the trace clock,
+   // the sinks are prepared for the new ROP before this returns)
+   void AdvanceTraceTime(time_t p_sec)
+   {
+      if (p_sec >= nextBoundary) NewTraceROP(p_sec);
+   }
+
+   // Launch the service thread (if not running yet)
+   void Start();
+   // Add/remove a sink (a removed sink is not accessed by the service thread any more)
+   void Register(RotatingSink*);
+   void Unregister(RotatingSink*);
+   // Wake up the service thread to retire the files handed back by a writer
+   void Notify();
+   // Keep the service thread away from the sinks (for rotating a sink synchronously)
+   void Lock() { pthread_mutex_lock(&mutex); }
+   void Unlock() { pthread_mutex_unlock(&mutex); }
+
+   void Run();
+
+private:
+   std::atomic<unsigned long>    rop;
+   std::atomic<time_t>           startTime;
+   bool                          traceClock;                   // True if the ROP follows the trace time
+   time_t                        nextBoundary;                 // Start of the next ROP of the trace clock (accessed by the driving thread only)
+   std::atomic<bool>             retirePending;                // Set by Notify
+   pthread_mutex_t               mutex;                        // Guards the sinks and the service thread's work on them
+   pthread_cond_t                wakeup;
+   pthread_t                     thread;
+   bool                          running;
+   std::vector<RotatingSink*>    sinks;
+
+   RotationService();
+   static void Create();
+   void NewTraceROP(time_t);
+   RotationService(const RotationService&);
+   void operator=(const RotationService&);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <staple/Type.h>
+
+// Bounded lock-free ring of pointers between exactly one producer and one consumer thread
+template <class T, unsigned long N>
+class SPSCRing {
+public:
+   SPSCRing() : head(0), tail(0) {}
+
+   // Producer side: false if the ring is full
+   bool Push(T* p_item)
+   {
+      unsigned long actTail = tail.load(std::memory_order_relaxed);
+      if (actTail - head.load(std::memory_order_acquire) >= N) return false;
+      slots[actTail % N] = p_item;
+      tail.store(actTail + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Consumer side: NULL if the ring is empty
+   T* Pop()
+   {
+      unsigned long actHead = head.load(std::memory_order_relaxed);
+      if (actHead == tail.load(std::memory_order_acquire)) return NULL;
+      T* item = slots[actHead % N];
+      head.store(actHead + 1, std::memory_order_release);
+      return item;
+   }
+
+private:
+   T*                         slots[N];
+   std::atomic<unsigned long> head;           // Number of items popped (written by the consumer only)
+   char                       pad[64];        // Keep the producer and consumer counters on different cache lines
+   std::atomic<unsigned long> tail;           // Number of items pushed (written by the producer only)
+};
+
+#endif
@@ -7,15 +7,19 @@
 #include <fstream>
 #include <string.h>
 #include <memory>
+#include <vector>
 #include <staple/Type.h>
 #include <staple/IPSession.h>
 #include <staple/TCPConn.h>
 #include <staple/PacketDumpFile.h>
+#include <staple/PacketPool.h>
+#include <staple/FlowTable.h>
+#include <staple/AddressFilter.h>
 
 // Associative array for the IP, HTTP sessions and TCP connections (TBD: should go into parser class)
 #if defined(USE_HASH_MAP)
-   typedef std::unordered_map<IPAddressId,IPSession,IPAddressIdTraits,IPAddressIdTraits>    IPSessionReg;
-   typedef std::unordered_map<TCPConnId,TCPConn,TCPConnIdTraits,TCPConnIdTraits>            TCPConnReg;
+   typedef FlowTable<IPAddressId,IPSession,IPAddressIdTraits,IPAddressIdTraits>    IPSessionReg;
+   typedef FlowTable<TCPConnId,TCPConn,TCPConnIdTraits,TCPConnIdTraits>            TCPConnReg;
 #else
    typedef std::map<IPAddressId,IPSession,IPAddressIdTraits>   IPSessionReg;
    typedef std::map<TCPConnId,TCPConn,TCPConnIdTraits>         TCPConnReg;
@@ -25,6 +29,7 @@ class IPStats
 {
 public:
    unsigned long packetsRead;
+   unsigned long packetsIPv6;
    unsigned long lastPacketsRead;
    unsigned long packetsDuplicated[DUPSTATS_MAX+1];
    unsigned long packetsMatched[2];
@@ -36,6 +41,7 @@ public:
    void Init()
    {
       packetsRead=0;
+      packetsIPv6=0;
       lastPacketsRead=0;
       for (int i=0;i<=DUPSTATS_MAX;i++) {packetsDuplicated[i]=0;}
       packetsMatched[0]=0;
@@ -48,6 +54,23 @@ public:
       kBytesMatched[0]=0;
       kBytesMatched[1]=0;
    }
+   // Add the counters of another (parser shard) instance
+   void Add(const IPStats& x)
+   {
+      packetsRead+=x.packetsRead;
+      packetsIPv6+=x.packetsIPv6;
+      for (int i=0;i<=DUPSTATS_MAX;i++) {packetsDuplicated[i]+=x.packetsDuplicated[i];}
+      for (int dir=0;dir<=1;dir++)
+      {
+         packetsMatched[dir]+=x.packetsMatched[dir];
+         bytesMatched[dir]+=x.bytesMatched[dir];
+         kBytesMatched[dir]+=x.kBytesMatched[dir]+(bytesMatched[dir]>>10);
+         bytesMatched[dir]&=0x3ff;
+      }
+      bytesRead+=x.bytesRead;
+      kBytesRead+=x.kBytesRead+(bytesRead>>10);
+      bytesRead&=0x3ff;
+   }
 };
 class TCPStats
 {
@@ -172,6 +195,72 @@ public:
       allTCPTALogNum=0;
       old60TCPTALogNum=0;
    }
+   // Add the counters of another (parser shard) instance
+   void Add(const TCPStats& x)
+   {
+      packetsRead+=x.packetsRead;
+      bytesRead+=x.bytesRead;
+      kBytesRead+=x.kBytesRead+(bytesRead>>10);
+      bytesRead&=0x3ff;
+      for (int dir=0;dir<=1;dir++)
+      {
+         packetsMatched[dir]+=x.packetsMatched[dir];
+         bytesMatched[dir]+=x.bytesMatched[dir];
+         kBytesMatched[dir]+=x.kBytesMatched[dir]+(bytesMatched[dir]>>10);
+         bytesMatched[dir]&=0x3ff;
+         bytesPL[dir]+=x.bytesPL[dir];
+         kBytesPL[dir]+=x.kBytesPL[dir]+(bytesPL[dir]>>10);
+         bytesPL[dir]&=0x3ff;
+         bytesPLAlreadySeen[dir]+=x.bytesPLAlreadySeen[dir];
+         kBytesPLAlreadySeen[dir]+=x.kBytesPLAlreadySeen[dir]+(bytesPLAlreadySeen[dir]>>10);
+         bytesPLAlreadySeen[dir]&=0x3ff;
+         dataPacketsSeen[dir]+=x.dataPacketsSeen[dir];
+         signPacketsSeenBMP[dir]+=x.signPacketsSeenBMP[dir];
+         signPacketsSeenAMP[dir]+=x.signPacketsSeenAMP[dir];
+         signPacketsLostBMP[dir]+=x.signPacketsLostBMP[dir];
+         signPacketsLostAMP[dir]+=x.signPacketsLostAMP[dir];
+         signPacketsSeenAMPTS[dir]+=x.signPacketsSeenAMPTS[dir];
+         signPacketsLostAMPTSOriginal[dir]+=x.signPacketsLostAMPTSOriginal[dir];
+         signPacketsLostAMPTSValidation[dir]+=x.signPacketsLostAMPTSValidation[dir];
+         lossBurstsDetected[dir]+=x.lossBurstsDetected[dir];
+         rtxPeriods[dir]+=x.rtxPeriods[dir];
+         SYNACKFound[dir]+=x.SYNACKFound[dir];
+         SYNACKNotFound[dir]+=x.SYNACKNotFound[dir];
+         SYNFound[dir]+=x.SYNFound[dir];
+         SYNNotFound[dir]+=x.SYNNotFound[dir];
+         mssLow[dir]+=x.mssLow[dir];
+         mssHigh[dir]+=x.mssHigh[dir];
+         wndLow[dir]+=x.wndLow[dir];
+         wndMed[dir]+=x.wndMed[dir];
+         wndHigh[dir]+=x.wndHigh[dir];
+      }
+      tcpsSeen+=x.tcpsSeen;
+      lossReliable+=x.lossReliable;
+      tsLossReliable+=x.tsLossReliable;
+      rtxDataOffset+=x.rtxDataOffset;
+      captureLoss+=x.captureLoss;
+      standalone+=x.standalone;
+      SACKPermitted+=x.SACKPermitted;
+      TSSeen+=x.TSSeen;
+      termFIN+=x.termFIN;
+      termRST+=x.termRST;
+      termTO+=x.termTO;
+
+      allTCPTALogNum+=x.allTCPTALogNum;
+      old60TCPTALogNum+=x.old60TCPTALogNum;
+   }
+   // Reset the SYN/SYNACK loss counters (they are reported per status log period)
+   void ResetSYNStats()
+   {
+      SYNACKFound[0]=0;
+      SYNACKFound[1]=0;
+      SYNACKNotFound[0]=0;
+      SYNACKNotFound[1]=0;
+      SYNFound[0]=0;
+      SYNFound[1]=0;
+      SYNNotFound[0]=0;
+      SYNNotFound[1]=0;
+   }
 };
 class UDPStats
 {
@@ -194,6 +283,21 @@ public:
       kBytesMatched[0]=0;
       kBytesMatched[1]=0;
    }
+   // Add the counters of another (parser shard) instance
+   void Add(const UDPStats& x)
+   {
+      packetsRead+=x.packetsRead;
+      bytesRead+=x.bytesRead;
+      kBytesRead+=x.kBytesRead+(bytesRead>>10);
+      bytesRead&=0x3ff;
+      for (int dir=0;dir<=1;dir++)
+      {
+         packetsMatched[dir]+=x.packetsMatched[dir];
+         bytesMatched[dir]+=x.bytesMatched[dir];
+         kBytesMatched[dir]+=x.kBytesMatched[dir]+(bytesMatched[dir]>>10);
+         bytesMatched[dir]&=0x3ff;
+      }
+   }
 };
 class ICMPStats
 {
@@ -216,6 +320,21 @@ public:
       kBytesMatched[0]=0;
       kBytesMatched[1]=0;
    }
+   // Add the counters of another (parser shard) instance
+   void Add(const ICMPStats& x)
+   {
+      packetsRead+=x.packetsRead;
+      bytesRead+=x.bytesRead;
+      kBytesRead+=x.kBytesRead+(bytesRead>>10);
+      bytesRead&=0x3ff;
+      for (int dir=0;dir<=1;dir++)
+      {
+         packetsMatched[dir]+=x.packetsMatched[dir];
+         bytesMatched[dir]+=x.bytesMatched[dir];
+         kBytesMatched[dir]+=x.kBytesMatched[dir]+(bytesMatched[dir]>>10);
+         bytesMatched[dir]&=0x3ff;
+      }
+   }
 };
 class FLVStats
 {
@@ -232,6 +351,8 @@ public:
    {
       sessionsSeen[0]=0;
       sessionsSeen[1]=0;
+      packets[0]=0;
+      packets[1]=0;
       bytes[0]=0;
       bytes[1]=0;
       kBytes[0]=0;
@@ -243,6 +364,22 @@ public:
       qoeNum[0]=0;
       qoeNum[1]=0;
    }
+
+   // Add the counters of another (parser shard) instance
+   void Add(const FLVStats& x)
+   {
+      for (int dir=0;dir<=1;dir++)
+      {
+         sessionsSeen[dir]+=x.sessionsSeen[dir];
+         packets[dir]+=x.packets[dir];
+         bytes[dir]+=x.bytes[dir];
+         kBytes[dir]+=x.kBytes[dir]+(bytes[dir]>>10);
+         bytes[dir]&=0x3ff;
+         duration[dir]+=x.duration[dir];
+         qoe[dir]+=x.qoe[dir];
+         qoeNum[dir]+=x.qoeNum[dir];
+      }
+   }
 };
 class MP4Stats
 {
@@ -254,6 +391,34 @@ public:
       sessionsSeen[0]=0;
       sessionsSeen[1]=0;
    }
+   // Add the counters of another (parser shard) instance
+   void Add(const MP4Stats& x)
+   {
+      sessionsSeen[0]+=x.sessionsSeen[0];
+      sessionsSeen[1]+=x.sessionsSeen[1];
+   }
+};
+class TimeoutStats
+{
+public:
+   unsigned long checkTimeHist[TIMEOUT_SCANHIST_BINS];     // Number of TCP/IP timeout checks by duration (<10us, <100us, <1ms, <10ms, <100ms, >=100ms)
+
+   void Init()
+   {
+      for (int i=0;i<TIMEOUT_SCANHIST_BINS;i++) {checkTimeHist[i]=0;}
+   }
+   // Add the counters of another (parser shard) instance
+   void Add(const TimeoutStats& x)
+   {
+      for (int i=0;i<TIMEOUT_SCANHIST_BINS;i++) {checkTimeHist[i]+=x.checkTimeHist[i];}
+   }
+   // Count a timeout check lasting 'usecs' microseconds
+   void AddCheck(unsigned long usecs)
+   {
+      int bin = 0;
+      for (unsigned long limit=10; (usecs>=limit) && (bin<TIMEOUT_SCANHIST_BINS-1); limit*=10) {bin++;}
+      checkTimeHist[bin]++;
+   }
 };
 
 class Parser;
@@ -272,12 +437,17 @@ public:
    unsigned short logLevel;
    MACAddress netMAC[2];
    unsigned short netMACLen[2];
-   DoubleWord netIP[2][100];
-   unsigned short netPort[2][100];
-   DoubleWord netMask[2][100];
-   bool netGiven[2][100];
-   bool portGiven[2][100];
-   unsigned short addrFilterNum[2];
+   std::vector<DoubleWord> netIP[2];
+   std::vector<unsigned short> netPort[2];
+   std::vector<DoubleWord> netMask[2];
+   std::vector<bool> netGiven[2];
+   std::vector<bool> portGiven[2];
+   std::vector<bool> netIsIPv6[2];                   // True if the network of the filter is an IPv6 one (given by netIP6/netPrefixLen6 instead of netIP/netMask)
+   std::vector<IPv6Address> netIP6[2];
+   std::vector<unsigned short> netPrefixLen6[2];
+   unsigned long addrFilterNum[2];
+   AddressFilter addrFilter[2];                      // Compiled network filters (built from netIP/netMask by CompileAddrFilters)
+   AddressFilter addrFilter6[2];                     // Compiled IPv6 network filters (built from netIP6/netPrefixLen6 by CompileAddrFilters)
    bool outputDumpGiven;
    std::string outputDumpPrefix;
    std::string outputDumpTmpPrefix;
@@ -285,9 +455,17 @@ public:
    bool ignoreL2Duplicates;
    std::string perfmonDirName;
    std::string perfmonLogPrefix;
+   unsigned short parserThreads;                     // Number of flow-sharded parser threads (1: parse on the reading thread)
+   bool pipelinedReader;                             // True if the packets are read and decoded by a separate reader thread
+   bool decapGTP;                                    // True if the GTP-U tunnels are decapsulated (the inner packets are analyzed)
+   bool tunnelKey;                                   // True if the flows are keyed by the GTP-U TEID besides the inner addresses
+   bool traceClockROP;                               // True if the logfiles are rotated at the ROP boundaries of the trace time (instead of the wall clock)
 
    // Overall statistics
    unsigned long  packetsRead;                       // Packets read from the file
+   unsigned long  packetsVLANStacked;                // Packets with stacked VLAN tags (QinQ)
+   unsigned long  packetsMPLS;                       // Packets with an MPLS label stack
+   unsigned long  packetsGTPU;                       // IP packets decapsulated from GTP-U tunnels
    unsigned long  packetsDuplicated[DUPSTATS_MAX+1]; // Number of packets wrt. duplicates ([0]: # of original transmissions, [1]: # 1st duplicates, ..., [DUPSTATS_MAX]: # of DUPSTATS_MAX+ duplicates)
    struct timeval traceStartTime;                    // First timestamp of the trace [s]
    struct timeval actTime;                           // Actual timestamp [s]
@@ -303,6 +481,7 @@ public:
    ICMPStats icmpStats;
    FLVStats flvStats;
    MP4Stats mp4Stats;
+   TimeoutStats timeoutStats;
 
    // Internal variables
    IPSessionReg   ipSessionReg;
@@ -315,9 +494,17 @@ public:
    unsigned short byteOrderPlatform;
    std::ostream logStream;
 
+   PacketPool packetPool;                            // Recycled packet objects of the decoder
    PacketDumpFile packetDumpFile;
    std::auto_ptr<Parser> parser;
    
+   // Make room for the next network filter of a net (at index addrFilterNum[netId])
+   void NewAddrFilter(unsigned short);
+   // Set the next network filter of a net from an IPv6 network (addr/len) or network and port ([addr]:port/len) (false: wrong input)
+   bool ParseIPv6Filter(unsigned short, const char*);
+   // Build the address lookup structures from the network filters given
+   void CompileAddrFilters();
+
    static void config(std::string const& key, std::string const& value, void*) throw (std::string);
 
    CounterContainer* getCounterContainer();
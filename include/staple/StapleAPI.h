@@ -4,9 +4,12 @@
 #include <string>
 #include <ostream>
 #include <memory>
+#include <vector>
 #include <sys/time.h>
 
 class Staple;
+class EthernetPacket;
+class L2Packet;
 
 namespace staple
 {
@@ -19,6 +22,7 @@ namespace staple
    {
    public:
        StapleAPI();
+       ~StapleAPI();
        
        /** Describe runtime status (tracked connections etc.) */
        void status(std::ostream&);
@@ -34,6 +38,26 @@ namespace staple
        
        /** Parse single packet; return success indication. */
        bool parsePacket(char* bytes, unsigned short int len, const struct timeval & t, bool uplink); 
+
+       /** IP packet handed over in a batch. */
+       struct PacketRef
+       {
+           char* bytes;
+           unsigned short int len;
+           struct timeval t;
+           bool uplink;
+       };
+
+       /**
+        * Parse a batch of packets in timestamp order; return the number of
+        * accepted (decodable IP) packets.
+        *
+        * The status log and the connection timeouts are evaluated once per
+        * batch. If given, bit i of the accepted bitmap (accepted[i/8], LSB
+        * first) is set if packet i was accepted; the bitmap has to hold at
+        * least (num+7)/8 bytes.
+        */
+       unsigned long parsePackets(const PacketRef* packets, unsigned long num, unsigned char* accepted = 0);
        
        /** Set log stream for TCP TA:s */
        void TCPTAlog(std::ostream *);
@@ -50,6 +74,10 @@ namespace staple
    private:
        std::auto_ptr< ::Staple > 
             s;
+       std::vector< ::EthernetPacket* >
+            batchEth;           // Ethernet wrappers of the batch packets (reused)
+       std::vector< ::L2Packet* >
+            batchL2;            // Accepted packets of the actual batch
    };
 }
 
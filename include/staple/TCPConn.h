@@ -6,6 +6,7 @@
 #include <staple/PacketTrainList.h>
 #include <staple/RangeList.h>
 #include <staple/CircularBuffer.h>
+#include <staple/TimerWheel.h>
 
 #include <sys/time.h>
 #include <list>
@@ -13,6 +14,9 @@
 
 // Key for identifying TCP connections
 // -----------------------------------
+class TCPConnId;
+inline std::size_t hash_value(const TCPConnId& x);
+
 class TCPConnId {
 
 public:
@@ -20,20 +24,26 @@ public:
    DoubleWord        netBIP;
    unsigned short    netAPort;
    unsigned short    netBPort;
+   u_int8_t          IPVersion;                 // 4 or 6 (the IPv6 addresses are represented by their handle)
+   u_int32_t         tunnelId;                  // GTP-U TEID of the connection if the flows are keyed by tunnel (0 otherwise)
+
+   TCPConnId() : IPVersion(4), tunnelId(0) {}
 
    // Needed for comparison (HTTP uses it)
    bool operator ==(const TCPConnId& x) const
    {
-      return ((netAPort == x.netAPort) && (netBPort == x.netBPort) && (netAIP.data == x.netAIP.data) && (netBIP.data == x.netBIP.data));
+      return ((netAPort == x.netAPort) && (netBPort == x.netBPort) && (netAIP.data == x.netAIP.data) && (netBIP.data == x.netBIP.data) && (IPVersion == x.IPVersion) && (tunnelId == x.tunnelId));
    };
    void Print(std::ostream& outStream) const
    {
-      outStream << (unsigned)netAIP.byte[3] << "." << (unsigned)netAIP.byte[2] << "." << (unsigned)netAIP.byte[1] << "." << (unsigned)netAIP.byte[0] << " " << netAPort << " ";
-      outStream << (unsigned)netBIP.byte[3] << "." << (unsigned)netBIP.byte[2] << "." << (unsigned)netBIP.byte[1] << "." << (unsigned)netBIP.byte[0] << " " << netBPort;
+      PrintIPAddress(outStream, IPVersion, netAIP) << " " << netAPort << " ";
+      PrintIPAddress(outStream, IPVersion, netBIP) << " " << netBPort;
    }
 
    bool operator< (const TCPConnId& o) const
    {
+      if (IPVersion != o.IPVersion) return (IPVersion < o.IPVersion);
+      if (tunnelId != o.tunnelId) return (tunnelId < o.tunnelId);
       if (netAPort != o.netAPort) return (netAPort < o.netAPort);
       if (netBPort != o.netBPort) return (netBPort < o.netBPort);
       if (netAIP.data != o.netAIP.data) return (netAIP.data < o.netAIP.data);
@@ -43,22 +53,33 @@ public:
 
 std::ostream& operator<<(std::ostream& o, const TCPConnId& p);
 
+// Hash of a TCP connection key (the addresses and the ports are separate words of the mix, so that neither symmetric
+// traffic nor many clients behind one address talking to one server collide)
+inline std::size_t hash_value(const TCPConnId& x)
+{
+   u_int64_t ips = ((u_int64_t)x.netAIP.data << 32) | x.netBIP.data;
+   u_int64_t ports = ((u_int64_t)x.tunnelId << 32) | ((u_int64_t)x.netAPort << 16) | x.netBPort;
+   return MixHash64(ips ^ x.IPVersion, ports);
+}
+
 struct TCPConnIdTraits {
 #if defined(USE_HASH_MAP)
    // Hash function for TCPConnId (needed by hash_map)
    size_t operator()(const TCPConnId& x) const
    {
-      return std::hash< u_int32_t >()((u_int32_t)x.netAIP.data ^ (u_int32_t)x.netBIP.data ^ (u_int32_t)x.netAPort ^ (u_int32_t)x.netBPort);
+      return hash_value(x);
    };
    // Equality function for TCPConnId (needed by hash_map)
    bool operator()(const TCPConnId& x, const TCPConnId& y) const
    {
-      return ((x.netAPort==y.netAPort) && (x.netBPort==y.netBPort) && (x.netAIP.data==y.netAIP.data) && (x.netBIP.data==y.netBIP.data));
+      return ((x.netAPort==y.netAPort) && (x.netBPort==y.netBPort) && (x.netAIP.data==y.netAIP.data) && (x.netBIP.data==y.netBIP.data) && (x.IPVersion==y.IPVersion) && (x.tunnelId==y.tunnelId));
    };
 #else
    // Sorting (needed by std::map)
    bool operator() (const TCPConnId& x, const TCPConnId& y) const
    {
+      if (x.IPVersion != y.IPVersion) return (x.IPVersion < y.IPVersion);
+      if (x.tunnelId != y.tunnelId) return (x.tunnelId < y.tunnelId);
       if (x.netAPort != y.netAPort) return (x.netAPort < y.netAPort);
       if (x.netBPort != y.netBPort) return (x.netBPort < y.netBPort);
       if (x.netAIP.data != y.netAIP.data) return (x.netAIP.data < y.netAIP.data);
@@ -67,10 +88,6 @@ struct TCPConnIdTraits {
 #endif
 };
 
-inline std::size_t hash_value(const TCPConnId& x)
-{
-   return std::hash< u_int32_t >()((u_int32_t)x.netAIP.data ^ (u_int32_t)x.netBIP.data ^ (u_int32_t)x.netAPort ^ (u_int32_t)x.netBPort);
-}
 
 namespace std
 {
@@ -356,8 +373,170 @@ public:
    }
 };
 
+// Owner of a lazily allocated cold part of a TCP connection
+// ----------------------------------------------------------
+// The part is allocated (and initialized) at the first Get() and copied together with the connection
+template <class T>
+class TCPConnPart {
+
+public:
+   TCPConnPart() : part(NULL) {}
+   TCPConnPart(const TCPConnPart& x) : part((x.part != NULL) ? new T(*x.part) : NULL) {}
+   ~TCPConnPart() {if (part != NULL) delete part;}
+
+   TCPConnPart& operator =(const TCPConnPart& x)
+   {
+      if (this != &x)
+      {
+         T* newPart = (x.part != NULL) ? new T(*x.part) : NULL;
+         if (part != NULL) delete part;
+         part = newPart;
+      }
+      return *this;
+   }
+
+   bool Allocated() const {return (part != NULL);}
+   const T* Ptr() const {return part;}
+   T& Get()
+   {
+      if (part == NULL)
+      {
+         part = new T();
+         part->Init();
+      }
+      return *part;
+   }
+   void Free()
+   {
+      if (part != NULL) delete part;
+      part = NULL;
+   }
+
+private:
+   T*             part;
+};
+
+// Content information of a TCP connection (cold part)
+// ---------------------------------------------------
+// Allocated when HTTP metadata or a content signature is found (or a BitTorrent piece is seen)
+class TCPConnContent {
+
+public:
+   FLV            flv[2];
+   MP4            mp4[2];
+
+   bool           isTorrent;
+   std::string    userAgent;
+   std::string    lastReqURI[2];
+   std::string    lastReqHost[2];
+   std::string    contentType;
+
+   void Init()
+   {
+      flv[0].Init();
+      flv[1].Init();
+      mp4[0].Init();
+      mp4[1].Init();
+
+      isTorrent=false;
+      userAgent.clear();
+      lastReqURI[0].clear();
+      lastReqURI[1].clear();
+      lastReqHost[0].clear();
+      lastReqHost[1].clear();
+      contentType.clear();
+   }
+};
+
+// TCP timestamp registry of a TCP connection (cold part)
+// ------------------------------------------------------
+// Allocated at the first DATA packet registered for timestamp-based loss verification
+typedef struct {bool tsSeen[2];unsigned long ts[2];bool rtxSeen;} TCPConnTSRegEntry;
+
+class TCPConnTimestamps {
+
+public:
+   typedef std::multimap<unsigned long /*seq*/, TCPConnTSRegEntry> TSReg;
+   TSReg          tsReg[2];                   // Timestamp registry for DATA packets
+
+   void Init()
+   {
+      tsReg[0].clear();
+      tsReg[1].clear();
+   }
+};
+
+// Transaction history of a TCP connection (cold part)
+// ---------------------------------------------------
+// Allocated when the first transaction starts
+class TCPConnHistory {
+
+public:
+   std::list<TCPTransaction> transactionList[2];     // List of transactions
+   unsigned long  TAFirstIPByte[2][2];               // The amount of IP data seen on the TCP connection at the start of the ongoing transaction [bytes]
+   unsigned long  TAFirstIPSessionByte[2][2];        // The amount of IP session data sent at the start of the ongoing TCP transaction [bytes]
+   double         TAFirstSmallPipeRTT[2][2];         // The value of the smallPipeRTT counter at the start of the ongoing TCP transaction (to calculate avg. small pipe RTT for the transaction)
+   unsigned long  TAFirstSmallPipeRTTSamples[2][2];  // The value of the smallPipeRTTSamples counter at the start of the ongoing TCP transaction (to calculate avg. small pipe RTT for the transaction)
+   double         TAFirstLargePipeRTT[2][2];         // The value of the largePipeRTT counter at the start of the ongoing TCP transaction (to calculate avg. large pipe RTT for the transaction)
+   unsigned long  TAFirstLargePipeRTTSamples[2][2];  // The value of the largePipeRTTSamples counter at the start of the ongoing TCP transaction (to calculate avg. large pipe RTT for the transaction)
+
+   void Init()
+   {
+      for (unsigned short i=0;i<2;i++)
+      {
+         transactionList[i].clear();
+         for (unsigned short j=0;j<2;j++)
+         {
+            TAFirstIPByte[i][j]=0;
+            TAFirstIPSessionByte[i][j]=0;
+            TAFirstSmallPipeRTT[i][j]=0;
+            TAFirstSmallPipeRTTSamples[i][j]=0;
+            TAFirstLargePipeRTT[i][j]=0;
+            TAFirstLargePipeRTTSamples[i][j]=0;
+         }
+      }
+   }
+};
+
+// Memory used by the TCP connections (per component)
+// --------------------------------------------------
+class TCPConnMemory {
+
+public:
+   unsigned long      connections;            // Number of live TCP connections
+   unsigned long long core;                   // TCPConn objects [bytes]
+   unsigned long long packetHistory;          // Packet history rings [bytes]
+   unsigned long long payload;                // Payload caches and payload ranges [bytes]
+   unsigned long long lists;                  // SYN registries, RTX period and highest SEQ lists [bytes]
+   unsigned long long content;                // Content information parts [bytes]
+   unsigned long long timestamps;             // Timestamp registry parts [bytes]
+   unsigned long long transactions;           // Transaction history parts [bytes]
+   unsigned long      contentParts;           // Number of connections with content information
+   unsigned long      timestampParts;         // Number of connections with a timestamp registry
+   unsigned long      transactionParts;       // Number of connections with a transaction history
+
+   void Init()
+   {
+      connections=0;
+      core=0;
+      packetHistory=0;
+      payload=0;
+      lists=0;
+      content=0;
+      timestamps=0;
+      transactions=0;
+      contentParts=0;
+      timestampParts=0;
+      transactionParts=0;
+   }
+   void Add(const TCPConnMemory&);
+   void Print(std::ostream&) const;
+};
+
 // TCP connection data
 // -------------------
+// The connection itself holds the state touched by the per-packet loss/RTT logic, the rarely
+// needed parts (content, timestamp registry, transaction history) are allocated on demand
 class TCPConn {
 
 public:
@@ -375,14 +554,14 @@ public:
 
    // Content container decoding
    bool           contentFound[2];            // True if (at least one) content signature is found (e.g., FLV, MP4, etc.)
-   FLV            flv[2];
-   MP4            mp4[2];
 
-   bool           isTorrent;
-   std::string    userAgent;
-   std::string    lastReqURI[2];
-   std::string    lastReqHost[2];
-   std::string    contentType;
+   // Cold parts
+   TCPConnPart<TCPConnContent>    content;    // Content information (HTTP metadata, content container decoding)
+   TCPConnPart<TCPConnTimestamps> timestamps; // Timestamp registry
+   TCPConnPart<TCPConnHistory>    history;    // Transaction history
+   TCPConnContent& Content() {return content.Get();}
+   TCPConnTimestamps& Timestamps() {return timestamps.Get();}
+   TCPConnHistory& History() {return history.Get();}
 
    // Statistics
    unsigned long  packetsSeen[2];             // The number of packets seen
@@ -432,6 +611,7 @@ public:
    bool           FINSent[2];                 // True if FIN already sent
    struct timeval lastPacketTime[2];          // The time of the last packet seen (used for closeTime & connection breakdown check)
    struct timeval closeTime;                  // The time when a TCP connection closes (FIN or RST or timeout)
+   TimerWheelLink<TCPConnId> timeoutLink;     // Position in the TCP timeout wheel of the parser
 
    // Option usage
    bool           SACKPermitted[2];           // True if a SACK permitted option was seen
@@ -464,9 +644,8 @@ public:
    unsigned long  rtxEWLFirstSeq[2];          // The starting SEQ of a possible end-of-window loss (the first retransmission after the last dupACK in RTX state)
 
    // TCP timestamp-based loss verification
-   typedef struct {bool tsSeen[2];unsigned long ts[2];bool rtxSeen;} TSRegEntry;
-   typedef std::multimap<unsigned long /*seq*/, TSRegEntry> TSReg;
-   TSReg          tsReg[2];                   // Timestamp registry for DATA packets
+   typedef TCPConnTSRegEntry TSRegEntry;
+   typedef TCPConnTimestamps::TSReg TSReg;
    bool           tsLossReliable;             // True if normal loss reliable is true _AND_ TS is used with high enough precision, and all necessary timestamps were seen
 
    // [For Reiner] List containing info for RTX periods
@@ -484,14 +663,7 @@ public:
 
    // Transaction related variables (TAFirstXXX variables may go into the transactions themselves)
    bool           ongoingTransaction[2];             // True if there is an ongoing transaction
-   std::list<TCPTransaction> transactionList[2];     // List of transactions
    unsigned short transactionReliability[2];         // Reliability of transactions (0 is the worst, 2 is the best)
-   unsigned long  TAFirstIPByte[2][2];               // The amount of IP data seen on the TCP connection at the start of the ongoing transaction [bytes]
-   unsigned long  TAFirstIPSessionByte[2][2];        // The amount of IP session data sent at the start of the ongoing TCP transaction [bytes]
-   double         TAFirstSmallPipeRTT[2][2];         // The value of the smallPipeRTT counter at the start of the ongoing TCP transaction (to calculate avg. small pipe RTT for the transaction)
-   unsigned long  TAFirstSmallPipeRTTSamples[2][2];  // The value of the smallPipeRTTSamples counter at the start of the ongoing TCP transaction (to calculate avg. small pipe RTT for the transaction)
-   double         TAFirstLargePipeRTT[2][2];         // The value of the largePipeRTT counter at the start of the ongoing TCP transaction (to calculate avg. large pipe RTT for the transaction)
-   unsigned long  TAFirstLargePipeRTTSamples[2][2];  // The value of the largePipeRTTSamples counter at the start of the ongoing TCP transaction (to calculate avg. large pipe RTT for the transaction)
    
    // Detect repeated data resends
    unsigned long  lastDataPacketSeq[2];       // The sequence number of the last DATA packet
@@ -543,17 +715,10 @@ public:
 
       contentFound[0]=false;
       contentFound[1]=false;
-      flv[0].Init();
-      flv[1].Init();
-      mp4[0].Init();
-      mp4[1].Init();
-      
-      isTorrent=false;
-      userAgent.clear();
-      lastReqURI[0].clear();
-      lastReqURI[1].clear();
-      lastReqHost[0].clear();
-      lastReqHost[1].clear();
+
+      content.Free();
+      timestamps.Free();
+      history.Free();
 
       packetsSeen[0]=0;
       packetsSeen[1]=0;
@@ -645,8 +810,6 @@ public:
       rtxEWLFirstSeq[0]=0;
       rtxEWLFirstSeq[1]=0;
 
-      tsReg[0].clear();
-      tsReg[1].clear();
       tsLossReliable=false;
 
       rtxPeriodList[0].clear();
@@ -663,34 +826,8 @@ public:
 
       ongoingTransaction[0]=false;
       ongoingTransaction[1]=false;
-      transactionList[0].clear();
-      transactionList[1].clear();
       transactionReliability[0]=0;
       transactionReliability[1]=0;
-      TAFirstIPByte[0][0]=0;
-      TAFirstIPByte[0][1]=0;
-      TAFirstIPByte[1][0]=0;
-      TAFirstIPByte[1][1]=0;
-      TAFirstIPSessionByte[0][0]=0;
-      TAFirstIPSessionByte[0][1]=0;
-      TAFirstIPSessionByte[1][0]=0;
-      TAFirstIPSessionByte[1][1]=0;
-      TAFirstSmallPipeRTT[0][0]=0;
-      TAFirstSmallPipeRTT[0][1]=0;
-      TAFirstSmallPipeRTT[1][0]=0;
-      TAFirstSmallPipeRTT[1][1]=0;
-      TAFirstSmallPipeRTTSamples[0][0]=0;
-      TAFirstSmallPipeRTTSamples[0][1]=0;
-      TAFirstSmallPipeRTTSamples[1][0]=0;
-      TAFirstSmallPipeRTTSamples[1][1]=0;
-      TAFirstLargePipeRTT[0][0]=0;
-      TAFirstLargePipeRTT[0][1]=0;
-      TAFirstLargePipeRTT[1][0]=0;
-      TAFirstLargePipeRTT[1][1]=0;
-      TAFirstLargePipeRTTSamples[0][0]=0;
-      TAFirstLargePipeRTTSamples[0][1]=0;
-      TAFirstLargePipeRTTSamples[1][0]=0;
-      TAFirstLargePipeRTTSamples[1][1]=0;
 
       lastDataPacketSeq[0]=0;
       lastDataPacketSeq[1]=0;
@@ -758,6 +895,9 @@ public:
       packetTrains[0].Init();
       packetTrains[1].Init();
    }
+
+   // Add the memory used by the connection to the per-component counters
+   void AddMemoryUsage(TCPConnMemory&) const;
 };
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <list>
+#include <vector>
+#include <staple/Type.h>
+
+// Position of a registry entry in a timer wheel (stored in the entry itself)
+template <class Key>
+class TimerWheelLink {
+public:
+   typename std::list<Key>::iterator pos;     // Position in the slot list
+   long                              sec;     // The second of the slot the entry is linked into (-1: not linked)
+
+   TimerWheelLink() : sec(-1) {}
+};
+
+// Timing wheel with one-second slots for the timeout of registry entries.
+// Entries are re-linked into the slot of their last activity (O(1), only once per second), so a timeout check
+// only visits the slots that became old instead of the whole registry.
+template <class Key>
+class TimerWheel {
+public:
+   TimerWheel() : nextSec(-1) {}
+
+   // Link the entry into the slot of second 'sec' (the entry is moved if it is already linked)
+   void Link(TimerWheelLink<Key>& link, const Key& key, long sec)
+   {
+      if (link.sec == sec) return;
+      std::list<Key>& slot = slots[sec & (TIMERWHEEL_SLOTS-1)];
+      if (link.sec < 0)
+      {
+         link.pos = slot.insert(slot.end(), key);
+      }
+      else
+      {
+         slot.splice(slot.end(), slots[link.sec & (TIMERWHEEL_SLOTS-1)], link.pos);
+      }
+      link.sec = sec;
+      // A slot visited already has to be visited again (the time may have gone back)
+      if ((nextSec < 0) || (sec < nextSec)) nextSec = sec;
+   }
+
+   // Remove the entry from the wheel (before erasing it from the registry)
+   void Unlink(TimerWheelLink<Key>& link)
+   {
+      if (link.sec < 0) return;
+      slots[link.sec & (TIMERWHEEL_SLOTS-1)].erase(link.pos);
+      link.sec = -1;
+   }
+
+   // Continue with the slot of second 'sec' (after all the entries have been checked at once, e.g. after a
+   // backward time jump: the slots of the seconds before 'sec' do not have to be visited again, the ones of the
+   // later seconds do, even if they have been visited before the jump)
+   void Restart(long sec)
+   {
+      if (nextSec >= 0) nextSec = sec;
+   }
+
+   // Collect the keys of the slots up to second 'lastSec' not visited yet (the caller has to check the actual
+   // times of the entries: after a backward time jump a slot may also hold entries of a later second)
+   void Expire(long lastSec, std::vector<Key>& keys)
+   {
+      if ((nextSec < 0) || (lastSec < nextSec)) return;
+      // Each slot has to be visited only once
+      long firstSec = (lastSec - nextSec >= TIMERWHEEL_SLOTS) ? lastSec - TIMERWHEEL_SLOTS + 1 : nextSec;
+      for (long sec=firstSec;sec<=lastSec;sec++)
+      {
+         std::list<Key>& slot = slots[sec & (TIMERWHEEL_SLOTS-1)];
+         keys.insert(keys.end(), slot.begin(), slot.end());
+      }
+      nextSec = lastSec + 1;
+   }
+
+private:
+   std::list<Key> slots[TIMERWHEEL_SLOTS];
+   long           nextSec;                    // The first second whose slot has not been visited yet (-1: empty wheel)
+};
+
+#endif
@@ -8,7 +8,7 @@
 #include <string.h>
 
 // Defines
-#define USE_HASH_MAP                               // If defined, __gnu_cxx::hash is used instead of std::map
+#define USE_HASH_MAP                               // If defined, hash tables (FlowTable) are used instead of std::map
 //#define PROFILE                                    // If defined, performance/memory profiling info is written into file
 //#define MAKE_URL_HIST                              // If defined, an HTTP URL histogram will be maintained (can increase the memory consumption seriously!)
 //#define WRITE_TCPTA_FILES                          // If defined, a file will be written for each TCP TA
@@ -19,8 +19,35 @@
 #define TS_MAJOR_REORDERING_THRESH        1        // Above this threshold, a timestamp reordering is considered to be a major fault (all sessions will be terminated) [s]
 #define TS_JUMP_THRESH                    300      // Above this threshold, a timestamp difference is conidered to be a jump [s]
 #define L2_DUPLICATE_TDIFF                0.1      // Duplicated L2 packets will be removed within this time threshold [s]
+#define L2DUP_MAX_RECORDS                 262144   // Maximum number of L2 frames kept for duplicate detection (within L2_DUPLICATE_TDIFF)
+#define L2DUP_TABLE_SIZE                  (2*L2DUP_MAX_RECORDS) // Size of the L2 duplicate hash table (power of 2)
+#define L2DUP_STORAGE_SIZE                33554432 // Size of the ring storing the content of these frames (power of 2) [bytes]
 #define DECODE_EVERY_SECOND_L2_DUPLICATE  true     // True: every second L2 duplicate will be decoded, false: none of the L2 duplicates will be decoded
 #define DUPSTATS_MAX                      4        // The last bin of the duplicate packet number statistics (has DUPSTATS_MAX and above)
+#define TIMERWHEEL_SLOTS                  64       // Number of one-second slots of the TCP/IP timeout wheels (power of 2, above the timeouts)
+#define TIMEOUT_SCANHIST_BINS             6        // Number of bins of the timeout check duration histogram (<10us, <100us, ..., >=100ms)
+#define MAX_PARSER_THREADS                32       // Maximum number of flow-sharded parser threads
+#define SHARD_QUEUE_SIZE                  16384    // Packet queue size of a parser shard [packets]
+#define SHARD_BATCH_SIZE                  64       // Packets handed over to a parser shard at once [packets]
+#define SHARD_FLUSH_PERIOD                1        // Packets are handed over to the parser shards at least this often, even in partial batches [s]
+#define READER_BATCH_SIZE                 256      // Packets handed over by the pipelined reader thread at once [packets]
+#define READER_RING_SIZE                  16       // Number of batches in flight between the reader and the parser thread
+#define READER_SPIN_LIMIT                 64       // Yields before sleeping when a pipeline stage waits for the other one
+#define PERFMON_WRITER_RING_SIZE          4194304  // Size of the record ring between the parser threads and the perfmon writer thread (power of 2) [bytes]
+#define PERFMON_WRITER_BUFFER_SIZE        262144   // Output buffer of each perfmon logfile in the writer thread [bytes]
+#define PERFMON_WRITER_IDLE_WAIT          10       // Sleep of the perfmon writer thread when no record is queued [ms]
+#define EVENT_BATCH_SIZE                  1048576  // Size of the batches of binary event records handed over to the Java publisher [bytes]
+#define EVENT_BATCH_NUM                   4        // Number of event batches (being filled, queued or being published)
+#define PACKETPOOL_MAX_FREE               8192     // Maximum number of spare packet objects kept per packet type (above the packets in flight in the reader pipeline)
+#define PACKETPOOL_SLAB_SIZE              2048     // Minimum capacity of the payload slabs of pooled packets [bytes]
+#define PAYLOAD_SHARE_MIN_LEN             256      // Shorter payloads are copied by the packet copy constructor instead of sharing the whole slab [bytes]
+#define FLOWTABLE_MIN_CELLS               32       // Initial hash table size of a flow table (power of two)
+#define IPV6_ADDRESS_TIMEOUT              600      // IPv6 addresses not seen for this long are forgotten by the IPv6 registry (longer than any session timeout) [s]
+#define IPV6_EXPIRY_SLICE                 4096     // Number of addresses checked by the IPv6 registry expiry per mutex hold
+#define GTPU_PORT                         2152     // UDP port of the GTP-U tunnels (decapsulated by the decoder if decapGTP is set)
+#define IP_ADDRESS_STRLEN                 48       // Buffer size for the text form of an IP address
+#define LINEBUFFER_SIZE                   4096     // Initial capacity of the log record line buffers (grown for longer records) [bytes]
+#define ADDRFILTER_STRIDE                 8        // Number of address bits resolved per level of the compiled network filter trie (divides 32)
 extern unsigned int TCPTA_SSTHRESH;                // We assume that after this amount of data, the slow start is over (used in TCP transaction TP calculation) [bytes]
 extern unsigned int TCPTA_SSMAXFS;                 // We assume that above this flightsize, the slow start is over (used in TCP transaction TP calculation) [bytes]
 extern unsigned int TCPTA_MINSIZE;
@@ -46,8 +73,10 @@ extern unsigned int UNLOADED_MAXDATA_BEFORE;       // Maximum amount of UL/DL IP
 extern unsigned int UNLOADED_MAXDATA_DURING;       // Maximum amount of UL/DL >>parallel<< IP session data that may be sent during the TCP SYN-SYNACK-ACK procedure so that the TCP setup can be considered unloaded [bytes]
 #define MAX_HISTORY_RANGE                 262144   // The maximum sequence range kept in history [bytes]
 #define HISTORY_MAX_ACKED_AGE             30       // A packet older than this threshold can be erased from the history if it is already ACKed [s]
+#define HISTORY_MIN_CAPACITY              16       // Initial number of packet records in the packet history ring of a TCP direction (power of two)
 #define TCP_SEQ_INSANE_THRESH             1000000  // Maximum valid TCP sequence number difference [bytes]
 #define MAX_PACKETLENGTH                  65535    // Max. length of L2 packets [bytes]
+#define INPUT_BLOCK_SIZE                  1048576  // Size of the blocks read from compressed (or non-mappable) input dump files [bytes]
 
 #ifdef USE_HASH_MAP
 #include <unordered_map>
@@ -55,6 +84,23 @@ extern unsigned int UNLOADED_MAXDATA_DURING;       // Maximum amount of UL/DL >>
 
 typedef unsigned char Byte;
 
+// Strong 64-bit mixing function (MurmurHash3 finalizer): every input bit affects every output bit
+inline u_int64_t MixHash64(u_int64_t x)
+{
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   x ^= x >> 33;
+   return x;
+}
+
+// Mixed hash of two words (the second one is spread by an odd multiplier, so one finalizer does for both)
+inline u_int64_t MixHash64(u_int64_t x, u_int64_t y)
+{
+   return MixHash64(x ^ (y * 0x9e3779b97f4a7c15ULL));
+}
+
 typedef union
 {
    u_int8_t byte[2];
@@ -73,13 +119,63 @@ typedef union
    u_int64_t data;
 } QuadWord;
 
-// IP address key for associative maps
+// Host byte order (known at compile time)
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+   #define HOST_LITTLE_ENDIAN             0
+#else
+   #define HOST_LITTLE_ENDIAN             1
+#endif
+
+// Unaligned load of a big endian (BIG = true, network byte order) or little endian field
+template <bool BIG>
+inline u_int16_t Load16(const void* p)
+{
+   u_int16_t x;
+   memcpy(&x, p, 2);
+   return (BIG == (HOST_LITTLE_ENDIAN == 1)) ? __builtin_bswap16(x) : x;
+}
+
+template <bool BIG>
+inline u_int32_t Load32(const void* p)
+{
+   u_int32_t x;
+   memcpy(&x, p, 4);
+   return (BIG == (HOST_LITTLE_ENDIAN == 1)) ? __builtin_bswap32(x) : x;
+}
+
+// IPv6 address (network byte order)
+class IPv6Address {
+public:
+   u_int8_t          byte[16];
+   bool operator ==(const IPv6Address& x) const {return (memcmp(byte, x.byte, 16) == 0);}
+};
+
+struct IPv6AddressHash {
+   size_t operator()(const IPv6Address& x) const
+   {
+      u_int64_t high, low;
+      memcpy(&high, &x.byte[0], 8);
+      memcpy(&low, &x.byte[8], 8);
+      return MixHash64(high ^ MixHash64(low));
+   }
+};
+
+// Text form of an IPv4 address or an IPv6 address handle (see IPv6Registry) into a buffer of IP_ADDRESS_STRLEN bytes
+const char* FormatIPAddress(char*, u_int8_t, const DoubleWord&);
+std::ostream& PrintIPAddress(std::ostream&, u_int8_t, const DoubleWord&);
+
+// IP address key for associative maps (IPv6 addresses are represented by their handle)
 class IPAddressId {
 public:
    DoubleWord        IP;
+   u_int8_t          IPVersion;                 // 4 or 6
+   u_int32_t         tunnelId;                  // GTP-U TEID of the address if the flows are keyed by tunnel (0 otherwise)
+
+   IPAddressId() : IPVersion(4), tunnelId(0) {}
    void Print(std::ostream& outStream) const
    {
-      outStream << "IP " << (unsigned)IP.byte[3] << "." << (unsigned)IP.byte[2] << "." << (unsigned)IP.byte[1] << "." << (unsigned)IP.byte[0] << "\n";
+      outStream << "IP ";
+      PrintIPAddress(outStream, IPVersion, IP) << "\n";
    }
 };
 
@@ -88,17 +184,19 @@ struct IPAddressIdTraits {
    // Hash function for IPAddressId (needed by hash_map)
    size_t operator()(const IPAddressId& x) const
    {
-      return std::hash< u_int32_t >()((u_int32_t)x.IP.data);
+      return MixHash64(x.IP.data | ((u_int64_t)x.IPVersion << 32), x.tunnelId);
    };
    // Equality function for IPAddressId (needed by hash_map)
    bool operator()(const IPAddressId& x, const IPAddressId& y) const
    {
-      return (x.IP.data==y.IP.data);
+      return ((x.IP.data==y.IP.data) && (x.IPVersion==y.IPVersion) && (x.tunnelId==y.tunnelId));
    };
 #else
    // Sorting (needed by std::map)
    bool operator() (const IPAddressId& x, const IPAddressId& y) const
    {
+      if (x.IPVersion != y.IPVersion) return (x.IPVersion < y.IPVersion);
+      if (x.tunnelId != y.tunnelId) return (x.tunnelId < y.tunnelId);
       return (x.IP.data < y.IP.data);
    }
 #endif
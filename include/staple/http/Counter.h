@@ -8,6 +8,7 @@
 #include <vector>
 
 #include <staple/Staple.h>
+#include <staple/RotationService.h>
 #include <staple/http/Timeval.h>
 #include <staple/http/globals.h>
 
@@ -36,6 +37,9 @@ class Staple;
 class CounterContainer
 {
 public:
+	/* The maximum number of distinct counter names. */
+	static const int MAX_COUNTERS = 4096;
+
 	CounterContainer(Staple&);
 	~CounterContainer();
 
@@ -80,9 +84,11 @@ private:
 	void writeToFileIfNew();
 
 	Staple& staple_;
-	unsigned doWrite_;
+	RotationService& rotation_;
+	// The counters are written when the ROP reaches this number
+	// (0: not known until the clock is started).
+	unsigned long writeROP_;
 	RotatingLogFile* logFile_;
-	Timeval created_;
 	std::vector<long long> counters_;
 };
 
@@ -106,12 +112,10 @@ private:
 void CounterContainer::increase(Counter* c)
 {
 	counters_[c->getID()]++;
-	doWrite_++;
 
-	// To avoid calling gettimeofday all the time we only
-	// check the timeout once every 2^20 \approx 1e6
-	// counter increase.
-	if ((doWrite_ & ((1 << 20) - 1)) == 0)
+	// No gettimeofday here: the ROP number is kept up to date by
+	// the rotation service.
+	if (rotation_.ROP() >= writeROP_)
 		writeToFileIfNew();
 }
 
@@ -121,14 +125,14 @@ long long CounterContainer::getCount(Counter* c)
 }
 
 /* A helper macro to simplify the task of creating and increasing a
- * counter by name.
+ * counter by name. The counter is a function-local static object, so
+ * it is created exactly once even if the parser shard threads reach
+ * the macro at the same time.
  */
 #define COUNTER_INCREASE(name)					  \
 	do {							  \
-		static Counter* counter = NULL;			  \
-		if (!counter)					  \
-			counter = new Counter(name);		  \
-		counter->increase(staple_);			  \
+		static Counter counter(name);			  \
+		counter.increase(staple_);			  \
 	} while(0)
 
 #endif
@@ -2,15 +2,18 @@
 #define HTTPENGINE_H
 
 #include <list>
+#include <map>
 #include <vector>
 #include <iostream>
 #include <set>
 #include <unordered_set>
 
 #include <staple/TCPConn.h>
+#include <staple/FlowTable.h>
 #include <staple/Type.h>
 #include <staple/http/globals.h>
 #include <staple/http/IPAddress.h>
+#include <staple/http/Timeval.h>
 
 class HTTPMsg;
 class HTTPConnection;
@@ -19,7 +22,6 @@ class HTTPMsgTester;
 class HTTPPageViewTester;
 class PageViewPrinter;
 class LogFile;
-class Timeval;
 
 /* If MBBA_OUTPUT is #defined to 1 then the page logs and request logs
  * are written in a MBBA and DNA friendly format. See
@@ -31,20 +33,20 @@ class Timeval;
  * HTTPEngine.cc.
  */
 inline void setServerIP(TCPConnId* id, const IPAddress& ip)
-{ id->netBIP = ip.getIP(); }
+{ id->netBIP = ip.getIP(); id->IPVersion = ip.getIPVersion(); }
 inline void setServerPort(TCPConnId* id, uint16_t port)
 { id->netBPort = port; }
 inline void setClientIP(TCPConnId* id, const IPAddress& ip)
-{ id->netAIP = ip.getIP(); }
+{ id->netAIP = ip.getIP(); id->IPVersion = ip.getIPVersion(); }
 inline void setClientPort(TCPConnId* id, uint16_t port)
 { id->netAPort = port; }
 
 inline IPAddress getServerIP(const TCPConnId& id)
-{ return IPAddress(id.netBIP); }
+{ return IPAddress(id.netBIP, id.IPVersion); }
 inline uint16_t getServerPort(const TCPConnId& id)
 { return id.netBPort; }
 inline IPAddress getClientIP(const TCPConnId& id)
-{ return IPAddress(id.netAIP); }
+{ return IPAddress(id.netAIP, id.IPVersion); }
 inline uint16_t getClientPort(const TCPConnId& id)
 { return id.netAPort; }
 
@@ -67,6 +69,9 @@ public:
 	long long tcpNum;
 	long long reqNum;
 	long long rspNum;
+
+	/* Add the counts of 'other' (e.g. of another parser shard). */
+	void add(const HTTPStats& other);
 };
 
 /* HTTPEngine is the entry point for HTTP parsing. Packets are entered
@@ -136,21 +141,32 @@ private:
 	void checkUserTimeout(const Timeval& time);
 	void updateUserStats(const HTTPUser* user);
 
-	/* Map source IP addresses to HTTPUser*. To be able to
-	 * efficiently remove HTTPUsers that haven't be used for the
-	 * last USER_TIMEOUT seconds we also store the HTTPUsers in a
-	 * linked list. The linked list is sorted so that the most
-	 * recently used objects are in the back of the list.
+	/* The HTTPUsers without TCP connections (only these can time
+	 * out), ordered by their last activity. A user is added when
+	 * its last connection is finished and removed when it gets a
+	 * new packet, so checkUserTimeout only has to look at the
+	 * first entries and never at the users with connections.
 	 */
-	typedef std::list<HTTPUser*> UserList;
-	typedef std::unordered_map<IPAddress, UserList::iterator> UserMap;
-	UserMap users_;
+	typedef std::multimap<Timeval, HTTPUser*> IdleUsers;
+	IdleUsers idleUsers_;
 
 	/* The HTTPUsers ordered in least recently used order. The
 	 * least recently used object is first in the list.
 	 */
+	typedef std::list<HTTPUser*> UserList;
 	UserList usersLRU_;
 
+	struct UserEntry {
+		UserList::iterator lru;
+		IdleUsers::iterator idle;	// idleUsers_.end() if the user has connections
+	};
+
+	/* Map source IP addresses to the entries of the HTTPUsers in
+	 * usersLRU_ and idleUsers_.
+	 */
+	typedef FlowTable<IPAddress, UserEntry> UserMap;
+	UserMap users_;
+
 	PageViewPrinter* printer_;
 	Staple& staple_;
 
@@ -4,19 +4,22 @@
 #include <staple/Type.h>
 
 /* A IPAddress class that can be used in both ordered and unordered
- * sets and maps without any preprocessor magic. */
+ * sets and maps without any preprocessor magic. IPv6 addresses are
+ * represented by their handle in the IPv6 registry. */
 class IPAddress
 {
 public:
-	explicit IPAddress(const DoubleWord& ip);
+	IPAddress(const DoubleWord& ip, Byte ipVersion);
 	IPAddress();
 
 	bool operator<(const IPAddress&) const;
 	const DoubleWord& getIP() const { return IP; }
+	Byte getIPVersion() const { return ipVersion; }
 	friend std::istream& operator>>(std::istream&, IPAddress&);
 
 private:
 	DoubleWord        IP;
+	Byte              ipVersion;        /* 4 or 6 */
 };
 
 bool operator==(const IPAddress&, const IPAddress&);
@@ -25,7 +28,7 @@ std::istream& operator>>(std::istream&, IPAddress&);
 
 inline std::size_t hash_value(const IPAddress& ip)
 {
-        return ip.getIP().data;
+        return MixHash64(ip.getIP().data | ((u_int64_t)ip.getIPVersion() << 32));
 }
 
 namespace std {
@@ -10,6 +10,9 @@
 #include <errno.h>
 
 #include <staple/Parser.h>
+#include <staple/ParserShards.h>
+#include <staple/PacketReader.h>
+#include <staple/PerfmonWriter.h>
 #include <staple/http/Counter.h>
 #include <staple/http/log.h>
 #include "Main.h"
@@ -25,14 +28,6 @@ int main(int argc, char** argv)
    return 0;
 }   
 
-struct ThreadArgs
-{
-   PerfmonStaple& perfmonStaple;
-   Parser& parser;
-};
-
-void* ParserThreadLauncher(void*);
-
 void PerfmonStaple::main(int argc, char** argv)
 {
    // Start heap profiling
@@ -46,6 +41,7 @@ void PerfmonStaple::main(int argc, char** argv)
       std::cout << "Switches:\n";
       std::cout << "   -A    IP:port/mask        IP, port and mask of Net A (port is optional)\n";
       std::cout << "   -B    IP:port/mask        IP, port and mask of Net B (port is optional)\n";
+      std::cout << "                             IPv6 networks: addr/len or [addr]:port/len\n";
       std::cout << "   -MACA xx:xx:xx:xx:xx:xx   MAC address (or prefix) of the Net A device\n";
       std::cout << "   -MACB yy:yy:yy:yy:yy:yy   MAC address (or prefix) of the Net B device\n";
       std::cout << "   -w    [filename_prefix]   write output pcap dumpfile - with optional name prefix (default: dump)\n";
@@ -63,6 +59,13 @@ void PerfmonStaple::main(int argc, char** argv)
       std::cout << "   -p    perfmon_log_dir     directory where the perfmon logs will be placed\n";
       std::cout << "   -pp   perfmon_log_prefix  the name of perfmon log files will include this prefix string\n";
       std::cout << "   -nohttp                   don't do any HTTP processing\n";
+      std::cout << "   -threads threadnum        number of parser threads; packets are sharded by client IP (default: 1)\n";
+      std::cout << "                             HTTP and counter logs are written by each thread separately,\n";
+      std::cout << "                             the perfmon log prefix of thread i is extended with _shard<i>\n";
+      std::cout << "   -pipeline                 read and decode the packets on a separate reader thread\n";
+      std::cout << "   -nogtp                    don't decapsulate GTP-U tunnels (analyze the tunnels as UDP)\n";
+      std::cout << "   -tunnelkey                key the IP sessions and TCP connections by GTP-U TEID besides the inner addresses\n";
+      std::cout << "   -traceclock               rotate the log files at the ROP boundaries of the trace time instead of the wall clock\n";
       std::cout << "   input_dumpfile            name of the input pcap packet dump file\n";
       exit(-1);
    }
@@ -92,6 +95,7 @@ void PerfmonStaple::main(int argc, char** argv)
       {
          unsigned short netId = (strcmp(argv[i],"-A")==0) ? 0 : 1;
          i++;
+         NewAddrFilter(netId);
 
          unsigned short IP[4];
          unsigned short mask, port;
@@ -128,8 +132,8 @@ void PerfmonStaple::main(int argc, char** argv)
             netGiven[netId][addrFilterNum[netId]] = false;
             portGiven[netId][addrFilterNum[netId]] = true;
          }
-         // Wrong input
-         else
+         // IPv6 network (addr/len) or IPv6 network and port ([addr]:port/len) is given, otherwise wrong input
+         else if (ParseIPv6Filter(netId, argv[i]) == false)
          {
             std::cerr << "Wrong Net IP!\n";
             exit(-1);
@@ -215,6 +219,49 @@ void PerfmonStaple::main(int argc, char** argv)
          continue;
       }
 
+      // Number of parser threads
+      if (strcmp(argv[i],"-threads") == 0)
+      {
+         i++;
+         parserThreads = atoi(argv[i++]);
+         if ((parserThreads < 1) || (parserThreads > MAX_PARSER_THREADS))
+         {
+            std::cerr << "Wrong number of parser threads!\n";
+            exit(-1);
+         }
+         continue;
+      }
+
+      // Pipelined reader thread
+      if (strcmp(argv[i],"-pipeline") == 0)
+      {
+         i++;
+         pipelinedReader = true;
+         continue;
+      }
+
+      // GTP-U decapsulation
+      if (strcmp(argv[i],"-nogtp") == 0)
+      {
+         i++;
+         decapGTP = false;
+         continue;
+      }
+      if (strcmp(argv[i],"-tunnelkey") == 0)
+      {
+         i++;
+         tunnelKey = true;
+         continue;
+      }
+
+      // ROPs of the trace time
+      if (strcmp(argv[i],"-traceclock") == 0)
+      {
+         i++;
+         traceClockROP = true;
+         continue;
+      }
+
       // Not a switch -> it is the input dumpfile
       inputDumpFileName = argv[i++];
    }
@@ -226,12 +273,25 @@ void PerfmonStaple::main(int argc, char** argv)
       exit(-1);
    }
    // Network IP addresses should not overlap
-   if ((addrFilterNum[0]>0) && (addrFilterNum[1]>0) &&
+   if ((addrFilterNum[0]>0) && (addrFilterNum[1]>0) && !netIsIPv6[0][0] && !netIsIPv6[1][0] &&
    (netIP[0][0].data & netMask[0][0].data & netMask[1][0].data) == (netIP[1][0].data & netMask[0][0].data & netMask[1][0].data))
    {
       std::cerr << "Overlapping network addresses!\n";
       exit(-1);
    }
+   CompileAddrFilters();
+   // The output dumpfile is written from the packet buffer of the reader
+   if ((parserThreads > 1) && (outputDumpGiven == true))
+   {
+      std::cerr << "Output dumpfile cannot be written with multiple parser threads!\n";
+      exit(-1);
+   }
+   // The output dumpfile and the debug log need the raw packet being parsed
+   if (pipelinedReader && ((outputDumpGiven == true) || (logLevel >= 5)))
+   {
+      std::cerr << "Output dumpfile and debug logging cannot be used with the pipelined reader!\n";
+      exit(-1);
+   }
 
    // Create logfile if necessary
    std::ofstream logFile;
@@ -268,78 +328,116 @@ void PerfmonStaple::main(int argc, char** argv)
    // Initialize the parser
    Parser parser(*this);
    parser.Init();
-   parser.perfmonTCPTAFile = &tcptafile;
-   parser.perfmonTCPTAPartialFile = &tcptapartialfile;
-   parser.perfmonFLVFile = &flvfile;
-   parser.perfmonFLVPartialFile = &flvpartialfile;
 
-   if (!noHTTP)
+   // Launch perfmon logfile writer thread
+   PerfmonWriter perfmonWriter(*this);
+   if (!perfmonWriter.Start()) exit(-1);
+   parser.perfmonWriter = &perfmonWriter;
+
+   // Launch the parser threads (HTTP logs and counters are written by them)
+   ParserShards* pParserShards = NULL;
+   if (parserThreads > 1)
+   {
+      pParserShards = new ParserShards(*this, parser, parserThreads, !noHTTP);
+   }
+   else if (!noHTTP)
    {
       parser.setHTTPPageLog(true);
       parser.setHTTPRequestLog(true);
       getCounterContainer()->setLogging(true);
    }
 
-   // Launch perfmon logfile writer thread
-   pthread_t thread;
-   struct ThreadArgs t = {*this, parser};
-   pthread_create(&thread, NULL, ParserThreadLauncher, (void*) &t);
-   
+   // Launch the reader thread
+   PacketReader* pPacketReader = NULL;
+   if (pipelinedReader) pPacketReader = new PacketReader(*this);
+
    while (1)
    {
-      // Delete last packet
-      if (pL2Packet != NULL) delete pL2Packet;
-      // Read next packet
-      pL2Packet = packetDumpFile.ReadPacket(&errorCode);
-      // Handle errors
-      if (errorCode == PacketDumpFile::ERROR_EOF)
+      if (pPacketReader != NULL)
       {
-         // EOF: try to open next input file (if available)
-         errorCode = packetDumpFile.NextInputFile();
-         if (errorCode != PacketDumpFile::NO_ERROR)
-         {
-            // Cannot open next input file, stop execution
-            break;
-         }
-         else
+         // Read next packet (the reader thread takes care of the input files and the packets parsed)
+         pL2Packet = pPacketReader->ReadPacket();
+         if (pL2Packet == NULL) break;
+      }
+      else
+      {
+         // Release last packet
+         packetPool.Release(pL2Packet);
+         // Read next packet
+         pL2Packet = packetDumpFile.ReadPacket(&errorCode);
+         // Handle errors
+         if (errorCode == PacketDumpFile::ERROR_EOF)
          {
-            // Successful open, continue reading packets
-            continue;
+            // EOF: try to open next input file (if available)
+            errorCode = packetDumpFile.NextInputFile();
+            if (errorCode != PacketDumpFile::NO_ERROR)
+            {
+               // Cannot open next input file, stop execution
+               break;
+            }
+            else
+            {
+               // Successful open, continue reading packets
+               continue;
+            }
          }
+         if (errorCode == PacketDumpFile::ERROR_FORMAT) continue;
+         if (errorCode == PacketDumpFile::ERROR_L2_DUPLICATE) continue;
+         if (pL2Packet == NULL) continue;
       }
-      if (errorCode == PacketDumpFile::ERROR_FORMAT) continue;
-      if (errorCode == PacketDumpFile::ERROR_L2_DUPLICATE) continue;
-      if (pL2Packet == NULL) continue;
       
       // Parse the packet
-      parser.ParsePacket(pL2Packet);
+      if (pParserShards != NULL)
+      {
+         // The packet is deleted by its parser thread
+         pParserShards->Dispatch(pL2Packet);
+         if (pPacketReader != NULL) pPacketReader->Detach();
+         pL2Packet = NULL;
+      }
+      else
+      {
+         parser.ParsePacket(pL2Packet);
+      }
    }
 
    // TCPdump file processed
    // ----------------------
    // Finish ongoing connections
+   if (pParserShards != NULL) pParserShards->Finish();
    parser.FinishConnections();
 
-   // Delete last packet
-   if (pL2Packet != NULL) delete pL2Packet;
+   // Release last packet
+   packetPool.Release(pL2Packet);
+   unsigned long long readerStalls = 0;
+   unsigned long long parserStalls = 0;
+   if (pPacketReader != NULL)
+   {
+      readerStalls = pPacketReader->readerStalls;
+      parserStalls = pPacketReader->parserStalls;
+      delete pPacketReader;
+   }
 
    // Print overall statistics
    if (logLevel >= 1)
    {
-      parser.PrintOverallStatistics(logStream);
+      if (pParserShards != NULL) pParserShards->PrintOverallStatistics(logStream);
+      else parser.PrintOverallStatistics(logStream);
+      if (pipelinedReader) logStream << "Pipelined reader stalls: " << readerStalls << " (reader waited for the parser), " << parserStalls << " (parser waited for the reader)\n";
+      logStream << "Perfmon writer stalls: " << perfmonWriter.producerStalls << " (parser waited for the perfmon writer thread)\n";
    }
 
-   if (!noHTTP) getCounterContainer()->writeToFile();
+   if (!noHTTP)
+   {
+      if (pParserShards != NULL) pParserShards->WriteCounters();
+      else getCounterContainer()->writeToFile();
+   }
+   delete pParserShards;
 
    // Close output dump file
    if (outputDumpGiven == true) packetDumpFile.CloseOutputFile();
 
-   // Terminate perfmon logfile writer thread
-   pthread_cancel(thread);
-   pthread_join(thread, 0);
-   
-   // Write and close final perfmon logfiles
-   PerfmonLogWrite(true);
+   // Write and close final perfmon logfiles, terminate perfmon logfile writer thread
+   perfmonWriter.Finish();
 
    // TBD: close normal logfile
 
@@ -350,123 +448,3 @@ void PerfmonStaple::main(int argc, char** argv)
       HeapProfilerStop();
    #endif
 }
-
-// Global function for launching Parser logfile writer thread
-void* ParserThreadLauncher(void* arg)
-{
-   struct ThreadArgs & args = *reinterpret_cast<struct ThreadArgs*>(arg);
-   PerfmonStaple& perfmonStaple = args.perfmonStaple;
-   Parser& parser = args.parser;//*reinterpret_cast<Parser*>(p_pParser);
-   while (true)
-   {
-      // Close & recreate perfmon logfiles
-      pthread_mutex_lock(&parser.perfmonFileMutex);
-      perfmonStaple.PerfmonLogWrite(false);
-      pthread_mutex_unlock(&parser.perfmonFileMutex);
-      // Sleep until the next ROP
-      struct timeval actRealTime;
-      struct timezone tmpZone;
-      gettimeofday(&actRealTime,&tmpZone);
-      unsigned long secsToSleep = PERFMON_ROP*(perfmonStaple.lastPerfmonROP+1) - actRealTime.tv_sec;
-      unsigned long usecsPassed = actRealTime.tv_usec;
-      struct timespec s = {secsToSleep, 1000 * usecsPassed};
-      nanosleep(&s, 0);
-   }
-   return NULL;
-}
-
-// Close old perfmon logfiles, and create new ones (if necessary)
-void PerfmonStaple::PerfmonLogWrite(bool p_isFinal)
-{
-   struct timeval actRealTime;
-   struct timezone tmpZone;
-   // Prepare new (temporary) perfmon logfiles
-   char tcpta_tmp[1000];
-   sprintf(tcpta_tmp, "%s/tcpta%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-   char tcpta_partial_tmp[1000];
-   sprintf(tcpta_partial_tmp, "%s/tcpta-partial%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-   char flv_tmp[1000];
-   sprintf(flv_tmp, "%s/flv%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-   char flv_partial_tmp[1000];
-   sprintf(flv_partial_tmp, "%s/flv-partial%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-
-   // Initialize lastPerfmonROP
-   if (lastPerfmonROP==0)
-   {
-      gettimeofday(&actRealTime,&tmpZone);
-      lastPerfmonROP = actRealTime.tv_sec/PERFMON_ROP;
-   }
-   // Rename the old temporary log files to their final names (not in the first ROP)
-   else
-   {
-      flvfile.close();
-      flvpartialfile.close();
-      tcptafile.close();
-      tcptapartialfile.close();
-
-      //Calculate the previous ROP Time
-	  time_t previousRopTime = PERFMON_ROP*lastPerfmonROP;
-	  struct tm * prevRopTime;
-	  prevRopTime = gmtime ( &previousRopTime );
-	  char prevTimeStamp[4];
-	  sprintf(prevTimeStamp, "%02d%02d", prevRopTime->tm_hour, prevRopTime->tm_min);
-
-	  //Increment the ROP counter
-      lastPerfmonROP++;
-
-      //Calculate the current ROP Time
-	  time_t epochTime = PERFMON_ROP*lastPerfmonROP;
-	  struct tm * ropTime;
-	  ropTime = gmtime ( &epochTime );
-
-	  //Create the Time stamp string in the format: A<year><month><day>.<previousRop HourMinute><currentRop HourMinute>
-	  char fileTimeStamp[20];
-	  sprintf(fileTimeStamp, "A%04d%02d%02d.%s-%02d%02d", (ropTime->tm_year+1900), (ropTime->tm_mon+1), ropTime->tm_mday, prevTimeStamp, ropTime->tm_hour, ropTime->tm_min);
-
-
-
-      // The file names contain timestamp
-      char tcpta_name[1000];
-      sprintf(tcpta_name, "%s/%s_staple_tcpta_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-      char tcpta_partial_name[1000];
-      sprintf(tcpta_partial_name, "%s/%s_staple_tcpta-partial_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-      char flv_name[1000];
-      sprintf(flv_name, "%s/%s_staple_flv_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-      char flv_partial_name[1000];
-      sprintf(flv_partial_name, "%s/%s_staple_flv-partial_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-
-      rename(flv_tmp,flv_name);
-      rename(flv_partial_tmp,flv_partial_name);
-      rename(tcpta_tmp,tcpta_name);
-      rename(tcpta_partial_tmp,tcpta_partial_name);
-   }
-
-   if (p_isFinal==false)
-   {
-      // Open the new (temporary) perfmon logfiles
-      flvfile.open(flv_tmp);
-      if (!flvfile.is_open())
-      {
-         printf("Error opening log file %s\n",strerror(errno));
-         exit(-1);
-      }
-      flvpartialfile.open(flv_partial_tmp);
-      if (!flvpartialfile.is_open())
-      {
-         printf("Error opening log file %s\n",strerror(errno));
-         exit(-1);
-      }
-      tcptafile.open(tcpta_tmp);
-      if (!tcptafile.is_open())
-      {
-         printf("Error opening log file %s\n",strerror(errno));
-         exit(-1);
-      }
-      tcptapartialfile.open(tcpta_partial_tmp);
-      if (!tcptapartialfile.is_open())
-      {
-         printf("Error opening log file %s\n",strerror(errno));
-         exit(-1);
-      }
-   }
-}
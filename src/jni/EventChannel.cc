@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <jni/EventChannel.h>
+
+// Size of the record header (event type and length)
+static const unsigned long EVENT_HEADER_SIZE = 2*sizeof(int32_t);
+
+EventChannel::EventChannel() :
+	producerStalls(0),
+	droppedEvents(0),
+	filling(0),
+	queued(0),
+	stopping(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+	// The deadlines of next are given on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&queuedCond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&releasedCond, NULL);
+	for (unsigned short i=0; i<EVENT_BATCH_NUM; i++) {
+		batches[i] = new Byte[EVENT_BATCH_SIZE];
+		batchLen[i] = 0;
+	}
+}
+
+EventChannel::~EventChannel()
+{
+	for (unsigned short i=0; i<EVENT_BATCH_NUM; i++) delete [] batches[i];
+	pthread_cond_destroy(&releasedCond);
+	pthread_cond_destroy(&queuedCond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void EventChannel::publish(int eventType, const char* event, unsigned long length)
+{
+	if (EVENT_HEADER_SIZE + length > EVENT_BATCH_SIZE) {
+		__sync_fetch_and_add(&droppedEvents, 1);
+		return;
+	}
+
+	pthread_mutex_lock(&mutex);
+	if (batchLen[filling] + EVENT_HEADER_SIZE + length > EVENT_BATCH_SIZE) {
+		// Wait until the next batch is published, unless it is free already
+		if (queued + 1 >= EVENT_BATCH_NUM) producerStalls++;
+		while (queued + 1 >= EVENT_BATCH_NUM) pthread_cond_wait(&releasedCond, &mutex);
+		queueFilling();
+	}
+
+	Byte* pos = batches[filling] + batchLen[filling];
+	int32_t header[2] = {eventType, (int32_t) length};
+	memcpy(pos, header, EVENT_HEADER_SIZE);
+	memcpy(pos + EVENT_HEADER_SIZE, event, length);
+	batchLen[filling] += EVENT_HEADER_SIZE + length;
+	pthread_mutex_unlock(&mutex);
+}
+
+// Queue the batch being filled and start filling the next one (the mutex is held and the next batch is free)
+void EventChannel::queueFilling()
+{
+	queued++;
+	filling = (filling + 1) % EVENT_BATCH_NUM;
+	batchLen[filling] = 0;
+	pthread_cond_signal(&queuedCond);
+}
+
+int EventChannel::next(const struct timespec& deadline, bool& partial)
+{
+	pthread_mutex_lock(&mutex);
+	int err = 0;
+	while ((queued == 0) && !stopping && (err == 0)) {
+		err = pthread_cond_timedwait(&queuedCond, &mutex, &deadline);
+	}
+	// Nothing got full: hand over the events collected so far
+	partial = (queued == 0) && (batchLen[filling] > 0);
+	if (partial) queueFilling();
+	int batch = -1;
+	if (queued > 0) batch = (filling + EVENT_BATCH_NUM - queued) % EVENT_BATCH_NUM;
+	pthread_mutex_unlock(&mutex);
+	return batch;
+}
+
+void EventChannel::release(int batch)
+{
+	pthread_mutex_lock(&mutex);
+	batchLen[batch] = 0;
+	queued--;
+	pthread_cond_broadcast(&releasedCond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void EventChannel::stop()
+{
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_signal(&queuedCond);
+	pthread_mutex_unlock(&mutex);
+}
@@ -12,6 +12,10 @@
 #include <pthread.h>
 
 #include <staple/Parser.h>
+#include <staple/ParserShards.h>
+#include <staple/PacketReader.h>
+#include <staple/PerfmonWriter.h>
+#include <jni/EventChannel.h>
 #include <staple/http/Counter.h>
 #include <staple/http/log.h>
 
@@ -40,8 +44,21 @@ struct hazelcastPublisher {
 	//back pointer to the StapleJniInterface which calls this class
 	jobject backPtr;
 
+	//method IDs of the callbacks (looked up once at start, NULL if not implemented)
+	jmethodID publishEventsMethod;
+	jmethodID publishEventMethod;
+	jmethodID flushMethod;
+
+	/**
+	 * Callback method which is used to publish a batch of events using Hazelcast.
+	 * @param events Direct buffer of binary event records (see EventChannel), valid only during the call
+	 * @param length The number of bytes used in the buffer
+	 */
+	void publishEvents(jobject events, jint length);
+
 	/**
-	 * Callback method which is used to publish the event using Hazelcast.
+	 * Callback method which is used to publish the event using Hazelcast
+	 * (used only if publishEvents is not implemented).
 	 * @param eventType The type of event: 0 = TCPTA, 1 = TCPTA_PARTIAL, 2 = FLV, 3 = FLV_PARTIAL and 4 = INVALID
 	 * @param event The Event text to publish
 	 */
@@ -54,17 +71,12 @@ struct hazelcastPublisher {
 
 };
 
-struct ThreadArgs {
-	StapleJniImpl& stapleJni;
-	Parser& parser;
-};
-
 struct FlushThreadArgs {
 	StapleJniImpl& stapleJni;
+	EventChannel& eventChannel;
 	int flushPeriod;
 };
 
-void* ParserThreadLauncher(void*);
 void* FlushThread(void*);
 
 JavaVM *jvm;
@@ -83,7 +95,12 @@ void StapleJniImpl::flush()
 	jboolean has_exception;
 	JNIEnv* env = JNU_GetEnv();
 	//	if (traceLevel>=3) std::cout << "StapleJniImpl::flush: Calling the CallMethodByName(" << env << ", " << has_exception << ", " << cpp_obj->backPtr << ", flush, ()V\n";
-	jniStaple.JNU_CallMethodByName(env, &has_exception, "flush", "()V");
+	if (cpp_obj->flushMethod != NULL) {
+		env->CallVoidMethod(cpp_obj->backPtr, cpp_obj->flushMethod);
+		has_exception = env->ExceptionCheck();
+	} else {
+		jniStaple.JNU_CallMethodByName(env, &has_exception, "flush", "()V");
+	}
 	if(has_exception){
 		env->ExceptionClear();
 		if (traceLevel>=3) std::cout << "StapleJniImpl::flush: Exception attempting to flush the buffer";
@@ -131,6 +148,16 @@ JNIEXPORT void JNICALL Java_com_ericsson_eniqanalysis_probing_jni_StapleJniInter
 	cpp_obj->backPtr = env->NewGlobalRef(jobj);
 	env -> GetJavaVM(&jvm);
 
+	// Look up the callbacks once (the missing ones throw NoSuchMethodError, which is cleared)
+	jclass clazz = env->GetObjectClass(jobj);
+	cpp_obj->publishEventsMethod = env->GetMethodID(clazz, "publishEvents", "(Ljava/nio/ByteBuffer;I)V");
+	if (env->ExceptionCheck()) env->ExceptionClear();
+	cpp_obj->publishEventMethod = env->GetMethodID(clazz, "publishEvent", "(ILjava/lang/String;)V");
+	if (env->ExceptionCheck()) env->ExceptionClear();
+	cpp_obj->flushMethod = env->GetMethodID(clazz, "flush", "()V");
+	if (env->ExceptionCheck()) env->ExceptionClear();
+	env->DeleteLocalRef(clazz);
+
 	const char *ipAndMaskA = 0, *ipAndMaskB = 0, *macA = 0, *macB = 0;
 	const char *logFileName = 0, *logFilePrefix = 0, *inputPcapFile=0, *outputDirectory=0;
 
@@ -197,30 +224,47 @@ JNIEXPORT void JNICALL Java_com_ericsson_eniqanalysis_probing_jni_StapleJniInter
 
 
 /**
- * Callback method which is used to publish the event using Hazelcast.
- * @param eventType The type of event. See the
- * 				StapleJniImpl.eventTypes enum:
- * 				0 = TCPTA, 1 = TCPTA_PARTIAL, 2 = FLV,
- * 				3 = FLV_PARTIAL and 4 = INVALID
- * @param event The Event text to publish
+ * Publishes a batch of events using Hazelcast.
+ * @param events Direct ByteBuffer wrapping the batch memory
+ * @param data The batch of binary event records (see EventChannel)
+ * @param length The number of bytes used in the batch
  */
-int StapleJniImpl::publishEvent(int eventType, std::string event)
+int StapleJniImpl::publishEvents(JNIEnv* env, jobject events, const Byte* data, unsigned long length)
 {
-	if (traceLevel>=3) std::cout << "StapleJniImpl::publishEvent-->\n";
-	jboolean has_exception;
-	JNIEnv* env = JNU_GetEnv();
-	jstring eventString = jniStaple.JNU_NewStringUTF(env, &has_exception, event);
-	jniStaple.JNU_CallMethodByName(env,
-			&has_exception,
-			"publishEvent",
-			"(ILjava/lang/String;)V",
-			(jint)eventType,
-			eventString);
+	if (traceLevel>=3) std::cout << "StapleJniImpl::publishEvents-->\n";
+	jboolean has_exception = JNI_FALSE;
+	if ((cpp_obj->publishEventsMethod != NULL) && (events != NULL)) {
+		env->CallVoidMethod(cpp_obj->backPtr, cpp_obj->publishEventsMethod, events, (jint)length);
+		has_exception = env->ExceptionCheck();
+	} else if (cpp_obj->publishEventMethod != NULL) {
+		// Older publisher: one call per event
+		unsigned long pos = 0;
+		while (pos + 2*sizeof(int32_t) <= length) {
+			int32_t header[2];
+			memcpy(header, data + pos, sizeof(header));
+			pos += sizeof(header);
+			std::string event(reinterpret_cast<const char*>(data + pos), header[1]);
+			pos += header[1];
+			jboolean event_exception = JNI_FALSE;
+			jstring eventString = JNU_NewStringUTF(env, &event_exception, event);
+			if (event_exception) {
+				env->ExceptionClear();
+				has_exception = JNI_TRUE;
+				continue;
+			}
+			env->CallVoidMethod(cpp_obj->backPtr, cpp_obj->publishEventMethod, (jint)header[0], eventString);
+			env->DeleteLocalRef(eventString);
+			if (env->ExceptionCheck()) {
+				env->ExceptionClear();
+				has_exception = JNI_TRUE;
+			}
+		}
+	}
 	if (has_exception) {
 		env->ExceptionClear();
 		return -1;
 	} else {
-		if (traceLevel>=3) std::cout << "StapleJniImpl::publishEvent <--\n";
+		if (traceLevel>=3) std::cout << "StapleJniImpl::publishEvents <--\n";
 		return 0;
 	}
 }
@@ -359,6 +403,7 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 
 	if (ipAndMaskA != NULL && *ipAndMaskA != '\0'){
 		unsigned short netId = 0;
+		NewAddrFilter(netId);
 
 		unsigned short IP[4];
 		unsigned short mask, port;
@@ -395,8 +440,8 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 			netGiven[netId][addrFilterNum[netId]] = false;
 			portGiven[netId][addrFilterNum[netId]] = true;
 		}
-		// Wrong input
-		else
+		// IPv6 network (addr/len) or IPv6 network and port ([addr]:port/len) is given, otherwise wrong input
+		else if (ParseIPv6Filter(netId, ipAndMaskA) == false)
 		{
 			throwJavaException("Staple Error: Wrong Net IP");
 			return;
@@ -406,6 +451,7 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 	}
 	if (ipAndMaskB != NULL && *ipAndMaskB != '\0'){
 		unsigned short netId = 1;
+		NewAddrFilter(netId);
 
 		unsigned short IP[4];
 		unsigned short mask, port;
@@ -442,8 +488,8 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 			netGiven[netId][addrFilterNum[netId]] = false;
 			portGiven[netId][addrFilterNum[netId]] = true;
 		}
-		// Wrong input
-		else
+		// IPv6 network (addr/len) or IPv6 network and port ([addr]:port/len) is given, otherwise wrong input
+		else if (ParseIPv6Filter(netId, ipAndMaskB) == false)
 		{
 			throwJavaException("Staple Error: Wrong Net IP");
 			return;
@@ -460,12 +506,13 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 		return;
 	}
 	// Network IP addresses should not overlap
-	if ((addrFilterNum[0]>0) && (addrFilterNum[1]>0) &&
+	if ((addrFilterNum[0]>0) && (addrFilterNum[1]>0) && !netIsIPv6[0][0] && !netIsIPv6[1][0] &&
 			(netIP[0][0].data & netMask[0][0].data & netMask[1][0].data) == (netIP[1][0].data & netMask[0][0].data & netMask[1][0].data))
 	{
 		throwJavaException("Staple Error: Overlapping network addresses");
 		return;
 	}
+	CompileAddrFilters();
 
 	// Create logfile if necessary
 	std::ofstream logFile;
@@ -502,16 +549,42 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 	// Initialize the parser
 	Parser parser(*this);
 	parser.Init();
-	parser.perfmonTCPTAFile = &tcptafile;
-	parser.perfmonTCPTAPartialFile = &tcptapartialfile;
-	parser.perfmonFLVFile = &flvfile;
-	parser.perfmonFLVPartialFile = &flvpartialfile;
 
 	parser.hazelcastPublish = publishToHazelcast;
 	parser.writeToFile = writeOutputToFile;
 
+	// Launch perfmon logfile writer thread
+	PerfmonWriter perfmonWriter(*this);
+	perfmonWriter.Start();
+	parser.perfmonWriter = &perfmonWriter;
 
-	if (!noHTTP)
+	// The events are published in batches by the flush thread
+	EventChannel eventChannel;
+	if (publishToHazelcast) parser.eventChannel = &eventChannel;
+	// Read by the flush thread until it is joined
+	struct FlushThreadArgs flushThreadArgs = {*this, eventChannel, flushPeriod};
+
+
+	// The output dumpfile is written from the packet buffer of the reader
+	if ((parserThreads > 1) && outputDumpGiven)
+	{
+		throwJavaException("Staple Error: output dumpfile cannot be written with multiple parser threads.");
+		return;
+	}
+	// The output dumpfile and the debug log need the raw packet being parsed
+	if (pipelinedReader && (outputDumpGiven || (logLevel >= 5)))
+	{
+		throwJavaException("Staple Error: output dumpfile and debug logging cannot be used with the pipelined reader.");
+		return;
+	}
+
+	// Launch the parser threads (HTTP logs and counters are written by them)
+	ParserShards* pParserShards = NULL;
+	if (parserThreads > 1)
+	{
+		pParserShards = new ParserShards(*this, parser, parserThreads, !noHTTP);
+	}
+	else if (!noHTTP)
 	{
 		parser.setHTTPPageLog(true);
 		parser.setHTTPRequestLog(true);
@@ -520,78 +593,105 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 
 	pthread_t flushThread;
 	if (publishToHazelcast){
-		struct FlushThreadArgs flushThreadArgs = {*this, flushPeriod};
 		pthread_create(&flushThread, NULL, FlushThread, (void*) &flushThreadArgs);
 	}
 
-	// Launch perfmon logfile writer thread
-	pthread_t thread;
-	struct ThreadArgs t = {*this, parser};
-	pthread_create(&thread, NULL, ParserThreadLauncher, (void*) &t);
-
 	//Continue until no more to read from the file or
 	//a terminate request is received
+	// Launch the reader thread
+	PacketReader* pPacketReader = NULL;
+	if (pipelinedReader) pPacketReader = new PacketReader(*this);
+
 	while (!SHUTTING_DOWN)
 	{
-		// Delete last packet
-		if (pL2Packet != NULL) delete pL2Packet;
-		// Read next packet
-		pL2Packet = packetDumpFile.ReadPacket(&errorCode);
-		// Handle errors
-		if (errorCode == PacketDumpFile::ERROR_EOF)
+		if (pPacketReader != NULL)
 		{
-			// EOF: try to open next input file (if available)
-			errorCode = packetDumpFile.NextInputFile();
-			if (errorCode != PacketDumpFile::NO_ERROR)
-			{
-				// Cannot open next input file, stop execution
-				break;
-			}
-			else
+			// Read next packet (the reader thread takes care of the input files and the packets parsed)
+			pL2Packet = pPacketReader->ReadPacket();
+			if (pL2Packet == NULL) break;
+		}
+		else
+		{
+			// Release last packet
+			packetPool.Release(pL2Packet);
+			// Read next packet
+			pL2Packet = packetDumpFile.ReadPacket(&errorCode);
+			// Handle errors
+			if (errorCode == PacketDumpFile::ERROR_EOF)
 			{
-				// Successful open, continue reading packets
-				continue;
+				// EOF: try to open next input file (if available)
+				errorCode = packetDumpFile.NextInputFile();
+				if (errorCode != PacketDumpFile::NO_ERROR)
+				{
+					// Cannot open next input file, stop execution
+					break;
+				}
+				else
+				{
+					// Successful open, continue reading packets
+					continue;
+				}
 			}
+			if (errorCode == PacketDumpFile::ERROR_FORMAT) continue;
+			if (errorCode == PacketDumpFile::ERROR_L2_DUPLICATE) continue;
+			if (pL2Packet == NULL) continue;
 		}
-		if (errorCode == PacketDumpFile::ERROR_FORMAT) continue;
-		if (errorCode == PacketDumpFile::ERROR_L2_DUPLICATE) continue;
-		if (pL2Packet == NULL) continue;
 
 		// Parse the packet
-		parser.ParsePacket(pL2Packet);
+		if (pParserShards != NULL)
+		{
+			// The packet is deleted by its parser thread
+			pParserShards->Dispatch(pL2Packet);
+			if (pPacketReader != NULL) pPacketReader->Detach();
+			pL2Packet = NULL;
+		}
+		else
+		{
+			parser.ParsePacket(pL2Packet);
+		}
 	}
 
 	// TCPdump file processed
 	// ----------------------
 	// Finish ongoing connections
+	if (pParserShards != NULL) pParserShards->Finish();
 	parser.FinishConnections();
 
-	// Delete last packet
-	if (pL2Packet != NULL) delete pL2Packet;
+	// Release last packet (the packets of the reader thread are released by the reader)
+	if (pPacketReader != NULL)
+	{
+		delete pPacketReader;
+		pL2Packet = NULL;
+	}
+	packetPool.Release(pL2Packet);
 
 	// Print overall statistics
 	if (logLevel >= 1)
 	{
-		parser.PrintOverallStatistics(logStream);
+		if (pParserShards != NULL) pParserShards->PrintOverallStatistics(logStream);
+		else parser.PrintOverallStatistics(logStream);
 	}
 
-	if (!noHTTP) getCounterContainer()->writeToFile();
+	if (!noHTTP)
+	{
+		if (pParserShards != NULL) pParserShards->WriteCounters();
+		else getCounterContainer()->writeToFile();
+	}
+	delete pParserShards;
 
 	// Close output dump file
 	if (outputDumpGiven == true) packetDumpFile.CloseOutputFile();
 
-	// Terminate perfmon logfile writer thread
-	pthread_cancel(thread);
-	pthread_join(thread, 0);
 
-	// Terminate the Hazelcast flush thread
+	// Publish the remaining events and terminate the Hazelcast flush thread
 	if (publishToHazelcast){
-		pthread_cancel(flushThread);
+		eventChannel.stop();
 		pthread_join(flushThread, 0);
+		if (logLevel >= 1) logStream << "Event publisher stalls: " << eventChannel.producerStalls << " (parser waited for the flush thread)\n";
 	}
 
-	// Write and close final perfmon logfiles
-	writeLog(true);
+	// Write and close final perfmon logfiles, terminate perfmon logfile writer thread
+	perfmonWriter.Finish();
 
 	//Flush the Hazelcast buffer
 	StapleJniImpl::flush();
@@ -602,150 +702,50 @@ void StapleJniImpl::start(const char * ipAndMaskA, const char * ipAndMaskB, cons
 #endif
 }
 
-// Global function for launching Parser logfile writer thread
+// Global function for launching the Hazelcast flush thread
+// It publishes the event batches as they get full, and the rest of the events and flushes the cache every flushPeriod
 void* FlushThread(void* arg)
 {
 	struct FlushThreadArgs & args = *reinterpret_cast<struct FlushThreadArgs*>(arg);
 	StapleJniImpl& jniStaple = args.stapleJni;
-	int flushPeriod = args.flushPeriod;
+	EventChannel& eventChannel = args.eventChannel;
+	int flushPeriod = (args.flushPeriod > 0) ? args.flushPeriod : 1;
 	if (traceLevel>=3) std::cout << "FlushThread starting. This will attempt to flush the cache every " << flushPeriod <<" seconds....\n";
-	while (true)
-	{
-		//Flush the Hazelcast buffer
-		jniStaple.flush();
-		struct timespec s = {flushPeriod, 0};
-		nanosleep(&s, 0);
-	}
-	return NULL;
-}
 
-
-
-// Global function for launching Parser logfile writer thread
-void* ParserThreadLauncher(void* arg)
-{
-	struct ThreadArgs & args = *reinterpret_cast<struct ThreadArgs*>(arg);
-	StapleJniImpl& jniStaple = args.stapleJni;
-	Parser& parser = args.parser;//*reinterpret_cast<Parser*>(p_pParser);
-	if (traceLevel>=3) std::cout << "ParserThreadLauncher starting. This will create new outfiles every " << PERFMON_ROP <<" seconds....\n";
-	while (true)
-	{
-		// Close & recreate perfmon logfiles
-		pthread_mutex_lock(&parser.perfmonFileMutex);
-		jniStaple.writeLog(false);
-		pthread_mutex_unlock(&parser.perfmonFileMutex);
-		// Sleep until the next ROP
-		struct timeval actRealTime;
-		struct timezone tmpZone;
-		gettimeofday(&actRealTime,&tmpZone);
-		unsigned long secsToSleep = PERFMON_ROP*(jniStaple.lastPerfmonROP+1) - actRealTime.tv_sec;
-		unsigned long usecsPassed = actRealTime.tv_usec;
-		struct timespec s = {secsToSleep, 1000 * usecsPassed};
-		nanosleep(&s, 0);
+	// The thread stays attached to the JVM, and the batches are wrapped by Java buffers only once
+	JNIEnv* env = jniStaple.JNU_GetEnv();
+	jobject buffers[EVENT_BATCH_NUM];
+	for (int i=0; i<EVENT_BATCH_NUM; i++) {
+		jobject buffer = env->NewDirectByteBuffer(eventChannel.data(i), eventChannel.capacity());
+		buffers[i] = (buffer != NULL) ? env->NewGlobalRef(buffer) : NULL;
+		if (buffer != NULL) env->DeleteLocalRef(buffer);
 	}
-	return NULL;
-}
 
-// Close old perfmon logfiles, and create new ones (if necessary)
-void StapleJniImpl::writeLog(bool p_isFinal)
-{
-	struct timeval actRealTime;
-	struct timezone tmpZone;
-
-	// Prepare new (temporary) perfmon logfiles
-	char tcpta_tmp[1000];
-	sprintf(tcpta_tmp, "%s/tcpta%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-	char tcpta_partial_tmp[1000];
-	sprintf(tcpta_partial_tmp, "%s/tcpta-partial%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-	char flv_tmp[1000];
-	sprintf(flv_tmp, "%s/flv%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-	char flv_partial_tmp[1000];
-	sprintf(flv_partial_tmp, "%s/flv-partial%s.tmp",perfmonDirName.c_str(),perfmonLogPrefix.c_str());
-
-	// Initialize lastPerfmonROP
-	if (lastPerfmonROP==0)
-	{
-		gettimeofday(&actRealTime,&tmpZone);
-		lastPerfmonROP = actRealTime.tv_sec/PERFMON_ROP;
-	}
-	// Rename the old temporary log files to their final names (not in the first ROP)
-	else
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += flushPeriod;
+	while (true)
 	{
-		flvfile.close();
-		flvpartialfile.close();
-		tcptafile.close();
-		tcptapartialfile.close();
-
-		//Calculate the previous ROP Time
-		time_t previousRopTime = PERFMON_ROP*lastPerfmonROP;
-		struct tm * prevRopTime;
-		prevRopTime = gmtime ( &previousRopTime );
-		char prevTimeStamp[4];
-		sprintf(prevTimeStamp, "%02d%02d", prevRopTime->tm_hour, prevRopTime->tm_min);
-
-		//Increment the ROP counter
-		lastPerfmonROP++;
-
-		//Calculate the current ROP Time
-		time_t epochTime = PERFMON_ROP*lastPerfmonROP;
-		struct tm * ropTime;
-		ropTime = gmtime ( &epochTime );
-
-		//Create the Time stamp string in the format: A<year><month><day>.<previousRop HourMinute><currentRop HourMinute>
-		char fileTimeStamp[20];
-		sprintf(fileTimeStamp, "A%04d%02d%02d.%s-%02d%02d", (ropTime->tm_year+1900), (ropTime->tm_mon+1), ropTime->tm_mday, prevTimeStamp, ropTime->tm_hour, ropTime->tm_min);
-
-
-
-		// The file names contain timestamp
-		char tcpta_name[1000];
-		sprintf(tcpta_name, "%s/%s_staple_tcpta_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-		char tcpta_partial_name[1000];
-		sprintf(tcpta_partial_name, "%s/%s_staple_tcpta-partial_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-		char flv_name[1000];
-		sprintf(flv_name, "%s/%s_staple_flv_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
-		char flv_partial_name[1000];
-		sprintf(flv_partial_name, "%s/%s_staple_flv-partial_%i%s.log",perfmonDirName.c_str(), fileTimeStamp, epochTime, perfmonLogPrefix.c_str());
+		bool partial;
+		int batch = eventChannel.next(deadline, partial);
+		if (batch >= 0) {
+			jniStaple.publishEvents(env, buffers[batch], eventChannel.data(batch), eventChannel.size(batch));
+			eventChannel.release(batch);
+			// Full batches are published as they come until the flush period is over
+			if (!partial) continue;
+		}
+		// All the events are published
+		else if (eventChannel.stopped()) break;
 
-		rename(flv_tmp,flv_name);
-		rename(flv_partial_tmp,flv_partial_name);
-		rename(tcpta_tmp,tcpta_name);
-		rename(tcpta_partial_tmp,tcpta_partial_name);
+		//Flush the Hazelcast buffer and start the next flush period (even if more events are pending)
+		jniStaple.flush();
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += flushPeriod;
 	}
 
-	if (p_isFinal==false)
-	{
-		// Open the new (temporary) perfmon logfiles
-		flvfile.open(flv_tmp);
-		if (!flvfile.is_open())
-		{
-			printf("Error opening log file %s\n",strerror(errno));
-			return;
-		}
-		flvpartialfile.open(flv_partial_tmp);
-		if (!flvpartialfile.is_open())
-		{
-			printf("Error opening log file %s\n",strerror(errno));
-			return;
-		}
-		tcptafile.open(tcpta_tmp);
-		if (!tcptafile.is_open())
-		{
-			printf("Error opening log file %s\n",strerror(errno));
-			return;
-		}
-		tcptapartialfile.open(tcpta_partial_tmp);
-		if (!tcptapartialfile.is_open())
-		{
-			printf("Error opening log file %s\n",strerror(errno));
-			return;
-		}
+	for (int i=0; i<EVENT_BATCH_NUM; i++) {
+		if (buffers[i] != NULL) env->DeleteGlobalRef(buffers[i]);
 	}
+	jvm->DetachCurrentThread();
+	return NULL;
 }
-
-
-
-
-
-
-
@@ -0,0 +1,59 @@
+#include <staple/AddressFilter.h>
+
+AddressFilter::AddressFilter()
+{
+   Clear();
+}
+
+void AddressFilter::Clear()
+{
+   Entry empty = {0, NONE};
+   nodes.assign(1 << ADDRFILTER_STRIDE, empty);
+}
+
+void AddressFilter::AddPrefix(uint32_t p_IP, uint32_t p_mask, uint32_t p_filterId)
+{
+   uint8_t IP[4] = {(uint8_t)(p_IP >> 24), (uint8_t)(p_IP >> 16), (uint8_t)(p_IP >> 8), (uint8_t)p_IP};
+   AddPrefix(IP, __builtin_popcount(p_mask), p_filterId);
+}
+
+void AddressFilter::AddPrefix(const uint8_t* p_IP, unsigned short p_prefixLen, uint32_t p_filterId)
+{
+   // Walk (and build) the trie down to the level holding the last bits of the prefix
+   uint32_t node = 0;
+   unsigned short level = 0;
+   while (p_prefixLen > (level+1)*ADDRFILTER_STRIDE)
+   {
+      uint32_t slot = (node << ADDRFILTER_STRIDE) + Chunk(p_IP, level);
+      if (nodes[slot].child == 0)
+      {
+         // The new node inherits the filter of the entry it refines
+         uint32_t child = NodeNum();
+         Entry inherited = {0, nodes[slot].filterId};
+         nodes.resize(nodes.size() + (1 << ADDRFILTER_STRIDE), inherited);
+         nodes[slot].child = child;
+      }
+      node = nodes[slot].child;
+      level++;
+   }
+
+   // The prefix covers a range of entries in this node (the address bits after the prefix are ignored)
+   unsigned short freeBits = (level+1)*ADDRFILTER_STRIDE - p_prefixLen;
+   uint32_t first = Chunk(p_IP, level) & ~((1 << freeBits)-1);
+   for (uint32_t i = first; i < first + (1 << freeBits); i++)
+   {
+      SetFilter((node << ADDRFILTER_STRIDE) + i, p_filterId);
+   }
+}
+
+// Apply the filter to an entry and everything below it (unless a lower filter id covers them already)
+void AddressFilter::SetFilter(uint32_t p_slot, uint32_t p_filterId)
+{
+   if (nodes[p_slot].filterId > p_filterId) nodes[p_slot].filterId = p_filterId;
+   uint32_t child = nodes[p_slot].child;
+   if (child == 0) return;
+   for (uint32_t i = 0; i < (1 << ADDRFILTER_STRIDE); i++)
+   {
+      SetFilter((child << ADDRFILTER_STRIDE) + i, p_filterId);
+   }
+}
@@ -20,6 +20,7 @@ bool CircularBuffer::Extend(unsigned long p_size)
    pBuffer = pNewBuffer;
    size = p_size;
    firstSeqPos = 0;
+   return true;
 }
 
 void CircularBuffer::SetFirstSeq(unsigned long p_seq)
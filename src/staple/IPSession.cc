@@ -126,9 +126,9 @@ void IPSession::FinishChannelRateCalc(unsigned short direction, bool reset)
       {
          TCPConn& tcpConn = staple.tcpConnReg[(*tcpIndex).first];
          // Is there an ongoing transaction, which started earlier (or at the same time) than this channel rate measurement?
-         if ((tcpConn.ongoingTransaction[direction]==true) && (tcpConn.TAFirstIPByte[direction][direction] <= CRFirstByte[direction]))
+         if ((tcpConn.ongoingTransaction[direction]==true) && (tcpConn.History().TAFirstIPByte[direction][direction] <= CRFirstByte[direction]))
          {
-            TCPTransaction& tcpTA = tcpConn.transactionList[direction].back();
+            TCPTransaction& tcpTA = tcpConn.History().transactionList[direction].back();
             // Update the max. channel rate
             if (tcpTA.CRMaxTP < TP)
             {
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <arpa/inet.h>                                   // inet_ntop
+
+#include <staple/IPv6Registry.h>
+
+IPv6Registry ipv6Registry;
+
+IPv6Registry::IPv6Registry()
+{
+   pthread_mutex_init(&mutex, NULL);
+   pthread_mutex_init(&expiryMutex, NULL);
+   nextHandle = 1;
+   epoch = 0;
+}
+
+IPv6Registry::~IPv6Registry()
+{
+   pthread_mutex_destroy(&mutex);
+   pthread_mutex_destroy(&expiryMutex);
+}
+
+u_int32_t IPv6Registry::Intern(const u_int8_t* p_address)
+{
+   pthread_mutex_lock(&mutex);
+   u_int32_t handle = InternLocked(p_address, epoch);
+   pthread_mutex_unlock(&mutex);
+   return handle;
+}
+
+void IPv6Registry::Intern(const u_int8_t* p_srcAddress, const u_int8_t* p_dstAddress, u_int32_t& p_srcHandle, u_int32_t& p_dstHandle, time_t p_time)
+{
+   unsigned long seenEpoch = (unsigned long)p_time / STATUS_LOG_PERIOD;
+   pthread_mutex_lock(&mutex);
+   p_srcHandle = InternLocked(p_srcAddress, seenEpoch);
+   p_dstHandle = InternLocked(p_dstAddress, seenEpoch);
+   pthread_mutex_unlock(&mutex);
+}
+
+// The caller holds the mutex
+u_int32_t IPv6Registry::InternLocked(const u_int8_t* p_address, unsigned long p_epoch)
+{
+   IPv6Address address;
+   memcpy(address.byte, p_address, 16);
+   HandleMap::iterator index = handles.find(address);
+   if (index == handles.end())
+   {
+      Entry newEntry;
+      newEntry.handle = nextHandle++;
+      newEntry.lastEpoch = p_epoch;
+      index = handles.insert(std::make_pair(address, newEntry)).first;
+      addresses.insert(std::make_pair(newEntry.handle, address));
+   }
+   else
+   {
+      // The packets may be slightly out of order
+      if (p_epoch > index->second.lastEpoch) index->second.lastEpoch = p_epoch;
+   }
+   return index->second.handle;
+}
+
+bool IPv6Registry::Lookup(u_int32_t p_handle, IPv6Address& p_address)
+{
+   pthread_mutex_lock(&mutex);
+   AddressMap::iterator index = addresses.find(p_handle);
+   bool found = (index != addresses.end());
+   if (found) p_address = index->second;
+   pthread_mutex_unlock(&mutex);
+   return found;
+}
+
+void IPv6Registry::Expire(time_t p_time)
+{
+   // One thread expires at a time, the others have nothing to do (the epoch is advanced once per period)
+   if (pthread_mutex_trylock(&expiryMutex) != 0) return;
+   pthread_mutex_lock(&mutex);
+   unsigned long newEpoch = (unsigned long)p_time / STATUS_LOG_PERIOD;
+   bool due = (newEpoch > epoch);
+   if (due) epoch = newEpoch;
+   HandleMap::iterator index = handles.begin();
+   pthread_mutex_unlock(&mutex);
+   // Check the addresses in slices, releasing the mutex in between, so that a large table does not stall the
+   // decoders. The iterator stays valid meanwhile: inserting does not move the nodes, and only the thread holding
+   // expiryMutex erases.
+   const unsigned long maxAge = IPV6_ADDRESS_TIMEOUT/STATUS_LOG_PERIOD;
+   bool done = !due;
+   while (!done)
+   {
+      pthread_mutex_lock(&mutex);
+      for (unsigned long i=0;(i<IPV6_EXPIRY_SLICE) && (index != handles.end());i++)
+      {
+         HandleMap::iterator actIndex = index++;
+         Entry& entry = actIndex->second;
+         // The addresses interned without a time before the first expiry count from it
+         if (entry.lastEpoch == 0) entry.lastEpoch = epoch;
+         // (an address may have been seen later than the epoch, by a decoder ahead of the parser)
+         if (entry.lastEpoch + maxAge < epoch)
+         {
+            addresses.erase(entry.handle);
+            handles.erase(actIndex);
+         }
+      }
+      done = (index == handles.end());
+      pthread_mutex_unlock(&mutex);
+   }
+   pthread_mutex_unlock(&expiryMutex);
+}
+
+unsigned long IPv6Registry::AddressNum() const
+{
+   pthread_mutex_lock(&mutex);
+   unsigned long num = handles.size();
+   pthread_mutex_unlock(&mutex);
+   return num;
+}
+
+unsigned long long IPv6Registry::MemoryUsage() const
+{
+   pthread_mutex_lock(&mutex);
+   unsigned long long bytes = handles.MemoryUsage() + addresses.MemoryUsage();
+   pthread_mutex_unlock(&mutex);
+   return bytes;
+}
+
+const char* FormatIPAddress(char* p_buffer, u_int8_t p_IPVersion, const DoubleWord& p_IP)
+{
+   if (p_IPVersion != 6)
+   {
+      sprintf(p_buffer, "%u.%u.%u.%u", (unsigned)p_IP.byte[3], (unsigned)p_IP.byte[2], (unsigned)p_IP.byte[1], (unsigned)p_IP.byte[0]);
+      return p_buffer;
+   }
+   // IPv6 address (or its handle if it has already been forgotten)
+   IPv6Address address;
+   if (!ipv6Registry.Lookup(p_IP.data, address) || (inet_ntop(AF_INET6, address.byte, p_buffer, IP_ADDRESS_STRLEN) == NULL))
+   {
+      sprintf(p_buffer, "v6#%u", (unsigned)p_IP.data);
+   }
+   return p_buffer;
+}
+
+std::ostream& PrintIPAddress(std::ostream& outStream, u_int8_t p_IPVersion, const DoubleWord& p_IP)
+{
+   char buffer[IP_ADDRESS_STRLEN];
+   return (outStream << FormatIPAddress(buffer, p_IPVersion, p_IP));
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include <staple/L2DuplicateFilter.h>
+
+#include "Util.h"
+
+L2DuplicateFilter::L2DuplicateFilter()
+{
+   lookups = 0;
+   probes = 0;
+   evictions = 0;
+   records = NULL;
+   table = NULL;
+   storage = NULL;
+   lastHash = 0;
+   Clear();
+}
+
+L2DuplicateFilter::~L2DuplicateFilter()
+{
+   if (records != NULL) delete [] records;
+   if (table != NULL) delete [] table;
+   if (storage != NULL) delete [] storage;
+}
+
+void L2DuplicateFilter::Clear()
+{
+   recordHead = 0;
+   recordTail = 0;
+   storageTail = 0;
+   if (table != NULL) memset(table, 0, L2DUP_TABLE_SIZE*sizeof(uint32_t));
+}
+
+typedef uint64_t (*L2HashKernel)(const Byte*, unsigned long);
+
+// Multiplicative hash, 8 bytes at a time
+static uint64_t HashMultiplicative(const Byte* p_data, unsigned long p_len)
+{
+   uint64_t word;
+   unsigned long i = 0;
+   uint64_t hash = p_len;
+   for (;i+8<=p_len;i+=8)
+   {
+      memcpy(&word, p_data+i, 8);
+      hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 29;
+   }
+   if (i < p_len)
+   {
+      word = 0;
+      memcpy(&word, p_data+i, p_len-i);
+      hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+   }
+   return hash ^ (hash >> 32);
+}
+
+#if defined(__x86_64__)
+// Hardware CRC32C, 8 bytes at a time
+__attribute__((target("sse4.2")))
+static uint64_t HashCRC32C(const Byte* p_data, unsigned long p_len)
+{
+   uint64_t word;
+   unsigned long i = 0;
+   uint64_t crc = 0xffffffff;
+   for (;i+8<=p_len;i+=8)
+   {
+      memcpy(&word, p_data+i, 8);
+      crc = _mm_crc32_u64(crc, word);
+   }
+   for (;i<p_len;i++)
+   {
+      crc = _mm_crc32_u8((uint32_t)crc, p_data[i]);
+   }
+   return ((crc ^ 0xffffffff) * 0x9e3779b97f4a7c15ULL) ^ p_len;
+}
+#endif
+
+// Use the CRC32C instruction if the CPU supports it (the build does not need -msse4.2)
+static L2HashKernel SelectHashKernel()
+{
+#if defined(__x86_64__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse4.2")) return HashCRC32C;
+#endif
+   return HashMultiplicative;
+}
+
+static const L2HashKernel hashKernel = SelectHashKernel();
+
+uint64_t L2DuplicateFilter::Hash(const Byte* p_data, unsigned long p_len)
+{
+   return hashKernel(p_data, p_len);
+}
+
+L2DuplicateRecord* L2DuplicateFilter::Find(const Byte* p_data, unsigned long p_savedLen, unsigned long p_origLen)
+{
+   lookups++;
+   lastHash = Hash(p_data, p_savedLen);
+   if (table == NULL) return NULL;
+   for (unsigned long i = lastHash & (L2DUP_TABLE_SIZE-1); table[i] != 0; i = (i+1) & (L2DUP_TABLE_SIZE-1))
+   {
+      probes++;
+      L2DuplicateRecord& record = records[table[i]-1];
+      // Same hash, same original and saved length and same content?
+      if ((record.hash == lastHash) && (record.savedL2PacketLength == p_savedLen) && (record.origL2PacketLength == p_origLen) &&
+         (memcmp(storage + (record.storagePos & (L2DUP_STORAGE_SIZE-1)), p_data, p_savedLen) == 0))
+      {
+         return &record;
+      }
+   }
+   return NULL;
+}
+
+L2DuplicateRecord* L2DuplicateFilter::Insert(const Byte* p_data, unsigned long p_savedLen, unsigned long p_origLen, const struct timeval& p_time)
+{
+   // Allocate the rings and the table at the first use
+   if (records == NULL)
+   {
+      records = new L2DuplicateRecord[L2DUP_MAX_RECORDS];
+      table = new uint32_t[L2DUP_TABLE_SIZE];
+      storage = new Byte[L2DUP_STORAGE_SIZE];
+      memset(table, 0, L2DUP_TABLE_SIZE*sizeof(uint32_t));
+   }
+
+   // Make room in the record ring
+   if (recordTail - recordHead >= L2DUP_MAX_RECORDS)
+   {
+      RemoveOldest();
+      evictions++;
+   }
+   // Make room in the storage ring (the content of a frame is never wrapped)
+   unsigned long long pos = storageTail;
+   if ((pos & (L2DUP_STORAGE_SIZE-1)) + p_savedLen > L2DUP_STORAGE_SIZE)
+   {
+      pos += L2DUP_STORAGE_SIZE - (pos & (L2DUP_STORAGE_SIZE-1));
+   }
+   while ((recordHead < recordTail) && (pos + p_savedLen - records[recordHead % L2DUP_MAX_RECORDS].storagePos > L2DUP_STORAGE_SIZE))
+   {
+      RemoveOldest();
+      evictions++;
+   }
+
+   // Store the frame
+   unsigned long slot = recordTail % L2DUP_MAX_RECORDS;
+   L2DuplicateRecord& record = records[slot];
+   record.hash = lastHash;
+   record.storagePos = pos;
+   record.time = p_time;
+   record.savedL2PacketLength = p_savedLen;
+   record.origL2PacketLength = p_origLen;
+   record.dupCount = 0;
+   record.isIP = false;
+   memcpy(storage + (pos & (L2DUP_STORAGE_SIZE-1)), p_data, p_savedLen);
+   storageTail = pos + p_savedLen;
+   recordTail++;
+
+   // Index it (the table is twice as large as the record ring, so there is always an empty cell)
+   unsigned long i = lastHash & (L2DUP_TABLE_SIZE-1);
+   while (table[i] != 0) i = (i+1) & (L2DUP_TABLE_SIZE-1);
+   table[i] = slot+1;
+   return &record;
+}
+
+void L2DuplicateFilter::Expire(const struct timeval& p_time)
+{
+   while (recordHead < recordTail)
+   {
+      // Check oldest packet time
+      struct timeval timeDiff = AbsTimeDiff(records[recordHead % L2DUP_MAX_RECORDS].time, p_time);
+      double tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
+      // If packet timeouted -> remove it
+      if (tDiff > L2_DUPLICATE_TDIFF) RemoveOldest();
+      else break;
+   }
+}
+
+void L2DuplicateFilter::RemoveOldest()
+{
+   unsigned long slot = recordHead % L2DUP_MAX_RECORDS;
+   recordHead++;
+   // Find the table cell of the record
+   unsigned long i = records[slot].hash & (L2DUP_TABLE_SIZE-1);
+   while (table[i] != slot+1) i = (i+1) & (L2DUP_TABLE_SIZE-1);
+   // Backward shift deletion: move up the following cells that would not be found otherwise
+   unsigned long j = i;
+   while (true)
+   {
+      j = (j+1) & (L2DUP_TABLE_SIZE-1);
+      if (table[j] == 0) break;
+      unsigned long home = records[table[j]-1].hash & (L2DUP_TABLE_SIZE-1);
+      // Is the home cell cyclically outside of (i,j]?
+      bool move = (i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j));
+      if (move)
+      {
+         table[i] = table[j];
+         i = j;
+      }
+   }
+   table[i] = 0;
+}
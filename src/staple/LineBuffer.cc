@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+
+#include <staple/LineBuffer.h>
+
+// Decimal digits of 0..99
+static const char digitPairs[201] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+// Decimal text of the IPv4 address octets (built on first use)
+struct OctetTable {
+   char     text[256][4];
+   u_int8_t len[256];
+
+   OctetTable()
+   {
+      for (unsigned short i=0;i<256;i++) len[i] = sprintf(text[i], "%u", (unsigned) i);
+   }
+};
+static const OctetTable octetTable;
+
+// Above this the fixed-6 fast path could lose the exact rounding (the scaled value must have at least 10 fraction bits)
+static const long double FIXED6_FAST_LIMIT = 9007199254.740992L;
+
+// Write the decimal digits of the value right-aligned before p_end, return the position of the first digit
+static inline char* FormatDigits(char* p_end, unsigned long long p_value)
+{
+   char* pos = p_end;
+   while (p_value >= 100)
+   {
+      const char* pair = digitPairs + 2*(p_value % 100);
+      p_value /= 100;
+      *--pos = pair[1];
+      *--pos = pair[0];
+   }
+   if (p_value >= 10)
+   {
+      const char* pair = digitPairs + 2*p_value;
+      *--pos = pair[1];
+      *--pos = pair[0];
+   }
+   else
+   {
+      *--pos = '0' + p_value;
+   }
+   return pos;
+}
+
+LineBuffer::LineBuffer() : len(0), capacity(LINEBUFFER_SIZE)
+{
+   buffer = (char*) malloc(capacity);
+}
+
+LineBuffer::~LineBuffer()
+{
+   free(buffer);
+}
+
+void LineBuffer::Grow(unsigned long p_size)
+{
+   while (capacity < p_size) capacity *= 2;
+   buffer = (char*) realloc(buffer, capacity);
+}
+
+LineBuffer& LineBuffer::operator<<(const char* p_str)
+{
+   return Append(p_str, strlen(p_str));
+}
+
+LineBuffer& LineBuffer::AppendUnsigned(unsigned long long p_value)
+{
+   char digits[24];
+   char* first = FormatDigits(digits + sizeof(digits), p_value);
+   return Append(first, digits + sizeof(digits) - first);
+}
+
+LineBuffer& LineBuffer::AppendSigned(long long p_value)
+{
+   if (p_value >= 0) return AppendUnsigned(p_value);
+   *this << '-';
+   return AppendUnsigned(0 - (unsigned long long) p_value);
+}
+
+LineBuffer& LineBuffer::AppendFixed6(long double p_value)
+{
+   // Fast path: the value is scaled to integer microunits, which is exact unless the scaled value is (nearly) halfway
+   // between two integers (negative values, NaN and infinity are left to printf as well)
+   if (!std::signbit(p_value) && (p_value < FIXED6_FAST_LIMIT))
+   {
+      long double scaled = p_value * 1000000.0L;
+      unsigned long long rounded = (unsigned long long) (scaled + 0.5L);
+      long double error = scaled - (long double) rounded;
+      if ((error < 0.499L) && (error > -0.499L))
+      {
+         char digits[32];
+         char* end = digits + sizeof(digits);
+         char* first = FormatDigits(end - 7, rounded / 1000000);
+         unsigned long fraction = rounded % 1000000;
+         end[-7] = '.';
+         const char* pair = digitPairs + 2*(fraction % 100);
+         end[-1] = pair[1]; end[-2] = pair[0];
+         pair = digitPairs + 2*((fraction / 100) % 100);
+         end[-3] = pair[1]; end[-4] = pair[0];
+         pair = digitPairs + 2*(fraction / 10000);
+         end[-5] = pair[1]; end[-6] = pair[0];
+         return Append(first, end - first);
+      }
+   }
+   char text[64];
+   int textLen = snprintf(text, sizeof(text), "%.6Lf", p_value);
+   if ((textLen < 0) || (textLen >= (int) sizeof(text)))
+   {
+      // Huge value: format it to its own buffer
+      char* pText = NULL;
+      textLen = asprintf(&pText, "%.6Lf", p_value);
+      if (textLen > 0) Append(pText, textLen);
+      free(pText);
+      return *this;
+   }
+   return Append(text, textLen);
+}
+
+LineBuffer& LineBuffer::AppendIPAddress(u_int8_t p_IPVersion, const DoubleWord& p_IP)
+{
+   if (p_IPVersion != 6)
+   {
+      char* pos = Reserve(4*4);
+      for (short i=3;i>=0;i--)
+      {
+         u_int8_t octet = p_IP.byte[i];
+         memcpy(pos, octetTable.text[octet], 4);
+         pos += octetTable.len[octet];
+         *pos++ = '.';
+      }
+      len = pos - 1 - buffer;
+      return *this;
+   }
+   char text[IP_ADDRESS_STRLEN];
+   return *this << FormatIPAddress(text, p_IPVersion, p_IP);
+}
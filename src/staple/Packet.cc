@@ -8,7 +8,8 @@
 
 L3Packet::~L3Packet()
 {
-   if (payload != NULL) delete [] payload;
+   if ((payload != NULL) && !SlabPayload()) delete [] payload;
+   if (payloadSlab != NULL) payloadSlab->Unref();
    // Make sure that L2Packet::~L2Packet doesn't try to delete us
    if (pL2Packet)
    {
@@ -71,18 +72,16 @@ void IPPacket :: Print(std::ostream& outStream) const
    DoubleWord netBIP = (direction == 0) ? dstIP : srcIP;
 
    // NetA IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netAIP.byte[3],(unsigned)netAIP.byte[2],(unsigned)netAIP.byte[1],(unsigned)netAIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netAIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString;
 
    // Direction
    outStream << ((direction == 0) ? " -> " : " <- ");
 
    // NetB IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netBIP.byte[3],(unsigned)netBIP.byte[2],(unsigned)netBIP.byte[1],(unsigned)netBIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netBIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString;
 
    outStream << " IPPktLen " << IPPktLen << " IPId " << IPId;
@@ -107,9 +106,8 @@ void TCPPacket :: Print(std::ostream& outStream) const
    unsigned short netBPort = (direction == 0) ? dstPort : srcPort;
 
    // NetA IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netAIP.byte[3],(unsigned)netAIP.byte[2],(unsigned)netAIP.byte[1],(unsigned)netAIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netAIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString << ":";
 
    // NetA port
@@ -121,9 +119,8 @@ void TCPPacket :: Print(std::ostream& outStream) const
    outStream << ((direction == 0) ? " -> " : " <- ");
 
    // NetB IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netBIP.byte[3],(unsigned)netBIP.byte[2],(unsigned)netBIP.byte[1],(unsigned)netBIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netBIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString << ":";
 
    // NetB Port
@@ -169,9 +166,8 @@ void UDPPacket :: Print(std::ostream& outStream) const
    unsigned short netBPort = (direction == 0) ? dstPort : srcPort;
 
    // NetA IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netAIP.byte[3],(unsigned)netAIP.byte[2],(unsigned)netAIP.byte[1],(unsigned)netAIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netAIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString << ":";
 
    // NetA port
@@ -183,9 +179,8 @@ void UDPPacket :: Print(std::ostream& outStream) const
    outStream << ((direction == 0) ? " -> " : " <- ");
 
    // NetB IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netBIP.byte[3],(unsigned)netBIP.byte[2],(unsigned)netBIP.byte[1],(unsigned)netBIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netBIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString << ":";
 
    // NetB Port
@@ -210,18 +205,16 @@ void ICMPPacket :: Print(std::ostream& outStream) const
    DoubleWord netBIP = (direction == 0) ? dstIP : srcIP;
 
    // NetA IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netAIP.byte[3],(unsigned)netAIP.byte[2],(unsigned)netAIP.byte[1],(unsigned)netAIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netAIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString;
 
    // Direction
    outStream << ((direction == 0) ? " -> " : " <- ");
 
    // NetB IP
-   sprintf((char*)&tmpBuff,"%hu.%hu.%hu.%hu",(unsigned)netBIP.byte[3],(unsigned)netBIP.byte[2],(unsigned)netBIP.byte[1],(unsigned)netBIP.byte[0]);
-   tmpString = (const char *)&tmpBuff;
-   tmpString.append(15-tmpString.size(),' ');
+   tmpString = FormatIPAddress((char*)&tmpBuff, IPVersion, netBIP);
+   if (tmpString.size() < 15) tmpString.append(15-tmpString.size(),' ');
    outStream << tmpString;
 
    outStream << " ICMP";
@@ -1,5 +1,8 @@
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <dirent.h>
 
 #include <string>
@@ -8,11 +11,10 @@
 #include <staple/Staple.h>
 #include <staple/Type.h>
 #include <staple/PacketDumpFile.h>
+#include <staple/IPv6Registry.h>
 
 #include "Util.h"
 
-char tmpBuffer[MAX_PACKETLENGTH];                        // Temporay storage at file read
-unsigned long crcTable[256];                             // Data structure for fast CRC-32 calculation of L2 packets
 
 PacketDumpFile::ErrorCode PacketDumpFile::CreateInputFileList(char *p_fileName)
 {
@@ -71,8 +73,8 @@ PacketDumpFile::ErrorCode PacketDumpFile::CreateInputFileList(char *p_fileName)
                newFile.firstPacketTime = pL2Packet->time;
                // Append to the file list
                inputFileList.push_back(newFile);
-               // Delete packet
-               delete pL2Packet;
+               // Release packet
+               staple.packetPool.Release(pL2Packet);
             }
             // Close packet dump file
             tmpDumpFile.CloseInputFile();
@@ -136,33 +138,70 @@ PacketDumpFile::ErrorCode PacketDumpFile::NextInputFile()
    return errorCode;
 }
 
+PacketDumpFile::PacketDumpFile(Staple& s)
+ : pPacketsDuplicated(s.packetsDuplicated), pIPPacketsDuplicated(s.ipStats.packetsDuplicated), staple(s)
+{
+   inFile = NULL;
+   inMap = NULL;
+   inMapSize = 0;
+   inBlock = NULL;
+   inData = NULL;
+   inDataLen = 0;
+   inDataPos = 0;
+   inDataOffset = 0;
+   packetData = NULL;
+   outFile = NULL;
+}
+
 PacketDumpFile::~PacketDumpFile()
 {
-   // Free up allocated L2 packet memory
-   // ----------------------------------
-   std::multimap<unsigned long, L2RawPacket>::iterator regIndex;
-   while (!l2RawPacketList.empty())
-   {
-      // Find packet in the registry
-      regIndex = l2RawPacketList.front().regIndex;
-      // Free up memory allocated for the L2 packet
-      delete (*regIndex).second.data;
-      // Erase element both from registry & list
-      l2RawPacketReg.erase(regIndex);
-      l2RawPacketList.pop_front();
-   }
+   CloseInputFile();
+   if (inBlock != NULL) delete [] inBlock;
 }
 
 PacketDumpFile::ErrorCode PacketDumpFile::OpenInputFile(char *p_fileName)
 {
-   // Init L2 packet registry and list (for L2 duplicate packet filtering)
-   l2RawPacketReg.clear();
-   l2RawPacketList.clear();
+   // Init L2 packet registry (for L2 duplicate packet filtering)
+   l2DuplicateFilter.Clear();
+
+   // Init input reader
+   inData = NULL;
+   inDataLen = 0;
+   inDataPos = 0;
+   inDataOffset = 0;
+   packetData = NULL;
 
    // Normal file
    if (p_fileName != 0)
    {
-      inFile = gzopen(p_fileName,"rb");
+      int fd = open(p_fileName, O_RDONLY);
+      if (fd < 0) return ERROR_OPEN;
+      // Uncompressed regular files are mapped into the memory (packets are read without any copy or system call)
+      struct stat statres;
+      Byte magic[2];
+      if ((fstat(fd, &statres) == 0) && S_ISREG(statres.st_mode) && (statres.st_size > 0) &&
+         (pread(fd, magic, 2, 0) == 2) && !((magic[0] == 0x1f) && (magic[1] == 0x8b)))
+      {
+         void* pMap = mmap(NULL, statres.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (pMap != MAP_FAILED)
+         {
+            madvise(pMap, statres.st_size, MADV_SEQUENTIAL);
+            inMap = (Byte*)pMap;
+            inMapSize = statres.st_size;
+            inData = inMap;
+            inDataLen = inMapSize;
+         }
+      }
+      // Gzip (or non-mappable) files are read through zlib
+      if (inMap != NULL)
+      {
+         close(fd);
+      }
+      else
+      {
+         inFile = gzdopen(fd,"rb");
+         if (inFile == NULL) close(fd);
+      }
    }
    // STDIN
    else
@@ -173,12 +212,24 @@ PacketDumpFile::ErrorCode PacketDumpFile::OpenInputFile(char *p_fileName)
    }
 
    // File open error
-   if (inFile == NULL) return ERROR_OPEN;
+   if ((inFile == NULL) && (inMap == NULL)) return ERROR_OPEN;
+
+   // Data read through zlib is decompressed block-wise
+   if (inFile != NULL)
+   {
+#if ZLIB_VERNUM >= 0x1240
+      gzbuffer(inFile, INPUT_BLOCK_SIZE/4);
+#endif
+      if (inBlock == NULL) inBlock = new Byte[INPUT_BLOCK_SIZE];
+      inData = inBlock;
+   }
+   if (staple.logLevel>=5) staple.logStream << "Reading input dump file " << ((inMap != NULL) ? "mapped into memory" : "block-wise through zlib") << ".\n";
 
    // Read dumpfile header
    DoubleWord tmpDoubleWord;
    Word tmpWord;
-   if (gzread(inFile,tmpBuffer,24)<=0) return ERROR_EOF;
+   const Byte* tmpBuffer = ReadInput(24);
+   if (tmpBuffer == NULL) return ERROR_EOF;
 
    // Determine byte order based on "magic number"
    byteOrderChange = 0;
@@ -283,73 +334,74 @@ PacketDumpFile::ErrorCode PacketDumpFile::OpenInputFile(char *p_fileName)
       }
    }
 
-   // Initialize CRC32 table for L2 duplicate packet detection
-   unsigned long crc, poly;
-   poly = 0xedb88320;
-   for (int i=0;i<256;i++)
+   return NO_ERROR;
+}
+
+const Byte* PacketDumpFile::ReadInput(unsigned long p_len)
+{
+   if ((inDataLen-inDataPos) < p_len)
    {
-      crc=i;
-      for (int j=8;j>0;j--)
+      // End of the mapped file (or no file opened at all)
+      if (inFile == NULL) return NULL;
+      // Larger than any valid record
+      if (p_len > INPUT_BLOCK_SIZE) return NULL;
+      // Move the unread bytes to the beginning of the block and fill up the rest of it
+      unsigned long unread = inDataLen-inDataPos;
+      memmove(inBlock, inBlock+inDataPos, unread);
+      inDataOffset += inDataPos;
+      inDataPos = 0;
+      inDataLen = unread;
+      while (inDataLen < p_len)
       {
-         if (crc&1)
-         {
-            crc = (crc>>1)^poly;
-         }
-         else
-         {
-            crc >>= 1;
-         }
+         int readLen = gzread(inFile, inBlock+inDataLen, INPUT_BLOCK_SIZE-inDataLen);
+         if (readLen <= 0) return NULL;
+         inDataLen += readLen;
       }
-      crcTable[i] = crc;
    }
-
-   return NO_ERROR;
+   const Byte* pData = inData+inDataPos;
+   inDataPos += p_len;
+   return pData;
 }
 
 L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
 {
    // Read dump header
    // ----------------
-   if (gzread(inFile,tmpBuffer,16)<=0)
+   const Byte* tmpBuffer = ReadInput(16);
+   if (tmpBuffer == NULL)
    {
       // End of file reached (or other read error)
       *p_pErrorCode = ERROR_EOF;
       return NULL;
    }
  
-   Word tmpWord;
-   DoubleWord tmpDoubleWord;
-   if (staple.logLevel>=5) staple.logStream << "Reading packet from dump file at position " << gztell(inFile) << "\n";
+   if (staple.logLevel>=5) staple.logStream << "Reading packet from dump file at position " << InputPosition() << "\n";
 
    // Read capture time (byte order and platform dependency check TBD)
+   // (byteOrderChange selects the bytes like byteOrderPlatform: the fields are big endian if it equals HOST_LITTLE_ENDIAN)
    struct timeval time;
-   tmpDoubleWord.byte[3*byteOrderChange] = tmpBuffer[0];
-   tmpDoubleWord.byte[1+byteOrderChange] = tmpBuffer[1];
-   tmpDoubleWord.byte[2-byteOrderChange] = tmpBuffer[2];
-   tmpDoubleWord.byte[3*(1-byteOrderChange)] = tmpBuffer[3];
-   time.tv_sec = tmpDoubleWord.data;
-   tmpDoubleWord.byte[3*byteOrderChange] = tmpBuffer[4];
-   tmpDoubleWord.byte[1+byteOrderChange] = tmpBuffer[5];
-   tmpDoubleWord.byte[2-byteOrderChange] = tmpBuffer[6];
-   tmpDoubleWord.byte[3*(1-byteOrderChange)] = tmpBuffer[7];
-   time.tv_usec = tmpDoubleWord.data;
-   // Read saved & original link layer packet length
-   tmpDoubleWord.byte[3*byteOrderChange] = tmpBuffer[8];
-   tmpDoubleWord.byte[1+byteOrderChange] = tmpBuffer[9];
-   tmpDoubleWord.byte[2-byteOrderChange] = tmpBuffer[10];
-   tmpDoubleWord.byte[3*(1-byteOrderChange)] = tmpBuffer[11];
-   savedL2PacketLength = tmpDoubleWord.data;
-   tmpDoubleWord.byte[3*byteOrderChange] = tmpBuffer[12];
-   tmpDoubleWord.byte[1+byteOrderChange] = tmpBuffer[13];
-   tmpDoubleWord.byte[2-byteOrderChange] = tmpBuffer[14];
-   tmpDoubleWord.byte[3*(1-byteOrderChange)] = tmpBuffer[15];
-   origL2PacketLength = tmpDoubleWord.data;
+   if (byteOrderChange == HOST_LITTLE_ENDIAN)
+   {
+      time.tv_sec = Load32<true>(&tmpBuffer[0]);
+      time.tv_usec = Load32<true>(&tmpBuffer[4]);
+      // Read saved & original link layer packet length
+      savedL2PacketLength = Load32<true>(&tmpBuffer[8]);
+      origL2PacketLength = Load32<true>(&tmpBuffer[12]);
+   }
+   else
+   {
+      time.tv_sec = Load32<false>(&tmpBuffer[0]);
+      time.tv_usec = Load32<false>(&tmpBuffer[4]);
+      // Read saved & original link layer packet length
+      savedL2PacketLength = Load32<false>(&tmpBuffer[8]);
+      origL2PacketLength = Load32<false>(&tmpBuffer[12]);
+   }
    if (staple.logLevel>=5) staple.logStream << "Link layer packet length is " << origL2PacketLength << " (" << savedL2PacketLength << " dumped) bytes.\n";
 
    // Kuznetsov's HACK
    if (modifiedFormat == true)
    {
-      if (gzread(inFile,tmpBuffer,8)<=0)
+      if (ReadInput(8) == NULL)
       {
          // End of file reached (or other read error)
          *p_pErrorCode = ERROR_EOF;
@@ -359,94 +411,47 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
 
    // L2 duplicate packet list length enforcement
    // -------------------------------------------
-   while ((!l2RawPacketList.empty()) && staple.ignoreL2Duplicates)
-   {
-      // Check oldest packet time
-      struct timeval timeDiff = AbsTimeDiff(l2RawPacketList.front().time, time);
-      double tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
-      // If packet timeouted -> remove it
-      if (tDiff > L2_DUPLICATE_TDIFF)
-      {
-         // Find it in the registry too
-         std::multimap<unsigned long, L2RawPacket>::iterator regIndex = l2RawPacketList.front().regIndex;
-         // Free up memory allocated for the L2 packet
-         delete (*regIndex).second.data;
-         // Erase element both from registry & list
-         l2RawPacketReg.erase(regIndex);
-         l2RawPacketList.pop_front();
-      }
-      else break;
-   }
+   if (staple.ignoreL2Duplicates) l2DuplicateFilter.Expire(time);
 
    // Read raw L2 packet (network byte order)
    // ---------------------------------------
    // Access to the possible new L2 packet in the registry (for future use after storage, e.g. for isIP decision)
-   std::multimap<unsigned long, L2RawPacket>::iterator newL2RawPacketIndex;
+   L2DuplicateRecord* pNewL2Record = NULL;
 
-   // Read L2 packet
-   if (gzread(inFile,tmpBuffer,savedL2PacketLength)<=0)
+   // Read L2 packet (the data is not copied: it stays valid until the next read)
+   tmpBuffer = ReadInput(savedL2PacketLength);
+   if (tmpBuffer == NULL)
    {
       // End of file reached (or other read error)
       *p_pErrorCode = ERROR_EOF;
       return NULL;
    }
+   packetData = tmpBuffer;
 
-   // Calculate L2 CRC32 and detect duplicates
-   // ----------------------------------------
+   // Detect duplicates
+   // -----------------
    bool found = false;
    if (staple.ignoreL2Duplicates)
    {
-      unsigned long crc=0xffffffff;
-      for (int i=0;i<savedL2PacketLength;i++)
-      {
-         crc = ((crc>>8) & 0x00ffffff) ^ crcTable[(crc^tmpBuffer[i]) & 0xff];
-      }
-      crc ^= 0xffffffff;
       // Try to find the packet in the L2 duplicate registry
-      std::multimap<unsigned long, L2RawPacket>::iterator oldL2RawPacketIndex;
-      std::multimap<unsigned long, L2RawPacket>::iterator index = l2RawPacketReg.find(crc);
-      // Found the same CRC
-      if (index != l2RawPacketReg.end())
-      {
-         // Check all the packets with the same CRC 
-         while ((*index).first==crc)
-         {
-            // Same original and saved length?
-            L2RawPacket& oldL2RawPacket = (*index).second;
-            if ((origL2PacketLength == oldL2RawPacket.origL2PacketLength) && (savedL2PacketLength == oldL2RawPacket.savedL2PacketLength))
-            {
-               // Same content?
-               if (memcmp((char*)tmpBuffer,(char*)oldL2RawPacket.data,savedL2PacketLength) == 0)
-               {
-                  // Packet found -> L2 duplicate
-                  found=true;
-                  oldL2RawPacketIndex=index;
-                  break;
-               }
-            }
-            // Not the same, check the next packet (if there is any)
-            index++;
-            if (index == l2RawPacketReg.end()) break;
-         }
-      }
+      L2DuplicateRecord* pOldL2Record = l2DuplicateFilter.Find(tmpBuffer, savedL2PacketLength, origL2PacketLength);
+      found = (pOldL2Record != NULL);
    
       if (found == true)
       {
-         // Duplicated packet -> get reference to the old L2 packet
-         L2RawPacket& oldL2RawPacket = (*oldL2RawPacketIndex).second;
-         // Increase its dupCount
-         oldL2RawPacket.dupCount++;
+         // Duplicated packet -> increase the dupCount of the old L2 packet
+         pOldL2Record->dupCount++;
          // Update statistics
-         staple.packetsDuplicated[(oldL2RawPacket.dupCount<DUPSTATS_MAX) ? oldL2RawPacket.dupCount : DUPSTATS_MAX]++;
-         if (oldL2RawPacket.isIP == true)
+         pPacketsDuplicated[(pOldL2Record->dupCount<DUPSTATS_MAX) ? pOldL2Record->dupCount : DUPSTATS_MAX]++;
+         if (pOldL2Record->isIP == true)
          {
-            staple.ipStats.packetsDuplicated[(oldL2RawPacket.dupCount<DUPSTATS_MAX) ? oldL2RawPacket.dupCount : DUPSTATS_MAX]++;
+            pIPPacketsDuplicated[(pOldL2Record->dupCount<DUPSTATS_MAX) ? pOldL2Record->dupCount : DUPSTATS_MAX]++;
          }
          // All, or every second duplicate will be ignored
-         if (((oldL2RawPacket.dupCount&1) == 1) || (DECODE_EVERY_SECOND_L2_DUPLICATE == false))
+         if (((pOldL2Record->dupCount&1) == 1) || (DECODE_EVERY_SECOND_L2_DUPLICATE == false))
          {
             // Return with error
-            if (staple.logLevel>=5) staple.logStream << "L2 duplicate detected (packet ignored) at " << gztell(inFile) << "\n";
+            if (staple.logLevel>=5) staple.logStream << "L2 duplicate detected (packet ignored) at " << InputPosition() << "\n";
    
             *p_pErrorCode = ERROR_L2_DUPLICATE;
             return NULL;
@@ -454,24 +459,10 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
       }
       else
       {
-         // Non-duplicated (new) packet -> create L2 packet
-         L2RawPacket l2RawPacket;
-         l2RawPacket.origL2PacketLength = origL2PacketLength;
-         l2RawPacket.savedL2PacketLength = savedL2PacketLength;
-         l2RawPacket.data = new Byte[savedL2PacketLength];
-         memcpy(l2RawPacket.data,tmpBuffer,savedL2PacketLength);
-         // Add L2 packet to the map
-         std::multimap<unsigned long, L2RawPacket>::iterator index = l2RawPacketReg.insert(std::make_pair(crc,l2RawPacket));
-         // Enable future access of the newly stored packet (e.g., for isIP decision during decoding)
-         newL2RawPacketIndex = index;
-         // Create list entry
-         L2RawPacketListEntry l2RawPacketListEntry;
-         l2RawPacketListEntry.time = time;
-         l2RawPacketListEntry.regIndex = index;
-         // Add it to the end of the list
-         l2RawPacketList.push_back(l2RawPacketListEntry);
+         // Non-duplicated (new) packet -> store it (enable future access for the isIP decision during decoding)
+         pNewL2Record = l2DuplicateFilter.Insert(tmpBuffer, savedL2PacketLength, origL2PacketLength, time);
          // Update statistics
-         staple.packetsDuplicated[0]++;
+         pPacketsDuplicated[0]++;
       }
    }
 
@@ -482,6 +473,8 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
 
    unsigned short actPos = 0;
    bool isIP = true;
+   unsigned short typeLen;
+   bool networkOrder = (staple.byteOrderPlatform == HOST_LITTLE_ENDIAN);   // True if the header fields are read as big endian words
 
    switch (linkType)
    {
@@ -490,8 +483,7 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
       case LINKTYPE_ETH:
       {
          // Allocate Ethernet return packet
-         EthernetPacket* pEthernetPacket = new EthernetPacket(staple);
-         pEthernetPacket->Init();
+         EthernetPacket* pEthernetPacket = staple.packetPool.NewEthernetPacket();
    
          // Read source & dest MAC addresses
          memcpy(pEthernetPacket->dstMAC.addr,&tmpBuffer[actPos],6);
@@ -499,26 +491,43 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
          actPos += 12;
    
          // Read Type/Length
-         tmpWord.byte[staple.byteOrderPlatform] = tmpBuffer[actPos++];
-         tmpWord.byte[1 - staple.byteOrderPlatform] = tmpBuffer[actPos++];
+         typeLen = networkOrder ? Load16<true>(&tmpBuffer[actPos]) : Load16<false>(&tmpBuffer[actPos]);
+         actPos += 2;
    
-         // VLAN frame?
+         // VLAN frame? (802.1Q, or stacked QinQ tags: 802.1ad and the legacy 0x9100; the outer VLAN is kept)
          short VLANId = -1;
-         if (tmpWord.data == 0x8100)
+         unsigned short VLANTagNum = 0;
+         while (((typeLen == 0x8100) || (typeLen == 0x88a8) || (typeLen == 0x9100)) && (actPos+4u <= savedL2PacketLength))
          {
             // Read additional VLAN tag
-            tmpWord.byte[staple.byteOrderPlatform] = tmpBuffer[actPos++];
-            tmpWord.byte[1 - staple.byteOrderPlatform] = tmpBuffer[actPos++];
-            VLANId = tmpWord.data&0x0fff;
+            unsigned short VLANTag = networkOrder ? Load16<true>(&tmpBuffer[actPos]) : Load16<false>(&tmpBuffer[actPos]);
+            actPos += 2;
+            if (VLANId == -1) VLANId = VLANTag&0x0fff;
+            VLANTagNum++;
    
             // Read Type/Length
-            tmpWord.byte[staple.byteOrderPlatform] = tmpBuffer[actPos++];
-            tmpWord.byte[1 - staple.byteOrderPlatform] = tmpBuffer[actPos++];
+            typeLen = networkOrder ? Load16<true>(&tmpBuffer[actPos]) : Load16<false>(&tmpBuffer[actPos]);
+            actPos += 2;
          }
          pEthernetPacket->VLANId = VLANId;
+         if (VLANTagNum > 1) staple.packetsVLANStacked++;
+
+         // MPLS frame? (the label stack is skipped; the payload type is not signalled, IP is recognized by its version)
+         if ((typeLen == 0x8847) || (typeLen == 0x8848))
+         {
+            bool bottomOfStack = false;
+            while ((bottomOfStack == false) && (actPos+4u <= savedL2PacketLength))
+            {
+               bottomOfStack = ((tmpBuffer[actPos+2]&0x01) != 0);
+               actPos += 4;
+            }
+            Byte IPVersion = (actPos < savedL2PacketLength) ? (tmpBuffer[actPos]>>4) : 0;
+            typeLen = (IPVersion == 4) ? 0x0800 : ((IPVersion == 6) ? 0x86dd : 0);
+            staple.packetsMPLS++;
+         }
    
          // Non-IP packet?
-         if (tmpWord.data != 0x0800) isIP=false;
+         if ((typeLen != 0x0800) && (typeLen != 0x86dd)) isIP=false;
 
          // Assign return packet
          pL2Packet = (L2Packet*)pEthernetPacket;
@@ -532,11 +541,11 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
          actPos += 3;
    
          // Read protocol
-         tmpWord.byte[staple.byteOrderPlatform] = tmpBuffer[actPos++];
-         tmpWord.byte[1 - staple.byteOrderPlatform] = tmpBuffer[actPos++];
+         typeLen = networkOrder ? Load16<true>(&tmpBuffer[actPos]) : Load16<false>(&tmpBuffer[actPos]);
+         actPos += 2;
 
          // Non-IP packet?
-         if (tmpWord.data != 0x0021) isIP=false;
+         if ((typeLen != 0x0021) && (typeLen != 0x0057)) isIP=false;
          // NO BREAK!!! (to build the default return packet)
       }
       // Build the default L2 return packet
@@ -544,8 +553,7 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
       default:
       {
          // Allocate the default L2 return packet
-         pL2Packet = new L2Packet(staple);
-         pL2Packet->Init();
+         pL2Packet = staple.packetPool.NewL2Packet();
          break;
       }
    }
@@ -556,8 +564,8 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
    // If new L2 packet was created & it is an IP packet -> set IP flag & update IP duplicate statistics
    if (staple.ignoreL2Duplicates && (found == false) && (isIP == true))
    {
-      (*newL2RawPacketIndex).second.isIP = true;
-      staple.ipStats.packetsDuplicated[0]++;
+      pNewL2Record->isIP = true;
+      pIPPacketsDuplicated[0]++;
    }
 
    // Decode L3 packet and embed it into the L2 return packet
@@ -570,7 +578,7 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
    if (isIP==true)
    {
       // Embed L3 packet into the L2 packet
-      pL2Packet->pL3Packet = DecodeIPPacket((char*)&tmpBuffer[actPos], savedL3PacketLength, staple);
+      pL2Packet->pL3Packet = DecodeIPPacket((char*)&tmpBuffer[actPos], savedL3PacketLength, time.tv_sec, staple);
       if (pL2Packet->pL3Packet) pL2Packet->pL3Packet->pL2Packet = pL2Packet;
 
       // Overwrite direction & match info (only for ethernet packets, if we have the switch MAC addresses specified)
@@ -626,100 +634,170 @@ L2Packet* PacketDumpFile::ReadPacket(ErrorCode* p_pErrorCode)
    return pL2Packet;
 }
 
-// GLOBAL function for decoding IP packets (TODO: inheritance)
-L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
+// IP packet decoder reading the fields as big (BIG = true) or little endian words
+template <bool BIG>
+static L3Packet* DecodeIPPacketFields(char* p_pBuffer, unsigned short p_len, time_t p_time, Staple& staple)
 {
    Byte tmpByte;
-   Word tmpWord;
-   DoubleWord tmpDoubleWord;
    unsigned short actPos = 0;
-   // Check whether we have captured the first byte of the IP packet
-   bool decodable = true;
-   if (p_len < 1) decodable=false;
-   // Read IP version & IP header length if possible
+   // Non-IP or too short packets are not decoded
+   if (p_len < 1) return NULL;
+   Byte IPVersion = ((Byte)p_pBuffer[0]) >> 4;
+
    unsigned short IPHLen;
-   if (decodable==true)
+   unsigned short IPPktLen;
+   unsigned short IPId;
+   unsigned char IPFlags;
+   unsigned short fragOffset;
+   unsigned char protocol;
+   DoubleWord srcIP;
+   DoubleWord dstIP;
+   const uint8_t* srcIP6 = NULL;
+   const uint8_t* dstIP6 = NULL;
+
+   // IPv4 packet
+   // -----------
+   if (IPVersion == 4)
    {
       tmpByte = p_pBuffer[actPos++];
-
-      // Non-IPv4 packets will not be decoded
-      if ((tmpByte&0xf0) != 0x40)
+      // IP header length
+      IPHLen = 4*(tmpByte&0x0f);
+      // Sanity check of IPHLen
+      if (IPHLen < 20)
       {
-         decodable=false;
+         if (staple.logLevel>=5) staple.logStream << "IP header length too low!\n";
+         return NULL;
       }
-      // IPv4 packet
-      else
+      // Check whether we have captured the entire IP header
+      if ((p_len-actPos) < (IPHLen-1)) return NULL;
+
+      // Skip ToS
+      actPos++;
+
+      // Read full IP packet length
+      IPPktLen = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
+
+      // Sanity check of IPHLen vs. IPPktLen
+      if (IPHLen > IPPktLen)
       {
-         // IP header length
-         IPHLen = 4*(tmpByte&0x0f);
-         // Sanity check of IPHLen
-         if (IPHLen < 20)
-         {
-            if (staple.logLevel>=5) staple.logStream << "IP header length too low!\n";
-            return NULL;
-         }
-         // Check whether we have captured the entire IP header
-         if ((p_len-actPos) < (IPHLen-1)) decodable=false;
+         if (staple.logLevel>=5) staple.logStream << "IP header length too high!\n";
+         return NULL;
       }
-   }
 
-   // Non-IPv4 or too short packets are not decoded
-   // ---------------------------------------------
-   if (decodable==false) return NULL;
-
-   // Skip ToS
-   actPos++;
+      // Read IP Id
+      IPId = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
-   // Read full IP packet length
-   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   unsigned short IPPktLen = tmpWord.data;
+      // Read IP flags and fragmentation info
+      unsigned short flagsFragOffset = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
-   // Sanity check of IPHLen vs. IPPktLen
-   if (IPHLen > IPPktLen)
-   {
-      if (staple.logLevel>=5) staple.logStream << "IP header length too high!\n";
-      return NULL;
-   }
+      IPFlags = (flagsFragOffset&0xe000)>>13;
+      fragOffset = (flagsFragOffset&0x1fff)<<3;
 
-   // Read IP Id
-   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   unsigned short IPId = tmpWord.data;
+      // Skip TTL
+      actPos++;
 
-   // Read IP flags and fragmentation info
-   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      // Read protocol
+      protocol = p_pBuffer[actPos++];
 
-   unsigned char IPFlags = (tmpWord.data&0xe000)>>13;
-   unsigned short fragOffset = (tmpWord.data&0x1fff)<<3;
+      // Skip IP CRC
+      actPos += 2;
 
-   // Skip TTL
-   actPos++;
+      // Read source IP address
+      srcIP.data = Load32<BIG>(&p_pBuffer[actPos]);
+      actPos += 4;
 
-   // Read protocol
-   unsigned char protocol = p_pBuffer[actPos++];
+      // Read destination IP address
+      dstIP.data = Load32<BIG>(&p_pBuffer[actPos]);
+      actPos += 4;
 
-   // Skip IP CRC
-   actPos += 2;
+      // Skip IP options
+      actPos += IPHLen-20;
+   }
+   // IPv6 packet
+   // -----------
+   else if (IPVersion == 6)
+   {
+      // Check whether we have captured the fixed IPv6 header
+      if (p_len < 40) return NULL;
+
+      // Read payload length (the IP packet length includes the fixed header as for IPv4)
+      IPPktLen = 40 + Load16<BIG>(&p_pBuffer[4]);
+
+      // Read next header
+      protocol = p_pBuffer[6];
+
+      // Source & destination IP addresses (interned below, after the header has been checked)
+      srcIP6 = (const uint8_t*)&p_pBuffer[8];
+      dstIP6 = (const uint8_t*)&p_pBuffer[24];
+      actPos = 40;
+
+      // Walk the extension headers to the upper layer header (fragment header: IPv4-like fragmentation info)
+      IPId = 0;
+      IPFlags = 0;
+      fragOffset = 0;
+      bool extHeader = true;
+      while (extHeader == true)
+      {
+         switch (protocol)
+         {
+            // Hop-by-hop, routing and destination options headers
+            case 0:
+            case 43:
+            case 60:
+            // Authentication header
+            case 51:
+            {
+               if ((p_len-actPos) < 8) return NULL;
+               unsigned short extLen = (protocol == 51) ? 4*(((Byte)p_pBuffer[actPos+1])+2) : 8*(((Byte)p_pBuffer[actPos+1])+1);
+               protocol = p_pBuffer[actPos];
+               actPos += extLen;
+               break;
+            }
+            // Fragment header
+            case 44:
+            {
+               if ((p_len-actPos) < 8) return NULL;
+               unsigned short offsetFlags = Load16<BIG>(&p_pBuffer[actPos+2]);
+               fragOffset = offsetFlags&0xfff8;
+               if ((offsetFlags&0x0001) != 0) IPFlags |= IPPacket::MF;
+               IPId = Load32<BIG>(&p_pBuffer[actPos+4])&0xffff;
+               protocol = p_pBuffer[actPos];
+               actPos += 8;
+               // The headers of a non-first fragment are not followed (as for IPv4, the rest is decoded as the upper layer)
+               if (fragOffset != 0) extHeader = false;
+               break;
+            }
+            default:
+               extHeader = false;
+         }
+         // Check whether we have captured the entire extension header
+         if (actPos > p_len) return NULL;
+      }
+      IPHLen = actPos;
 
-   // Read source IP address
-   tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-   DoubleWord srcIP = tmpDoubleWord;
+      // Sanity check of IPHLen vs. IPPktLen
+      if (IPHLen > IPPktLen)
+      {
+         if (staple.logLevel>=5) staple.logStream << "IP header length too high!\n";
+         return NULL;
+      }
 
-   // Read destination IP address
-   tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-   tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-   DoubleWord dstIP = tmpDoubleWord;
+      // ICMPv6 is counted as ICMP
+      if (protocol == 58) protocol = 1;
+   }
+   // Non-IP packets are not decoded
+   // ------------------------------
+   else
+   {
+      return NULL;
+   }
 
-   // Filter IP addresses & determine packet direction
+   // Filter IP addresses & determine packet direction (the first filter of a net matching either address decides)
    bool matchNet[2];
-   short matchNum[2];
+   long matchNum[2];
    matchNet[0] = false;
    matchNet[1] = false;
    matchNum[0] = -1;
@@ -727,71 +805,70 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    unsigned char direction;
    for (unsigned short netId=0;netId<=1;netId++)
    {
-      for (unsigned short actFilter = 0; actFilter < staple.addrFilterNum[netId]; ++actFilter)
+      uint32_t srcFilter = (IPVersion == 4) ? staple.addrFilter[netId].Find(srcIP.data) : staple.addrFilter6[netId].Find(srcIP6);
+      uint32_t dstFilter = (IPVersion == 4) ? staple.addrFilter[netId].Find(dstIP.data) : staple.addrFilter6[netId].Find(dstIP6);
+      if (srcFilter != AddressFilter::NONE || dstFilter != AddressFilter::NONE)
       {
-         // Perform IP filtering if necessary
-         if (staple.netGiven[netId][actFilter])
+         matchNet[netId] = true;
+         // The source address is checked first against each filter
+         if (srcFilter <= dstFilter)
          {
-            if ((srcIP.data & staple.netMask[netId][actFilter].data) == (staple.netIP[netId][actFilter].data & staple.netMask[netId][actFilter].data))
-            {
-               matchNet[netId] = true;
-               matchNum[netId] = actFilter;
-               direction = netId;
-               break;
-            }
-            else if ((dstIP.data & staple.netMask[netId][actFilter].data) == (staple.netIP[netId][actFilter].data & staple.netMask[netId][actFilter].data))
-            {
-               matchNet[netId] = true;
-               matchNum[netId] = actFilter;
-               direction = 1-netId;
-               break;
-            }
+            matchNum[netId] = srcFilter;
+            direction = netId;
+         }
+         else
+         {
+            matchNum[netId] = dstFilter;
+            direction = 1-netId;
          }
       }
    }
 
-   // Skip IP options
-   actPos += IPHLen-20;
+   // Only the IPv6 addresses of the matching packets are interned (the rest are only counted)
+   if (IPVersion == 6)
+   {
+      if (matchNet[0] || matchNet[1])
+      {
+         ipv6Registry.Intern(srcIP6, dstIP6, srcIP.data, dstIP.data, p_time);
+      }
+      else
+      {
+         srcIP.data = 0;
+         dstIP.data = 0;
+      }
+   }
 
    // TCP packet (check snaplength)
    // -----------------------------
    if ((protocol == 6) && ((p_len-actPos) >= 20))
    {
       // Create TCP return packet
-      TCPPacket* pL3Packet = new TCPPacket(staple);
-      pL3Packet->Init();
+      TCPPacket* pL3Packet = staple.packetPool.NewTCPPacket();
       pL3Packet->IPPktLen = IPPktLen;
       pL3Packet->IPId = IPId;
       pL3Packet->IPFlags = IPFlags;
       pL3Packet->fragOffset = fragOffset;
       pL3Packet->srcIP = srcIP;
       pL3Packet->dstIP = dstIP;
+      pL3Packet->IPVersion = IPVersion;
       pL3Packet->match = (matchNet[0] || matchNet[1]);
       pL3Packet->direction = direction;
 
       // Read TCP source port
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->srcPort = tmpWord.data;
+      pL3Packet->srcPort = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Read TCP destination port
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->dstPort = tmpWord.data;
+      pL3Packet->dstPort = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Read TCP sequence number
-      tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-      pL3Packet->seq = tmpDoubleWord.data;
+      pL3Packet->seq = Load32<BIG>(&p_pBuffer[actPos]);
+      actPos += 4;
 
       // Read TCP acknowledgement number
-      tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-      pL3Packet->ack = tmpDoubleWord.data;
+      pL3Packet->ack = Load32<BIG>(&p_pBuffer[actPos]);
+      actPos += 4;
 
       // Read TCP header length
       tmpByte = p_pBuffer[actPos++];
@@ -801,7 +878,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
       if (TCPHLen < 20)
       {
          if (staple.logLevel>=5) staple.logStream << "TCP header length too low!\n";
-         delete pL3Packet;
+         staple.packetPool.Release(pL3Packet);
          return NULL;
       }
 
@@ -809,7 +886,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
       if ((IPHLen+TCPHLen) > IPPktLen)
       {
          if (staple.logLevel>=5) staple.logStream << "TCP header length too high!\n";
-         delete pL3Packet;
+         staple.packetPool.Release(pL3Packet);
          return NULL;
       }
 
@@ -820,9 +897,8 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
       pL3Packet->TCPFlags = p_pBuffer[actPos++];
 
       // Read TCP receiver window size
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->rwnd = tmpWord.data;
+      pL3Packet->rwnd = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Skip CRC & urgent pointer
       actPos += 4;
@@ -876,7 +952,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
             if (optionLenOK==false)
             {
                if (staple.logLevel>=5) staple.logStream << "Bad TCP option length!\n";
-               delete pL3Packet;
+               staple.packetPool.Release(pL3Packet);
                return NULL;
             }
             // Process option content
@@ -889,23 +965,17 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
                   if ((((optionLen-2)%8) != 0) && ((optionLen-2) > 0))
                   {
                      if (staple.logLevel>=5) staple.logStream << "Bad SACK option length!\n";
-                     delete pL3Packet;
+                     staple.packetPool.Release(pL3Packet);
                      return NULL;
                   }
                   // Process SACK info
                   pL3Packet->sackBlockNum = (optionLen-2)/8;
                   for (int i=0;i<pL3Packet->sackBlockNum;i++)
                   {
-                     tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-                     pL3Packet->sackLeftEdge[i] = tmpDoubleWord.data;
-                     tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                     tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-                     pL3Packet->sackRightEdge[i] = tmpDoubleWord.data;
+                     pL3Packet->sackLeftEdge[i] = Load32<BIG>(&p_pBuffer[actPos]);
+                     actPos += 4;
+                     pL3Packet->sackRightEdge[i] = Load32<BIG>(&p_pBuffer[actPos]);
+                     actPos += 4;
                      optBytesRead += 8;
                   }
                   break;
@@ -917,20 +987,14 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
                   if (optionLen!=10)
                   {
                      if (staple.logLevel>=5) staple.logStream << "Bad TCP timestamp option length!\n";
-                     delete pL3Packet;
+                     staple.packetPool.Release(pL3Packet);
                      return NULL;
                   }
                   // Read TS Value and TS Echo
-                  tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-                  pL3Packet->tsValue = tmpDoubleWord.data;
-                  tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-                  tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
-                  pL3Packet->tsEcho = tmpDoubleWord.data;
+                  pL3Packet->tsValue = Load32<BIG>(&p_pBuffer[actPos]);
+                  actPos += 4;
+                  pL3Packet->tsEcho = Load32<BIG>(&p_pBuffer[actPos]);
+                  actPos += 4;
                   optBytesRead += 8;
                   break;
                }
@@ -940,7 +1004,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
                   if (optionLen!=3)
                   {
                      if (staple.logLevel>=5) staple.logStream << "Bad TCP window scale option length!\n";
-                     delete pL3Packet;
+                     staple.packetPool.Release(pL3Packet);
                      return NULL;
                   }
                   // Read window scale value
@@ -962,7 +1026,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
          unsigned short PLdumped = (pL3Packet->TCPPLLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->TCPPLLen;
          if (PLdumped > 0)
          {
-            pL3Packet->payload = new Byte[PLdumped];
+            pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
             pL3Packet->payloadSavedLen = PLdumped;
             memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
             actPos += PLdumped;
@@ -986,7 +1050,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
          if ((matchNet[1]==true) && (staple.portGiven[1][matchNum[1]] == true))
          {
             unsigned short netBPort = (pL3Packet->direction == 0) ? pL3Packet->dstPort : pL3Packet->srcPort;
-            if (netBPort != staple.netPort[1][matchNum[0]]) pL3Packet->match = false;
+            if (netBPort != staple.netPort[1][matchNum[1]]) pL3Packet->match = false;
          }
       }
 
@@ -1000,31 +1064,28 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    if ((protocol == 17) && ((p_len-actPos) >= 8))
    {
       // Create UDP return packet
-      UDPPacket* pL3Packet = new UDPPacket(staple);
-      pL3Packet->Init();
+      UDPPacket* pL3Packet = staple.packetPool.NewUDPPacket();
       pL3Packet->IPPktLen = IPPktLen;
       pL3Packet->IPId = IPId;
       pL3Packet->IPFlags = IPFlags;
       pL3Packet->fragOffset = fragOffset;
       pL3Packet->srcIP = srcIP;
       pL3Packet->dstIP = dstIP;
+      pL3Packet->IPVersion = IPVersion;
       pL3Packet->match = (matchNet[0] || matchNet[1]);
       pL3Packet->direction = direction;
 
       // Read UDP source port
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->srcPort = tmpWord.data;
+      pL3Packet->srcPort = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Read UDP destination port
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->dstPort = tmpWord.data;
+      pL3Packet->dstPort = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Read UDP length
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->UDPPLLen = tmpWord.data;
+      pL3Packet->UDPPLLen = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
       pL3Packet->UDPPLLen -= 8;
 
       // Skip checksum
@@ -1034,7 +1095,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
       unsigned short PLdumped = (pL3Packet->UDPPLLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->UDPPLLen;
       if (PLdumped > 0)
       {
-         pL3Packet->payload = new Byte[PLdumped];
+         pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
          pL3Packet->payloadSavedLen = PLdumped;
          memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
          actPos += PLdumped;
@@ -1051,7 +1112,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
          if ((matchNet[1]==true) && (staple.portGiven[1][matchNum[1]] == true))
          {
             unsigned short netBPort = (pL3Packet->direction == 0) ? pL3Packet->dstPort : pL3Packet->srcPort;
-            if (netBPort != staple.netPort[1][matchNum[0]]) pL3Packet->match = false;
+            if (netBPort != staple.netPort[1][matchNum[1]]) pL3Packet->match = false;
          }
       }
 
@@ -1065,21 +1126,20 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    if ((protocol == 1) && ((p_len-actPos) >= 2))
    {
       // Create ICMP return packet
-      ICMPPacket* pL3Packet = new ICMPPacket(staple);
-      pL3Packet->Init();
+      ICMPPacket* pL3Packet = staple.packetPool.NewICMPPacket();
       pL3Packet->IPPktLen = IPPktLen;
       pL3Packet->IPId = IPId;
       pL3Packet->IPFlags = IPFlags;
       pL3Packet->fragOffset = fragOffset;
       pL3Packet->srcIP = srcIP;
       pL3Packet->dstIP = dstIP;
+      pL3Packet->IPVersion = IPVersion;
       pL3Packet->match = (matchNet[0] || matchNet[1]);
       pL3Packet->direction = direction;
 
       // Read ICMP type code
-      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
-      pL3Packet->typeCode = tmpWord.data;
+      pL3Packet->typeCode = Load16<BIG>(&p_pBuffer[actPos]);
+      actPos += 2;
 
       // Skip rest of the packet (incl. link layer padding)
       actPos = p_len;
@@ -1089,14 +1149,14 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    // Non-TCP/non-UDP/non-ICMP (e.g. IGMP) or too short snaplength packet
    // -------------------------------------------------------------------
    // Create IP return packet
-   IPPacket* pL3Packet = new IPPacket(staple);
-   pL3Packet->Init();
+   IPPacket* pL3Packet = staple.packetPool.NewIPPacket();
    pL3Packet->IPPktLen = IPPktLen;
    pL3Packet->IPId = IPId;
    pL3Packet->IPFlags = IPFlags;
    pL3Packet->fragOffset = fragOffset;
    pL3Packet->srcIP = srcIP;
    pL3Packet->dstIP = dstIP;
+   pL3Packet->IPVersion = IPVersion;
    pL3Packet->match = (matchNet[0] || matchNet[1]);
    pL3Packet->direction = direction;
 
@@ -1104,7 +1164,7 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    unsigned short PLdumped = (pL3Packet->IPPktLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->IPPktLen;
    if (PLdumped > 0)
    {
-      pL3Packet->payload = new Byte[PLdumped];
+      pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
       pL3Packet->payloadSavedLen = PLdumped;
       memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
       actPos += PLdumped;
@@ -1115,9 +1175,102 @@ L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
    return pL3Packet;
 }
 
+// Position of the inner IP packet if the IP packet is an unfragmented GTP-U G-PDU (0 otherwise)
+template <bool BIG>
+static unsigned short GTPUPayloadPos(const char* p_pBuffer, unsigned short p_len, u_int32_t& p_TEID)
+{
+   // Outer IP header (UDP, unfragmented)
+   unsigned short actPos;
+   Byte IPVersion = ((Byte)p_pBuffer[0]) >> 4;
+   if (IPVersion == 4)
+   {
+      if ((p_len < 20) || (p_pBuffer[9] != 17) || ((Load16<BIG>(&p_pBuffer[6])&0x3fff) != 0)) return 0;
+      actPos = 4*(p_pBuffer[0]&0x0f);
+      if (actPos < 20) return 0;
+   }
+   else if (IPVersion == 6)
+   {
+      if ((p_len < 40) || (p_pBuffer[6] != 17)) return 0;
+      actPos = 40;
+   }
+   else
+   {
+      return 0;
+   }
+
+   // UDP header (either port is the GTP-U port)
+   if (p_len < actPos+8+8) return 0;
+   if ((Load16<BIG>(&p_pBuffer[actPos]) != GTPU_PORT) && (Load16<BIG>(&p_pBuffer[actPos+2]) != GTPU_PORT)) return 0;
+   actPos += 8;
+
+   // GTP-U header (version 1, GTP, G-PDU message)
+   Byte flags = p_pBuffer[actPos];
+   if (((flags&0xf0) != 0x30) || ((Byte)p_pBuffer[actPos+1] != 0xff)) return 0;
+   p_TEID = Load32<BIG>(&p_pBuffer[actPos+4]);
+   actPos += 8;
+   // Sequence number, N-PDU number and next extension header type (present if any of the E, S and PN flags is set)
+   if ((flags&0x07) != 0)
+   {
+      if (p_len < actPos+4) return 0;
+      Byte nextExtType = ((flags&0x04) != 0) ? p_pBuffer[actPos+3] : 0;
+      actPos += 4;
+      // Extension headers (length in 4 byte units, the last byte is the type of the next one)
+      while (nextExtType != 0)
+      {
+         if (p_len < actPos+1) return 0;
+         unsigned short extLen = 4*((Byte)p_pBuffer[actPos]);
+         if ((extLen == 0) || (p_len < actPos+extLen)) return 0;
+         nextExtType = p_pBuffer[actPos+extLen-1];
+         actPos += extLen;
+      }
+   }
+
+   // The payload has to be an IP packet
+   if (p_len < actPos+1) return 0;
+   IPVersion = ((Byte)p_pBuffer[actPos]) >> 4;
+   if ((IPVersion != 4) && (IPVersion != 6)) return 0;
+   return actPos;
+}
+
+// GLOBAL function for decoding IP packets (TODO: inheritance)
+L3Packet* DecodeIPPacket(char* p_pBuffer, unsigned short p_len, time_t p_time, Staple& staple)
+{
+   // The fields are in network byte order, unless the platform byte order is configured to be the opposite
+   bool networkOrder = (staple.byteOrderPlatform == HOST_LITTLE_ENDIAN);
+
+   // Decapsulate GTP-U (the inner packet is decoded in place, the tunnel headers are skipped)
+   u_int32_t TEID = 0;
+   if ((staple.decapGTP == true) && (p_len > 0))
+   {
+      unsigned short innerPos = networkOrder ? GTPUPayloadPos<true>(p_pBuffer, p_len, TEID) : GTPUPayloadPos<false>(p_pBuffer, p_len, TEID);
+      if (innerPos > 0)
+      {
+         p_pBuffer += innerPos;
+         p_len -= innerPos;
+         staple.packetsGTPU++;
+      }
+      else
+      {
+         TEID = 0;
+      }
+   }
+
+   L3Packet* pL3Packet = networkOrder ? DecodeIPPacketFields<true>(p_pBuffer, p_len, p_time, staple) : DecodeIPPacketFields<false>(p_pBuffer, p_len, p_time, staple);
+   if (pL3Packet != NULL) ((IPPacket*)pL3Packet)->tunnelId = (staple.tunnelKey == true) ? TEID : 0;
+   return pL3Packet;
+}
+
 void PacketDumpFile::CloseInputFile()
 {
    if (inFile!=NULL) gzclose(inFile);
+   if (inMap!=NULL) munmap(inMap, inMapSize);
+   inFile = NULL;
+   inMap = NULL;
+   inMapSize = 0;
+   inData = NULL;
+   inDataLen = 0;
+   inDataPos = 0;
+   packetData = NULL;
    return;
 }
 
@@ -1184,7 +1337,7 @@ void PacketDumpFile::WriteActualPacket()
    // Write original packet length
    gzwrite(outFile,(char*)(&origL2PacketLength),4);
    // Write packet data
-   gzwrite(outFile,(char*)(&tmpBuffer),savedL2PacketLength);
+   gzwrite(outFile,(char*)packetData,savedL2PacketLength);
 
    return;   
 }
@@ -0,0 +1,122 @@
+#include <staple/PacketPool.h>
+#include <staple/Staple.h>
+
+PacketPool::PacketPool(Staple& s) : allocations(0), staple(s)
+{
+}
+
+PacketPool::~PacketPool()
+{
+   for (unsigned long i=0;i<freeEthernetPackets.size();i++) delete freeEthernetPackets[i];
+   for (unsigned long i=0;i<freeL2Packets.size();i++) delete freeL2Packets[i];
+   for (unsigned long i=0;i<freeIPPackets.size();i++) delete freeIPPackets[i];
+   for (unsigned long i=0;i<freeTCPPackets.size();i++) delete freeTCPPackets[i];
+   for (unsigned long i=0;i<freeUDPPackets.size();i++) delete freeUDPPackets[i];
+   for (unsigned long i=0;i<freeICMPPackets.size();i++) delete freeICMPPackets[i];
+}
+
+template <class T> T* PacketPool::Get(std::vector<T*>& freeList)
+{
+   T* p;
+   if (freeList.empty())
+   {
+      p = new T(staple);
+      allocations++;
+   }
+   else
+   {
+      p = freeList.back();
+      freeList.pop_back();
+   }
+   p->Init();
+   return p;
+}
+
+template <class T> void PacketPool::Put(std::vector<T*>& freeList, T* p)
+{
+   // Keep only a limited number of spare objects (e.g., after a burst of buffered packets)
+   if (freeList.size() < PACKETPOOL_MAX_FREE)
+   {
+      freeList.push_back(p);
+   }
+   else
+   {
+      delete p;
+   }
+}
+
+EthernetPacket* PacketPool::NewEthernetPacket() { return Get(freeEthernetPackets); }
+L2Packet* PacketPool::NewL2Packet() { return Get(freeL2Packets); }
+IPPacket* PacketPool::NewIPPacket() { return Get(freeIPPackets); }
+TCPPacket* PacketPool::NewTCPPacket() { return Get(freeTCPPackets); }
+UDPPacket* PacketPool::NewUDPPacket() { return Get(freeUDPPackets); }
+ICMPPacket* PacketPool::NewICMPPacket() { return Get(freeICMPPackets); }
+
+Byte* PacketPool::PayloadSlab(L3Packet* p_pL3Packet, unsigned short p_len)
+{
+   PayloadBuffer* pSlab = p_pL3Packet->payloadSlab;
+   // A slab still shared with a buffered copy of an earlier packet can't be overwritten
+   if ((pSlab != NULL) && (pSlab->Shared() || (pSlab->size < p_len)))
+   {
+      pSlab->Unref();
+      pSlab = NULL;
+   }
+   if (pSlab == NULL)
+   {
+      // Round up the capacity so that the slab can be reused by most of the later packets
+      unsigned long slabSize = (p_len < PACKETPOOL_SLAB_SIZE) ? PACKETPOOL_SLAB_SIZE : p_len;
+      pSlab = PayloadBuffer::New(slabSize);
+      allocations++;
+   }
+   p_pL3Packet->payloadSlab = pSlab;
+   return pSlab->data;
+}
+
+void PacketPool::Release(L2Packet* p_pL2Packet)
+{
+   if (p_pL2Packet == NULL) return;
+   // Release the contained L3 packet first
+   L3Packet* pL3Packet = p_pL2Packet->pL3Packet;
+   if (pL3Packet != NULL)
+   {
+      p_pL2Packet->pL3Packet = NULL;
+      pL3Packet->pL2Packet = NULL;
+      Release(pL3Packet);
+   }
+   if (p_pL2Packet->l2Type == L2Packet::ETHERNET)
+   {
+      Put(freeEthernetPackets, static_cast<EthernetPacket*>(p_pL2Packet));
+   }
+   else
+   {
+      Put(freeL2Packets, p_pL2Packet);
+   }
+}
+
+void PacketPool::Release(L3Packet* p_pL3Packet)
+{
+   if (p_pL3Packet == NULL) return;
+   // Release the containing L2 packet together with this one
+   if (p_pL3Packet->pL2Packet != NULL)
+   {
+      Release(p_pL3Packet->pL2Packet);
+      return;
+   }
+   // The payload slab is kept for the next packet, unless it is still shared with a buffered copy
+   if ((p_pL3Packet->payload != NULL) && !p_pL3Packet->SlabPayload()) delete [] p_pL3Packet->payload;
+   if ((p_pL3Packet->payloadSlab != NULL) && p_pL3Packet->payloadSlab->Shared())
+   {
+      p_pL3Packet->payloadSlab->Unref();
+      p_pL3Packet->payloadSlab = NULL;
+   }
+   p_pL3Packet->payload = NULL;
+   p_pL3Packet->payloadSavedLen = 0;
+   switch (p_pL3Packet->l3Type)
+   {
+      case L3Packet::IP|L3Packet::TCP: Put(freeTCPPackets, static_cast<TCPPacket*>(p_pL3Packet)); break;
+      case L3Packet::IP|L3Packet::UDP: Put(freeUDPPackets, static_cast<UDPPacket*>(p_pL3Packet)); break;
+      case L3Packet::IP|L3Packet::ICMP: Put(freeICMPPackets, static_cast<ICMPPacket*>(p_pL3Packet)); break;
+      case L3Packet::IP: Put(freeIPPackets, static_cast<IPPacket*>(p_pL3Packet)); break;
+      default: delete p_pL3Packet;
+   }
+}
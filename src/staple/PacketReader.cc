@@ -0,0 +1,145 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <staple/PacketReader.h>
+#include <staple/Staple.h>
+
+// Wait a bit for the other side of the pipeline (spin first, then sleep)
+static void Backoff(unsigned long& p_spins)
+{
+   if (++p_spins < READER_SPIN_LIMIT) sched_yield();
+   else usleep(50);
+}
+
+// Global function of the reader thread
+void* PacketReaderLauncher(void* arg)
+{
+   reinterpret_cast<PacketReader*>(arg)->Run();
+   return NULL;
+}
+
+PacketReader::PacketReader(Staple& s) : readerStalls(0), parserStalls(0), staple(s), actBatch(NULL), actIndex(0), finished(false), stopping(false)
+{
+   // The duplicate statistics are counted by the reader thread
+   for (int i=0;i<=DUPSTATS_MAX;i++) {packetsDuplicated[i] = 0; ipPacketsDuplicated[i] = 0;}
+   staple.packetDumpFile.pPacketsDuplicated = packetsDuplicated;
+   staple.packetDumpFile.pIPPacketsDuplicated = ipPacketsDuplicated;
+   // All batches are free at the beginning
+   for (unsigned long i=0;i<READER_RING_SIZE;i++)
+   {
+      PacketBatch* pBatch = new PacketBatch();
+      batches.push_back(pBatch);
+      freeBatches.Push(pBatch);
+   }
+   pthread_create(&thread, NULL, PacketReaderLauncher, (void*)this);
+}
+
+PacketReader::~PacketReader()
+{
+   // Stop the reader thread: keep giving back batches until the last one is read
+   stopping = true;
+   while (ReadPacket() != NULL) {}
+   pthread_join(thread, 0);
+   staple.packetDumpFile.pPacketsDuplicated = staple.packetsDuplicated;
+   staple.packetDumpFile.pIPPacketsDuplicated = staple.ipStats.packetsDuplicated;
+   // Give the remaining packets back to the pool
+   for (unsigned long i=0;i<batches.size();i++)
+   {
+      for (unsigned short j=0;j<batches[i]->num;j++)
+      {
+         staple.packetPool.Release(batches[i]->packets[j]);
+      }
+      delete batches[i];
+   }
+}
+
+void PacketReader::Run()
+{
+   bool last = false;
+   while (!last)
+   {
+      // Get a parsed batch (backpressure: wait until the parser gives one back)
+      PacketBatch* pBatch;
+      unsigned long spins = 0;
+      while ((pBatch = freeBatches.Pop()) == NULL)
+      {
+         if (spins == 0) readerStalls++;
+         Backoff(spins);
+      }
+      // Give its packets back to the pool
+      for (unsigned short i=0;i<pBatch->num;i++)
+      {
+         staple.packetPool.Release(pBatch->packets[i]);
+      }
+      pBatch->num = 0;
+      // Fill it with new packets
+      PacketDumpFile::ErrorCode errorCode;
+      while ((pBatch->num < READER_BATCH_SIZE) && !last)
+      {
+         if (stopping)
+         {
+            last = true;
+            break;
+         }
+         L2Packet* pL2Packet = staple.packetDumpFile.ReadPacket(&errorCode);
+         if (errorCode == PacketDumpFile::ERROR_EOF)
+         {
+            // EOF: try to open next input file (if available)
+            if (staple.packetDumpFile.NextInputFile() != PacketDumpFile::NO_ERROR)
+            {
+               last = true;
+               break;
+            }
+            continue;
+         }
+         if (pL2Packet == NULL) continue;
+         pBatch->packets[pBatch->num++] = pL2Packet;
+      }
+      pBatch->last = last;
+      // Pass the duplicate statistics counted since the last batch
+      for (int i=0;i<=DUPSTATS_MAX;i++)
+      {
+         pBatch->packetsDuplicated[i] = packetsDuplicated[i];
+         pBatch->ipPacketsDuplicated[i] = ipPacketsDuplicated[i];
+         packetsDuplicated[i] = 0;
+         ipPacketsDuplicated[i] = 0;
+      }
+      // Pass it to the parser (there is always room for all the batches)
+      fullBatches.Push(pBatch);
+   }
+}
+
+L2Packet* PacketReader::ReadPacket()
+{
+   while ((actBatch == NULL) || (actIndex >= actBatch->num))
+   {
+      if (finished) return NULL;
+      // Give the parsed batch back to the reader thread
+      if (actBatch != NULL)
+      {
+         finished = actBatch->last;
+         freeBatches.Push(actBatch);
+         actBatch = NULL;
+         if (finished) return NULL;
+      }
+      // Wait for the next decoded batch
+      unsigned long spins = 0;
+      while ((actBatch = fullBatches.Pop()) == NULL)
+      {
+         if (spins == 0) parserStalls++;
+         Backoff(spins);
+      }
+      actIndex = 0;
+      for (int i=0;i<=DUPSTATS_MAX;i++)
+      {
+         staple.packetsDuplicated[i] += actBatch->packetsDuplicated[i];
+         staple.ipStats.packetsDuplicated[i] += actBatch->ipPacketsDuplicated[i];
+      }
+   }
+   return actBatch->packets[actIndex++];
+}
+
+void PacketReader::Detach()
+{
+   if ((actBatch != NULL) && (actIndex > 0)) actBatch->packets[actIndex-1] = NULL;
+}
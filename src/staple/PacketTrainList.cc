@@ -1,172 +1,129 @@
 #include <staple/PacketTrainList.h>
-#include <list>
 
 #include <staple/Type.h>
 #include <staple/Packet.h>
 
 /*
 ** -----------------------------------------------------------------------------------------
-** Class PacketTrain
+** Class PacketTrainList
 ** -----------------------------------------------------------------------------------------
 */
 
-// Returns true if the input data range at least PARTIALLY OVERLAPS with the packet train
-bool PacketTrain::TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq)
+PacketTrainList::PacketTrainList()
 {
-   if (((p_firstSeq < firstSeq) && (p_lastSeq <= firstSeq)) || ((p_firstSeq >= lastSeq) && (p_lastSeq > lastSeq)))
-   {
-      return false;
-   }
-   else
-   {
-      return true;
-   }
+   packets = NULL;
+   capacity = 0;
+   head = 0;
+   size = 0;
+   firstSeq = 0;
+   lastSeq = 0;
 }
 
-// Finds a packet based on its starting and ending SEQ
-// Returns an iterator pointing to the packet (returns end() if no matching packet found)
-// firstSeq = the sequence number of the first byte in the packet
-// lastSeq = the sequence number of the first byte beyond the packet
-std::list<PacketTrainTCPPacket>::iterator PacketTrain::TestPacket (unsigned long p_firstSeq, unsigned long p_lastSeq)
+PacketTrainList::PacketTrainList(const PacketTrainList& p_list)
 {
-   if (TestPartialOverlap(p_firstSeq, p_lastSeq) == true)
-   {
-      std::list<PacketTrainTCPPacket>::iterator index = packetList.begin();
-      while (index != packetList.end())
-      {
-         if ((p_firstSeq == (*index).seq) && (p_lastSeq == (*index).seq+(*index).len))
-         {
-            break;
-         }
-         index++;
-      }
-      return index;
-   }
-   else
-   {
-      return packetList.end();
-   }
+   packets = NULL;
+   capacity = 0;
+   head = 0;
+   size = 0;
+   *this = p_list;
 }
 
-// Finds a packet based on its starting SEQ (length does not matter)
-// Returns an iterator pointing to the packet (returns end() if no matching packet found)
-// seq = the sequence number of the first byte in the packet
-std::list<PacketTrainTCPPacket>::iterator PacketTrain::TestPacketSeq (unsigned long p_seq)
+PacketTrainList& PacketTrainList::operator =(const PacketTrainList& p_list)
 {
-   if (TestPartialOverlap(p_seq, p_seq) == true)
-   {
-      std::list<PacketTrainTCPPacket>::iterator index = packetList.begin();
-      while (index != packetList.end())
-      {
-         if (p_seq == (*index).seq)
-         {
-            break;
-         }
-         index++;
-      }
-      return index;
-   }
-   else
-   {
-      return packetList.end();
-   }
+   if (this == &p_list) return *this;
+   Init();
+   firstSeq = p_list.firstSeq;
+   lastSeq = p_list.lastSeq;
+   if (p_list.size > 0)
+   {
+      capacity = p_list.capacity;
+      packets = new PacketTrainTCPPacket[capacity];
+      for (unsigned long i=0;i<p_list.size;i++) packets[i] = p_list.Packet(i);
+      size = p_list.size;
+   }
+   return *this;
 }
 
-// Appends a CONSECUTIVE packet at the END of the packet train
-// Returns true on success
-bool PacketTrain::InsertPacketToBack (PacketTrainTCPPacket& p_packet)
+PacketTrainList::~PacketTrainList()
 {
-   // Empty packet -> error
-   if (p_packet.len == 0) return false;
-
-   // Is it the first packet?
-   if (packetList.empty()==true)
-   {
-      packetList.push_back(p_packet);
-      firstSeq = p_packet.seq;
-      lastSeq = p_packet.seq + p_packet.len;
-      return true;      
-   }
-
-   // Or is it a consecutive packet?
-   if (p_packet.seq == lastSeq)
-   {
-      packetList.push_back(p_packet);
-      lastSeq += p_packet.len;
-      return true;
-   }
-
-   return false;
+   if (packets != NULL) delete [] packets;
 }
 
-// Appends a CONSECUTIVE packet at the START of the packet train
-// Returns true on success
-bool PacketTrain::InsertPacketToFront (PacketTrainTCPPacket& p_packet)
+void PacketTrainList::Init()
 {
-   // Empty packet -> error
-   if (p_packet.len == 0) return false;
+   if (packets != NULL) delete [] packets;
+   packets = NULL;
+   capacity = 0;
+   head = 0;
+   size = 0;
+   firstSeq = 0;
+   lastSeq = 0;
+}
 
-   // Is it the first packet?
-   if (packetList.empty()==true)
+// Index of the first packet whose SEQ is not below the given SEQ (size if there is no such packet)
+unsigned long PacketTrainList::LowerBound (unsigned long p_seq) const
+{
+   unsigned long low = 0;
+   unsigned long high = size;
+   while (low < high)
    {
-      packetList.push_front(p_packet);
-      firstSeq = p_packet.seq;
-      lastSeq = p_packet.seq + p_packet.len;
-      return true;      
+      unsigned long mid = (low + high) / 2;
+      if (Packet(mid).seq < p_seq) low = mid + 1;
+      else high = mid;
    }
+   return low;
+}
 
-   // Or is it a consecutive packet?
-   if ((p_packet.seq + p_packet.len) == firstSeq)
+// Returns true if the input data range at least PARTIALLY OVERLAPS with a packet train
+// (a zero-length range overlaps with a train if it is inside the train or at one of its ends)
+bool PacketTrainList::TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq) const
+{
+   if (size == 0) return false;
+   if (p_lastSeq > p_firstSeq)
    {
-      packetList.push_front(p_packet);
-      firstSeq -= p_packet.len;
-      return true;
+      // The last packet starting before the end of the range has to end after its start
+      unsigned long i = LowerBound(p_lastSeq);
+      return ((i > 0) && ((Packet(i-1).seq + Packet(i-1).len) > p_firstSeq));
    }
-
-   return false;
+   // Zero-length range: the packet starting at or after it has to start right there, or the one before it has to reach it
+   unsigned long i = LowerBound(p_firstSeq);
+   if ((i < size) && (Packet(i).seq == p_firstSeq)) return true;
+   return ((i > 0) && ((Packet(i-1).seq + Packet(i-1).len) >= p_firstSeq));
 }
 
-// Removes the first packet from the packet train
-// Returns true if successful
-bool PacketTrain::RemoveFirstPacket()
+// Finds a packet based on its starting and ending SEQ
+// firstSeq = the sequence number of the first byte in the packet
+// lastSeq = the sequence number of the first byte beyond the packet
+unsigned long PacketTrainList::FindPacket (unsigned long p_firstSeq, unsigned long p_lastSeq) const
 {
-   if (packetList.empty()==true)
-   {
-      return false;
-   }
-   else
-   {
-      firstSeq += packetList.front().len;
-      packetList.pop_front();
-      return true;
-   }
+   unsigned long i = FindPacketSeq(p_firstSeq);
+   if ((i != NONE) && ((Packet(i).seq + Packet(i).len) != p_lastSeq)) return NONE;
+   return i;
 }
 
-void PacketTrain::Print(std::ostream& outStream) const
+// Finds a packet based on its starting SEQ (length does not matter)
+unsigned long PacketTrainList::FindPacketSeq (unsigned long p_seq) const
 {
-   outStream << "firstSeq " << firstSeq << " lastSeq " << lastSeq << " number of packets " << packetList.size() << "\n";
+   unsigned long i = LowerBound(p_seq);
+   if ((i < size) && (Packet(i).seq == p_seq)) return i;
+   return NONE;
 }
 
-/*
-** -----------------------------------------------------------------------------------------
-** Class PacketTrainList
-** -----------------------------------------------------------------------------------------
-*/
+bool PacketTrainList::IsTrainEnd (unsigned long i) const
+{
+   return ((i+1 >= size) || ((Packet(i).seq + Packet(i).len) != Packet(i+1).seq));
+}
 
-// Returns an iterator to the packet train whose data range at least PARTIALLY OVERLAPS with
-// the input data range (end() if no overlap)
-std::list<PacketTrain>::iterator PacketTrainList::TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq)
+// Doubles the size of the ring (packets are moved to the start of the new ring)
+void PacketTrainList::Grow()
 {
-   std::list<PacketTrain>::iterator index = packetTrainList.begin();
-   while (index != packetTrainList.end())
-   {
-      if ((*index).TestPartialOverlap(p_firstSeq, p_lastSeq) == true)
-      {
-         break;
-      }
-      index++;
-   }
-   return index;
+   unsigned long newCapacity = (capacity == 0) ? HISTORY_MIN_CAPACITY : 2*capacity;
+   PacketTrainTCPPacket* newPackets = new PacketTrainTCPPacket[newCapacity];
+   for (unsigned long i=0;i<size;i++) newPackets[i] = Packet(i);
+   if (packets != NULL) delete [] packets;
+   packets = newPackets;
+   capacity = newCapacity;
+   head = 0;
 }
 
 // Inserts a non-overlapping packet into the packet train list
@@ -176,192 +133,62 @@ bool PacketTrainList::InsertPacket (PacketTrainTCPPacket& p_packet)
    // Empty packet
    if (p_packet.len == 0) return false;
 
-   // First packet in the list?
-   if (packetTrainList.empty() == true)
+   unsigned long i = size;
+   // Not past the END -> find its place (it must not overlap with the packets seen)
+   if ((size > 0) && (p_packet.seq < lastSeq))
    {
-      // Create first packet train
-      PacketTrain packetTrain;
-      packetTrain.Init();
-      packetTrain.InsertPacketToFront(p_packet);
-
-      packetTrainList.push_back(packetTrain);
-      firstSeq = p_packet.seq;
-      lastSeq = p_packet.seq + p_packet.len;
-      return true;
+      i = LowerBound(p_packet.seq);
+      if ((i < size) && (Packet(i).seq < p_packet.seq + p_packet.len)) return false;
+      if ((i > 0) && ((Packet(i-1).seq + Packet(i-1).len) > p_packet.seq)) return false;
    }
 
-   // CONSECUTIVE packet at the END?
-   if (p_packet.seq == lastSeq)
-   {
-      packetTrainList.back().InsertPacketToBack(p_packet);
-      lastSeq = p_packet.seq + p_packet.len;
-      return true;      
-   }
+   if (size == capacity) Grow();
 
-   // NON-CONSECUTIVE packet past the END?
-   if (p_packet.seq > lastSeq)
+   // Shift the shorter side of the ring to make room for the packet
+   if (i < size - i)
    {
-      // Create new packet train
-      PacketTrain packetTrain;
-      packetTrain.Init();
-      packetTrain.InsertPacketToFront(p_packet);
-
-      packetTrainList.push_back(packetTrain);
-      lastSeq = p_packet.seq + p_packet.len;
-      return true;
+      head = (head + capacity - 1) & (capacity-1);
+      for (unsigned long j=0;j<i;j++) Packet(j) = Packet(j+1);
    }
-
-   // NON-OVERLAPPING packet somewhere else?
-   std::list<PacketTrain>::iterator trainIndex;
-   trainIndex = TestPartialOverlap(p_packet.seq,p_packet.seq+p_packet.len);
-   if (trainIndex == packetTrainList.end())
+   else
    {
-      // Find the train that is proceding the packet
-      trainIndex = packetTrainList.begin();
-      while (trainIndex != packetTrainList.end())
-      {
-         if ((p_packet.seq+p_packet.len) <= (*trainIndex).firstSeq)
-         {
-            std::list<PacketTrain>::iterator nextTrain = trainIndex;
-
-            // Is it the first train?
-            if (nextTrain == packetTrainList.begin())
-            {
-               // Does the packet fit to the first train?
-               if ((p_packet.seq+p_packet.len) == (*nextTrain).firstSeq)
-               {
-                  // Append packet
-                  (*nextTrain).InsertPacketToFront(p_packet);
-               }
-               else
-               {
-                  // Create new first packet train
-                  PacketTrain packetTrain;
-                  packetTrain.Init();
-                  packetTrain.InsertPacketToFront(p_packet);
-                  packetTrainList.push_front(packetTrain);
-               }
-               firstSeq = p_packet.seq;
-            }
-            else
-            {
-               std::list<PacketTrain>::iterator lastTrain = --trainIndex;
-               // No connection to packet trains
-               if ((p_packet.seq!=(*lastTrain).lastSeq) && ((p_packet.seq+p_packet.len)!=(*nextTrain).firstSeq))
-               {
-                  // Create new packet train
-                  PacketTrain packetTrain;
-                  packetTrain.Init();
-                  packetTrain.InsertPacketToFront(p_packet);
-                  // Insert it before the next train
-                  packetTrainList.insert(nextTrain,packetTrain);
-               }
-               // Connection to the last packet train
-               if ((p_packet.seq==(*lastTrain).lastSeq) && ((p_packet.seq+p_packet.len)!=(*nextTrain).firstSeq))
-               {
-                  // Append packet
-                  (*lastTrain).InsertPacketToBack(p_packet);
-               }
-               // Connection to the next packet train
-               if ((p_packet.seq!=(*lastTrain).lastSeq) && ((p_packet.seq+p_packet.len)==(*nextTrain).firstSeq))
-               {
-                  // Append packet to the next train
-                  (*nextTrain).InsertPacketToFront(p_packet);
-               }
-               // Connection to both packet trains
-               if ((p_packet.seq==(*lastTrain).lastSeq) && ((p_packet.seq+p_packet.len)==(*nextTrain).firstSeq))
-               {
-                  // Merge last and next train by the new packet
-                  if ((*lastTrain).packetList.size() > (*nextTrain).packetList.size())
-                  {
-                     // Append new packet to the last train
-                     (*lastTrain).InsertPacketToBack(p_packet);
-                     // Copy packets from nextTrain to lastTrain
-                     while ((*nextTrain).packetList.empty() != true)
-                     {
-                        (*lastTrain).packetList.push_back((*nextTrain).packetList.front());
-                        (*nextTrain).packetList.pop_front();
-                     }
-                     // Inflate lastTrain's data range
-                     (*lastTrain).lastSeq = (*nextTrain).lastSeq;
-                     // Erase nextTrain
-                     packetTrainList.erase(nextTrain);
-                  }
-                  else
-                  {
-                     // Append new packet to the next train
-                     (*nextTrain).InsertPacketToFront(p_packet);
-                     // Copy packets from lastTrain to nextTrain
-                     while ((*lastTrain).packetList.empty() != true)
-                     {
-                        (*nextTrain).packetList.push_front((*lastTrain).packetList.back());
-                        (*lastTrain).packetList.pop_back();
-                     }
-                     // Inflate nextTrain's data range
-                     (*nextTrain).firstSeq = (*lastTrain).firstSeq;
-                     // Erase lastTrain
-                     packetTrainList.erase(lastTrain);
-                  }
-               }
-            }
-            return true;
-         }
-         trainIndex++;
-      }
+      for (unsigned long j=size;j>i;j--) Packet(j) = Packet(j-1);
    }
+   Packet(i) = p_packet;
+   size++;
 
-   return false;
+   firstSeq = Packet(0).seq;
+   lastSeq = Packet(size-1).seq + Packet(size-1).len;
+   return true;
 }
 
 // Removes the first packet from the packet train list
 // Returns true if successful
 bool PacketTrainList::RemoveFirstPacket()
 {
-   bool success = false;
+   if (size == 0) return false;
 
-   std::list<PacketTrain>::iterator index = packetTrainList.begin();
-
-   while (index != packetTrainList.end())
-   {
-      // Try to remove the first packet from the first train
-      if ((*index).RemoveFirstPacket() == true)
-      {
-         // Packet removed
-         success = true;
-
-         // If the train became empty -> erase it
-         if ((*index).firstSeq == (*index).lastSeq)
-         {
-            packetTrainList.pop_front();
-         }
-
-         // Stop
-         break;
-      }
-      // Packet removal was not successful (first train was empty)
-      else
-      {
-         // Erase it
-         packetTrainList.pop_front();
-         // Continue with the NEW first train
-         index = packetTrainList.begin();
-      }
-   }
+   head = (head + 1) & (capacity-1);
+   size--;
 
    // Update firstSeq
-   if (packetTrainList.empty() == true)
+   if (size == 0)
    {
       firstSeq = lastSeq = 0;
    }
    else
    {
-      firstSeq = packetTrainList.front().firstSeq;
+      firstSeq = Packet(0).seq;
    }
-
-   return success;
+   return true;
 }
 
 void PacketTrainList::Print(std::ostream& outStream) const
 {
-   outStream << "firstSeq " << firstSeq << " lastSeq " << lastSeq << " number of packet trains " << packetTrainList.size() << "\n";
+   unsigned long trains = 0;
+   for (unsigned long i=0;i<size;i++)
+   {
+      if (IsTrainEnd(i)) trains++;
+   }
+   outStream << "firstSeq " << firstSeq << " lastSeq " << lastSeq << " number of packet trains " << trains << "\n";
 }
@@ -15,8 +15,9 @@
 #include <staple/Parser.h>
 #include <staple/Staple.h>
 #include <staple/Type.h>
-#include <jni/StapleJniImpl.h>
+#include <jni/EventChannel.h>
 #include <staple/PacketTrainList.h>
+#include <staple/IPv6Registry.h>
 #include <staple/http/HTTPEngine.h>
 
 #include "Util.h"
@@ -30,10 +31,9 @@ void Parser::Init()
 
    lastIPPacketTime.tv_sec = 0;
    lastIPPacketTime.tv_usec = 0;
-   lastTCPTimeoutCheck.tv_sec = 0;
-   lastTCPTimeoutCheck.tv_usec = 0;
-   lastIPTimeoutCheck.tv_sec = 0;
-   lastIPTimeoutCheck.tv_usec = 0;
+   lastTimeoutCheck.tv_sec = 0;
+   lastTimeoutCheck.tv_usec = 0;
+   timeoutFullScan = false;
 
    lastStatusLogTime.tv_sec = 0;
    lastStatusLogTime.tv_usec = 0;
@@ -42,25 +42,50 @@ void Parser::Init()
    perfmonTCPTAPartialFile = NULL;
    perfmonFLVFile = NULL;
    perfmonFLVPartialFile = NULL;
+   perfmonWriter = NULL;
+   eventChannel = NULL;
+
+   // The logfiles are rotated synchronously as the trace time passes the ROP boundaries
+   pTraceClock = NULL;
+   if (staple.traceClockROP)
+   {
+      pTraceClock = &RotationService::Instance();
+      pTraceClock->SetTraceClock();
+   }
 
    hazelcastPublish = false;
    writeToFile = true;
 
    // Initialize perfmon file mutex
    pthread_mutex_init(&perfmonFileMutex, NULL);
+   pPerfmonFileMutex = &perfmonFileMutex;
+
+   writeStatusLog = true;
 }
 
 void Parser::ParsePacket(L2Packet* pL2Packet)
 {
-   IPStats& ipStats = staple.ipStats;
-   TCPStats& tcpStats = staple.tcpStats;
-   UDPStats& udpStats = staple.udpStats;
-   ICMPStats& icmpStats = staple.icmpStats;
-   FLVStats& flvStats = staple.flvStats;
-   MP4Stats& mp4Stats = staple.mp4Stats;
-   
+   UpdateTraceTime(pL2Packet);
+   PeriodicTasks();
+   ParseL3Packet(pL2Packet);
+}
+
+// Parse a batch of packets (the status log and the timeouts are checked once, after the last packet)
+void Parser::ParsePackets(L2Packet** p_pL2Packets, unsigned long p_num)
+{
+   for (unsigned long i=0;i<p_num;i++)
+   {
+      UpdateTraceTime(p_pL2Packets[i]);
+      ParseL3Packet(p_pL2Packets[i]);
+   }
+   if (p_num > 0) PeriodicTasks();
+}
+
+// Advance the trace time to the timestamp of the next packet (detecting timestamp reordering & jumps)
+void Parser::UpdateTraceTime(L2Packet* pL2Packet)
+{
    const unsigned short& logLevel = staple.logLevel;
-   
+
    staple.packetsRead++;
 
    // Initialize trace times
@@ -70,8 +95,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
       staple.actTime = pL2Packet->time;
       staple.actRelTime.tv_sec = 0;
       staple.actRelTime.tv_usec = 0;
-      lastTCPTimeoutCheck = pL2Packet->time;
-      lastIPTimeoutCheck = pL2Packet->time;
+      lastTimeoutCheck = pL2Packet->time;
    }
    // Check timestamp order
    // (TCP_TIMEOUT <= IP_TIMEOUT !!!)
@@ -88,12 +112,9 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
       }
       if (rDiff>=TS_MAJOR_REORDERING_THRESH)
       {
-         // Major reordering -> terminate all HTTP sessions, TCP connections and IP sessions
+         // Major reordering -> terminate all HTTP sessions, check all TCP connections and IP sessions for timeout
          httpEngine.finishAllTCPSessions();
-         lastTCPTimeoutCheck = pL2Packet->time;
-         lastTCPTimeoutCheck.tv_sec -= (TCP_TIMEOUT+1);
-         lastIPTimeoutCheck = pL2Packet->time;
-         lastIPTimeoutCheck.tv_sec -= (IP_TIMEOUT+1);
+         timeoutFullScan = true;
       }
       else
       {
@@ -123,143 +144,40 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
    staple.actTime = pL2Packet->time;
    staple.actRelTime = AbsTimeDiff(staple.traceStartTime, staple.actTime);
 
+   // Switch the logfiles before the first packet of a new ROP is parsed
+   if (pTraceClock != NULL) pTraceClock->AdvanceTraceTime(staple.actTime.tv_sec);
+}
+
+// Write the status log and terminate the timeouted connections if they are due at the actual trace time
+void Parser::PeriodicTasks()
+{
    // Write status log
-   if ((staple.actTime.tv_sec - lastStatusLogTime.tv_sec >= STATUS_LOG_PERIOD) || (lastStatusLogTime.tv_sec == 0))
-   {
-      // Write traffic info
-      unsigned long ipPktNum = ipStats.packetsMatched[0]+ipStats.packetsMatched[1];
-      unsigned long ipKBytes = ipStats.kBytesMatched[0]+ipStats.kBytesMatched[1];
-      // Processing speed
-      struct timeval actRealTime;
-      struct timezone tmpZone;
-      gettimeofday(&actRealTime,&tmpZone);
-      struct timeval timeDiff = AbsTimeDiff(actRealTime, staple.lastRealTime);
-      double tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
-      // Store original format flags
-      std::ios_base::fmtflags origFormat = staple.logStream.flags();
-      int origPrec = staple.logStream.precision();
-      staple.logStream.precision(2);
-      staple.logStream.setf(std::ios::fixed);
-      staple.logStream << staple.actTime.tv_sec << " "
-                       << (((double)(staple.actTime.tv_sec - staple.traceStartTime.tv_sec))/3600) << "h"
-                       << " pkt " << ipPktNum
-                       << " vol " << ((double)ipKBytes/1048576) << "GB"
-                       << " SA-lossDL " << (100*((double)(tcpStats.SYNACKNotFound[0]))/(tcpStats.SYNACKFound[0]+tcpStats.SYNACKNotFound[0])) << "%"
-                       << " SA-lossUL " << (100*((double)(tcpStats.SYNACKNotFound[1]))/(tcpStats.SYNACKFound[1]+tcpStats.SYNACKNotFound[1])) << "%"
-                       << " S-lossDL " << (100*((double)(tcpStats.SYNNotFound[1]))/(tcpStats.SYNFound[1]+tcpStats.SYNNotFound[1])) << "%"
-                       << " S-lossUL " << (100*((double)(tcpStats.SYNNotFound[0]))/(tcpStats.SYNFound[0]+tcpStats.SYNNotFound[0])) << "%"
-                       << " TCP " << (100*(double)(tcpStats.kBytesMatched[0]+tcpStats.kBytesMatched[1])/ipKBytes) << "%"
-                       << " UDP " << (100*(double)(udpStats.kBytesMatched[0]+udpStats.kBytesMatched[1])/ipKBytes) << "%"
-                       << " FLV " << (100*(double)(flvStats.kBytes[0]+flvStats.kBytes[1])/ipKBytes) << "%"
-                       << " HTTP " << (100*(double)(httpEngine.getStats().IPBytes[0]+httpEngine.getStats().IPBytes[1])/1024/ipKBytes) << "%"
-                       << " [" << (ipStats.packetsRead-ipStats.lastPacketsRead)/tDiff << " pkt/s "
-                       << (ipStats.kBytesRead-ipStats.lastKBytesRead)/tDiff << " KB/s]"
-                       << " TCPlr " << (100*(double)(tcpStats.lossReliable)/tcpStats.tcpsSeen) << "%"
-                       << " TCPdo " << (100*(double)(tcpStats.rtxDataOffset)/tcpStats.tcpsSeen) << "%"
-                       << " TCPcl " << (100*(double)(tcpStats.captureLoss)/tcpStats.tcpsSeen) << "%"
-                       << " TANum " << tcpStats.allTCPTALogNum << " 60s " << tcpStats.old60TCPTALogNum;
-
-      tcpStats.SYNNotFound[0]=0;
-      tcpStats.SYNNotFound[1]=0;
-      tcpStats.SYNFound[0]=0;
-      tcpStats.SYNFound[1]=0;
-      tcpStats.SYNACKNotFound[0]=0;
-      tcpStats.SYNACKNotFound[1]=0;
-      tcpStats.SYNACKFound[0]=0;
-      tcpStats.SYNACKFound[1]=0;
-      // Write internal state
-      TCPConnReg::iterator index = staple.tcpConnReg.begin();
-      unsigned long tcpConnNum = staple.tcpConnReg.size();
+   if (writeStatusLog && ((staple.actTime.tv_sec - lastStatusLogTime.tv_sec >= STATUS_LOG_PERIOD) || (lastStatusLogTime.tv_sec == 0)))
+   {
+      unsigned long tcpConnNum;
       unsigned long tcpTANum[2];
       unsigned long flvNum[2];
-      tcpTANum[0] = 0;
-      tcpTANum[1] = 0;
-      flvNum[0] = 0;
-      flvNum[1] = 0;
-      while (index != staple.tcpConnReg.end())
-      {
-         TCPConn& actTCPConn = (index->second);
-         // Update in-session statistics
-         tcpTANum[0] += actTCPConn.transactionList[0].size();
-         tcpTANum[1] += actTCPConn.transactionList[1].size();
-         flvNum[0] += (actTCPConn.flv[0].found) ? 1 : 0;
-         flvNum[1] += (actTCPConn.flv[1].found) ? 1 : 0;
-         index++;
-      }
-      staple.logStream << " #tcp " << tcpConnNum << " #tcpta " << tcpTANum[0] << "/" << tcpTANum[1] << " #flv " << flvNum[0] << "/" << flvNum[1] << "\n";
-      // Revert to original formatting settings
-      staple.logStream.flags(origFormat);
-      staple.logStream.precision(origPrec);
-      // Update state
-      staple.lastRealTime = actRealTime;
-      ipStats.lastPacketsRead = ipStats.packetsRead;
-      ipStats.lastKBytesRead = ipStats.kBytesRead;
-      // Update last log time
-      lastStatusLogTime = staple.actTime;
+      TCPConnMemory tcpMemory;
+      CountConnectionState(tcpConnNum, tcpTANum, flvNum, tcpMemory);
+      WriteStatusLog(tcpConnNum, tcpTANum, flvNum, tcpMemory, httpEngine.getStats());
    }
 
-   // Terminate timeouted TCPs
-   if ((lastTCPTimeoutCheck.tv_sec+TCP_TIMEOUT) < staple.actTime.tv_sec)
+   // Terminate timeouted TCPs and IP sessions (checked once per second)
+   if (staple.actTime.tv_sec != lastTimeoutCheck.tv_sec)
    {
-      struct timeval diffA, diffB;
-      double dA,dB;
-      TCPConnReg::iterator index = staple.tcpConnReg.begin();
-      while (index != staple.tcpConnReg.end())
-      {
-         diffA = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[0]);
-         diffB = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[1]);
-         dA = diffA.tv_sec + (double)diffA.tv_usec/1000000;
-         dB = diffB.tv_sec + (double)diffB.tv_usec/1000000;
-         if ((dA > TCP_TIMEOUT) && (dB > TCP_TIMEOUT))
-         {
-            if (logLevel >= 3)
-            {
-               staple.logStream << "TCP connection timeouted.\n";
-            }
-
-            TCPConnReg::iterator eraseIndex = index++;
-
-            ((*eraseIndex).second).termination = TCPConn::TERM_TO;
-            ReleaseTCPConnection(eraseIndex);
-         }
-         else
-         {
-            index++;
-         }
-      }
-      lastTCPTimeoutCheck = staple.actTime;
+      CheckTimeouts();
    }
+}
 
-   // Terminate timeouted IP sessions
-   if ((lastIPTimeoutCheck.tv_sec+IP_TIMEOUT) < staple.actTime.tv_sec)
-   {
-      struct timeval diffA, diffB;
-      double dA,dB;
-      IPSessionReg::iterator index = staple.ipSessionReg.begin();
-      while (index != staple.ipSessionReg.end())
-      {
-         diffA = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[0]);
-         diffB = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[1]);
-         dA = diffA.tv_sec + (double)diffA.tv_usec/1000000;
-         dB = diffB.tv_sec + (double)diffB.tv_usec/1000000;
-         if ((dA > IP_TIMEOUT) && (dB > IP_TIMEOUT))
-         {
-            if (logLevel >= 3)
-            {
-               staple.logStream << "IP session timeouted.\n";
-            }
-
-            IPSessionReg::iterator eraseIndex = index++;
-
-            ReleaseIPSession(eraseIndex);
-         }
-         else
-         {
-            index++;
-         }
-      }
-      lastIPTimeoutCheck = staple.actTime;
-   }
+void Parser::ParseL3Packet(L2Packet* pL2Packet)
+{
+   IPStats& ipStats = staple.ipStats;
+   TCPStats& tcpStats = staple.tcpStats;
+   UDPStats& udpStats = staple.udpStats;
+   ICMPStats& icmpStats = staple.icmpStats;
+   MP4Stats& mp4Stats = staple.mp4Stats;
+   
+   const unsigned short& logLevel = staple.logLevel;
 
    if (pL2Packet->pL3Packet == NULL)
    {
@@ -283,6 +201,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
          IPPacket& ipPacket = *((IPPacket*)pL3Packet);
 
          ipStats.packetsRead++;
+         if (ipPacket.IPVersion == 6) ipStats.packetsIPv6++;
          ipStats.bytesRead+=ipPacket.IPPktLen;
          if (ipStats.bytesRead>>10 != 0)
          {
@@ -306,6 +225,8 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
             // Calculate IP session key
             IPAddressId ipSessionId;
             ipSessionId.IP = (ipPacket.direction == 0) ? ipPacket.srcIP : ipPacket.dstIP;
+            ipSessionId.IPVersion = ipPacket.IPVersion;
+            ipSessionId.tunnelId = ipPacket.tunnelId;
 
             // Find the IP session
             ipIndex = staple.ipSessionReg.find(ipSessionId);
@@ -334,6 +255,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
             ipSession.lastButOnePacketTime[ipPacket.direction] = ipSession.lastPacketTime[ipPacket.direction];
             ipSession.lastButOnePacketLength[ipPacket.direction] = ipSession.lastPacketLength[ipPacket.direction];
             ipSession.lastPacketTime[ipPacket.direction] = staple.actTime;
+            ipTimerWheel.Link(ipSession.timeoutLink, ipIndex->first, staple.actTime.tv_sec);
             ipSession.lastPacketLength[ipPacket.direction] = ipPacket.IPPktLen;
             ipSession.lastIPIdSeen[ipPacket.direction] = ipPacket.IPId;
 
@@ -456,6 +378,8 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
             tcpConnId.netBIP = (tcpPacket.direction == 0) ? tcpPacket.dstIP : tcpPacket.srcIP;
             tcpConnId.netAPort = (tcpPacket.direction == 0) ? tcpPacket.srcPort : tcpPacket.dstPort;
             tcpConnId.netBPort = (tcpPacket.direction == 0) ? tcpPacket.dstPort : tcpPacket.srcPort;
+            tcpConnId.IPVersion = tcpPacket.IPVersion;
+            tcpConnId.tunnelId = tcpPacket.tunnelId;
 
             // Get IP session (using cached iterator)
             IPSession& ipSession = ipIndex->second;
@@ -877,7 +801,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                               tsRegEntry.tsSeen[0] = ((tcpPacket.options&TCPPacket::TIMESTAMP)!=0) ? true : false;
                               tsRegEntry.tsSeen[1] = false;
                               tsRegEntry.rtxSeen = false;
-                              tcpConn.tsReg[tcpPacket.direction].insert(std::make_pair(tcpPacket.seq,tsRegEntry));
+                              tcpConn.Timestamps().tsReg[tcpPacket.direction].insert(std::make_pair(tcpPacket.seq,tsRegEntry));
                            }
 
                            // Logging
@@ -932,7 +856,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                            if (tcpConn.ongoingTransaction[tcpPacket.direction]==true)
                            {
                               // Get reference to the transaction
-                              TCPTransaction& tcpTA = tcpConn.transactionList[tcpPacket.direction].back();
+                              TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
 
                               struct timeval timeDiff = AbsTimeDiff(staple.actTime, tcpTA.flightSizeLastTime);
                               double tDiff = ((tcpTA.flightSizeLastTime.tv_sec==0) && (tcpTA.flightSizeLastTime.tv_usec==0)) ? 0 :
@@ -944,43 +868,47 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                               tcpTA.flightSizeTimeSum += tDiff;
                            }
                            // Have we already seen it?
-                           std::list<PacketTrain>::iterator overlapIndex;
-                           overlapIndex = tcpConn.packetTrains[tcpPacket.direction].TestPartialOverlap(tcpPacket.seq,tcpPacket.seq+tcpPacket.TCPPLLen);
-                           if (overlapIndex != tcpConn.packetTrains[tcpPacket.direction].packetTrainList.end())
+                           PacketTrainList& packetTrains = tcpConn.packetTrains[tcpPacket.direction];
+                           if (packetTrains.TestPartialOverlap(tcpPacket.seq,tcpPacket.seq+tcpPacket.TCPPLLen) == true)
                            {
                               // If we have an ongoing transaction and we have not reached the slow start end yet -> we reached it now...
-                              if ((tcpConn.ongoingTransaction[tcpPacket.direction] == true) &&
-                              (tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime.tv_sec==0) && (tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime.tv_usec==0))
+                              if (tcpConn.ongoingTransaction[tcpPacket.direction] == true)
                               {
-                                 // Logging
-                                 if (logLevel >= 3)
+                                 // Get reference to the transaction
+                                 TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
+                                 if ((tcpTA.ssEndACKTime.tv_sec==0) && (tcpTA.ssEndACKTime.tv_usec==0))
                                  {
-                                    staple.logStream << " - slow start end reached (AMP loss)";
+                                    // Logging
+                                    if (logLevel >= 3)
+                                    {
+                                       staple.logStream << " - slow start end reached (AMP loss)";
+                                    }
+                                    tcpTA.ssEndACKTime = tcpConn.highestDataACKTime[1-tcpPacket.direction];
+                                    tcpTA.ssEndIPSessionBytes = tcpConn.highestDataACKIPSessionBytes[tcpPacket.direction];
                                  }
-                                 tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime = tcpConn.highestDataACKTime[1-tcpPacket.direction];
-                                 tcpConn.transactionList[tcpPacket.direction].back().ssEndIPSessionBytes = tcpConn.highestDataACKIPSessionBytes[tcpPacket.direction];
                               }
                               // Packet overlaps with the packets seen
                               // -------------------------------------
-                              std::list<PacketTrainTCPPacket>::iterator packetIndex = (*overlapIndex).TestPacket(tcpPacket.seq,tcpPacket.seq+tcpPacket.TCPPLLen);
-                              if (packetIndex != (*overlapIndex).packetList.end())
+                              unsigned long packetIndex = packetTrains.FindPacket(tcpPacket.seq,tcpPacket.seq+tcpPacket.TCPPLLen);
+                              if (packetIndex != PacketTrainList::NONE)
                               {
                                  // Exact match with a packet
                                  // -------------------------
+                                 PacketTrainTCPPacket& packet = packetTrains.Packet(packetIndex);
                                  // Logging
                                  if (logLevel >= 3)
                                  {
                                     staple.logStream << " - already seen";
                                  }
                                  // Look for timestamps for AMP loss validation (if BMP loss not yet detected)
-                                 if ((tcpConn.tsLossReliable==true) && ((*packetIndex).lossInfo != PacketTrainTCPPacket::LOST_BMP))
+                                 if ((tcpConn.tsLossReliable==true) && (packet.lossInfo != PacketTrainTCPPacket::LOST_BMP))
                                  {
                                     // For ambigous retransmissions, update TSReg to find out retransmission necessity later
                                     if (tcpPacket.seq >= tcpConn.highestACKSeen[1-tcpPacket.direction])
                                     {
                                        // Look up the seq in the timestamp registry
-                                       TCPConn::TSReg::iterator tsRegIndex = tcpConn.tsReg[tcpPacket.direction].find(tcpPacket.seq);
-                                       if (tsRegIndex != tcpConn.tsReg[tcpPacket.direction].end())
+                                       TCPConn::TSReg::iterator tsRegIndex = tcpConn.Timestamps().tsReg[tcpPacket.direction].find(tcpPacket.seq);
+                                       if (tsRegIndex != tcpConn.Timestamps().tsReg[tcpPacket.direction].end())
                                        {
                                           TCPConn::TSRegEntry& tsRegEntry = (*tsRegIndex).second;
                                           // If it is the first retransmission, insert retransmission timestamp into the registry
@@ -1008,9 +936,9 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  }
 
                                  // Mark packet as AMP loss candidate (if not lost BMP & not yet marked)
-                                 if (((*packetIndex).lossInfo != PacketTrainTCPPacket::LOST_BMP) && ((*packetIndex).ampLossCandidate == false))
+                                 if ((packet.lossInfo != PacketTrainTCPPacket::LOST_BMP) && (packet.ampLossCandidate == false))
                                  {
-                                    (*packetIndex).ampLossCandidate = true;
+                                    packet.ampLossCandidate = true;
                                     // Logging
                                     if (logLevel >= 3)
                                     {
@@ -1119,7 +1047,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  if (tcpConn.ongoingTransaction[tcpPacket.direction]==true)
                                  {
                                     // Get reference to the transaction
-                                    TCPTransaction& tcpTA = tcpConn.transactionList[tcpPacket.direction].back();
+                                    TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
                                     tcpTA.lossReliable = false;
                                     tcpTA.rtxDataOffset = true;
                                  }
@@ -1173,16 +1101,20 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                               if ((reorderDepth==0) || ((reorderDepth>0)&&(tcpPacket.seq<reorderLowestSeq)))
                               {
                                  // If we have an ongoing transaction and we have not reached the slow start end yet -> we reached it now...
-                                 if ((tcpConn.ongoingTransaction[tcpPacket.direction] == true) &&
-                                 (tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime.tv_sec==0) && (tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime.tv_usec==0))
+                                 if (tcpConn.ongoingTransaction[tcpPacket.direction] == true)
                                  {
-                                    // Logging
-                                    if (logLevel >= 3)
+                                    // Get reference to the transaction
+                                    TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
+                                    if ((tcpTA.ssEndACKTime.tv_sec==0) && (tcpTA.ssEndACKTime.tv_usec==0))
                                     {
-                                       staple.logStream << " - slow start end reached (BMP loss)";
+                                       // Logging
+                                       if (logLevel >= 3)
+                                       {
+                                          staple.logStream << " - slow start end reached (BMP loss)";
+                                       }
+                                       tcpTA.ssEndACKTime = tcpConn.highestDataACKTime[1-tcpPacket.direction];
+                                       tcpTA.ssEndIPSessionBytes = tcpConn.highestDataACKIPSessionBytes[tcpPacket.direction];
                                     }
-                                    tcpConn.transactionList[tcpPacket.direction].back().ssEndACKTime = tcpConn.highestDataACKTime[1-tcpPacket.direction];
-                                    tcpConn.transactionList[tcpPacket.direction].back().ssEndIPSessionBytes = tcpConn.highestDataACKIPSessionBytes[tcpPacket.direction];
                                  }
                                  // Mark packet as lost BMP
                                  tmpPacket.lossInfo = PacketTrainTCPPacket::LOST_BMP;
@@ -1263,7 +1195,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                     tsRegEntry.tsSeen[0] = ((tcpPacket.options&TCPPacket::TIMESTAMP)!=0) ? true : false;
                                     tsRegEntry.tsSeen[1] = false;
                                     tsRegEntry.rtxSeen = false;
-                                    tcpConn.tsReg[tcpPacket.direction].insert(std::make_pair(tcpPacket.seq,tsRegEntry));
+                                    tcpConn.Timestamps().tsReg[tcpPacket.direction].insert(std::make_pair(tcpPacket.seq,tsRegEntry));
                                  }
 
                                  // Logging
@@ -1401,10 +1333,12 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                            }
 
                            // Process timestamps of ACKed packets (AMP loss verification)
-                           if (tcpConn.tsLossReliable==true)
+                           // (an unallocated registry has no entries to process)
+                           if ((tcpConn.tsLossReliable==true) && tcpConn.timestamps.Allocated())
                            {
-                              TCPConn::TSReg::iterator highIndex = tcpConn.tsReg[1-tcpPacket.direction].lower_bound(tcpPacket.ack);
-                              TCPConn::TSReg::iterator actIndex = tcpConn.tsReg[1-tcpPacket.direction].begin();
+                              TCPConn::TSReg& tsReg = tcpConn.Timestamps().tsReg[1-tcpPacket.direction];
+                              TCPConn::TSReg::iterator highIndex = tsReg.lower_bound(tcpPacket.ack);
+                              TCPConn::TSReg::iterator actIndex = tsReg.begin();
                               while (actIndex != highIndex)
                               {
                                  unsigned long actSeq = (*actIndex).first;
@@ -1449,15 +1383,14 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                                 staple.logStream << " - retransmission was necessary (AMP loss)";
                                              }
                                              // Mark the packet as lost AMP (TS-based loss detection)
-                                             std::list<PacketTrain>::iterator overlapIndex = tcpConn.packetTrains[1-tcpPacket.direction].TestPartialOverlap(actSeq,actSeq);
-                                             if (overlapIndex != tcpConn.packetTrains[1-tcpPacket.direction].packetTrainList.end())
+                                             if (tcpConn.packetTrains[1-tcpPacket.direction].TestPartialOverlap(actSeq,actSeq) == true)
                                              {
                                                 // Got the train
-                                                std::list<PacketTrainTCPPacket>::iterator packetIndex = (*overlapIndex).TestPacketSeq(actSeq);
-                                                if (packetIndex != (*overlapIndex).packetList.end())
+                                                unsigned long packetIndex = tcpConn.packetTrains[1-tcpPacket.direction].FindPacketSeq(actSeq);
+                                                if (packetIndex != PacketTrainList::NONE)
                                                 {
                                                    // Got the packet
-                                                   (*packetIndex).lossTSInfo = PacketTrainTCPPacket::LOST_AMP_TS;
+                                                   tcpConn.packetTrains[1-tcpPacket.direction].Packet(packetIndex).lossTSInfo = PacketTrainTCPPacket::LOST_AMP_TS;
                                                 }
                                                 else
                                                 {
@@ -1486,7 +1419,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  // Next entry
                                  TCPConn::TSReg::iterator eraseIndex = actIndex++;
                                  // Erase the processed entry
-                                 tcpConn.tsReg[1-tcpPacket.direction].erase(eraseIndex);
+                                 tsReg.erase(eraseIndex);
                               }
                            }
 
@@ -1513,19 +1446,18 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  staple.logStream << " - retransmission state: checking packet with seq " << tcpConn.highestACKSeen[tcpPacket.direction];
                               }
                               // Check the packet that the >>>last<<< ACK requested
-                              std::list<PacketTrain>::iterator overlapIndex;
-                              overlapIndex = tcpConn.packetTrains[1-tcpPacket.direction].TestPartialOverlap(tcpConn.highestACKSeen[tcpPacket.direction],tcpConn.highestACKSeen[tcpPacket.direction]);
-                              if (overlapIndex != tcpConn.packetTrains[1-tcpPacket.direction].packetTrainList.end())
+                              PacketTrainList& packetTrains = tcpConn.packetTrains[1-tcpPacket.direction];
+                              if (packetTrains.TestPartialOverlap(tcpConn.highestACKSeen[tcpPacket.direction],tcpConn.highestACKSeen[tcpPacket.direction]) == true)
                               {
                                  // Got the train
-                                 std::list<PacketTrainTCPPacket>::iterator packetIndex = (*overlapIndex).TestPacketSeq(tcpConn.highestACKSeen[tcpPacket.direction]);
-                                 if (packetIndex != (*overlapIndex).packetList.end())
+                                 unsigned long packetIndex = packetTrains.FindPacketSeq(tcpConn.highestACKSeen[tcpPacket.direction]);
+                                 if (packetIndex != PacketTrainList::NONE)
                                  {
                                     // Got the packet
-                                    if ((*packetIndex).ampLossCandidate == true)
+                                    if (packetTrains.Packet(packetIndex).ampLossCandidate == true)
                                     {
                                        // Mark packet as lost AMP
-                                       (*packetIndex).lossInfo = PacketTrainTCPPacket::LOST_AMP;
+                                       packetTrains.Packet(packetIndex).lossInfo = PacketTrainTCPPacket::LOST_AMP;
                                        // Logging
                                        if (logLevel >= 3)
                                        {
@@ -1543,7 +1475,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                     if (tcpConn.ongoingTransaction[1-tcpPacket.direction]==true)
                                     {
                                        // Get reference to the transaction
-                                       TCPTransaction& tcpTA = tcpConn.transactionList[1-tcpPacket.direction].back();
+                                       TCPTransaction& tcpTA = tcpConn.History().transactionList[1-tcpPacket.direction].back();
                                        tcpTA.lossReliable = false;
                                        tcpTA.rtxDataOffset = true;
                                     }
@@ -1564,7 +1496,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  if (tcpConn.ongoingTransaction[1-tcpPacket.direction]==true)
                                  {
                                     // Get reference to the transaction
-                                    TCPTransaction& tcpTA = tcpConn.transactionList[1-tcpPacket.direction].back();
+                                    TCPTransaction& tcpTA = tcpConn.History().transactionList[1-tcpPacket.direction].back();
                                     tcpTA.lossReliable = false;
                                     tcpTA.captureLoss = true;
                                  }
@@ -1646,14 +1578,15 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                               #ifdef WRITE_TCPTA_FILES
                                  if (tcpConn.ongoingTransaction[1-tcpPacket.direction]==true)
                                  {
+                                    FILE* logfile = tcpConn.History().transactionList[1-tcpPacket.direction].back().logfile;
                                     double t = actRelTime.tv_sec + (double)actRelTime.tv_usec/1e6;
                                     if ((ipSessionByteACKed!=0) && (tcpConn.inRTTCalcState[1-tcpPacket.direction]) && (tcpPacket.ack > tcpConn.firstRTTCalcSeq[1-tcpPacket.direction]))
                                     {
-                                       fprintf (tcpConn.transactionList[1-tcpPacket.direction].back().logfile, "%f 1 %u\n", t, (tcpConn.highestExpectedSeq[1-tcpPacket.direction] - tcpConn.highestDataACKSeen[tcpPacket.direction]));
+                                       fprintf (logfile, "%f 1 %u\n", t, (tcpConn.highestExpectedSeq[1-tcpPacket.direction] - tcpConn.highestDataACKSeen[tcpPacket.direction]));
                                     }
                                     else
                                     {
-                                       fprintf (tcpConn.transactionList[1-tcpPacket.direction].back().logfile, "%f 0 0\n", t);
+                                       fprintf (logfile, "%f 0 0\n", t);
                                     }
                                  }
                               #endif
@@ -1768,16 +1701,16 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  // Update min. & max. RTT for the ongoing transactions
                                  for (int TADir=0;TADir<2;TADir++)
                                  {
-                                    if ((tcpConn.ongoingTransaction[TADir] == true) &&
-                                    ((tcpConn.transactionList[TADir].back().minRTT[tcpPacket.direction]==-1) ||
-                                    (tcpConn.transactionList[TADir].back().minRTT[tcpPacket.direction]>rtt)))
+                                    if (tcpConn.ongoingTransaction[TADir] == false) continue;
+                                    // Get reference to the transaction
+                                    TCPTransaction& tcpTA = tcpConn.History().transactionList[TADir].back();
+                                    if ((tcpTA.minRTT[tcpPacket.direction]==-1) || (tcpTA.minRTT[tcpPacket.direction]>rtt))
                                     {
-                                       tcpConn.transactionList[TADir].back().minRTT[tcpPacket.direction] = rtt;
+                                       tcpTA.minRTT[tcpPacket.direction] = rtt;
                                     }
-                                    if ((tcpConn.ongoingTransaction[TADir] == true) &&
-                                    (tcpConn.transactionList[TADir].back().maxRTT[tcpPacket.direction]<rtt))
+                                    if (tcpTA.maxRTT[tcpPacket.direction]<rtt)
                                     {
-                                       tcpConn.transactionList[TADir].back().maxRTT[tcpPacket.direction] = rtt;
+                                       tcpTA.maxRTT[tcpPacket.direction] = rtt;
                                     }
                                  }
 
@@ -1805,17 +1738,20 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                               // Update transaction (only after SEQ-IPSessionByte shrinking???)
                               if (tcpConn.ongoingTransaction[1-tcpPacket.direction] == true)
                               {
+                                 // Get reference to the transaction
+                                 TCPConnHistory& history = tcpConn.History();
+                                 TCPTransaction& tcpTA = history.transactionList[1-tcpPacket.direction].back();
                                  // Update first data ACK
-                                 if ((tcpConn.transactionList[1-tcpPacket.direction].back().firstDataACKTime.tv_sec==0) && (tcpConn.transactionList[1-tcpPacket.direction].back().firstDataACKTime.tv_usec==0))
+                                 if ((tcpTA.firstDataACKTime.tv_sec==0) && (tcpTA.firstDataACKTime.tv_usec==0))
                                  {
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().firstDataACKTime = staple.actTime;
+                                    tcpTA.firstDataACKTime = staple.actTime;
                                     // Store info for reverse byte counts & TP calculation
-                                    tcpConn.TAFirstIPByte[1-tcpPacket.direction][tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction]-tcpPacket.IPPktLen;
-                                    tcpConn.TAFirstIPSessionByte[1-tcpPacket.direction][tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction]-tcpPacket.IPPktLen;
+                                    history.TAFirstIPByte[1-tcpPacket.direction][tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction]-tcpPacket.IPPktLen;
+                                    history.TAFirstIPSessionByte[1-tcpPacket.direction][tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction]-tcpPacket.IPPktLen;
                                     // First DATA ACK candidate for the TCP TA TP report
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstTime = staple.actTime;
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstIPByte = tcpConn.TAFirstIPByte[1-tcpPacket.direction][1-tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstIPSessionByte = tcpConn.TAFirstIPSessionByte[1-tcpPacket.direction][1-tcpPacket.direction];
+                                    tcpTA.reportFirstTime = staple.actTime;
+                                    tcpTA.reportFirstIPByte = history.TAFirstIPByte[1-tcpPacket.direction][1-tcpPacket.direction];
+                                    tcpTA.reportFirstIPSessionByte = history.TAFirstIPSessionByte[1-tcpPacket.direction][1-tcpPacket.direction];
                                     if (logLevel >= 3)
                                     {
                                        staple.logStream << " - TCP TA report first ACK candidate stored";
@@ -1825,17 +1761,17 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  else
                                  {
                                     // Calculate time difference to the first DATA ACK
-                                    struct timeval ackTimeDiff = AbsTimeDiff(staple.actTime,tcpConn.transactionList[1-tcpPacket.direction].back().firstDataACKTime);
+                                    struct timeval ackTimeDiff = AbsTimeDiff(staple.actTime,tcpTA.firstDataACKTime);
                                     double ackTDiff = ackTimeDiff.tv_sec + (double)ackTimeDiff.tv_usec/1000000;
                                     // Update the first ACK of the TCP TA report (if needed)
-                                    if ((tcpConn.transactionList[1-tcpPacket.direction].back().reportStartValid==false) && (ipSessionByteACKed>0))
+                                    if ((tcpTA.reportStartValid==false) && (ipSessionByteACKed>0))
                                     {
                                        if (ackTDiff<ACK_COMPRESSION_TIME)
                                        {
                                           // ACK compression: update the candidate ACK info
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstTime = staple.actTime;
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstIPByte = ipByteACKed;
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstIPSessionByte = ipSessionByteACKed;
+                                          tcpTA.reportFirstTime = staple.actTime;
+                                          tcpTA.reportFirstIPByte = ipByteACKed;
+                                          tcpTA.reportFirstIPSessionByte = ipSessionByteACKed;
                                           if (logLevel >= 3)
                                           {
                                              staple.logStream << " - ACK compression: storing new TCP TA report first ACK candidate";
@@ -1844,19 +1780,19 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                        else
                                        {
                                           // No ACK compression: the previous ACK is the right one!
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportStartValid=true;
+                                          tcpTA.reportStartValid=true;
                                           if (logLevel >= 3)
                                           {
                                              staple.logStream << " - TCP TA report first ACK validated";
                                           }
                                           // If slow start end is already reached (the first packet was retransmitted) corrigate ssEnd (so that it will not be earlier than first report start time)
-                                          if ((tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_sec!=0) || (tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_usec!=0))
+                                          if ((tcpTA.ssEndACKTime.tv_sec!=0) || (tcpTA.ssEndACKTime.tv_usec!=0))
                                           {
                                              // Slow start end is first report start time
-                                             tcpConn.transactionList[1-tcpPacket.direction].back().ssEndIPSessionBytes = tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstIPSessionByte;
-                                             tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime = tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstTime;
-                                             tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_usec += 1000; // not to confuse etambor scripts
-                                             tcpConn.transactionList[1-tcpPacket.direction].back().ssEndValid=true;
+                                             tcpTA.ssEndIPSessionBytes = tcpTA.reportFirstIPSessionByte;
+                                             tcpTA.ssEndACKTime = tcpTA.reportFirstTime;
+                                             tcpTA.ssEndACKTime.tv_usec += 1000; // not to confuse etambor scripts
+                                             tcpTA.ssEndValid=true;
                                              if (logLevel >= 3)
                                              {
                                                 staple.logStream << " - slow start end shifted past the TCP TA report first ACK";
@@ -1865,17 +1801,17 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                        }
                                     }
                                     // Slow start end candidate already found?
-                                    if (((tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_sec!=0) || (tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_usec!=0)) &&
-                                       (tcpConn.transactionList[1-tcpPacket.direction].back().ssEndValid==false) && (ipSessionByteACKed>0))
+                                    if (((tcpTA.ssEndACKTime.tv_sec!=0) || (tcpTA.ssEndACKTime.tv_usec!=0)) &&
+                                       (tcpTA.ssEndValid==false) && (ipSessionByteACKed>0))
                                     {
-                                       ackTimeDiff = AbsTimeDiff(staple.actTime,tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime);
+                                       ackTimeDiff = AbsTimeDiff(staple.actTime,tcpTA.ssEndACKTime);
                                        ackTDiff = ackTimeDiff.tv_sec + (double)ackTimeDiff.tv_usec/1000000;
                                        // Check for ACK compression at the slow start end
                                        if (ackTDiff<ACK_COMPRESSION_TIME)
                                        {
                                           // ACK compression: we have a new candidate
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().ssEndIPSessionBytes = ipSessionByteACKed;
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime = staple.actTime;
+                                          tcpTA.ssEndIPSessionBytes = ipSessionByteACKed;
+                                          tcpTA.ssEndACKTime = staple.actTime;
                                           if (logLevel >= 3)
                                           {
                                              staple.logStream << " - ACK compression: storing new slow start end candidate";
@@ -1884,7 +1820,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                        else
                                        {
                                           // No ACK compression: the previous ACK is the right one!
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().ssEndValid=true;
+                                          tcpTA.ssEndValid=true;
                                           if (logLevel >= 3)
                                           {
                                              staple.logStream << " - slow start end validated";
@@ -1896,8 +1832,8 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  if (ipSessionByteACKed!=0)
                                  {
                                     // Update ssEndACKTime
-                                    if (((tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_sec==0) &&
-                                    (tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_usec==0)) &&
+                                    if (((tcpTA.ssEndACKTime.tv_sec==0) &&
+                                    (tcpTA.ssEndACKTime.tv_usec==0)) &&
                                     (tcpConn.highestExpectedDataSeq[1-tcpPacket.direction]-tcpConn.highestDataACKSeen[tcpPacket.direction]>TCPTA_SSMAXFS))
                                     {
                                        // Logging
@@ -1906,48 +1842,48 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                           staple.logStream << " - slow start end reached (flight size)";
                                        }
 
-                                       tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime = staple.actTime;
-                                       tcpConn.transactionList[1-tcpPacket.direction].back().ssEndIPSessionBytes = ipSessionByteACKed;
+                                       tcpTA.ssEndACKTime = staple.actTime;
+                                       tcpTA.ssEndIPSessionBytes = ipSessionByteACKed;
                                     }
-                                    if (((tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_sec==0) &&
-                                    (tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime.tv_usec==0)) &&
-                                    (tcpPacket.ack >= tcpConn.transactionList[1-tcpPacket.direction].back().firstDataPacketSeq + TCPTA_SSTHRESH))
+                                    if (((tcpTA.ssEndACKTime.tv_sec==0) &&
+                                    (tcpTA.ssEndACKTime.tv_usec==0)) &&
+                                    (tcpPacket.ack >= tcpTA.firstDataPacketSeq + TCPTA_SSTHRESH))
                                     {
                                        // Logging
                                        if (logLevel >= 3)
                                        {
                                           staple.logStream << " - slow start end reached (byte limit)";
                                        }
-                                       tcpConn.transactionList[1-tcpPacket.direction].back().ssEndACKTime = staple.actTime;
-                                       tcpConn.transactionList[1-tcpPacket.direction].back().ssEndIPSessionBytes = ipSessionByteACKed;
+                                       tcpTA.ssEndACKTime = staple.actTime;
+                                       tcpTA.ssEndIPSessionBytes = ipSessionByteACKed;
                                     }
                                     // Update last but highest data ACK
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKTime = tcpConn.transactionList[1-tcpPacket.direction].back().highestDataACKTime;
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKSeen = tcpConn.transactionList[1-tcpPacket.direction].back().highestDataACKSeen;
+                                    tcpTA.lastButHighestDataACKTime = tcpTA.highestDataACKTime;
+                                    tcpTA.lastButHighestDataACKSeen = tcpTA.highestDataACKSeen;
                                     // Update highest data ACK
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestDataACKTime = staple.actTime;
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestDataACKSeen = tcpConn.highestDataACKSeen[tcpPacket.direction];
+                                    tcpTA.highestDataACKTime = staple.actTime;
+                                    tcpTA.highestDataACKSeen = tcpConn.highestDataACKSeen[tcpPacket.direction];
                                     // Update IPSessionBytes
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPSessionByte[1-tcpPacket.direction] = tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPSessionByte[1-tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPSessionByte[tcpPacket.direction] = tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPSessionByte[tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPSessionByte[1-tcpPacket.direction] = ipSessionByteACKed;
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPSessionByte[tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPByte[1-tcpPacket.direction] = tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPByte[1-tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPByte[tcpPacket.direction] = tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPByte[tcpPacket.direction];
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPByte[1-tcpPacket.direction] = ipByteACKed;
-                                    tcpConn.transactionList[1-tcpPacket.direction].back().highestACKedIPByte[tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction];
+                                    tcpTA.lastButHighestACKedIPSessionByte[1-tcpPacket.direction] = tcpTA.highestACKedIPSessionByte[1-tcpPacket.direction];
+                                    tcpTA.lastButHighestACKedIPSessionByte[tcpPacket.direction] = tcpTA.highestACKedIPSessionByte[tcpPacket.direction];
+                                    tcpTA.highestACKedIPSessionByte[1-tcpPacket.direction] = ipSessionByteACKed;
+                                    tcpTA.highestACKedIPSessionByte[tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction];
+                                    tcpTA.lastButHighestACKedIPByte[1-tcpPacket.direction] = tcpTA.highestACKedIPByte[1-tcpPacket.direction];
+                                    tcpTA.lastButHighestACKedIPByte[tcpPacket.direction] = tcpTA.highestACKedIPByte[tcpPacket.direction];
+                                    tcpTA.highestACKedIPByte[1-tcpPacket.direction] = ipByteACKed;
+                                    tcpTA.highestACKedIPByte[tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction];
                                     // Last but highest DATA ACK already seen?
-                                    if ((tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKTime.tv_sec!=0) || (tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKTime.tv_usec!=0))
+                                    if ((tcpTA.lastButHighestDataACKTime.tv_sec!=0) || (tcpTA.lastButHighestDataACKTime.tv_usec!=0))
                                     {
-                                       struct timeval ackTimeDiff = AbsTimeDiff(tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKTime, tcpConn.transactionList[1-tcpPacket.direction].back().highestDataACKTime);
+                                       struct timeval ackTimeDiff = AbsTimeDiff(tcpTA.lastButHighestDataACKTime, tcpTA.highestDataACKTime);
                                        double ackTDiff = ackTimeDiff.tv_sec + (double)ackTimeDiff.tv_usec/1000000;
                                        // ACK compression?
                                        if (ackTDiff>=ACK_COMPRESSION_TIME)
                                        {
                                           // No ACK compression: update TCP TA report end time
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportLastTime = tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestDataACKTime;
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportLastIPByte = tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPByte[1-tcpPacket.direction];
-                                          tcpConn.transactionList[1-tcpPacket.direction].back().reportLastIPSessionByte = tcpConn.transactionList[1-tcpPacket.direction].back().lastButHighestACKedIPSessionByte[1-tcpPacket.direction];
+                                          tcpTA.reportLastTime = tcpTA.lastButHighestDataACKTime;
+                                          tcpTA.reportLastIPByte = tcpTA.lastButHighestACKedIPByte[1-tcpPacket.direction];
+                                          tcpTA.reportLastIPSessionByte = tcpTA.lastButHighestACKedIPSessionByte[1-tcpPacket.direction];
                                           if (logLevel >= 3)
                                           {
                                              staple.logStream << " - TCP TA report end updated (no ACK compression)";
@@ -1955,32 +1891,29 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                        }
                                     }
                                     // Print transaction progress report periodically (if we have a valid report start & end time)
-                                    if (((tcpConn.transactionList[1-tcpPacket.direction].back().reportLastTime.tv_sec!=0) || (tcpConn.transactionList[1-tcpPacket.direction].back().reportLastTime.tv_usec!=0)) &&
-                                    (tcpConn.transactionList[1-tcpPacket.direction].back().reportStartValid==true))
+                                    if (((tcpTA.reportLastTime.tv_sec!=0) || (tcpTA.reportLastTime.tv_usec!=0)) &&
+                                    (tcpTA.reportStartValid==true))
                                     {
                                        struct timeval timeDiff;
-                                       if ((tcpConn.transactionList[1-tcpPacket.direction].back().lastReport.time.tv_sec==0) && (tcpConn.transactionList[1-tcpPacket.direction].back().lastReport.time.tv_usec==0))
+                                       if ((tcpTA.lastReport.time.tv_sec==0) && (tcpTA.lastReport.time.tv_usec==0))
                                        {
                                           // First progress report
-                                          timeDiff = AbsTimeDiff(tcpConn.transactionList[1-tcpPacket.direction].back().reportLastTime, tcpConn.transactionList[1-tcpPacket.direction].back().reportFirstTime);
+                                          timeDiff = AbsTimeDiff(tcpTA.reportLastTime, tcpTA.reportFirstTime);
                                        }
                                        else
                                        {
                                           // Not the first progress report
-                                          timeDiff = AbsTimeDiff(tcpConn.transactionList[1-tcpPacket.direction].back().reportLastTime, tcpConn.transactionList[1-tcpPacket.direction].back().lastReport.time);
+                                          timeDiff = AbsTimeDiff(tcpTA.reportLastTime, tcpTA.lastReport.time);
                                        }
                                        double tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
                                        if (tDiff >= TCPTA_ROP)
                                        {
-                                          PrintTCPTAStatistics(tcpIndex,tcpConn.transactionList[1-tcpPacket.direction].back(),1-tcpPacket.direction,false,false);
+                                          PrintTCPTAStatistics(tcpIndex,tcpTA,1-tcpPacket.direction,false,false);
                                        }
                                     }
                                  }
                                  if ((tcpConn.ongoingTransaction[1-tcpPacket.direction]==true) && (tcpConn.sndLossState[1-tcpPacket.direction]==TCPConn::NORMAL))
                                  {
-                                    // Get reference to the transaction
-                                    TCPTransaction& tcpTA = tcpConn.transactionList[1-tcpPacket.direction].back();
-
                                     struct timeval timeDiff = AbsTimeDiff(staple.actTime,tcpTA.flightSizeLastTime);
                                     double tDiff = ((tcpTA.flightSizeLastTime.tv_sec==0) && (tcpTA.flightSizeLastTime.tv_usec==0)) ? 0 :
                                                    (timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000);
@@ -1992,7 +1925,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
                                  }
                                  // Finish transaction if necessary
                                  if ((tcpPacket.ack >= tcpConn.highestExpectedSeq[1-tcpPacket.direction]) &&
-                                 (((tcpConn.nonPSHDataPacketSeen[1-tcpPacket.direction] == true) && (tcpConn.transactionList[1-tcpPacket.direction].back().highestSeqIPLength <= tcpConn.maxDataPacketIPLen[1-tcpPacket.direction]-40)) ||
+                                 (((tcpConn.nonPSHDataPacketSeen[1-tcpPacket.direction] == true) && (tcpTA.highestSeqIPLength <= tcpConn.maxDataPacketIPLen[1-tcpPacket.direction]-40)) ||
                                  (tcpConn.nonPSHDataPacketSeen[1-tcpPacket.direction] == false)))
                                  {
                                     FinishTCPTransaction(tcpIndex,ipSession,1-tcpPacket.direction);
@@ -2050,6 +1983,7 @@ void Parser::ParsePacket(L2Packet* pL2Packet)
 
                // Store last packet time
                tcpConn.lastPacketTime[tcpPacket.direction] = staple.actTime;
+               tcpTimerWheel.Link(tcpConn.timeoutLink, tcpIndex->first, staple.actTime.tv_sec);
 
                // Store last window size (for dupACK<->window update differentiation)
                tcpConn.lastWndSize[tcpPacket.direction] = tcpPacket.rwnd;
@@ -2134,22 +2068,24 @@ void Parser::HighestSeqTCPDataPacket(TCPPacket& tcpPacket, TCPConnReg::iterator&
       newTA.Init();
       newTA.firstDataPacketTime = staple.actTime;
       newTA.firstDataPacketSeq = tcpPacket.seq;
-      tcpConn.TAFirstIPByte[tcpPacket.direction][tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction]-tcpPacket.IPPktLen;
-      tcpConn.TAFirstIPSessionByte[tcpPacket.direction][tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction]-tcpPacket.IPPktLen;
-      tcpConn.TAFirstSmallPipeRTT[tcpPacket.direction][0] = tcpConn.smallPipeRTT[0];
-      tcpConn.TAFirstSmallPipeRTT[tcpPacket.direction][1] = tcpConn.smallPipeRTT[1];
-      tcpConn.TAFirstSmallPipeRTTSamples[tcpPacket.direction][0] = tcpConn.smallPipeRTTSamples[0];
-      tcpConn.TAFirstSmallPipeRTTSamples[tcpPacket.direction][1] = tcpConn.smallPipeRTTSamples[1];
-      tcpConn.TAFirstLargePipeRTT[tcpPacket.direction][0] = tcpConn.largePipeRTT[0];
-      tcpConn.TAFirstLargePipeRTT[tcpPacket.direction][1] = tcpConn.largePipeRTT[1];
-      tcpConn.TAFirstLargePipeRTTSamples[tcpPacket.direction][0] = tcpConn.largePipeRTTSamples[0];
-      tcpConn.TAFirstLargePipeRTTSamples[tcpPacket.direction][1] = tcpConn.largePipeRTTSamples[1];
-      bool firstTA=tcpConn.transactionList[tcpPacket.direction].empty();
+      TCPConnHistory& history = tcpConn.History();
+      history.TAFirstIPByte[tcpPacket.direction][tcpPacket.direction] = tcpConn.IPBytes[tcpPacket.direction]-tcpPacket.IPPktLen;
+      history.TAFirstIPSessionByte[tcpPacket.direction][tcpPacket.direction] = ipSession.bytesSeen[tcpPacket.direction]-tcpPacket.IPPktLen;
+      history.TAFirstSmallPipeRTT[tcpPacket.direction][0] = tcpConn.smallPipeRTT[0];
+      history.TAFirstSmallPipeRTT[tcpPacket.direction][1] = tcpConn.smallPipeRTT[1];
+      history.TAFirstSmallPipeRTTSamples[tcpPacket.direction][0] = tcpConn.smallPipeRTTSamples[0];
+      history.TAFirstSmallPipeRTTSamples[tcpPacket.direction][1] = tcpConn.smallPipeRTTSamples[1];
+      history.TAFirstLargePipeRTT[tcpPacket.direction][0] = tcpConn.largePipeRTT[0];
+      history.TAFirstLargePipeRTT[tcpPacket.direction][1] = tcpConn.largePipeRTT[1];
+      history.TAFirstLargePipeRTTSamples[tcpPacket.direction][0] = tcpConn.largePipeRTTSamples[0];
+      history.TAFirstLargePipeRTTSamples[tcpPacket.direction][1] = tcpConn.largePipeRTTSamples[1];
+      bool firstTA=history.transactionList[tcpPacket.direction].empty();
 
       // Open TCP TA file
       #ifdef WRITE_TCPTA_FILES
-         char ta_name[200];
-         sprintf(ta_name, "%s/%u.%u.%u.%u_%u-%u.%u.%u.%u_%u-%u.TAlog",perfmonDirName.c_str(),tcpConnId.netAIP.byte[3], tcpConnId.netAIP.byte[2], tcpConnId.netAIP.byte[1], tcpConnId.netAIP.byte[0],tcpConnId.netAPort,tcpConnId.netBIP.byte[3], tcpConnId.netBIP.byte[2], tcpConnId.netBIP.byte[1], tcpConnId.netBIP.byte[0],tcpConnId.netBPort,tcpPacket.seq);
+         char ta_name[300];
+         char netAIPStr[IP_ADDRESS_STRLEN], netBIPStr[IP_ADDRESS_STRLEN];
+         sprintf(ta_name, "%s/%s_%u-%s_%u-%u.TAlog",perfmonDirName.c_str(),FormatIPAddress(netAIPStr, tcpConnId.IPVersion, tcpConnId.netAIP),tcpConnId.netAPort,FormatIPAddress(netBIPStr, tcpConnId.IPVersion, tcpConnId.netBIP),tcpConnId.netBPort,tcpPacket.seq);
          newTA.logfile = fopen(ta_name,"w");
          if (newTA.logfile==NULL)
          {
@@ -2165,7 +2101,7 @@ void Parser::HighestSeqTCPDataPacket(TCPPacket& tcpPacket, TCPConnReg::iterator&
       (tcpPacket.payload[4]==0x07) &&
       (tcpPacket.payload[5]==0x00))
       {
-         tcpConn.isTorrent = true;
+         tcpConn.Content().isTorrent = true;
          if (staple.logLevel >= 3)
          {
             staple.logStream << " - BitTorrent piece found";
@@ -2173,11 +2109,14 @@ void Parser::HighestSeqTCPDataPacket(TCPPacket& tcpPacket, TCPConnReg::iterator&
       }
 
       // Add last HTTP request URI, host, and content-type to the transaction
-      newTA.lastRevReqURI = tcpConn.lastReqURI[1-tcpPacket.direction];
-      newTA.lastRevReqHost = tcpConn.lastReqHost[1-tcpPacket.direction];
-      newTA.contentType = tcpConn.contentType;
+      if (tcpConn.content.Allocated())
+      {
+         newTA.lastRevReqURI = tcpConn.content.Ptr()->lastReqURI[1-tcpPacket.direction];
+         newTA.lastRevReqHost = tcpConn.content.Ptr()->lastReqHost[1-tcpPacket.direction];
+         newTA.contentType = tcpConn.content.Ptr()->contentType;
+      }
 
-      tcpConn.transactionList[tcpPacket.direction].push_back(newTA);
+      history.transactionList[tcpPacket.direction].push_back(newTA);
       tcpConn.ongoingTransaction[tcpPacket.direction] = true;
       // Logging
       if (staple.logLevel >= 3)
@@ -2189,8 +2128,10 @@ void Parser::HighestSeqTCPDataPacket(TCPPacket& tcpPacket, TCPConnReg::iterator&
    // Update transaction with the highest seq. IP packet size & TCP flags (to determine end)
    if (tcpConn.ongoingTransaction[tcpPacket.direction] == true)
    {
-      tcpConn.transactionList[tcpPacket.direction].back().highestSeqIPLength = tcpPacket.IPPktLen;
-      tcpConn.transactionList[tcpPacket.direction].back().highestSeqTCPFlags = tcpPacket.TCPFlags;
+      // Get reference to the transaction
+      TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
+      tcpTA.highestSeqIPLength = tcpPacket.IPPktLen;
+      tcpTA.highestSeqTCPFlags = tcpPacket.TCPFlags;
    }
 
    // Enter RTT calc state
@@ -2219,7 +2160,7 @@ void Parser::HighestSeqTCPDataPacket(TCPPacket& tcpPacket, TCPConnReg::iterator&
    if ((tcpConn.ongoingTransaction[tcpPacket.direction]==true) && (tcpConn.sndLossState[tcpPacket.direction]==TCPConn::NORMAL))
    {
       // Get reference to the transaction
-      TCPTransaction& tcpTA = tcpConn.transactionList[tcpPacket.direction].back();
+      TCPTransaction& tcpTA = tcpConn.History().transactionList[tcpPacket.direction].back();
 
       struct timeval timeDiff = AbsTimeDiff(staple.actTime,tcpTA.flightSizeLastTime);
       double tDiff = ((tcpTA.flightSizeLastTime.tv_sec==0) && (tcpTA.flightSizeLastTime.tv_usec==0)) ? 0 :
@@ -2342,7 +2283,7 @@ void Parser::TCPPayloadACKed(TCPConnReg::iterator& tcpACKIndex, TCPPacket& tcpPa
          (plCache[plPos+4]=='m') && (plCache[plPos+5]=='p') && (plCache[plPos+6]=='4') && (plCache[plPos+7]=='2'))
          {
             // Signature found
-            tcpConn.mp4[1-tcpPacket.direction].found=true;
+            tcpConn.Content().mp4[1-tcpPacket.direction].found=true;
             tcpConn.contentFound[1-tcpPacket.direction]=true;
             mp4Stats.sessionsSeen[1-tcpPacket.direction]++;
             // Free up payload cache (we do not decode MP4 yet)
@@ -2351,19 +2292,19 @@ void Parser::TCPPayloadACKed(TCPConnReg::iterator& tcpACKIndex, TCPPacket& tcpPa
             if (staple.logLevel >= FLVLOGLEVEL) staple.logStream << " - MP4 signature found";
 staple.logStream << "MP4 video starts\n";
 tcpConnId.Print(staple.logStream);
-staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n";
+staple.logStream << " - URI: " << tcpConn.Content().lastReqURI[tcpPacket.direction] << "\n";
             break;
          }
          // Look for FLV signature in the first FLV_SIGNATURE_LIMIT bytes
          if ((plPos<FLV_SIGNATURE_LIMIT) && (plCache[plPos]=='F') && (plCache[plPos+1]=='L') && (plCache[plPos+2]=='V'))
          {
             // Signature found
-            tcpConn.flv[1-tcpPacket.direction].found=true;
+            tcpConn.Content().flv[1-tcpPacket.direction].found=true;
             tcpConn.contentFound[1-tcpPacket.direction]=true;
             flvStats.sessionsSeen[1-tcpPacket.direction]++;
             // Store FLV signature position & FLV start time
-            tcpConn.flv[1-tcpPacket.direction].startPos=plPos;
-            tcpConn.flv[1-tcpPacket.direction].startTime=staple.actTime;
+            tcpConn.Content().flv[1-tcpPacket.direction].startPos=plPos;
+            tcpConn.Content().flv[1-tcpPacket.direction].startTime=staple.actTime;
             // Increase payload cache size (to accomodate whole FLV frames later)
             plCache.Extend(TCP_PL_CACHE_NORMAL_SIZE);
             // We processed the FLV signature
@@ -2374,7 +2315,7 @@ staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n
             if (staple.logLevel >= FLVLOGLEVEL) staple.logStream << " - FLV signature found";
 staple.logStream << "Flash video starts\n";
 tcpConnId.Print(staple.logStream);
-staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n";
+staple.logStream << " - URI: " << tcpConn.Content().lastReqURI[tcpPacket.direction] << "\n";
             break;
          }
          plPos++;
@@ -2386,9 +2327,9 @@ staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n
    // ==============
    // FLV BODY processing
    // -------------------
-   if (tcpConn.flv[1-tcpPacket.direction].found==true)
+   if (tcpConn.content.Allocated() && (tcpConn.Content().flv[1-tcpPacket.direction].found==true))
    {
-      FLV& flv = tcpConn.flv[1-tcpPacket.direction];
+      FLV& flv = tcpConn.Content().flv[1-tcpPacket.direction];
       // Decode FLV header
       // -----------------
       if (plPos == (flv.startPos+3))
@@ -2405,7 +2346,7 @@ staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n
             if (version != 1)
             {
                // Stop & revert FLV processing
-               tcpConn.flv[1-tcpPacket.direction].found=false;
+               flv.found=false;
                flvStats.sessionsSeen[1-tcpPacket.direction]--;
                if (plCache.size>0) plCache.Free();
                // Logging
@@ -2427,7 +2368,7 @@ staple.logStream << " - URI: " << tcpConn.lastReqURI[tcpPacket.direction] << "\n
             if (dataOffset > 1e7)
             {
                // Stop & revert FLV processing
-               tcpConn.flv[1-tcpPacket.direction].found=false;
+               flv.found=false;
                flvStats.sessionsSeen[1-tcpPacket.direction]--;
                if (plCache.size>0) plCache.Free();
                // Logging
@@ -2620,6 +2561,7 @@ bool Parser::ReleaseIPSession(IPSessionReg::iterator& releaseIndex)
    if (releaseIndex == staple.ipSessionReg.end()) return false;
 
    // Erase session entry
+   ipTimerWheel.Unlink(releaseIndex->second.timeoutLink);
    staple.ipSessionReg.erase(releaseIndex);
 
    return true;
@@ -2636,6 +2578,8 @@ bool Parser::ReleaseTCPConnection(TCPConnReg::iterator& releaseIndex)
    // Find its IP session
    IPAddressId ipSessionId;
    ipSessionId.IP = tcpConnId.netAIP;
+   ipSessionId.IPVersion = tcpConnId.IPVersion;
+   ipSessionId.tunnelId = tcpConnId.tunnelId;
    IPSession& ipSession = staple.ipSessionReg[ipSessionId];
 
    // Finish RTT calc states if necessary (and possibly IP channel rate calc)
@@ -2803,6 +2747,7 @@ bool Parser::ReleaseTCPConnection(TCPConnReg::iterator& releaseIndex)
    httpEngine.finishTCPSession(tcpConnId);
 
    // Erase TCP connection entry
+   tcpTimerWheel.Unlink(releaseIndex->second.timeoutLink);
    staple.tcpConnReg.erase(releaseIndex);
 
    return true;
@@ -2815,9 +2760,9 @@ void Parser::FinishFLV(TCPConnReg::iterator& tcpFinishIndex, unsigned short dire
    const TCPConnId& tcpConnId = tcpFinishIndex->first;
 
    // Sanity check
-   if (tcpConn.flv[direction].found==false) return;
+   if ((!tcpConn.content.Allocated()) || (tcpConn.Content().flv[direction].found==false)) return;
 
-   FLV& flv = tcpConn.flv[direction];
+   FLV& flv = tcpConn.Content().flv[direction];
 
    // Check if FLV is fully decoded (only 4 bytes [previous TAG size] remained at the end)
    if (tcpConn.highestDataACKSeen[1-direction] == (tcpConn.payloadPos[direction]+4))
@@ -2866,9 +2811,10 @@ void Parser::FinishFLV(TCPConnReg::iterator& tcpFinishIndex, unsigned short dire
 
    char lineStr[1000];
    char* lineStrPos = lineStr;
-   lineStrPos += sprintf(lineStrPos, "%u.%u.%u.%u\t",tcpConnId.netAIP.byte[3], tcpConnId.netAIP.byte[2], tcpConnId.netAIP.byte[1], tcpConnId.netAIP.byte[0]);
+   char IPStr[IP_ADDRESS_STRLEN];
+   lineStrPos += sprintf(lineStrPos, "%s\t", FormatIPAddress(IPStr, tcpConnId.IPVersion, tcpConnId.netAIP));
    lineStrPos += sprintf(lineStrPos, "%u\t", tcpConnId.netAPort);
-   lineStrPos += sprintf(lineStrPos, "%u.%u.%u.%u\t",tcpConnId.netBIP.byte[3], tcpConnId.netBIP.byte[2], tcpConnId.netBIP.byte[1], tcpConnId.netBIP.byte[0]);
+   lineStrPos += sprintf(lineStrPos, "%s\t", FormatIPAddress(IPStr, tcpConnId.IPVersion, tcpConnId.netBIP));
    lineStrPos += sprintf(lineStrPos, "%u\t", tcpConnId.netBPort);
    lineStrPos += sprintf(lineStrPos, "%lu\t", tcpConn.payloadPos[direction]-flv.startPos);
    lineStrPos += sprintf(lineStrPos, "%f\t", mediaRate);
@@ -2984,12 +2930,11 @@ void Parser::FinishFLV(TCPConnReg::iterator& tcpFinishIndex, unsigned short dire
 
    // Write full MOS logfile
    // ----------------------
-   pthread_mutex_lock(&perfmonFileMutex);
-   if (perfmonFLVFile)
+   if (HasPerfmonLog(perfmonFLVFile))
    {
-	  std::ostringstream event;
-      event << std::fixed << std::setprecision(6)
-                        << tstart << "\t" << flv.lastTransportTS << "\t" << lineStr;
+      LineBuffer& event = perfmonLine;
+      event.Clear();
+      event << tstart << "\t" << flv.lastTransportTS << "\t" << lineStr;
 
       double avgQoE=0;
       double avgQoEBody=0;
@@ -3055,19 +3000,12 @@ void Parser::FinishFLV(TCPConnReg::iterator& tcpFinishIndex, unsigned short dire
 
       event << "}\n";
 
-      if (writeToFile){
-    	  (*perfmonFLVFile) << event.str();
-      }
-      if (hazelcastPublish){
-    	  StapleJniImpl stapleJni;
-    	  stapleJni.publishEvent(stapleJni.FLV_FULL, event.str());
-      }
-
+      WritePerfmonRecord(PerfmonWriter::FLV, perfmonFLVFile, event);
    }
    
    // Write splitted MOS logfile
    // --------------------------
-   if (perfmonFLVPartialFile)
+   if (HasPerfmonLog(perfmonFLVPartialFile))
    {
       std::list<double>::iterator qoeIndex=flv.qoeList.begin();
       std::list<double>::iterator qoeTimeIndex=flv.qoeTime.begin();
@@ -3076,28 +3014,42 @@ void Parser::FinishFLV(TCPConnReg::iterator& tcpFinishIndex, unsigned short dire
       unsigned short seqNum=0;
       while (qoeIndex!=flv.qoeList.end())
       {
-    	 std::ostringstream event;
-    	 event << std::fixed << std::setprecision(6) << tstart+(*qoeTimeIndex) << "\t"
+         LineBuffer& event = perfmonLine;
+         event.Clear();
+         event << tstart+(*qoeTimeIndex) << "\t"
                  << (qoeNextTimeIndex!=flv.qoeTime.end() ? ((*qoeNextTimeIndex)-(*qoeTimeIndex)) : flv.lastTransportTS-(*qoeTimeIndex)) << "\t"
                  << lineStr
                  << seqNum << "\t"
                  << (*qoeIndex) << "\n";
 
-         if (writeToFile){
-        	 (*perfmonFLVPartialFile) << event.str();
-         }
-         if (hazelcastPublish){
-        	 StapleJniImpl stapleJni;
-        	 stapleJni.publishEvent(stapleJni.FLV_PARTIAL, event.str());
-         }
+         WritePerfmonRecord(PerfmonWriter::FLV_PARTIAL, perfmonFLVPartialFile, event);
          seqNum++;
          qoeIndex++;
          qoeTimeIndex++;
          qoeNextTimeIndex++;
       }
    }
-   
-   pthread_mutex_unlock(&perfmonFileMutex);
+}
+
+// True if the records of the given perfmon log are written or published
+bool Parser::HasPerfmonLog(std::ostream* p_pFile) const
+{
+   return (perfmonWriter != NULL) || (p_pFile != NULL);
+}
+
+// Write a perfmon record to its logfile (queued to the perfmon writer thread if there is one) and publish it
+void Parser::WritePerfmonRecord(PerfmonWriter::LogType p_type, std::ostream* p_pFile, const LineBuffer& p_record)
+{
+   if (writeToFile && (perfmonWriter != NULL)) perfmonWriter->Write(p_type, p_record.Data(), p_record.Size());
+   // The log streams may be shared by several parsers
+   if (writeToFile && (perfmonWriter == NULL) && (p_pFile != NULL))
+   {
+      pthread_mutex_lock(pPerfmonFileMutex);
+      p_pFile->write(p_record.Data(), p_record.Size());
+      pthread_mutex_unlock(pPerfmonFileMutex);
+   }
+   // Handed over to Java in batches by the flush thread
+   if (hazelcastPublish && (eventChannel != NULL)) eventChannel->publish(p_type, p_record.Data(), p_record.Size());
 }
 
 bool Parser::FinishTCPTransaction(TCPConnReg::iterator& tcpFinishIndex, IPSession& ipSession, unsigned short direction)
@@ -3106,23 +3058,26 @@ bool Parser::FinishTCPTransaction(TCPConnReg::iterator& tcpFinishIndex, IPSessio
    TCPConn& tcpConn = tcpFinishIndex->second;
    const TCPConnId& tcpConnId = tcpFinishIndex->first;
    // Sanity check
-   if ((tcpConn.ongoingTransaction[direction]==false) || (tcpConn.transactionList[direction].empty())) return false;
+   if (tcpConn.ongoingTransaction[direction]==false) return false;
+   TCPConnHistory& history = tcpConn.History();
+   if (history.transactionList[direction].empty()) return false;
    // Get reference to the transaction
-   TCPTransaction& tcpTA = tcpConn.transactionList[direction].back();
+   TCPTransaction& tcpTA = history.transactionList[direction].back();
 
    tcpConn.ongoingTransaction[direction] = false;
 
    // Close TCP TA logfile
    #ifdef WRITE_TCPTA_FILES
       fclose(tcpTA.logfile);
-      char logfileName[200];
-      sprintf(logfileName, "%s/%u.%u.%u.%u_%u-%u.%u.%u.%u_%u-%u.TAlog",perfmonDirName.c_str(),tcpConnId.netAIP.byte[3], tcpConnId.netAIP.byte[2], tcpConnId.netAIP.byte[1], tcpConnId.netAIP.byte[0],tcpConnId.netAPort,tcpConnId.netBIP.byte[3], tcpConnId.netBIP.byte[2], tcpConnId.netBIP.byte[1], tcpConnId.netBIP.byte[0],tcpConnId.netBPort,tcpTA.firstDataPacketSeq);
+      char logfileName[300];
+      char netAIPStr[IP_ADDRESS_STRLEN], netBIPStr[IP_ADDRESS_STRLEN];
+      sprintf(logfileName, "%s/%s_%u-%s_%u-%u.TAlog",perfmonDirName.c_str(),FormatIPAddress(netAIPStr, tcpConnId.IPVersion, tcpConnId.netAIP),tcpConnId.netAPort,FormatIPAddress(netBIPStr, tcpConnId.IPVersion, tcpConnId.netBIP),tcpConnId.netBPort,tcpTA.firstDataPacketSeq);
    #endif
 
    // If no ACK has been received, ignore transaction
    if (tcpTA.highestDataACKSeen == 0)
    {
-      tcpConn.transactionList[direction].pop_back();
+      history.transactionList[direction].pop_back();
       // Logging
       if (staple.logLevel >= 3)
       {
@@ -3140,7 +3095,7 @@ bool Parser::FinishTCPTransaction(TCPConnReg::iterator& tcpFinishIndex, IPSessio
    if ((dataReceived<=TCPTA_MINSIZE) &&
    ((tcpTA.lastReport.time.tv_sec==0) && (tcpTA.lastReport.time.tv_usec==0)))
    {
-      tcpConn.transactionList[direction].pop_back();
+      history.transactionList[direction].pop_back();
       // Do not keep TCP TA log file
       #ifdef WRITE_TCPTA_FILES
          remove(logfileName);
@@ -3170,16 +3125,16 @@ bool Parser::FinishTCPTransaction(TCPConnReg::iterator& tcpFinishIndex, IPSessio
    for (int i=0;i<2;i++)
    {
       // Calculate IP data amounts
-      tcpTA.IPBytes[i]=(tcpTA.lastButHighestACKedIPByte[i]!=0) ? (tcpTA.lastButHighestACKedIPByte[i]-tcpConn.TAFirstIPByte[direction][i]) : 0;
-      tcpTA.IPSessionBytes[i] = (tcpTA.lastButHighestACKedIPSessionByte[i]!=0) ? (tcpTA.lastButHighestACKedIPSessionByte[i]-tcpConn.TAFirstIPSessionByte[direction][i]) : 0;
+      tcpTA.IPBytes[i]=(tcpTA.lastButHighestACKedIPByte[i]!=0) ? (tcpTA.lastButHighestACKedIPByte[i]-history.TAFirstIPByte[direction][i]) : 0;
+      tcpTA.IPSessionBytes[i] = (tcpTA.lastButHighestACKedIPSessionByte[i]!=0) ? (tcpTA.lastButHighestACKedIPSessionByte[i]-history.TAFirstIPSessionByte[direction][i]) : 0;
       // Calculate mean RTT
-      tcpTA.smallPipeRTTSamples[i] = tcpConn.smallPipeRTTSamples[i] - tcpConn.TAFirstSmallPipeRTTSamples[direction][i];
+      tcpTA.smallPipeRTTSamples[i] = tcpConn.smallPipeRTTSamples[i] - history.TAFirstSmallPipeRTTSamples[direction][i];
       tcpTA.smallPipeRTT[i] = (tcpTA.smallPipeRTTSamples[i]!=0) ?
-         (tcpConn.smallPipeRTT[i] - tcpConn.TAFirstSmallPipeRTT[direction][i]) / tcpTA.smallPipeRTTSamples[i] :
+         (tcpConn.smallPipeRTT[i] - history.TAFirstSmallPipeRTT[direction][i]) / tcpTA.smallPipeRTTSamples[i] :
          0;
-      tcpTA.largePipeRTTSamples[i] = tcpConn.largePipeRTTSamples[i] - tcpConn.TAFirstLargePipeRTTSamples[direction][i];
+      tcpTA.largePipeRTTSamples[i] = tcpConn.largePipeRTTSamples[i] - history.TAFirstLargePipeRTTSamples[direction][i];
       tcpTA.largePipeRTT[i] = (tcpTA.largePipeRTTSamples[i]!=0) ?
-         (tcpConn.largePipeRTT[i] - tcpConn.TAFirstLargePipeRTT[direction][i]) / tcpTA.largePipeRTTSamples[i] :
+         (tcpConn.largePipeRTT[i] - history.TAFirstLargePipeRTT[direction][i]) / tcpTA.largePipeRTTSamples[i] :
          0;
    }
    tcpTA.ssEndIPSessionBytes = (tcpTA.reportLastIPSessionByte!=0) ? (tcpTA.reportLastIPSessionByte - tcpTA.ssEndIPSessionBytes) : 0;
@@ -3220,33 +3175,31 @@ bool Parser::SACKAMPLossCheck(TCPConn& tcpConn, unsigned short direction, unsign
 bool Parser::AMPLossRange(TCPConn& tcpConn, unsigned short direction, unsigned long firstSeq, unsigned long highestSeq, bool skipReordered)
 {
    // Reconsider the loss of packets in the EWL range (only packets that have been retransmitted)
-   std::list<PacketTrain>::iterator overlapIndex;
-   overlapIndex = tcpConn.packetTrains[direction].TestPartialOverlap(firstSeq,firstSeq);
-   if (overlapIndex != tcpConn.packetTrains[direction].packetTrainList.end())
+   PacketTrainList& packetTrains = tcpConn.packetTrains[direction];
+   if (packetTrains.TestPartialOverlap(firstSeq,firstSeq) == true)
    {
       // Got the train
-      std::list<PacketTrainTCPPacket>::iterator packetIndex = (*overlapIndex).TestPacketSeq(firstSeq);
-      if (packetIndex != (*overlapIndex).packetList.end())
+      unsigned long packetIndex = packetTrains.FindPacketSeq(firstSeq);
+      if (packetIndex != PacketTrainList::NONE)
       {
          // Got the first packet -> go through the EWL range
-         while ((*packetIndex).seq<highestSeq)
+         while (packetTrains.Packet(packetIndex).seq<highestSeq)
          {
+            PacketTrainTCPPacket& packet = packetTrains.Packet(packetIndex);
             // Corrigate loss of AMP loss candidate packets (originally considered not lost)
-            if (((*packetIndex).lossInfo==PacketTrainTCPPacket::NOT_LOST) && ((*packetIndex).ampLossCandidate==true))
+            if ((packet.lossInfo==PacketTrainTCPPacket::NOT_LOST) && (packet.ampLossCandidate==true))
             {
                // We may skip reordered packets
-               if ((skipReordered==false) || ((*packetIndex).reordered==false))
+               if ((skipReordered==false) || (packet.reordered==false))
                {
                   // Mark packet as lost AMP
-                  (*packetIndex).lossInfo = PacketTrainTCPPacket::LOST_AMP;
+                  packet.lossInfo = PacketTrainTCPPacket::LOST_AMP;
                }
             }
             // Calculate highest processed seq (for packet history hole test)
-            unsigned long highestSeqProcessed = (*packetIndex).seq+(*packetIndex).len;
-            // Next packet
-            packetIndex++;
-            // Reached the end?
-            if (packetIndex == (*overlapIndex).packetList.end())
+            unsigned long highestSeqProcessed = packet.seq+packet.len;
+            // Reached the end of the train?
+            if (packetTrains.IsTrainEnd(packetIndex) == true)
             {
                // Check whether all packets have been parsed
                if (highestSeqProcessed < highestSeq)
@@ -3260,6 +3213,8 @@ bool Parser::AMPLossRange(TCPConn& tcpConn, unsigned short direction, unsigned l
                // Finish processing
                break;
             }
+            // Next packet
+            packetIndex++;
          }
       }
       else
@@ -3291,33 +3246,16 @@ void Parser::RemovePacketsFromSignificantSet(TCPConn& tcpConn, unsigned short di
       staple.logStream << " - removing packets starting at seq " << firstSeq << " from " << ((amp==true) ? "AMP " : " ") << ((bmp==true) ? "BMP " : " ") << "significant set";
    }
 
-   // Is the history empty?
-   if (tcpConn.packetTrains[direction].packetTrainList.empty()) return;
-
-   // Remove packets starting from the last packet train
-   std::list<PacketTrain>::iterator actTrainIndex = --(tcpConn.packetTrains[direction].packetTrainList.end());
-   while (1)
+   // Remove packets starting from the last packet
+   PacketTrainList& packetTrains = tcpConn.packetTrains[direction];
+   for (unsigned long i=packetTrains.Size();i>0;i--)
    {
-      // Remove packets starting from the last packet of the train (no empty trains allowed!)
-      std::list<PacketTrainTCPPacket>::iterator actPacketIndex = --((*actTrainIndex).packetList.end());
-      while (1)
-      {
-         // Check if we have passed the first SEQ
-         if ((*actPacketIndex).seq < firstSeq) break;
-         // Remove packets from AMP/BMP significant set
-         if (amp==true) (*actPacketIndex).signAMP=false;
-         if (bmp==true) (*actPacketIndex).signBMP=false;
-         // Check if we have to exit (processed the first packet in the actual train)
-         if (actPacketIndex == (*actTrainIndex).packetList.begin()) break;
-         // If not yet, process the preceding packet
-         actPacketIndex--;
-      }
-      // Check if we have to exit (passed the first SEQ or processed the first packet train)
-      if (((*actPacketIndex).seq < firstSeq) ||
-         (actTrainIndex == tcpConn.packetTrains[direction].packetTrainList.begin()))
-         break;
-      // If not yet, travel backwards on the packet train list
-      actTrainIndex--;
+      PacketTrainTCPPacket& actPacket = packetTrains.Packet(i-1);
+      // Check if we have passed the first SEQ
+      if (actPacket.seq < firstSeq) break;
+      // Remove packets from AMP/BMP significant set
+      if (amp==true) actPacket.signAMP=false;
+      if (bmp==true) actPacket.signBMP=false;
    }
 
    return;
@@ -3380,10 +3318,10 @@ void Parser::ApplyHistorySizeLimits(TCPConnReg::iterator& index, unsigned short
    // We may remove packets until they are already ACKed and older than a threshold
    struct timeval timeDiff;
    double tDiff;
-   while (!tcpConn.packetTrains[direction].packetTrainList.empty())
+   while (!tcpConn.packetTrains[direction].Empty())
    {
-      // Get reference to the first packet (no empty trains allowed!)
-      PacketTrainTCPPacket& firstPacket = tcpConn.packetTrains[direction].packetTrainList.front().packetList.front();
+      // Get reference to the first packet
+      PacketTrainTCPPacket& firstPacket = tcpConn.packetTrains[direction].Front();
       
       timeDiff = AbsTimeDiff(staple.actTime, firstPacket.t);
       tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
@@ -3405,35 +3343,41 @@ bool Parser::RemovePacketFromHistory(TCPConnReg::iterator& index, unsigned short
    TCPConn& tcpConn = index->second;
 
    // Is the packet list empty?
-   if (tcpConn.packetTrains[direction].packetTrainList.empty()) return false;
+   if (tcpConn.packetTrains[direction].Empty()) return false;
 
-   // Get reference to the first packet (no empty trains allowed!)
-   PacketTrainTCPPacket& firstPacket = tcpConn.packetTrains[direction].packetTrainList.front().packetList.front();
+   // Get reference to the first packet
+   PacketTrainTCPPacket& firstPacket = tcpConn.packetTrains[direction].Front();
 
    // Select the (possible) TCP transaction to which this sequence number belongs
-   bool taFound=false;
+   TCPTransaction* pTA = NULL;
    // Sanity check: there are transactions...
-   while (!tcpConn.transactionList[direction].empty())
+   if (tcpConn.history.Allocated())
    {
-      // Packet to be removed falls into the oldest transaction?
-      if ((firstPacket.seq >= tcpConn.transactionList[direction].front().firstDataPacketSeq) &&
-      ((firstPacket.seq+firstPacket.len) <= tcpConn.transactionList[direction].front().highestDataACKSeen))
+      TCPConnHistory& history = tcpConn.History();
+      while (!history.transactionList[direction].empty())
       {
-         // We found the TA
-         taFound=true;
-         break;
-      }
-      // Is the oldest transaction older than the packet to be removed (and not the ongoing transaction)?
-      else if ((firstPacket.seq >= tcpConn.transactionList[direction].front().highestDataACKSeen) &&
-      !((tcpConn.transactionList[direction].front().firstDataPacketSeq == tcpConn.transactionList[direction].back().firstDataPacketSeq) && (tcpConn.ongoingTransaction[direction]==true)))
-      {
-         // Remove the transaction and print it (overall report only - last partial report is written at FinishTCPTA())
-         PrintTCPTAStatistics(index,tcpConn.transactionList[direction].front(),direction,true,true);
-         tcpConn.transactionList[direction].pop_front();
-      }
-      else
-      {
-         break;
+         // Get reference to the oldest transaction
+         TCPTransaction& oldestTA = history.transactionList[direction].front();
+         // Packet to be removed falls into the oldest transaction?
+         if ((firstPacket.seq >= oldestTA.firstDataPacketSeq) &&
+         ((firstPacket.seq+firstPacket.len) <= oldestTA.highestDataACKSeen))
+         {
+            // We found the TA
+            pTA = &oldestTA;
+            break;
+         }
+         // Is the oldest transaction older than the packet to be removed (and not the ongoing transaction)?
+         else if ((firstPacket.seq >= oldestTA.highestDataACKSeen) &&
+         !((oldestTA.firstDataPacketSeq == history.transactionList[direction].back().firstDataPacketSeq) && (tcpConn.ongoingTransaction[direction]==true)))
+         {
+            // Remove the transaction and print it (overall report only - last partial report is written at FinishTCPTA())
+            PrintTCPTAStatistics(index,oldestTA,direction,true,true);
+            history.transactionList[direction].pop_front();
+         }
+         else
+         {
+            break;
+         }
       }
    }
 
@@ -3446,12 +3390,12 @@ bool Parser::RemovePacketFromHistory(TCPConnReg::iterator& index, unsigned short
       tcpConn.signPacketsLostAMPTS[direction] += (firstPacket.lossTSInfo == PacketTrainTCPPacket::LOST_AMP_TS) ? 1 : 0;
       tcpConn.signPacketsRetrAMP[direction] += (firstPacket.ampLossCandidate == true) ? 1 : 0;
       // Update TCP transaction as well (if there is one)
-      if (taFound==true)
+      if (pTA != NULL)
       {
-         tcpConn.transactionList[direction].front().signPacketsSeenAMP++;
-         tcpConn.transactionList[direction].front().signPacketsLostAMP += (firstPacket.lossInfo == PacketTrainTCPPacket::LOST_AMP) ? 1 : 0;
-         tcpConn.transactionList[direction].front().signPacketsLostAMPTS += (firstPacket.lossTSInfo == PacketTrainTCPPacket::LOST_AMP_TS) ? 1 : 0;
-         tcpConn.transactionList[direction].front().signPacketsRetrAMP += (firstPacket.ampLossCandidate == true) ? 1 : 0;
+         pTA->signPacketsSeenAMP++;
+         pTA->signPacketsLostAMP += (firstPacket.lossInfo == PacketTrainTCPPacket::LOST_AMP) ? 1 : 0;
+         pTA->signPacketsLostAMPTS += (firstPacket.lossTSInfo == PacketTrainTCPPacket::LOST_AMP_TS) ? 1 : 0;
+         pTA->signPacketsRetrAMP += (firstPacket.ampLossCandidate == true) ? 1 : 0;
       }
    }
    // Update significant BMP loss related variables
@@ -3462,11 +3406,11 @@ bool Parser::RemovePacketFromHistory(TCPConnReg::iterator& index, unsigned short
       tcpConn.signPacketsLostBMP[direction] += (firstPacket.lossInfo == PacketTrainTCPPacket::LOST_BMP) ? 1 : 0;
       tcpConn.signPacketsReorderedBMP[direction] += (firstPacket.reordered == true) ? 1 : 0;
       // Update TCP transaction as well (if there is one)
-      if (taFound==true)
+      if (pTA != NULL)
       {
-         tcpConn.transactionList[direction].front().signPacketsSeenBMP++;
-         tcpConn.transactionList[direction].front().signPacketsLostBMP += (firstPacket.lossInfo == PacketTrainTCPPacket::LOST_BMP) ? 1 : 0;
-         tcpConn.transactionList[direction].front().signPacketsReorderedBMP += (firstPacket.reordered == true) ? 1 : 0;
+         pTA->signPacketsSeenBMP++;
+         pTA->signPacketsLostBMP += (firstPacket.lossInfo == PacketTrainTCPPacket::LOST_BMP) ? 1 : 0;
+         pTA->signPacketsReorderedBMP += (firstPacket.reordered == true) ? 1 : 0;
       }
    }
    // Calculate next expected SEQ for consecutiveness check
@@ -3476,19 +3420,19 @@ bool Parser::RemovePacketFromHistory(TCPConnReg::iterator& index, unsigned short
    tcpConn.packetTrains[direction].RemoveFirstPacket();
 
    // Check consecutiveness for already ACKed packets (if the list is not empty)
-   if ((!tcpConn.packetTrains[direction].packetTrainList.empty()) && (expectedSeq < tcpConn.highestACKSeen[1-direction]))
+   if ((!tcpConn.packetTrains[direction].Empty()) && (expectedSeq < tcpConn.highestACKSeen[1-direction]))
    {
-      if (tcpConn.packetTrains[direction].packetTrainList.front().packetList.front().seq > expectedSeq)
+      if (tcpConn.packetTrains[direction].Front().seq > expectedSeq)
       {
          // Hole in the packet history -> invalidate loss
          tcpConn.lossReliable = false;
          tcpConn.tsLossReliable = false;
          tcpConn.captureLoss = true;
          // Update possible transaction as well
-         if (taFound==true)
+         if (pTA != NULL)
          {
-            tcpConn.transactionList[direction].front().lossReliable = false;
-            tcpConn.transactionList[direction].front().captureLoss = true;
+            pTA->lossReliable = false;
+            pTA->captureLoss = true;
          }
          // Logging
          if (staple.logLevel >= 3)
@@ -3519,19 +3463,197 @@ void Parser::FinishConnections()
    }
 }
 
+// Terminate the timeouted TCP connections and IP sessions
+// (only the entries in the old slots of the timer wheels are checked, except after a major timestamp reordering)
+void Parser::CheckTimeouts()
+{
+   const unsigned short& logLevel = staple.logLevel;
+   struct timeval scanStartTime;
+   struct timezone tmpZone;
+   gettimeofday(&scanStartTime,&tmpZone);
+
+   std::vector<TCPConnId> tcpKeys;
+   std::vector<IPAddressId> ipKeys;
+   if (timeoutFullScan)
+   {
+      for (TCPConnReg::iterator index = staple.tcpConnReg.begin(); index != staple.tcpConnReg.end(); index++) tcpKeys.push_back(index->first);
+      for (IPSessionReg::iterator index = staple.ipSessionReg.begin(); index != staple.ipSessionReg.end(); index++) ipKeys.push_back(index->first);
+      timeoutFullScan = false;
+      // The wheels continue from the actual time (they may be ahead of it after a backward time jump)
+      tcpTimerWheel.Restart(staple.actTime.tv_sec - TCP_TIMEOUT);
+      ipTimerWheel.Restart(staple.actTime.tv_sec - IP_TIMEOUT);
+   }
+   else
+   {
+      tcpTimerWheel.Expire(staple.actTime.tv_sec - TCP_TIMEOUT - 1, tcpKeys);
+      ipTimerWheel.Expire(staple.actTime.tv_sec - IP_TIMEOUT - 1, ipKeys);
+   }
+
+   // Terminate timeouted TCPs
+   struct timeval diffA, diffB;
+   double dA,dB;
+   for (unsigned long i=0;i<tcpKeys.size();i++)
+   {
+      TCPConnReg::iterator index = staple.tcpConnReg.find(tcpKeys[i]);
+      if (index == staple.tcpConnReg.end()) continue;
+      diffA = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[0]);
+      diffB = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[1]);
+      dA = diffA.tv_sec + (double)diffA.tv_usec/1000000;
+      dB = diffB.tv_sec + (double)diffB.tv_usec/1000000;
+      if ((dA > TCP_TIMEOUT) && (dB > TCP_TIMEOUT))
+      {
+         if (logLevel >= 3)
+         {
+            staple.logStream << "TCP connection timeouted.\n";
+         }
+
+         ((*index).second).termination = TCPConn::TERM_TO;
+         ReleaseTCPConnection(index);
+      }
+   }
+
+   // Terminate timeouted IP sessions
+   for (unsigned long i=0;i<ipKeys.size();i++)
+   {
+      IPSessionReg::iterator index = staple.ipSessionReg.find(ipKeys[i]);
+      if (index == staple.ipSessionReg.end()) continue;
+      diffA = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[0]);
+      diffB = AbsTimeDiff(staple.actTime, ((*index).second).lastPacketTime[1]);
+      dA = diffA.tv_sec + (double)diffA.tv_usec/1000000;
+      dB = diffB.tv_sec + (double)diffB.tv_usec/1000000;
+      if ((dA > IP_TIMEOUT) && (dB > IP_TIMEOUT))
+      {
+         if (logLevel >= 3)
+         {
+            staple.logStream << "IP session timeouted.\n";
+         }
+
+         ReleaseIPSession(index);
+      }
+   }
+   lastTimeoutCheck = staple.actTime;
+
+   // Update the scan time histogram
+   struct timeval scanEndTime;
+   gettimeofday(&scanEndTime,&tmpZone);
+   struct timeval scanTime = AbsTimeDiff(scanEndTime, scanStartTime);
+   staple.timeoutStats.AddCheck(scanTime.tv_sec*1000000 + scanTime.tv_usec);
+}
+
+// Count the live TCP connections, TCP transactions, FLV streams and the memory they use (for the status log)
+void Parser::CountConnectionState (unsigned long& tcpConnNum, unsigned long* tcpTANum, unsigned long* flvNum, TCPConnMemory& tcpMemory)
+{
+   TCPConnReg::iterator index = staple.tcpConnReg.begin();
+   tcpConnNum = staple.tcpConnReg.size();
+   tcpTANum[0] = 0;
+   tcpTANum[1] = 0;
+   flvNum[0] = 0;
+   flvNum[1] = 0;
+   tcpMemory.Init();
+   while (index != staple.tcpConnReg.end())
+   {
+      TCPConn& actTCPConn = (index->second);
+      // Update in-session statistics
+      if (actTCPConn.history.Allocated())
+      {
+         tcpTANum[0] += actTCPConn.history.Ptr()->transactionList[0].size();
+         tcpTANum[1] += actTCPConn.history.Ptr()->transactionList[1].size();
+      }
+      if (actTCPConn.content.Allocated())
+      {
+         flvNum[0] += (actTCPConn.content.Ptr()->flv[0].found) ? 1 : 0;
+         flvNum[1] += (actTCPConn.content.Ptr()->flv[1].found) ? 1 : 0;
+      }
+      // Memory accounting
+      actTCPConn.AddMemoryUsage(tcpMemory);
+      index++;
+   }
+}
+
+// Write one status log line (traffic info is taken from the stats of staple, internal state is given by the caller)
+void Parser::WriteStatusLog (unsigned long tcpConnNum, const unsigned long* tcpTANum, const unsigned long* flvNum, const TCPConnMemory& tcpMemory, const HTTPStats& httpStats)
+{
+   IPStats& ipStats = staple.ipStats;
+   TCPStats& tcpStats = staple.tcpStats;
+   UDPStats& udpStats = staple.udpStats;
+   FLVStats& flvStats = staple.flvStats;
+
+   // Write traffic info
+   unsigned long ipPktNum = ipStats.packetsMatched[0]+ipStats.packetsMatched[1];
+   unsigned long ipKBytes = ipStats.kBytesMatched[0]+ipStats.kBytesMatched[1];
+   // Processing speed
+   struct timeval actRealTime;
+   struct timezone tmpZone;
+   gettimeofday(&actRealTime,&tmpZone);
+   struct timeval timeDiff = AbsTimeDiff(actRealTime, staple.lastRealTime);
+   double tDiff = timeDiff.tv_sec + (double)timeDiff.tv_usec/1000000;
+   // Store original format flags
+   std::ios_base::fmtflags origFormat = staple.logStream.flags();
+   int origPrec = staple.logStream.precision();
+   staple.logStream.precision(2);
+   staple.logStream.setf(std::ios::fixed);
+   staple.logStream << staple.actTime.tv_sec << " "
+                    << (((double)(staple.actTime.tv_sec - staple.traceStartTime.tv_sec))/3600) << "h"
+                    << " pkt " << ipPktNum
+                    << " vol " << ((double)ipKBytes/1048576) << "GB"
+                    << " SA-lossDL " << (100*((double)(tcpStats.SYNACKNotFound[0]))/(tcpStats.SYNACKFound[0]+tcpStats.SYNACKNotFound[0])) << "%"
+                    << " SA-lossUL " << (100*((double)(tcpStats.SYNACKNotFound[1]))/(tcpStats.SYNACKFound[1]+tcpStats.SYNACKNotFound[1])) << "%"
+                    << " S-lossDL " << (100*((double)(tcpStats.SYNNotFound[1]))/(tcpStats.SYNFound[1]+tcpStats.SYNNotFound[1])) << "%"
+                    << " S-lossUL " << (100*((double)(tcpStats.SYNNotFound[0]))/(tcpStats.SYNFound[0]+tcpStats.SYNNotFound[0])) << "%"
+                    << " TCP " << (100*(double)(tcpStats.kBytesMatched[0]+tcpStats.kBytesMatched[1])/ipKBytes) << "%"
+                    << " UDP " << (100*(double)(udpStats.kBytesMatched[0]+udpStats.kBytesMatched[1])/ipKBytes) << "%"
+                    << " FLV " << (100*(double)(flvStats.kBytes[0]+flvStats.kBytes[1])/ipKBytes) << "%"
+                    << " HTTP " << (100*(double)(httpStats.IPBytes[0]+httpStats.IPBytes[1])/1024/ipKBytes) << "%"
+                    << " [" << (ipStats.packetsRead-ipStats.lastPacketsRead)/tDiff << " pkt/s "
+                    << (ipStats.kBytesRead-ipStats.lastKBytesRead)/tDiff << " KB/s]"
+                    << " TCPlr " << (100*(double)(tcpStats.lossReliable)/tcpStats.tcpsSeen) << "%"
+                    << " TCPdo " << (100*(double)(tcpStats.rtxDataOffset)/tcpStats.tcpsSeen) << "%"
+                    << " TCPcl " << (100*(double)(tcpStats.captureLoss)/tcpStats.tcpsSeen) << "%"
+                    << " TANum " << tcpStats.allTCPTALogNum << " 60s " << tcpStats.old60TCPTALogNum
+                    << " TOcheck";
+   for (int i=0;i<TIMEOUT_SCANHIST_BINS;i++)
+   {
+      staple.logStream << ((i==0) ? " " : "/") << staple.timeoutStats.checkTimeHist[i];
+   }
+   staple.timeoutStats.Init();
+
+   tcpStats.ResetSYNStats();
+   // Write internal state
+   staple.logStream << " #tcp " << tcpConnNum << " #tcpta " << tcpTANum[0] << "/" << tcpTANum[1] << " #flv " << flvNum[0] << "/" << flvNum[1] << "\n";
+   staple.logStream << "   ";
+   tcpMemory.Print(staple.logStream);
+   unsigned long ipv6AddressNum = ipv6Registry.AddressNum();
+   staple.logStream << "   IPv6 registry: " << ipv6AddressNum << " addresses, " << (double)ipv6Registry.MemoryUsage()/((ipv6AddressNum > 0) ? ipv6AddressNum : 1) << " bytes/address\n";
+   // Forget the IPv6 addresses not seen for a while (the registry is shared by the process, it expires once per
+   // status log period whichever Staple instance calls it)
+   ipv6Registry.Expire(staple.actTime.tv_sec);
+   // Revert to original formatting settings
+   staple.logStream.flags(origFormat);
+   staple.logStream.precision(origPrec);
+   // Update state
+   staple.lastRealTime = actRealTime;
+   ipStats.lastPacketsRead = ipStats.packetsRead;
+   ipStats.lastKBytesRead = ipStats.kBytesRead;
+   // Update last log time
+   lastStatusLogTime = staple.actTime;
+}
+
 bool Parser::PrintTCPStatistics (TCPConnReg::iterator& tcpPrintIndex, std::ostream& outStream)
 {
    // Get TCP connection
    TCPConn& tcpConn = tcpPrintIndex->second;
+   // No transactions were seen
+   if (!tcpConn.history.Allocated()) return true;
+   TCPConnHistory& history = tcpConn.History();
    for (unsigned short dir=0;dir<=1;dir++)
    {
       // Print statistics for remaining TCP transactions
       // -----------------------------------------------
-      while (!tcpConn.transactionList[dir].empty())
+      while (!history.transactionList[dir].empty())
       {
          // Print overall reports only (last partial report is written at FinishTCPTA())
-         PrintTCPTAStatistics(tcpPrintIndex,tcpConn.transactionList[dir].front(),dir,true,true);
-         tcpConn.transactionList[dir].pop_front();
+         PrintTCPTAStatistics(tcpPrintIndex,history.transactionList[dir].front(),dir,true,true);
+         history.transactionList[dir].pop_front();
       }
    }
    return true;
@@ -3630,20 +3752,16 @@ bool Parser::PrintTCPTAStatistics (TCPConnReg::iterator& tcpPrintIndex, TCPTrans
       }
 
       // Print
-      if (!(overall ? perfmonTCPTAFile : perfmonTCPTAPartialFile))
+      if (!HasPerfmonLog(overall ? perfmonTCPTAFile : perfmonTCPTAPartialFile))
          return true;
       
-      pthread_mutex_lock(&perfmonFileMutex);
-
-      std::ostringstream event;
+      LineBuffer& event = perfmonLine;
+      event.Clear();
 
-      event << std::setprecision(6) << std::fixed
-              << tstart << "\t" << tDiff << "\t"
-              << (unsigned) (tcpConnId.netAIP.byte[3]) << "." << (unsigned) (tcpConnId.netAIP.byte[2]) << "."
-              << (unsigned) (tcpConnId.netAIP.byte[1]) << "." << (unsigned) (tcpConnId.netAIP.byte[0]) << "\t"
-              << tcpConnId.netAPort << "\t"
-              << (unsigned) (tcpConnId.netBIP.byte[3]) << "." << (unsigned) (tcpConnId.netBIP.byte[2]) << "."
-              << (unsigned) (tcpConnId.netBIP.byte[1]) << "." << (unsigned) (tcpConnId.netBIP.byte[0]) << "\t"
+      event << tstart << "\t" << tDiff << "\t";
+      event.AppendIPAddress(tcpConnId.IPVersion, tcpConnId.netAIP) << "\t"
+              << tcpConnId.netAPort << "\t";
+      event.AppendIPAddress(tcpConnId.IPVersion, tcpConnId.netBIP) << "\t"
               << tcpConnId.netBPort << "\t"
               << dir << "\t"
               << dataReceived << "\t";
@@ -3784,7 +3902,7 @@ bool Parser::PrintTCPTAStatistics (TCPConnReg::iterator& tcpPrintIndex, TCPTrans
       {
          event << tcpTA.contentType << "\t";
       }
-      else if (tcpConn.isTorrent)
+      else if (tcpConn.content.Allocated() && tcpConn.content.Ptr()->isTorrent)
       {
          event << "BitTorrent\t";
       }
@@ -3819,29 +3937,10 @@ bool Parser::PrintTCPTAStatistics (TCPConnReg::iterator& tcpPrintIndex, TCPTrans
       {
          event << "\\N";
       }
-/*
-      if (!tcpConn.userAgent.empty())
-      {
-         fprintf(event, "%s", tcpConn.userAgent.c_str());
-      }
-      else
-      {
-         fprintf(event, "\\N");
-      }
-*/
       event << "\n";
 
-      if (writeToFile){
-          std::ostream & actFile = *(overall ? perfmonTCPTAFile : perfmonTCPTAPartialFile);
-    	  actFile << event.str();
-      }
-      if (hazelcastPublish){
-    	  StapleJniImpl staple;
-    	  staple.publishEvent((overall ? staple.TCPTA : staple.TCPTA_PARTIAL), event.str());
-      }
-
-
-      pthread_mutex_unlock(&perfmonFileMutex);
+      if (overall) WritePerfmonRecord(PerfmonWriter::TCPTA, perfmonTCPTAFile, event);
+      else WritePerfmonRecord(PerfmonWriter::TCPTA_PARTIAL, perfmonTCPTAPartialFile, event);
       return true;
    }
    else
@@ -3850,16 +3949,31 @@ bool Parser::PrintTCPTAStatistics (TCPConnReg::iterator& tcpPrintIndex, TCPTrans
    }
 }
 
+// The actual HTTP stats (sessions still in progress are not included)
+const HTTPStats& Parser::GetHTTPStats() const
+{
+   return httpEngine.getStats();
+}
+
+// Finish all HTTP sessions and return the final HTTP stats
+const HTTPStats& Parser::FinishHTTPSessions()
+{
+   // This must be called to update the stats.
+   httpEngine.finishAllTCPSessions();
+   return httpEngine.getStats();
+}
+
 void Parser::PrintOverallStatistics (std::ostream& outStream)
+{
+   PrintOverallStatistics(outStream, FinishHTTPSessions());
+}
+
+void Parser::PrintOverallStatistics (std::ostream& outStream, const HTTPStats& httpStats)
 {
    IPStats& ipStats = staple.ipStats;
    TCPStats& tcpStats = staple.tcpStats;
    UDPStats& udpStats = staple.udpStats;
    ICMPStats& icmpStats = staple.icmpStats;
-
-   // This must be called to update the stats.
-   httpEngine.finishAllTCPSessions();
-   const HTTPStats& httpStats(httpEngine.getStats());
    FLVStats& flvStats = staple.flvStats;
    MP4Stats& mp4Stats = staple.mp4Stats;
 
@@ -3876,11 +3990,18 @@ void Parser::PrintOverallStatistics (std::ostream& outStream)
    outStream << "   -minor (<" << TS_MAJOR_REORDERING_THRESH << "s): " << staple.tsMinorReorderingNum << " times\n";
    outStream << "Timestamp jumps (>" << TS_JUMP_THRESH << "s): " << staple.tsJumpNum << " times (" << staple.tsJumpLen << "s)\n";
    outStream << "Overall number of packets read from file: " << staple.packetsRead << "\n";
+   outStream << "Decapsulated packets: GTP-U " << staple.packetsGTPU << ", MPLS " << staple.packetsMPLS << ", stacked VLAN " << staple.packetsVLANStacked << "\n";
+   outStream << "Packet object allocations: " << staple.packetPool.allocations << " (" << ((staple.packetsRead>0) ? (double)staple.packetPool.allocations/staple.packetsRead : 0) << " per packet)\n";
+#if defined(USE_HASH_MAP)
+   outStream << "Flow table lookups: TCP " << staple.tcpConnReg.lookups << " (" << ((staple.tcpConnReg.lookups>0) ? (double)staple.tcpConnReg.probes/staple.tcpConnReg.lookups : 0) << " probes/lookup), "
+             << "IP " << staple.ipSessionReg.lookups << " (" << ((staple.ipSessionReg.lookups>0) ? (double)staple.ipSessionReg.probes/staple.ipSessionReg.lookups : 0) << " probes/lookup)\n";
+#endif
    outStream << "   IP:           " << ipStats.packetsRead << " (" << ipStats.kBytesRead << " Kbytes)\n";
    outStream << "   -TCP:         " << tcpStats.packetsRead << " (" << tcpStats.kBytesRead << " Kbytes)\n";
    outStream << "   -UDP:         " << udpStats.packetsRead << " (" << udpStats.kBytesRead << " Kbytes)\n";
    outStream << "   -ICMP:        " << icmpStats.packetsRead << " (" << icmpStats.kBytesRead << " Kbytes)\n";
    outStream << "   -Other:       " << (ipStats.packetsRead-tcpStats.packetsRead-udpStats.packetsRead-icmpStats.packetsRead) << " (" << (ipStats.kBytesRead-tcpStats.kBytesRead-udpStats.kBytesRead-icmpStats.kBytesRead) << " Kbytes)\n";
+   outStream << "   -IPv6:        " << ipStats.packetsIPv6 << " (" << ipv6Registry.AddressNum() << " addresses tracked, " << ipv6Registry.MemoryUsage() << " bytes)\n";
    if (staple.ignoreL2Duplicates)
    {
       outStream << "L2 duplicate stats (every second L2 duplicate decoding was " << ((DECODE_EVERY_SECOND_L2_DUPLICATE==true) ? "ON" : "OFF") << "):\n";
@@ -3889,6 +4010,8 @@ void Parser::PrintOverallStatistics (std::ostream& outStream)
          outStream << "   -" << i << "  dups: " << staple.packetsDuplicated[i] << " (all), " << ipStats.packetsDuplicated[i] << " (IP)\n";
       }
       outStream << "   -" << DUPSTATS_MAX << "+ dups: " << staple.packetsDuplicated[DUPSTATS_MAX] << " (all), " << ipStats.packetsDuplicated[DUPSTATS_MAX] << " (IP)\n";
+      const L2DuplicateFilter& l2DuplicateFilter = staple.packetDumpFile.l2DuplicateFilter;
+      outStream << "   -lookups: " << l2DuplicateFilter.lookups << " (" << ((l2DuplicateFilter.lookups>0) ? (double)l2DuplicateFilter.probes/l2DuplicateFilter.lookups : 0) << " probes/lookup), early evictions: " << l2DuplicateFilter.evictions << "\n";
    }
    outStream << "Overall number of matching IP packets seen:\n";
    outStream << "   IP      A->B: " << ipStats.packetsMatched[0] << " (" << ipStats.kBytesMatched[0] << " Kbytes)\n";
@@ -0,0 +1,442 @@
+#include <sstream>
+
+#include <staple/ParserShards.h>
+#include <staple/http/Counter.h>
+
+#include "Util.h"
+
+// LockedStreamBuf
+// ---------------
+int LockedStreamBuf::overflow(int c)
+{
+   if (c == traits_type::eof()) return traits_type::not_eof(c);
+   pthread_mutex_lock(&mutex);
+   int result = (target != NULL) ? target->sputc(traits_type::to_char_type(c)) : c;
+   pthread_mutex_unlock(&mutex);
+   return result;
+}
+
+std::streamsize LockedStreamBuf::xsputn(const char* s, std::streamsize n)
+{
+   pthread_mutex_lock(&mutex);
+   std::streamsize result = (target != NULL) ? target->sputn(s, n) : n;
+   pthread_mutex_unlock(&mutex);
+   return result;
+}
+
+int LockedStreamBuf::sync()
+{
+   pthread_mutex_lock(&mutex);
+   int result = (target != NULL) ? target->pubsync() : 0;
+   pthread_mutex_unlock(&mutex);
+   return result;
+}
+
+// ParserShard
+// -----------
+ParserShard::ParserShard()
+{
+   running = false;
+   queueHead = 0;
+   queueLen = 0;
+   finished = false;
+   busy = false;
+   pthread_mutex_init(&queueMutex, NULL);
+   pthread_cond_init(&queueNotEmpty, NULL);
+   pthread_cond_init(&queueNotFull, NULL);
+   pthread_cond_init(&queueDrained, NULL);
+   pthread_mutex_init(&statsMutex, NULL);
+   pending.reserve(SHARD_BATCH_SIZE);
+}
+
+ParserShard::~ParserShard()
+{
+   // Delete the packets never parsed
+   for (unsigned long i=0;i<queueLen;i++)
+   {
+      delete queue[(queueHead+i)%SHARD_QUEUE_SIZE];
+   }
+   for (unsigned long i=0;i<pending.size();i++)
+   {
+      delete pending[i];
+   }
+   pthread_mutex_destroy(&queueMutex);
+   pthread_cond_destroy(&queueNotEmpty);
+   pthread_cond_destroy(&queueNotFull);
+   pthread_cond_destroy(&queueDrained);
+   pthread_mutex_destroy(&statsMutex);
+}
+
+// Global function of the parser threads: parse the queued packets until the queue is finished
+void* ParserShardLauncher(void* arg)
+{
+   ParserShard& shard = *reinterpret_cast<ParserShard*>(arg);
+   Parser& parser = *shard.staple.parser;
+   std::vector<L2Packet*> batch;
+   batch.reserve(SHARD_QUEUE_SIZE);
+   while (true)
+   {
+      // Take all queued packets at once
+      pthread_mutex_lock(&shard.queueMutex);
+      while ((shard.queueLen == 0) && (!shard.finished))
+      {
+         pthread_cond_wait(&shard.queueNotEmpty, &shard.queueMutex);
+      }
+      if (shard.queueLen == 0)
+      {
+         pthread_mutex_unlock(&shard.queueMutex);
+         break;
+      }
+      for (unsigned long i=0;i<shard.queueLen;i++)
+      {
+         batch.push_back(shard.queue[(shard.queueHead+i)%SHARD_QUEUE_SIZE]);
+      }
+      shard.queueHead = (shard.queueHead+shard.queueLen)%SHARD_QUEUE_SIZE;
+      shard.queueLen = 0;
+      shard.busy = true;
+      pthread_cond_signal(&shard.queueNotFull);
+      pthread_mutex_unlock(&shard.queueMutex);
+
+      // Parse them
+      pthread_mutex_lock(&shard.statsMutex);
+      for (unsigned long i=0;i<batch.size();i++)
+      {
+         parser.ParsePacket(batch[i]);
+         delete batch[i];
+      }
+      pthread_mutex_unlock(&shard.statsMutex);
+      batch.clear();
+
+      pthread_mutex_lock(&shard.queueMutex);
+      shard.busy = false;
+      pthread_cond_signal(&shard.queueDrained);
+      pthread_mutex_unlock(&shard.queueMutex);
+   }
+   return NULL;
+}
+
+// ParserShards
+// ------------
+ParserShards::ParserShards(Staple& p_master, Parser& p_masterParser, unsigned short p_shardNum, bool p_http) :
+   master(p_master),
+   masterParser(p_masterParser),
+   logBuf(p_master.logStream.rdbuf()),
+   origLogBuf(p_master.logStream.rdbuf()),
+   http(p_http),
+   lastFlushTime(0)
+{
+   // The master and the shards write the same log
+   master.logStream.rdbuf(&logBuf);
+
+   for (unsigned short i=0;i<p_shardNum;i++)
+   {
+      ParserShard* pShard = new ParserShard();
+      Staple& staple = pShard->staple;
+
+      // Per-packet logs of different shards would be interleaved, so detailed logging is limited
+      staple.logLevel = (master.logLevel > 1) ? 1 : master.logLevel;
+      staple.logStream.rdbuf(&logBuf);
+      staple.byteOrderPlatform = master.byteOrderPlatform;
+      staple.ignoreL2Duplicates = master.ignoreL2Duplicates;
+      staple.perfmonDirName = master.perfmonDirName;
+      // HTTP and counter logs are written by each shard separately
+      std::ostringstream prefix;
+      prefix << master.perfmonLogPrefix << "_shard" << i;
+      staple.perfmonLogPrefix = prefix.str();
+      // Output dump is written by the reader only
+      staple.outputDumpGiven = false;
+
+      // TCPTA and FLV records go to the perfmon files of the master parser
+      Parser& parser = *staple.parser;
+      parser.perfmonTCPTAFile = masterParser.perfmonTCPTAFile;
+      parser.perfmonTCPTAPartialFile = masterParser.perfmonTCPTAPartialFile;
+      parser.perfmonFLVFile = masterParser.perfmonFLVFile;
+      parser.perfmonFLVPartialFile = masterParser.perfmonFLVPartialFile;
+      parser.perfmonWriter = masterParser.perfmonWriter;
+      parser.eventChannel = masterParser.eventChannel;
+      parser.pPerfmonFileMutex = &masterParser.perfmonFileMutex;
+      parser.hazelcastPublish = masterParser.hazelcastPublish;
+      parser.writeToFile = masterParser.writeToFile;
+      // The merged status log is written by the master
+      parser.writeStatusLog = false;
+
+      if (http)
+      {
+         parser.setHTTPPageLog(true);
+         parser.setHTTPRequestLog(true);
+         staple.getCounterContainer()->setLogging(true);
+      }
+
+      shards.push_back(pShard);
+   }
+
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      pthread_create(&shards[i]->thread, NULL, ParserShardLauncher, (void*) shards[i]);
+      shards[i]->running = true;
+   }
+}
+
+ParserShards::~ParserShards()
+{
+   Finish();
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      delete shards[i];
+   }
+   master.logStream.rdbuf(origLogBuf);
+}
+
+// Hand over a (decoded) packet to the shard of its IP session (the packet is deleted by the shard)
+void ParserShards::Dispatch(L2Packet* pL2Packet)
+{
+   master.packetsRead++;
+
+   // Trace times of the master (reorderings are handled by the shards)
+   if (master.packetsRead == 1)
+   {
+      master.traceStartTime = pL2Packet->time;
+      master.actTime = pL2Packet->time;
+   }
+   if ((pL2Packet->time.tv_sec > master.actTime.tv_sec) || ((pL2Packet->time.tv_sec == master.actTime.tv_sec) && (pL2Packet->time.tv_usec > master.actTime.tv_usec)))
+   {
+      master.actTime = pL2Packet->time;
+   }
+   master.actRelTime = AbsTimeDiff(master.traceStartTime, master.actTime);
+
+   // Trace clock: the packets of the previous ROP are parsed by all shards before the logfiles are switched
+   RotationService* pTraceClock = masterParser.pTraceClock;
+   if ((pTraceClock != NULL) && pTraceClock->IsNewROP(master.actTime.tv_sec))
+   {
+      WaitIdle();
+      pTraceClock->AdvanceTraceTime(master.actTime.tv_sec);
+   }
+
+   ParserShard& shard = *shards[ShardIndex(pL2Packet)];
+   shard.pending.push_back(pL2Packet);
+   if (shard.pending.size() >= SHARD_BATCH_SIZE) FlushPending(shard);
+   // The partial batches of quiet shards are not kept back until the next status log
+   if (master.actTime.tv_sec - lastFlushTime >= SHARD_FLUSH_PERIOD) FlushAllPending();
+
+   // Write status log
+   if ((master.actTime.tv_sec - masterParser.lastStatusLogTime.tv_sec >= STATUS_LOG_PERIOD) || (masterParser.lastStatusLogTime.tv_sec == 0))
+   {
+      WriteStatusLog();
+   }
+}
+
+// Wait until all packets are parsed and finish the ongoing connections of the shards
+void ParserShards::Finish()
+{
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      ParserShard& shard = *shards[i];
+      if (shard.finished) continue;
+      FlushPending(shard);
+      pthread_mutex_lock(&shard.queueMutex);
+      shard.finished = true;
+      pthread_cond_signal(&shard.queueNotEmpty);
+      pthread_mutex_unlock(&shard.queueMutex);
+   }
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      ParserShard& shard = *shards[i];
+      if (!shard.running) continue;
+      pthread_join(shard.thread, 0);
+      shard.running = false;
+      shard.staple.parser->FinishConnections();
+   }
+}
+
+// Print the overall statistics of all shards (Finish() must be called before)
+void ParserShards::PrintOverallStatistics(std::ostream& outStream)
+{
+   HTTPStats httpStats;
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      httpStats.add(shards[i]->staple.parser->FinishHTTPSessions());
+   }
+   MergeStats();
+   master.tsMinorReorderingNum = 0;
+   master.tsMajorReorderingNum = 0;
+   master.tsJumpNum = 0;
+   master.tsJumpLen = 0;
+#if defined(USE_HASH_MAP)
+   // The registries of the master are not used, their counters hold the totals of the shards
+   master.tcpConnReg.lookups = 0;
+   master.tcpConnReg.probes = 0;
+   master.ipSessionReg.lookups = 0;
+   master.ipSessionReg.probes = 0;
+#endif
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      master.tsMinorReorderingNum += shards[i]->staple.tsMinorReorderingNum;
+      master.tsMajorReorderingNum += shards[i]->staple.tsMajorReorderingNum;
+      master.tsJumpNum += shards[i]->staple.tsJumpNum;
+      master.tsJumpLen += shards[i]->staple.tsJumpLen;
+#if defined(USE_HASH_MAP)
+      master.tcpConnReg.lookups += shards[i]->staple.tcpConnReg.lookups;
+      master.tcpConnReg.probes += shards[i]->staple.tcpConnReg.probes;
+      master.ipSessionReg.lookups += shards[i]->staple.ipSessionReg.lookups;
+      master.ipSessionReg.probes += shards[i]->staple.ipSessionReg.probes;
+#endif
+   }
+   masterParser.PrintOverallStatistics(outStream, httpStats);
+}
+
+// Write the final counters of all shards
+void ParserShards::WriteCounters()
+{
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      shards[i]->staple.getCounterContainer()->writeToFile();
+   }
+}
+
+// Shard of a packet: all packets of an IP session (i.e., of a client IP address) go to the same shard
+unsigned short ParserShards::ShardIndex(const L2Packet* pL2Packet) const
+{
+   const L3Packet* pL3Packet = pL2Packet->pL3Packet;
+   if ((pL3Packet == NULL) || ((pL3Packet->l3Type&L3Packet::IP) == 0)) return 0;
+   const IPPacket& ipPacket = *((const IPPacket*)pL3Packet);
+   u_int32_t key;
+   if (ipPacket.match == true)
+   {
+      key = (ipPacket.direction == 0) ? ipPacket.srcIP.data : ipPacket.dstIP.data;
+   }
+   else
+   {
+      key = ipPacket.srcIP.data ^ ipPacket.dstIP.data;
+   }
+   // Mix the bits (neighbouring client addresses should go to different shards)
+   key ^= key >> 16;
+   key *= 0x45d9f3b;
+   key ^= key >> 16;
+   return key % shards.size();
+}
+
+// Move the pending packets of a shard to its queue (blocks while the queue is full)
+void ParserShards::FlushPending(ParserShard& shard)
+{
+   if (shard.pending.empty()) return;
+   pthread_mutex_lock(&shard.queueMutex);
+   unsigned long i = 0;
+   while (i < shard.pending.size())
+   {
+      while (shard.queueLen == SHARD_QUEUE_SIZE)
+      {
+         pthread_cond_signal(&shard.queueNotEmpty);
+         pthread_cond_wait(&shard.queueNotFull, &shard.queueMutex);
+      }
+      while ((i < shard.pending.size()) && (shard.queueLen < SHARD_QUEUE_SIZE))
+      {
+         shard.queue[(shard.queueHead+shard.queueLen)%SHARD_QUEUE_SIZE] = shard.pending[i++];
+         shard.queueLen++;
+      }
+   }
+   pthread_cond_signal(&shard.queueNotEmpty);
+   pthread_mutex_unlock(&shard.queueMutex);
+   shard.pending.clear();
+}
+
+// Move the pending packets of all shards to their queues
+void ParserShards::FlushAllPending()
+{
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      FlushPending(*shards[i]);
+   }
+   lastFlushTime = master.actTime.tv_sec;
+}
+
+// Wait until the shards have parsed all packets dispatched so far
+void ParserShards::WaitIdle()
+{
+   FlushAllPending();
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      ParserShard& shard = *shards[i];
+      pthread_mutex_lock(&shard.queueMutex);
+      while ((shard.queueLen > 0) || shard.busy)
+      {
+         pthread_cond_wait(&shard.queueDrained, &shard.queueMutex);
+      }
+      pthread_mutex_unlock(&shard.queueMutex);
+   }
+}
+
+// Sum up the stats of the shards into the master (the statsMutex of each shard must be held or the shards must be finished)
+void ParserShards::MergeStats()
+{
+   // Fields maintained by the dispatching thread (the input side)
+   unsigned long packetsDuplicated[DUPSTATS_MAX+1];
+   for (int i=0;i<=DUPSTATS_MAX;i++) {packetsDuplicated[i] = master.ipStats.packetsDuplicated[i];}
+   unsigned long lastPacketsRead = master.ipStats.lastPacketsRead;
+   unsigned long lastKBytesRead = master.ipStats.lastKBytesRead;
+
+   master.ipStats.Init();
+   master.tcpStats.Init();
+   master.udpStats.Init();
+   master.icmpStats.Init();
+   master.flvStats = FLVStats();
+   master.mp4Stats.Init();
+   master.timeoutStats.Init();
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      Staple& staple = shards[i]->staple;
+      master.ipStats.Add(staple.ipStats);
+      master.tcpStats.Add(staple.tcpStats);
+      master.udpStats.Add(staple.udpStats);
+      master.icmpStats.Add(staple.icmpStats);
+      master.flvStats.Add(staple.flvStats);
+      master.mp4Stats.Add(staple.mp4Stats);
+      master.timeoutStats.Add(staple.timeoutStats);
+   }
+
+   for (int i=0;i<=DUPSTATS_MAX;i++) {master.ipStats.packetsDuplicated[i] = packetsDuplicated[i];}
+   master.ipStats.lastPacketsRead = lastPacketsRead;
+   master.ipStats.lastKBytesRead = lastKBytesRead;
+}
+
+// Write one status log line with the merged state of all shards
+void ParserShards::WriteStatusLog()
+{
+   FlushAllPending();
+
+   unsigned long tcpConnNum = 0;
+   unsigned long tcpTANum[2] = {0, 0};
+   unsigned long flvNum[2] = {0, 0};
+   TCPConnMemory tcpMemory;
+   tcpMemory.Init();
+   HTTPStats httpStats;
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      pthread_mutex_lock(&shards[i]->statsMutex);
+   }
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      unsigned long shardTCPConnNum;
+      unsigned long shardTCPTANum[2];
+      unsigned long shardFLVNum[2];
+      TCPConnMemory shardTCPMemory;
+      Parser& parser = *shards[i]->staple.parser;
+      parser.CountConnectionState(shardTCPConnNum, shardTCPTANum, shardFLVNum, shardTCPMemory);
+      tcpMemory.Add(shardTCPMemory);
+      tcpConnNum += shardTCPConnNum;
+      tcpTANum[0] += shardTCPTANum[0];
+      tcpTANum[1] += shardTCPTANum[1];
+      flvNum[0] += shardFLVNum[0];
+      flvNum[1] += shardFLVNum[1];
+      httpStats.add(parser.GetHTTPStats());
+   }
+   MergeStats();
+   // SYN loss counters and timeout check times are reported per status log period
+   for (unsigned short i=0;i<shards.size();i++)
+   {
+      shards[i]->staple.tcpStats.ResetSYNStats();
+      shards[i]->staple.timeoutStats.Init();
+      pthread_mutex_unlock(&shards[i]->statsMutex);
+   }
+
+   masterParser.WriteStatusLog(tcpConnNum, tcpTANum, flvNum, tcpMemory, httpStats);
+}
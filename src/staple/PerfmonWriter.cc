@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <staple/PerfmonWriter.h>
+#include <staple/Staple.h>
+#include <staple/RotationService.h>
+
+// Base names of the logfiles (indexed by LogType)
+static const char* perfmonLogName[PerfmonWriter::LOG_TYPE_NUM] = {"tcpta", "tcpta-partial", "flv", "flv-partial"};
+
+static const uint64_t RING_MASK = PERFMON_WRITER_RING_SIZE - 1;
+
+// Ring space taken by a record with the given payload length (8-byte header, padded to 8 bytes)
+static inline uint64_t RecordSize(unsigned long p_len)
+{
+   return (8 + p_len + 7) & ~((uint64_t)7);
+}
+
+void* PerfmonWriterLauncher(void* p_pWriter)
+{
+   reinterpret_cast<PerfmonWriter*>(p_pWriter)->Run();
+   return NULL;
+}
+
+PerfmonWriter::PerfmonWriter(Staple& p_staple) :
+   producerStalls(0),
+   droppedRecords(0),
+   staple(p_staple),
+   running(false),
+   stopping(false),
+   lastPerfmonROP(0),
+   head(0),
+   tail(0)
+{
+   ring = new Byte[PERFMON_WRITER_RING_SIZE];
+   memset(ring, 0, PERFMON_WRITER_RING_SIZE);
+   for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+   {
+      fd[i] = -1;
+      buffer[i] = new Byte[PERFMON_WRITER_BUFFER_SIZE];
+      bufferLen[i] = 0;
+   }
+}
+
+PerfmonWriter::~PerfmonWriter()
+{
+   Finish();
+   for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+   {
+      if (fd[i] >= 0) close(fd[i]);
+      delete [] buffer[i];
+   }
+   delete [] ring;
+}
+
+bool PerfmonWriter::Start()
+{
+   bool success = Rotate(false);
+   // Set before the thread exists (and cleared if it could not be created)
+   running = true;
+   int error = pthread_create(&thread, NULL, PerfmonWriterLauncher, (void*) this);
+   if (error != 0)
+   {
+      running = false;
+      printf("Error creating the perfmon writer thread %s\n",strerror(error));
+      return false;
+   }
+   // The ROP boundaries are given by the rotation service
+   RotationService::Instance().Register(this);
+   return success;
+}
+
+void PerfmonWriter::Write(LogType p_type, const char* p_record, unsigned long p_len)
+{
+   uint64_t size = RecordSize(p_len);
+   // Without the writer thread (it could not be started) the ring would never be drained
+   if ((size > PERFMON_WRITER_RING_SIZE) || !running)
+   {
+      __sync_fetch_and_add(&droppedRecords, 1);
+      return;
+   }
+
+   // Reserve room for the record (wait for the writer thread if the ring is full)
+   bool stalled = false;
+   uint64_t pos = head.load(std::memory_order_relaxed);
+   while (true)
+   {
+      if (pos + size - tail.load(std::memory_order_acquire) > PERFMON_WRITER_RING_SIZE)
+      {
+         if (!stalled) producerStalls++;
+         stalled = true;
+         sched_yield();
+         pos = head.load(std::memory_order_relaxed);
+         continue;
+      }
+      if (head.compare_exchange_weak(pos, pos + size, std::memory_order_relaxed)) break;
+   }
+
+   // Copy the payload (it may wrap around the end of the ring), then publish the header
+   uint64_t offset = (pos + 8) & RING_MASK;
+   unsigned long firstLen = (p_len < PERFMON_WRITER_RING_SIZE - offset) ? p_len : PERFMON_WRITER_RING_SIZE - offset;
+   memcpy(ring + offset, p_record, firstLen);
+   if (firstLen < p_len) memcpy(ring, p_record + firstLen, p_len - firstLen);
+   uint64_t header = (((uint64_t)p_len) << 32) | (p_type + 1);
+   __atomic_store_n(reinterpret_cast<uint64_t*>(ring + (pos & RING_MASK)), header, __ATOMIC_RELEASE);
+}
+
+void PerfmonWriter::Finish()
+{
+   if (!running) return;
+   RotationService::Instance().Unregister(this);
+   stopping.store(true, std::memory_order_release);
+   pthread_join(thread, NULL);
+   running = false;
+   // Write out and rename the last logfiles
+   Rotate(true);
+}
+
+void PerfmonWriter::Run()
+{
+   while (true)
+   {
+      bool found = Drain();
+      // The producers are done when Finish is called, so an empty ring stays empty
+      if (stopping.load(std::memory_order_acquire) && !found && (tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire))) break;
+
+      if (!found)
+      {
+         struct timespec s = {0, PERFMON_WRITER_IDLE_WAIT*1000000};
+         nanosleep(&s, 0);
+      }
+   }
+}
+
+// Move the completed records from the ring to the file buffers (false if there was none)
+bool PerfmonWriter::Drain()
+{
+   bool found = false;
+   uint64_t pos = tail.load(std::memory_order_relaxed);
+   while (true)
+   {
+      uint64_t header = __atomic_load_n(reinterpret_cast<uint64_t*>(ring + (pos & RING_MASK)), __ATOMIC_ACQUIRE);
+      // The next record is not complete yet
+      if (header == 0) break;
+      unsigned long len = header >> 32;
+      unsigned short type = (header & 0xffffffff) - 1;
+      uint64_t size = RecordSize(len);
+
+      // Copy the payload, then clear the whole record for the later producers
+      uint64_t offset = (pos + 8) & RING_MASK;
+      unsigned long firstLen = (len < PERFMON_WRITER_RING_SIZE - offset) ? len : PERFMON_WRITER_RING_SIZE - offset;
+      if (type == ROP_MARKER)
+      {
+         uint64_t rop;
+         memcpy(&rop, ring + offset, firstLen);
+         if (firstLen < len) memcpy(reinterpret_cast<Byte*>(&rop) + firstLen, ring, len - firstLen);
+         AdvanceROP(rop);
+      }
+      else
+      {
+         Append(type, ring + offset, firstLen);
+         if (firstLen < len) Append(type, ring, len - firstLen);
+      }
+      uint64_t start = pos & RING_MASK;
+      unsigned long firstSize = (size < PERFMON_WRITER_RING_SIZE - start) ? size : PERFMON_WRITER_RING_SIZE - start;
+      memset(ring + start, 0, firstSize);
+      if (firstSize < size) memset(ring, 0, size - firstSize);
+
+      pos += size;
+      tail.store(pos, std::memory_order_release);
+      found = true;
+   }
+   return found;
+}
+
+void PerfmonWriter::PrepareROP(unsigned long p_rop)
+{
+   uint64_t rop = p_rop;
+   Write(ROP_MARKER, reinterpret_cast<const char*>(&rop), sizeof(rop));
+}
+
+// Close & recreate the logfiles up to the given ROP (an empty set of logfiles is written for each skipped ROP)
+void PerfmonWriter::AdvanceROP(unsigned long p_rop)
+{
+   // The logfiles were opened before the trace clock was started: they belong to its first ROP
+   if (lastPerfmonROP == 0)
+   {
+      lastPerfmonROP = p_rop;
+      return;
+   }
+   while (lastPerfmonROP < p_rop) Rotate(false);
+}
+
+void PerfmonWriter::Append(unsigned short p_type, const Byte* p_data, unsigned long p_len)
+{
+   if (fd[p_type] < 0) return;
+   if (bufferLen[p_type] + p_len > PERFMON_WRITER_BUFFER_SIZE) FlushBuffer(p_type);
+   if (p_len > PERFMON_WRITER_BUFFER_SIZE)
+   {
+      // Larger than the buffer: write it directly
+      Byte* pOrigBuffer = buffer[p_type];
+      buffer[p_type] = const_cast<Byte*>(p_data);
+      bufferLen[p_type] = p_len;
+      FlushBuffer(p_type);
+      buffer[p_type] = pOrigBuffer;
+      return;
+   }
+   memcpy(buffer[p_type] + bufferLen[p_type], p_data, p_len);
+   bufferLen[p_type] += p_len;
+}
+
+void PerfmonWriter::FlushBuffer(unsigned short p_type)
+{
+   unsigned long written = 0;
+   while (written < bufferLen[p_type])
+   {
+      ssize_t n = write(fd[p_type], buffer[p_type] + written, bufferLen[p_type] - written);
+      if (n < 0)
+      {
+         if (errno == EINTR) continue;
+         printf("Error writing log file %s\n",strerror(errno));
+         break;
+      }
+      written += n;
+   }
+   bufferLen[p_type] = 0;
+}
+
+// Close old perfmon logfiles, and create new ones (if necessary)
+bool PerfmonWriter::Rotate(bool p_isFinal)
+{
+   // Temporary logfile names
+   char tmpName[LOG_TYPE_NUM][1000];
+   for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+   {
+      snprintf(tmpName[i], sizeof(tmpName[i]), "%s/%s%s.tmp",staple.perfmonDirName.c_str(),perfmonLogName[i],staple.perfmonLogPrefix.c_str());
+   }
+
+   // Initialize lastPerfmonROP
+   if (lastPerfmonROP==0)
+   {
+      lastPerfmonROP = RotationService::Instance().ROP();
+   }
+   // Rename the old temporary log files to their final names (not in the first ROP)
+   else
+   {
+      // Write out the buffered records and make them durable before the files are handed over
+      for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+      {
+         if (fd[i] < 0) continue;
+         FlushBuffer(i);
+         fdatasync(fd[i]);
+         close(fd[i]);
+         fd[i] = -1;
+      }
+
+      // Calculate the previous ROP Time
+      time_t previousRopTime = PERFMON_ROP*lastPerfmonROP;
+      struct tm* prevRopTime = gmtime(&previousRopTime);
+      char prevTimeStamp[24];
+      snprintf(prevTimeStamp, sizeof(prevTimeStamp), "%02d%02d", prevRopTime->tm_hour, prevRopTime->tm_min);
+
+      // Increment the ROP counter
+      lastPerfmonROP++;
+
+      // Calculate the current ROP Time
+      time_t epochTime = PERFMON_ROP*lastPerfmonROP;
+      struct tm* ropTime = gmtime(&epochTime);
+
+      // Create the Time stamp string in the format: A<year><month><day>.<previousRop HourMinute><currentRop HourMinute>
+      char fileTimeStamp[64];
+      snprintf(fileTimeStamp, sizeof(fileTimeStamp), "A%04d%02d%02d.%s-%02d%02d", (ropTime->tm_year+1900), (ropTime->tm_mon+1), ropTime->tm_mday, prevTimeStamp, ropTime->tm_hour, ropTime->tm_min);
+
+      // The file names contain timestamp
+      for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+      {
+         char name[1000];
+         snprintf(name, sizeof(name), "%s/%s_staple_%s_%i%s.log",staple.perfmonDirName.c_str(), fileTimeStamp, perfmonLogName[i], (int) epochTime, staple.perfmonLogPrefix.c_str());
+         rename(tmpName[i], name);
+      }
+   }
+
+   if (p_isFinal) return true;
+
+   // Open the new (temporary) perfmon logfiles
+   bool success = true;
+   for (unsigned short i=0;i<LOG_TYPE_NUM;i++)
+   {
+      fd[i] = open(tmpName[i], O_WRONLY|O_CREAT|O_TRUNC, 0666);
+      if (fd[i] < 0)
+      {
+         printf("Error opening log file %s\n",strerror(errno));
+         success = false;
+      }
+   }
+   return success;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <sys/time.h>
+
+#include <staple/RotationService.h>
+
+static RotationService* pRotationService = NULL;
+static pthread_once_t rotationServiceOnce = PTHREAD_ONCE_INIT;
+
+// The service is never destroyed (its thread may run until the process exits)
+void RotationService::Create()
+{
+   pRotationService = new RotationService();
+}
+
+RotationService& RotationService::Instance()
+{
+   pthread_once(&rotationServiceOnce, Create);
+   return *pRotationService;
+}
+
+void* RotationServiceLauncher(void* p_pService)
+{
+   reinterpret_cast<RotationService*>(p_pService)->Run();
+   return NULL;
+}
+
+RotationService::RotationService() :
+   traceClock(false),
+   nextBoundary(0),
+   retirePending(false),
+   running(false)
+{
+   struct timeval actRealTime;
+   gettimeofday(&actRealTime, NULL);
+   rop = actRealTime.tv_sec/PERFMON_ROP;
+   startTime = actRealTime.tv_sec;
+   pthread_mutex_init(&mutex, NULL);
+   pthread_cond_init(&wakeup, NULL);
+}
+
+void RotationService::Start()
+{
+   pthread_mutex_lock(&mutex);
+   if (!running)
+   {
+      pthread_create(&thread, NULL, RotationServiceLauncher, (void*) this);
+      pthread_detach(thread);
+      running = true;
+   }
+   pthread_mutex_unlock(&mutex);
+}
+
+void RotationService::SetTraceClock()
+{
+   pthread_mutex_lock(&mutex);
+   traceClock = true;
+   nextBoundary = 0;
+   rop = 0;
+   startTime = 0;
+   pthread_mutex_unlock(&mutex);
+}
+
+void RotationService::NewTraceROP(time_t p_sec)
+{
+   unsigned long newROP = p_sec/PERFMON_ROP;
+   nextBoundary = PERFMON_ROP*(newROP+1);
+   pthread_mutex_lock(&mutex);
+   if (StartTime() == 0) startTime.store(p_sec, std::memory_order_release);
+   for (unsigned long i=0;i<sinks.size();i++) sinks[i]->PrepareROP(newROP);
+   rop.store(newROP, std::memory_order_release);
+   pthread_mutex_unlock(&mutex);
+}
+
+void RotationService::Register(RotatingSink* p_pSink)
+{
+   Start();
+   pthread_mutex_lock(&mutex);
+   sinks.push_back(p_pSink);
+   pthread_mutex_unlock(&mutex);
+}
+
+void RotationService::Unregister(RotatingSink* p_pSink)
+{
+   pthread_mutex_lock(&mutex);
+   sinks.erase(std::remove(sinks.begin(), sinks.end(), p_pSink), sinks.end());
+   pthread_mutex_unlock(&mutex);
+}
+
+void RotationService::Notify()
+{
+   retirePending.store(true);
+   // Never wait for the service thread: if it is busy, it checks retirePending before going to sleep again
+   if (pthread_mutex_trylock(&mutex) == 0)
+   {
+      pthread_cond_signal(&wakeup);
+      pthread_mutex_unlock(&mutex);
+   }
+}
+
+void RotationService::Run()
+{
+   pthread_mutex_lock(&mutex);
+   while (true)
+   {
+      // Sleep until the next ROP boundary, but at most 1 s (a Notify may be missed between the check and the wait)
+      if (!retirePending.exchange(false))
+      {
+         struct timeval actRealTime;
+         gettimeofday(&actRealTime, NULL);
+         struct timespec deadline = {actRealTime.tv_sec + 1, actRealTime.tv_usec*1000};
+         time_t boundary = PERFMON_ROP*(ROP()+1);
+         if (!traceClock && (boundary < deadline.tv_sec))
+         {
+            deadline.tv_sec = boundary;
+            deadline.tv_nsec = 0;
+         }
+         pthread_cond_timedwait(&wakeup, &mutex, &deadline);
+         retirePending.store(false);
+      }
+
+      // Close and rename the files handed back by the writers
+      for (unsigned long i=0;i<sinks.size();i++) sinks[i]->Retire();
+
+      // The trace clock is advanced by the parser
+      if (traceClock) continue;
+
+      // ROP boundary: the files of the new ROP are ready by the time the writers see the new ROP number
+      struct timeval actRealTime;
+      gettimeofday(&actRealTime, NULL);
+      unsigned long actROP = actRealTime.tv_sec/PERFMON_ROP;
+      if (actROP != ROP())
+      {
+         for (unsigned long i=0;i<sinks.size();i++) sinks[i]->PrepareROP(actROP);
+         rop.store(actROP, std::memory_order_release);
+      }
+   }
+}
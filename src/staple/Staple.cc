@@ -4,6 +4,7 @@
 #include "Util.h"
 
 #include <sstream>
+#include <arpa/inet.h>                                   // inet_pton
 
 Staple::Staple() :
    // Init input parameters
@@ -15,9 +16,18 @@ Staple::Staple() :
    perfmonDirName(""),
    perfmonLogPrefix(""),
    ignoreL2Duplicates(false),
+   parserThreads(1),
+   pipelinedReader(false),
+   decapGTP(true),
+   tunnelKey(false),
+   traceClockROP(false),
+   packetPool(*this),
    packetDumpFile(*this),
    // Init internal variables
    packetsRead(0),
+   packetsVLANStacked(0),
+   packetsMPLS(0),
+   packetsGTPU(0),
    tsMinorReorderingNum(0),
    tsMajorReorderingNum(0),
    tsJumpNum(0),
@@ -36,6 +46,7 @@ Staple::Staple() :
    udpStats.Init();
    icmpStats.Init();
    mp4Stats.Init();
+   timeoutStats.Init();
    for (int i = 0; i <= DUPSTATS_MAX; ++i) {packetsDuplicated[i] = 0;}
    parser->Init();
    // Get system time (for processing speed calculation)
@@ -54,6 +65,70 @@ Staple::~Staple()
    delete counterContainer_;
 }
 
+void Staple::NewAddrFilter(unsigned short p_netId)
+{
+   unsigned long filterNum = addrFilterNum[p_netId] + 1;
+   netIP[p_netId].resize(filterNum);
+   netPort[p_netId].resize(filterNum, 0);
+   netMask[p_netId].resize(filterNum);
+   netGiven[p_netId].resize(filterNum, false);
+   portGiven[p_netId].resize(filterNum, false);
+   netIsIPv6[p_netId].resize(filterNum, false);
+   netIP6[p_netId].resize(filterNum);
+   netPrefixLen6[p_netId].resize(filterNum, 0);
+}
+
+bool Staple::ParseIPv6Filter(unsigned short p_netId, const char* p_spec)
+{
+   std::string spec(p_spec);
+   unsigned short port = 0;
+   bool portSet = false;
+
+   // Prefix length
+   size_t slashPos = spec.rfind('/');
+   if (slashPos == std::string::npos) return false;
+   unsigned short prefixLen;
+   char tail;
+   if ((sscanf(spec.c_str()+slashPos+1, "%hu%c", &prefixLen, &tail) != 1) || (prefixLen > 128)) return false;
+
+   // Address (in brackets if a port is given)
+   std::string addr = spec.substr(0, slashPos);
+   if ((addr.size() > 0) && (addr[0] == '['))
+   {
+      size_t closePos = addr.find(']');
+      if (closePos == std::string::npos) return false;
+      if (sscanf(addr.c_str()+closePos+1, ":%hu%c", &port, &tail) != 1) return false;
+      portSet = true;
+      addr = addr.substr(1, closePos-1);
+   }
+   IPv6Address IP;
+   if (inet_pton(AF_INET6, addr.c_str(), IP.byte) != 1) return false;
+
+   unsigned long actFilter = addrFilterNum[p_netId];
+   netIsIPv6[p_netId][actFilter] = true;
+   netIP6[p_netId][actFilter] = IP;
+   netPrefixLen6[p_netId][actFilter] = prefixLen;
+   netPort[p_netId][actFilter] = port;
+   netGiven[p_netId][actFilter] = true;
+   portGiven[p_netId][actFilter] = portSet;
+   return true;
+}
+
+void Staple::CompileAddrFilters()
+{
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      addrFilter[netId].Clear();
+      addrFilter6[netId].Clear();
+      for (unsigned long actFilter=0;actFilter<addrFilterNum[netId];actFilter++)
+      {
+         if (!netGiven[netId][actFilter]) continue;
+         if (netIsIPv6[netId][actFilter]) addrFilter6[netId].AddPrefix(netIP6[netId][actFilter].byte, netPrefixLen6[netId][actFilter], actFilter);
+         else addrFilter[netId].AddPrefix(netIP[netId][actFilter].data, netMask[netId][actFilter].data, actFilter);
+      }
+   }
+}
+
 void Staple::config(std::string const& key, std::string const& val, void* ptr) throw (std::string)
 {
    Staple& staple = *reinterpret_cast<Staple*>(ptr);
@@ -76,6 +151,33 @@ void Staple::config(std::string const& key, std::string const& val, void* ptr) t
          staple.perfmonDirName = val;
       }
    }
+   else if (key == "parserThreads")
+   {
+      int n = parseint(val);
+      if ((n < 1) || (n > MAX_PARSER_THREADS))
+      {
+         std::ostringstream o;
+         o << "bad parserThreads \"" << val << "\"";
+         throw o.str();
+      }
+      staple.parserThreads = n;
+   }
+   else if (key == "pipelinedReader")
+   {
+      staple.pipelinedReader = (parseint(val) != 0);
+   }
+   else if (key == "decapGTP")
+   {
+      staple.decapGTP = (parseint(val) != 0);
+   }
+   else if (key == "tunnelKey")
+   {
+      staple.tunnelKey = (parseint(val) != 0);
+   }
+   else if (key == "traceClockROP")
+   {
+      staple.traceClockROP = (parseint(val) != 0);
+   }
    else if (key == "tcpSSBytes")
       TCPTA_SSTHRESH = parseint(val);
    else if (key == "tcpSSFlightSize")
@@ -3,6 +3,8 @@
 #include <staple/Parser.h>
 #include "Util.h"
 
+#include <string.h>
+
 #ifndef LIBSTAPLE_VERSION
 #define LIBSTAPLE_VERSION "unknown"
 #endif
@@ -14,6 +16,11 @@ std::string staple::libstaple_version()
 
 staple::StapleAPI::StapleAPI() : s(new Staple()) {}
 
+staple::StapleAPI::~StapleAPI()
+{
+   for (unsigned long i=0;i<batchEth.size();i++) delete batchEth[i];
+}
+
 void staple::StapleAPI::status(std::ostream& ss)
 {
    ss << "IP sessions: " << s->ipSessionReg.size()
@@ -39,11 +46,49 @@ bool staple::StapleAPI::parsePacket(char * bytes, unsigned short int len, const
    EthernetPacket eth(p.staple);
    eth.Init();
    eth.time = t;
-   eth.pL3Packet = DecodeIPPacket(bytes, len, p.staple);
+   eth.pL3Packet = DecodeIPPacket(bytes, len, t.tv_sec, p.staple);
    if (!eth.pL3Packet) return false;
    eth.pL3Packet->pL2Packet = &eth;
    static_cast<IPPacket*>(eth.pL3Packet)->direction = uplink ? 0 : 1;
    static_cast<IPPacket*>(eth.pL3Packet)->match = true;
    p.ParsePacket(static_cast<L2Packet*>(&eth));
+   // Give the decoded packet back to the pool (the stack Ethernet packet is not pooled)
+   eth.pL3Packet->pL2Packet = NULL;
+   p.staple.packetPool.Release(eth.pL3Packet);
+   eth.pL3Packet = NULL;
    return true;
 }
+
+unsigned long staple::StapleAPI::parsePackets(const PacketRef* packets, unsigned long num, unsigned char* accepted)
+{
+   Parser & p = *s->parser;
+   if (accepted) memset(accepted, 0, (num+7)/8);
+   // Decode the whole batch first (one Ethernet wrapper per slot, reused across batches)
+   while (batchEth.size() < num) batchEth.push_back(new EthernetPacket(p.staple));
+   if (batchL2.size() < num) batchL2.resize(num);
+   unsigned long acceptedNum = 0;
+   for (unsigned long i=0;i<num;i++)
+   {
+      L3Packet* pL3Packet = DecodeIPPacket(packets[i].bytes, packets[i].len, packets[i].t.tv_sec, p.staple);
+      if (!pL3Packet) continue;
+      EthernetPacket& eth = *batchEth[acceptedNum];
+      eth.Init();
+      eth.time = packets[i].t;
+      eth.pL3Packet = pL3Packet;
+      pL3Packet->pL2Packet = &eth;
+      static_cast<IPPacket*>(pL3Packet)->direction = packets[i].uplink ? 0 : 1;
+      static_cast<IPPacket*>(pL3Packet)->match = true;
+      batchL2[acceptedNum++] = &eth;
+      if (accepted) accepted[i/8] |= 1 << (i%8);
+   }
+   if (acceptedNum > 0) p.ParsePackets(&batchL2[0], acceptedNum);
+   // Give the decoded packets back to the pool
+   for (unsigned long i=0;i<acceptedNum;i++)
+   {
+      EthernetPacket& eth = *batchEth[i];
+      eth.pL3Packet->pL2Packet = NULL;
+      p.staple.packetPool.Release(eth.pL3Packet);
+      eth.pL3Packet = NULL;
+   }
+   return acceptedNum;
+}
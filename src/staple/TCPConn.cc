@@ -5,3 +5,85 @@ std::ostream& operator<<(std::ostream& o, const TCPConnId& p)
    p.Print(o);
    return o;
 }
+
+// Heap usage estimates of the standard containers (node = value + links)
+template <class T>
+static unsigned long ListBytes(const std::list<T>& p_list)
+{
+   return p_list.size() * (sizeof(T) + 2*sizeof(void*));
+}
+
+template <class K, class V>
+static unsigned long MapBytes(unsigned long p_size)
+{
+   return p_size * (sizeof(std::pair<const K,V>) + 4*sizeof(void*));
+}
+
+static unsigned long StringBytes(const std::string& p_string)
+{
+   return (p_string.capacity() > 15) ? p_string.capacity()+1 : 0;
+}
+
+void TCPConnMemory::Add(const TCPConnMemory& p_memory)
+{
+   connections += p_memory.connections;
+   core += p_memory.core;
+   packetHistory += p_memory.packetHistory;
+   payload += p_memory.payload;
+   lists += p_memory.lists;
+   content += p_memory.content;
+   timestamps += p_memory.timestamps;
+   transactions += p_memory.transactions;
+   contentParts += p_memory.contentParts;
+   timestampParts += p_memory.timestampParts;
+   transactionParts += p_memory.transactionParts;
+}
+
+void TCPConnMemory::Print(std::ostream& outStream) const
+{
+   double n = (connections > 0) ? connections : 1;
+   outStream << "TCP memory: " << connections << " connections, "
+             << (core+packetHistory+payload+lists+content+timestamps+transactions)/n << " bytes/connection"
+             << " (core " << core/n
+             << ", packet history " << packetHistory/n
+             << ", payload " << payload/n
+             << ", lists " << lists/n
+             << ", content " << content/n << " [" << contentParts << "]"
+             << ", timestamps " << timestamps/n << " [" << timestampParts << "]"
+             << ", transactions " << transactions/n << " [" << transactionParts << "])\n";
+}
+
+void TCPConn::AddMemoryUsage(TCPConnMemory& p_memory) const
+{
+   p_memory.connections++;
+   p_memory.core += sizeof(TCPConn);
+   for (unsigned short i=0;i<2;i++)
+   {
+      p_memory.packetHistory += packetTrains[i].Capacity() * sizeof(PacketTrainTCPPacket);
+      p_memory.payload += payloadCache[i].size + ListBytes(payloadRanges[i].rangeList);
+      p_memory.lists += ListBytes(rtxPeriodList[i]) + ListBytes(highestSeqList[i]);
+   }
+   p_memory.lists += MapBytes<unsigned long,char>(SYNReg.size() + SYNACKReg.size());
+
+   if (content.Allocated())
+   {
+      const TCPConnContent& c = *content.Ptr();
+      p_memory.contentParts++;
+      p_memory.content += sizeof(TCPConnContent) + StringBytes(c.userAgent) + StringBytes(c.contentType);
+      for (unsigned short i=0;i<2;i++)
+      {
+         p_memory.content += StringBytes(c.lastReqURI[i]) + StringBytes(c.lastReqHost[i]) + ListBytes(c.flv[i].qoeList) + ListBytes(c.flv[i].qoeTime);
+      }
+   }
+   if (timestamps.Allocated())
+   {
+      p_memory.timestampParts++;
+      p_memory.timestamps += sizeof(TCPConnTimestamps) +
+         MapBytes<unsigned long,TCPConnTSRegEntry>(timestamps.Ptr()->tsReg[0].size() + timestamps.Ptr()->tsReg[1].size());
+   }
+   if (history.Allocated())
+   {
+      p_memory.transactionParts++;
+      p_memory.transactions += sizeof(TCPConnHistory) + ListBytes(history.Ptr()->transactionList[0]) + ListBytes(history.Ptr()->transactionList[1]);
+   }
+}
@@ -204,7 +204,8 @@ const Byte* ChunkedParser::parse(const Byte* buf, const Byte* end, vector<Byte>*
 				state_ = END;
 				buf += 2;
 			} else {
-				newBuf = parseHeader(buf, end, &headers_);
+				// The trailer headers are not used, only skipped.
+				newBuf = parseHeader(buf, end);
 				if (newBuf == NULL) {
 					WARN("ChunkedParser::parse: Strange header, ignoring. ",
 					     quoteString(buf, end));
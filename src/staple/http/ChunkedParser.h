@@ -6,7 +6,6 @@
 #include <staple/Type.h>
 #include <staple/http/globals.h>
 
-class HTTPHeader;
 class Staple;
 
 /* Class to parse entity body encoded with transfer-encoding:
@@ -24,7 +23,6 @@ public:
 
 	// Get length of body parsed so far.
 	long getBodyLength() const { return totalLen_; }
-	const std::vector<HTTPHeader>& getHeaders() const { return headers_; }
 
 private:
 	// We allow copying of ChunkedParser to allow copying of HTTPMsg.
@@ -35,7 +33,6 @@ private:
 	Staple& staple_;
 	ParseState state_;
 	long curChunkSize_, receivedBytesOfCurChunk_, totalLen_;
-	std::vector<HTTPHeader> headers_;
 };
 
 #endif
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <limits.h>
 
 #include <staple/http/Counter.h>
 #include <staple/http/log.h>
@@ -18,6 +21,11 @@ using std::set;
 int CounterContainer::maxCounterID_ = 0;
 CounterContainer::CounterMap CounterContainer::counterIDs_;
 
+/* Guards counterIDs_ and the set of containers: counters may be
+ * allocated concurrently by the parser shard threads.
+ */
+static pthread_mutex_t counterMutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 set<CounterContainer*>& CounterContainer::getStaticMapContainer ()
 {
@@ -27,23 +35,43 @@ set<CounterContainer*>& CounterContainer::getStaticMapContainer ()
 
 CounterContainer::CounterContainer(Staple& staple) :
 	staple_(staple),
-	doWrite_(0),
-	logFile_(NULL),
-	created_(Timeval::getCurrentTime())
+	rotation_(RotationService::Instance()),
+	writeROP_(ULONG_MAX),
+	logFile_(NULL)
 {
+	/* Reserve the capacity up front so that a counter allocated
+	 * by another thread never reallocates the vector under an
+	 * increase() running in parallel.
+	 */
+	counters_.reserve(MAX_COUNTERS);
+	pthread_mutex_lock(&counterMutex);
+	counters_.resize(maxCounterID_, 0);
 	getStaticMapContainer ().insert(this);
+	pthread_mutex_unlock(&counterMutex);
 }
 
 CounterContainer::~CounterContainer()
 {
+	pthread_mutex_lock(&counterMutex);
 	getStaticMapContainer().erase(this);
+	pthread_mutex_unlock(&counterMutex);
 }
 
 int CounterContainer::allocateCounter(const std::string& name)
 {
+	pthread_mutex_lock(&counterMutex);
 	CounterMap::iterator it = counterIDs_.find(name);
 	int id;
 	if (it == counterIDs_.end()) {
+		/* The counters_ of the other containers must not be
+		 * reallocated under their threads, so never grow them
+		 * beyond the reserved capacity.
+		 */
+		if (maxCounterID_ >= MAX_COUNTERS) {
+			pthread_mutex_unlock(&counterMutex);
+			std::cerr << "Too many counters (" << MAX_COUNTERS << "), cannot allocate \"" << name << "\"" << std::endl;
+			abort();
+		}
 		id = maxCounterID_++;
 		counterIDs_[name] = id;
 
@@ -54,6 +82,7 @@ int CounterContainer::allocateCounter(const std::string& name)
 	} else {
 		id = it->second;
 	}
+	pthread_mutex_unlock(&counterMutex);
 
 	return id;
 }
@@ -62,12 +91,14 @@ void CounterContainer::print(LogFile* lf)
 {
 	DataWriterTab dw;
 	dw.setLogFile(lf);
+	pthread_mutex_lock(&counterMutex);
 	for (CounterMap::const_iterator it = counterIDs_.begin(); it != counterIDs_.end(); ++it) {
 		const CounterMap::value_type& p = *it;
 		dw.write(p.first);
 		dw.write(counters_[p.second]);
 		dw.endRecord();
 	}
+	pthread_mutex_unlock(&counterMutex);
 	lf->flush();
 }
 
@@ -87,14 +118,20 @@ void CounterContainer::setLogging(bool enable)
 	if (enable) {
 		logFile_ = new RotatingLogFile(staple_, "counters");
 		logFile_->setAutoRotate(false);
+		// Computed when the clock is running.
+		writeROP_ = 0;
 	} else {
 		logFile_ = NULL;
+		writeROP_ = ULONG_MAX;
 	}
 }
 
 void CounterContainer::resetAll()
 {
+	/* The size of counters_ is changed by allocateCounter. */
+	pthread_mutex_lock(&counterMutex);
 	fill(counters_.begin(), counters_.end(), 0);
+	pthread_mutex_unlock(&counterMutex);
 }
 
 void CounterContainer::writeToFileIfNew()
@@ -102,15 +139,25 @@ void CounterContainer::writeToFileIfNew()
 	if (!logFile_)
 		return;
 
-	Timeval cur(Timeval::getCurrentTime());
-	if (cur.diff(created_) < RotatingLogFile::HTTP_ROP)
-		return;
-
-	if (logFile_->shouldRotate()) {
-		logFile_->openNewLogFile();
-		print(logFile_);
-		resetAll();
+	/* The first write is at the first ROP boundary at least
+	 * HTTP_ROP seconds after the start of the clock (the start of
+	 * the program, or the first packet if the ROPs follow the
+	 * trace time).
+	 */
+	if (writeROP_ == 0) {
+		time_t start = rotation_.StartTime();
+		if (start == 0)
+			return;
+		long rop = RotatingLogFile::HTTP_ROP;
+		writeROP_ = (start + 2 * rop - 1) / rop;
+		if (rotation_.ROP() < writeROP_)
+			return;
 	}
+
+	logFile_->openNewLogFile();
+	print(logFile_);
+	resetAll();
+	writeROP_ = rotation_.ROP() + 1;
 }
 
 Counter::Counter(const std::string& name)
@@ -10,7 +10,7 @@ using std::ostream;
 using std::endl;
 using std::string;
 
-DataWriterTab::DataWriterTab() : logFile_(NULL), curCol_(0)
+DataWriterTab::DataWriterTab() : logFile_(NULL), curCol_(0), lastSec_(-1), lastSecLen_(0)
 { }
 
 DataWriterTab::~DataWriterTab()
@@ -29,10 +29,7 @@ void DataWriterTab::write(const std::string& s)
 
 void DataWriterTab::write(const std::string& s, int maxLen)
 {
-	int len = 0;
-	if (curCol_ > 0)
-		buf_ << '\t';
-	curCol_++;
+	nextColumn();
 
 	if (s.size() == 0) {
 		// Special case empty strings. Some scripts in Perfmon
@@ -41,12 +38,22 @@ void DataWriterTab::write(const std::string& s, int maxLen)
 		return;
 	}
 
-	for (size_t i = 0; i < s.size(); i++) {
-		char c = s[i];
-		len++;
-		if (len > maxLen)
-			break;
-
+	size_t end = s.size();
+	if (maxLen < 0)
+		end = 0;
+	else if (end > (size_t) maxLen)
+		end = maxLen;
+
+	/* Copy the runs of printable characters at once. */
+	const char* str = s.data();
+	size_t runStart = 0;
+	for (size_t i = 0; i < end; i++) {
+		char c = str[i];
+		if (c != '\\' && isprint(c))
+			continue;
+
+		buf_.Append(str + runStart, i - runStart);
+		runStart = i + 1;
 		if (c == '\\')
 			buf_ << "\\\\";
 		else if (c == '\t')
@@ -55,14 +62,13 @@ void DataWriterTab::write(const std::string& s, int maxLen)
 			buf_ << "\\n";
 		else if (c == '\r')
 			buf_ << "\\r";
-		else if (isprint(c))
-			buf_ << c;
 		else {
-			char buf[16];
-			sprintf(buf, "\\x%02x", (unsigned char) c);
-			buf_ << buf;
+			char hex[16];
+			sprintf(hex, "\\x%02x", (unsigned char) c);
+			buf_ << hex;
 		}
 	}
+	buf_.Append(str + runStart, end - runStart);
 }
 
 void DataWriterTab::write(int x)
@@ -77,34 +83,54 @@ void DataWriterTab::write(long long x)
 
 void DataWriterTab::write(double x)
 {
-	// We don't want scientific notation, use sprintf instead of
-	// mucking with C++ manipulators.
-	char buf[32];
-	snprintf(buf, sizeof(buf), "%f", x);
-	writeSimple(buf);
+	// No scientific notation: the same as printf("%f").
+	nextColumn();
+	buf_.AppendFixed6(x);
 }
 
 void DataWriterTab::write(const Timeval& t)
 {
-	writeSimple(t);
+	// The same as operator<<(ostream&, const Timeval&).
+	const struct timeval& tv = t.getTimeval();
+	if (tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+		std::ostringstream o;
+		o << t;
+		writeSimple(o.str());
+		return;
+	}
+
+	if (tv.tv_sec != lastSec_) {
+		time_t sec = tv.tv_sec;
+		struct tm* tm = localtime(&sec);
+		lastSecLen_ = strftime(lastSecText_, sizeof(lastSecText_), "%Y-%m-%d %H:%M:%S", tm);
+		lastSec_ = sec;
+	}
+
+	nextColumn();
+	buf_.Append(lastSecText_, lastSecLen_);
+	long ms = tv.tv_usec/1000;
+	char frac[4] = { '.', (char) ('0' + ms/100), (char) ('0' + ms/10%10), (char) ('0' + ms%10) };
+	buf_.Append(frac, sizeof(frac));
 }
 
 void DataWriterTab::write(const IPAddress& ip)
 {
-	writeSimple(ip);
+	nextColumn();
+	buf_.AppendIPAddress(ip.getIPVersion(), ip.getIP());
 }
 
 void DataWriterTab::write(HTTPMsg::Method m)
 {
-	writeSimple(m);
+	writeSimple(methodToString(m));
 }
 
 void DataWriterTab::endRecord()
 {
 	curCol_ = 0;
 
-	logFile_->writeLine(buf_.str());
-	buf_.str("");
+	line_.assign(buf_.Data(), buf_.Size());
+	logFile_->writeLine(line_);
+	buf_.Clear();
 }
 
 // FIXME: Use curLine_ to print current line number on exception.
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <sstream>
 
+#include <staple/LineBuffer.h>
 #include <staple/http/Timeval.h>
 #include <staple/http/IPAddress.h>
 #include <staple/http/globals.h>
@@ -37,16 +38,29 @@ private:
 	DISALLOW_COPY_AND_ASSIGN(DataWriterTab);
 
 	LogFile* logFile_;
-	std::stringstream buf_;
+	/* The record being formatted and its copy handed to the log
+	 * file. Both keep their capacity between the records. */
+	LineBuffer buf_;
+	std::string line_;
 	int curCol_;
-	template<typename T> void writeSimple(const T& x)
-	{
 
+	/* Text of the last second written by write(const Timeval&),
+	 * as formatting the local time is expensive. */
+	time_t lastSec_;
+	char lastSecText_[64];
+	size_t lastSecLen_;
+
+	void nextColumn()
+	{
 		if (curCol_ > 0)
 			buf_ << '\t';
-		buf_ << x;
 		curCol_++;
 	}
+	template<typename T> void writeSimple(const T& x)
+	{
+		nextColumn();
+		buf_ << x;
+	}
 };
 
 class DataReaderTab
@@ -1,5 +1,9 @@
 #include <algorithm>
 #include <ctype.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "HTTP-helpers.h"
 #include "string-utils.h"
@@ -14,11 +18,133 @@ const Byte* skipSpace(const Byte* buf, const Byte* end)
 	return buf;
 }
 
+/* The line end scanning kernels. They scan [p, end) for CRLF
+ * sequences, store pointers to them in lines and return the number
+ * found. They stop after maxLines CRLFs or at the CRLF of the first
+ * empty line, where lineStart is the start of the line p is in. The
+ * scalar one relies on memchr, which the C library typically
+ * vectorizes as well.
+ */
+typedef int (*LineEndsKernel)(const Byte* p, const Byte* end, const Byte* lineStart,
+			      const Byte** lines, int maxLines);
+
+static int findLineEndsScalar(const Byte* p, const Byte* end, const Byte* lineStart,
+			      const Byte** lines, int maxLines)
+{
+	int n = 0;
+	while (end - p >= 2) {
+		p = (const Byte*) memchr(p, '\r', end - p - 1);
+		if (p == NULL)
+			break;
+		if (p[1] == '\n') {
+			lines[n++] = p;
+			if (p == lineStart || n == maxLines)
+				break;
+			lineStart = p + 2;
+		}
+		p++;
+	}
+	return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Compare a block with '\r' and the block one byte later with '\n',
+ * giving one bit per CRLF. The loads read BLOCK+1 bytes, so the
+ * remaining bytes (and the last one) are left to the scalar kernel.
+ */
+#define FIND_LINE_ENDS_VECTOR(BLOCK, VEC, LOAD, SET1, CMPEQ, AND, MOVEMASK)	\
+	int n = 0;								\
+	const VEC cr = SET1('\r');						\
+	const VEC lf = SET1('\n');						\
+	for (; end - p > BLOCK; p += BLOCK) {					\
+		VEC a = LOAD((const VEC*) p);					\
+		VEC b = LOAD((const VEC*) (p+1));				\
+		unsigned mask = MOVEMASK(AND(CMPEQ(a, cr), CMPEQ(b, lf)));	\
+		for (; mask != 0; mask &= mask - 1) {				\
+			const Byte* crlf = p + __builtin_ctz(mask);		\
+			lines[n++] = crlf;					\
+			if (crlf == lineStart || n == maxLines)			\
+				return n;					\
+			lineStart = crlf + 2;					\
+		}								\
+	}									\
+	return n + findLineEndsScalar(p, end, lineStart, lines + n, maxLines - n)
+
+__attribute__((target("sse2")))
+static int findLineEndsSSE2(const Byte* p, const Byte* end, const Byte* lineStart,
+			    const Byte** lines, int maxLines)
+{
+	FIND_LINE_ENDS_VECTOR(16, __m128i, _mm_loadu_si128, _mm_set1_epi8,
+			      _mm_cmpeq_epi8, _mm_and_si128, _mm_movemask_epi8);
+}
+
+__attribute__((target("avx2")))
+static int findLineEndsAVX2(const Byte* p, const Byte* end, const Byte* lineStart,
+			    const Byte** lines, int maxLines)
+{
+	FIND_LINE_ENDS_VECTOR(32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8,
+			      _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_movemask_epi8);
+}
+#endif
+
+/* Use the widest kernel the CPU supports. */
+static LineEndsKernel selectLineEndsKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return findLineEndsAVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return findLineEndsSSE2;
+#endif
+	return findLineEndsScalar;
+}
+
+static const LineEndsKernel lineEndsKernel = selectLineEndsKernel();
+
+/* A single CRLF is typically close, so this uses the memchr based
+ * kernel (which has less setup than the others).
+ */
 const Byte* findCRLF(const Byte* buf, const Byte* end)
 {
 	CHECKED_RETURN_INIT(buf, end);
-	const Byte crlf[] = {'\r', '\n'};
-	CHECKED_RETURN(std::search(buf, end, crlf, crlf+2));
+	const Byte* crlf;
+	CHECKED_RETURN(findLineEndsScalar(buf, end, NULL, &crlf, 1) ? crlf : end);
+}
+
+int findLineEnds(const Byte* buf, const Byte* from, const Byte* end, const Byte** lines, int maxLines)
+{
+	assert(buf <= from && from <= end);
+	assert(maxLines > 0);
+	return lineEndsKernel(from, end, buf, lines, maxLines);
+}
+
+/* The kernel of the id, NULL if the CPU does not support it. */
+static LineEndsKernel lineEndsKernelById(LineEndsKernelId id)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (id == LINE_ENDS_AVX2)
+		return __builtin_cpu_supports("avx2") ? findLineEndsAVX2 : NULL;
+	if (id == LINE_ENDS_SSE2)
+		return __builtin_cpu_supports("sse2") ? findLineEndsSSE2 : NULL;
+#endif
+	return id == LINE_ENDS_SCALAR ? findLineEndsScalar : NULL;
+}
+
+bool hasLineEndsKernel(LineEndsKernelId id)
+{
+	return lineEndsKernelById(id) != NULL;
+}
+
+int findLineEndsWith(LineEndsKernelId id, const Byte* buf, const Byte* from, const Byte* end,
+		     const Byte** lines, int maxLines)
+{
+	assert(buf <= from && from <= end);
+	assert(maxLines > 0);
+	LineEndsKernel kernel = lineEndsKernelById(id);
+	assert(kernel != NULL);
+	return kernel(from, end, buf, lines, maxLines);
 }
 
 /* True, if c can appear in the name of a HTTP header. */
@@ -27,87 +153,76 @@ static bool isHeaderChar(Byte c)
 	return isalnum(c) || c == '-' || c == '_';
 }
 
-/* This list must be sorted! */
-static const char* parsedHeaders[] = {
-	"cache-control",
-	"content-encoding",
-	"content-length",
-	"content-type",
-	"host",
-	"location",
-	"referer",
-	"transfer-encoding",
-	"user-agent",
-};
-static const size_t parsedHeadersSize = sizeof(parsedHeaders) / sizeof(parsedHeaders[0]);
-
-/* Hint on the number of headers we typically see. Use in call to
- * vector::reserve below.
+/* Return the id of the header if [start, end) is one of the headers
+ * we parse (ignoring case) and HEADER_NUM otherwise. The names all
+ * have different lengths, so a switch on the length (and a check of
+ * the first character to quickly reject the rest) identifies the only
+ * candidate.
  */
-static const size_t numHeadersHint = 6;
-
-struct StringLess
-{
-	bool operator() (const char* s1, const char* s2)
-		{
-			return strcmp(s1, s2) < 0;
-		}
-};
-
-static const char* findHeader(const Byte* start, const Byte* end)
+static HTTPHeaderId findHeader(const Byte* start, const Byte* end)
 {
-	/* We don't have any header names longer than 32 in
-	 * parsedHeaders.
-	 */
-	char buf[32];
-	if (end - start > (int) sizeof(buf)-1)
-		return NULL;
-	int i;
-	for (i = 0; start+i != end; i++)
-		buf[i] = tolower(*(start+i));
-	buf[i] = 0;
-
-	StringLess sl;
-	const char** h = std::lower_bound(parsedHeaders, parsedHeaders+parsedHeadersSize, buf, sl);
-	if (h == parsedHeaders+parsedHeadersSize)
-		return NULL;
-	else if (!strcmp(*h, buf))
-		return *h;
-	else
-		return NULL;
+	HTTPHeaderId id;
+	const char* name;
+	switch (end - start) {
+	case 4: id = HEADER_HOST; name = "host"; break;
+	case 7: id = HEADER_REFERER; name = "referer"; break;
+	case 8: id = HEADER_LOCATION; name = "location"; break;
+	case 10: id = HEADER_USER_AGENT; name = "user-agent"; break;
+	case 12: id = HEADER_CONTENT_TYPE; name = "content-type"; break;
+	case 13: id = HEADER_CACHE_CONTROL; name = "cache-control"; break;
+	case 14: id = HEADER_CONTENT_LENGTH; name = "content-length"; break;
+	case 16: id = HEADER_CONTENT_ENCODING; name = "content-encoding"; break;
+	case 17: id = HEADER_TRANSFER_ENCODING; name = "transfer-encoding"; break;
+	default: return HEADER_NUM;
+	}
+
+	if (tolower(*start) != *name)
+		return HEADER_NUM;
+	for (const char* n = name+1; ++start != end; n++) {
+		if (tolower(*start) != *n)
+			return HEADER_NUM;
+	}
+	return id;
 }
 
-bool isHeaderParsed(const string& name)
+HTTPHeaderId headerId(const string& name)
 {
 	const char* s = name.c_str();
 	return findHeader((const Byte*) s, (const Byte*) s + name.size());
 }
 
-const Byte* parseHeader(const Byte* buf, const Byte* end, HTTPHeaders* headers)
+const Byte* parseHeaderLine(const Byte* buf, const Byte* crlf, HTTPHeaderId* id, HTTPRange* value)
 {
-	CHECKED_RETURN_INIT(buf, end);
+	CHECKED_RETURN_INIT(buf, crlf);
 	const Byte* ptr = buf;
-	while (ptr != end && isHeaderChar(*ptr))
+	while (ptr != crlf && isHeaderChar(*ptr))
 		ptr++;
 
-	if (ptr == end || *ptr != ':')
+	if (ptr == crlf || *ptr != ':')
 		return NULL;
 
-	const char* name = findHeader(buf, ptr);
+	*id = findHeader(buf, ptr);
+	if (*id == HEADER_NUM)
+		CHECKED_RETURN(crlf);
 
 	assert(*ptr == ':');
 	ptr++; // Skip ':'
-	const Byte* endCRLF = findCRLF(ptr, end);
-	if (endCRLF == end)
-		return NULL;
-	if (!name)
-		CHECKED_RETURN(endCRLF+2);
-	ptr = skipSpace(ptr, endCRLF);
-	const Byte* e = endCRLF;
+	ptr = skipSpace(ptr, crlf);
+	const Byte* e = crlf;
 	while (e != ptr && *e == ' ')
 		e--;
 
-	headers->reserve(numHeadersHint);
-	headers->push_back(HTTPHeader(name, string(ptr, e)));
-	CHECKED_RETURN(endCRLF+2);
+	*value = HTTPRange(ptr, e);
+	CHECKED_RETURN(crlf);
+}
+
+const Byte* parseHeader(const Byte* buf, const Byte* end)
+{
+	CHECKED_RETURN_INIT(buf, end);
+	const Byte* crlf = findCRLF(buf, end);
+	HTTPHeaderId id;
+	HTTPRange value(crlf, crlf);
+	if (crlf == end || !parseHeaderLine(buf, crlf, &id, &value))
+		return NULL;
+	CHECKED_RETURN(crlf+2);
 }
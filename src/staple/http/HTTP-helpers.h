@@ -57,14 +57,42 @@ const Byte* skipSpace(const Byte* buf, const Byte* end);
  * pointer to start of CRLF otherwise. */
 const Byte* findCRLF(const Byte* buf, const Byte* end);
 
-/* Only a subset of all headers are parsed by parseHeader. This
- * function return true if a header is parsed and false if it is
- * ignored.
+/* Find the ends of the lines in [buf, end) in one pass, up to and
+ * including the end of the first empty line (i.e., the end of a
+ * header block). The scan starts at 'from' in [buf, end], [buf, from)
+ * must be known to contain no CRLF. Pointers to the CRLFs are stored
+ * in lines, at most maxLines of them. Return the number of CRLFs
+ * found. The header block ends in [buf, end) if the last one found is
+ * at the start of its line.
+ *
+ * The scanning uses SSE2 or AVX2 if the CPU supports it.
  */
-bool isHeaderParsed(const std::string& name);
+int findLineEnds(const Byte* buf, const Byte* from, const Byte* end, const Byte** lines, int maxLines);
 
-/* Parse a HTTP header in [buf, end). Return NULL if not possible,
- * otherwise return pointer to area where parsing can resume. If not
- * NULL is returned, a header is added to headers is filled in. */
-const Byte* parseHeader(const Byte* buf, const Byte* end, HTTPHeaders* headers);
+/* The kernels findLineEnds can use. findLineEndsWith is findLineEnds
+ * with the given kernel, which the CPU has to support. They are there
+ * for the tester of the kernels.
+ */
+enum LineEndsKernelId { LINE_ENDS_SCALAR, LINE_ENDS_SSE2, LINE_ENDS_AVX2 };
+
+bool hasLineEndsKernel(LineEndsKernelId id);
+int findLineEndsWith(LineEndsKernelId id, const Byte* buf, const Byte* from, const Byte* end,
+		     const Byte** lines, int maxLines);
+
+/* Only a subset of all headers are parsed by parseHeaderLine. This
+ * function returns the id of a header that is parsed and HEADER_NUM
+ * if it is ignored.
+ */
+HTTPHeaderId headerId(const std::string& name);
+
+/* Parse the HTTP header line [buf, crlf), where crlf points to the
+ * CRLF ending the line. Return NULL if not possible and crlf
+ * otherwise. If the header is one we parse, its id is stored in 'id'
+ * and its value (without the surrounding spaces) in 'value',
+ * otherwise 'id' is set to HEADER_NUM. */
+const Byte* parseHeaderLine(const Byte* buf, const Byte* crlf, HTTPHeaderId* id, HTTPRange* value);
+
+/* Skip a HTTP header in [buf, end). Return NULL if not possible,
+ * otherwise return pointer to area where parsing can resume. */
+const Byte* parseHeader(const Byte* buf, const Byte* end);
 #endif
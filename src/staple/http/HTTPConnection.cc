@@ -260,7 +260,7 @@ bool HTTPConnection::processRspPacket(const TCPPacket& packet, int offset)
 		TCPConnId tcpConnId(getTCPConnId(packet));
 		TCPConnReg::iterator tcpIt = staple_.tcpConnReg.find(tcpConnId);
 		if (tcpIt != staple_.tcpConnReg.end()) {
-			TCPConn& conn = tcpIt->second;
+			TCPConnContent& conn = tcpIt->second.Content();
 			int dir = packet.direction;
 			// Make sure that we don't overwrite anything
 			// we stored before.
@@ -309,6 +309,7 @@ HTTPConnection::HTTPMessages::iterator HTTPConnection::consumeMessage(const HTTP
 
 		if (!msg->responseParsed())
 			WARN("HTTPConnection::consumeMessage: Consuming msg without fully parsed response. ", *msg);
+		msg->compact();
 		tester_->addMessage(this, msg);
 		user_->associateWithPageView(msg);
 	} else {
@@ -347,11 +348,11 @@ void HTTPConnection::finishSession()
 void HTTPConnection::printTestOutput(std::ostream& o, bool swapNetworks) const
 {
 	if (swapNetworks) {
-		o << IPAddress(connId.netBIP) << '\t' << connId.netBPort << '\t';
-		o << IPAddress(connId.netAIP) << '\t' << connId.netAPort << '\t';
+		o << getServerIP(connId) << '\t' << connId.netBPort << '\t';
+		o << getClientIP(connId) << '\t' << connId.netAPort << '\t';
 	} else {
-		o << IPAddress(connId.netAIP) << '\t' << connId.netAPort << '\t';
-		o << IPAddress(connId.netBIP) << '\t' << connId.netBPort << '\t';
+		o << getClientIP(connId) << '\t' << connId.netAPort << '\t';
+		o << getServerIP(connId) << '\t' << connId.netBPort << '\t';
 	}
 }
 
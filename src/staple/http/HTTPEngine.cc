@@ -89,6 +89,7 @@ HTTPEngine::~HTTPEngine()
 		delete *it;
 	users_.clear();
 	usersLRU_.clear();
+	idleUsers_.clear();
 	delete msgTester_;
 	delete pageTester_;
 	closePageLog();
@@ -106,6 +107,7 @@ void HTTPEngine::finishAllTCPSessions()
 	}
 	users_.clear();
 	usersLRU_.clear();
+	idleUsers_.clear();
 }
 
 void HTTPEngine::closePageLog()
@@ -198,6 +200,8 @@ TCPConnId getTCPConnId(const TCPPacket& packet)
 		id.netAIP = packet.dstIP;
 		id.netBIP = packet.srcIP;
 	}
+	id.IPVersion = packet.IPVersion;
+	id.tunnelId = packet.tunnelId;
 
 	return id;
 }
@@ -212,25 +216,20 @@ void HTTPEngine::updateUserStats(const HTTPUser* user)
 
 void HTTPEngine::checkUserTimeout(const Timeval& time)
 {
-	UserList::iterator it = usersLRU_.begin();
-	while (it != usersLRU_.end()) {
-		HTTPUser* user = *it;
-		if (user->hasConnections()) {
-			++it;
-			continue;
-		}
-
-		if (time.diff(user->getLastActivity()) > USER_TIMEOUT) {
-			LOG_AND_COUNT("HTTPEngine::checkUserTimeout Removing user ", user->getClientIP());
-			updateUserStats(user);
-			users_.erase(user->getClientIP());
-			delete user;
-			it = usersLRU_.erase(it);
-		} else {
-			// We can break out of the loop here as the
-			// list is ordered.
+	while (!idleUsers_.empty()) {
+		IdleUsers::iterator it = idleUsers_.begin();
+		// The users after this one have been active later.
+		if (time.diff(it->first) <= USER_TIMEOUT)
 			break;
-		}
+
+		HTTPUser* user = it->second;
+		LOG_AND_COUNT("HTTPEngine::checkUserTimeout Removing user ", user->getClientIP());
+		updateUserStats(user);
+		UserMap::iterator uIt = users_.find(user->getClientIP());
+		usersLRU_.erase(uIt->second.lru);
+		users_.erase(uIt);
+		idleUsers_.erase(it);
+		delete user;
 	}
 }
 
@@ -251,21 +250,29 @@ void HTTPEngine::processPacket(const TCPPacket& packet)
 
 	checkUserTimeout(packet.pL2Packet->time);
 
-	IPAddress aip(id.netAIP);
+	IPAddress aip(getClientIP(id));
 	UserMap::iterator it = users_.find(aip);
 	HTTPUser* user;
 	if (it == users_.end()) {
 		COUNTER_INCREASE("HTTPEngine::processPacket new user");
 		user = new HTTPUser(staple_, aip, printer_, pageTester_, msgTester_);
 		usersLRU_.push_back(user);
-		users_.insert(make_pair(aip, --usersLRU_.end()));
+		UserEntry entry = { --usersLRU_.end(), idleUsers_.end() };
+		users_.insert(std::make_pair(aip, entry));
 		stats_.sessionsSeen++;
 	} else {
-		UserList::iterator listIt = it->second;
-		user = *listIt;
+		UserEntry& entry = it->second;
+		user = *entry.lru;
+
+		// The packet belongs to a connection, so the user is not
+		// idle any more.
+		if (entry.idle != idleUsers_.end()) {
+			idleUsers_.erase(entry.idle);
+			entry.idle = idleUsers_.end();
+		}
 
 		// Move the entry to the back of the list.
-		usersLRU_.splice(usersLRU_.end(), usersLRU_, listIt);
+		usersLRU_.splice(usersLRU_.end(), usersLRU_, entry.lru);
 	}
 
 	stats_.packetsSeen[packet.direction]++;
@@ -278,14 +285,17 @@ void HTTPEngine::finishTCPSession(const TCPConnId& id)
 {
 	LOG_AND_COUNT("HTTPEngine::finishTCPSession: Removing TCP session ", id);
 
-	IPAddress aip(id.netAIP);
+	IPAddress aip(getClientIP(id));
 	UserMap::iterator it = users_.find(aip);
 	if (it == users_.end()) {
 		LOG_AND_COUNT("HTTPEngine::finishTCPSession: User not found. ", aip);
 		return;
 	}
-	HTTPUser* user = *(it->second);
+	UserEntry& entry = it->second;
+	HTTPUser* user = *entry.lru;
 	user->finishTCPSession(id);
+	if (!user->hasConnections() && entry.idle == idleUsers_.end())
+		entry.idle = idleUsers_.insert(std::make_pair(user->getLastActivity(), user));
 }
 
 void HTTPEngine::printSummary() const
@@ -412,3 +422,17 @@ HTTPStats::HTTPStats()
 	reqNum = 0;
 	rspNum = 0;
 }
+
+void HTTPStats::add(const HTTPStats& other)
+{
+	sessionsSeen += other.sessionsSeen;
+	pagesSeen += other.pagesSeen;
+	for (int dir = 0; dir < 2; ++dir) {
+		packetsSeen[dir] += other.packetsSeen[dir];
+		IPBytes[dir] += other.IPBytes[dir];
+		httpBytes[dir] += other.httpBytes[dir];
+	}
+	tcpNum += other.tcpNum;
+	reqNum += other.reqNum;
+	rspNum += other.rspNum;
+}
@@ -17,11 +17,11 @@ using std::find;
 using std::ostream;
 
 const long HTTPMsg::MAX_CONTENT_LENGTH;
-const std::string HTTPMsg::emptyString;
 
 HTTPMsg::HTTPMsg(Staple& staple, const TCPConnId& id) :
 	staple_(staple),
 	connId_(id),
+	arena_(staple),
 	reqChunkedParser_(staple),
 	rspChunkedParser_(staple)
 {
@@ -43,6 +43,9 @@ HTTPMsg::HTTPMsg(Staple& staple, const TCPConnId& id) :
 	rspLength = -1;
 	rspEndOnConnectionClose = false;
 
+	reqScannedLen_ = 0;
+	rspScannedLen_ = 0;
+
 	resyncNeeded_ = false;
 	doResync_ = false;
 	resynced_ = false;
@@ -65,6 +68,14 @@ void HTTPMsg::finishTCPSession(bool graceful)
 		rspParseState = RSP_PARSE_COMPLETE;
 }
 
+void HTTPMsg::compact()
+{
+	arena_.shrink();
+	reqBuf.release();
+	rspBuf.release();
+	std::vector<Byte>().swap(rspBody);
+}
+
 void HTTPMsg::doResynchronization()
 {
 	assert(reqParseState == REQ_PARSE_START);
@@ -123,16 +134,23 @@ const Byte* HTTPMsg::parseReqURI(const Byte* buf, const Byte* end)
 {
 	CHECKED_RETURN_INIT(buf, end);
 	buf = skipSpace(buf, end);
-	const Byte* URIend = find(buf, end, ' ');
+	const Byte* URIend = (const Byte*) memchr(buf, ' ', end - buf);
+	if (URIend == NULL)
+		URIend = end;
 	if (URIend == end) {
 		return NULL;
 	} else {
-		reqURI = string(buf, URIend);
-		URL url(reqURI);
-		if (url.hasSchema()) {
-			requestURL_ = reqURI;
-			host = url.getHost();
-			reqURI = url.getPath();
+		reqURI = arena_.store(buf, URIend);
+		if (isalpha(*buf)) {
+			/* Absolute URI (as sent to proxies), not worth
+			 * avoiding the allocations in URL for.
+			 */
+			URL url(string(buf, URIend));
+			if (url.hasSchema()) {
+				requestURL_ = reqURI;
+				host = arena_.store(url.getHost().data(), url.getHost().data() + url.getHost().size());
+				reqURI = arena_.store(url.getPath().data(), url.getPath().data() + url.getPath().size());
+			}
 		}
 		CHECKED_RETURN(URIend);
 	}
@@ -168,7 +186,7 @@ static const Byte* parseVersion(const Byte* buf, const Byte* end, HTTPMsg::Versi
 	CHECKED_RETURN(versionEnd);
 }
 
-static HTTPMsg::ContentEncoding parseContentEncoding(const string& enc)
+static HTTPMsg::ContentEncoding parseContentEncoding(StringView enc)
 {
 	const char* s = enc.c_str();
 	if (iequals("identity", s) || enc == "-") return HTTPMsg::CE_IDENTITY;
@@ -178,7 +196,7 @@ static HTTPMsg::ContentEncoding parseContentEncoding(const string& enc)
 	else return HTTPMsg::CE_UNKNOWN;
 }
 
-static HTTPMsg::TransferEncoding parseTransferEncoding(const string& enc)
+static HTTPMsg::TransferEncoding parseTransferEncoding(StringView enc)
 {
 	const char* s = enc.c_str();
 	if (iequals("identity", s) || enc == "-") return HTTPMsg::TE_IDENTITY;
@@ -189,7 +207,7 @@ static HTTPMsg::TransferEncoding parseTransferEncoding(const string& enc)
 	else return HTTPMsg::TE_UNKNOWN;
 }
 
-int HTTPMsg::parseContentLength(const string& value)
+int HTTPMsg::parseContentLength(StringView value)
 {
 	char* end;
 	long ret = strtol(value.c_str(), &end, 10);
@@ -214,30 +232,48 @@ int HTTPMsg::parseContentLength(const string& value)
 	return ret;
 }
 
-/* Iterate through reqHeaders and parse the ones we are interested in. */
-void HTTPMsg::parseReqHeaders()
+/* Store a request header value and parse it if we are interested in
+ * it. Called for each header line we parse. */
+void HTTPMsg::parseReqHeader(HTTPHeaderId id, const Byte* start, const Byte* end)
 {
-	for (vector<HTTPHeader>::iterator it = reqHeaders.begin();
-	     it != reqHeaders.end();
-	     it++) {
-		const char* s = it->name;
-		if (!strcmp("host", s))
-			host = it->value;
-		else if (!strcmp("referer", s))
-			referer = it->value;
-		else if (!strcmp("transfer-encoding", s)) {
-			reqTransferEnc = parseTransferEncoding(it->value);
-			if (reqTransferEnc == TE_UNKNOWN)
-				WARN("HTTPMsg::parseReqHeaders: Unknown transfer-encoding: ", it->value);
-		} else if (!strcmp("content-length", s))
-			reqLength = parseContentLength(it->value);
+	StringRef ref = arena_.store(start, end);
+	reqHeaders.add(id, ref);
+	StringView value = arena_.view(ref);
+	switch (id) {
+	case HEADER_HOST:
+		host = ref;
+		break;
+	case HEADER_REFERER:
+		referer = ref;
+		break;
+	case HEADER_TRANSFER_ENCODING:
+		reqTransferEnc = parseTransferEncoding(value);
+		if (reqTransferEnc == TE_UNKNOWN)
+			WARN("HTTPMsg::parseReqHeaders: Unknown transfer-encoding: ", value);
+		break;
+	case HEADER_CONTENT_LENGTH:
+		reqLength = parseContentLength(value);
+		break;
+	default:
+		break;
 	}
+}
 
+/* Called at the end of the request headers. */
+void HTTPMsg::parseReqHeaders()
+{
 	/* If the request had a absolute URI HTTPMsg::parseReqURI has
 	 * already set requestURL_.
 	 */
-	if (requestURL_.empty())
-		requestURL_ = string("http://") + getHost() + getRequestURI();
+	if (requestURL_.size == 0) {
+		static const char schema[] = "http://";
+		const size_t schemaLen = sizeof(schema) - 1;
+		requestURL_ = arena_.allocate(schemaLen + host.size + reqURI.size);
+		char* url = arena_.data(requestURL_);
+		memcpy(url, schema, schemaLen);
+		memcpy(url + schemaLen, getHost().c_str(), host.size);
+		memcpy(url + schemaLen + host.size, getRequestURI().c_str(), reqURI.size);
+	}
 }
 
 static const Byte* skip0(const Byte* buf, const Byte* end)
@@ -277,6 +313,12 @@ const Byte* HTTPMsg::parseRequest(const Byte* buf, const Byte* end, const TCPPac
         Request-Line = Method SP Request-URI SP HTTP-Version CRLF
 */
 	CHECKED_RETURN_INIT(buf, end);
+
+	// Where the search for CRLF can resume, see reqScannedLen_. A CR
+	// may end the scanned part.
+	const Byte* scanned = buf + std::max(reqScannedLen_ - 1, 0);
+	reqScannedLen_ = 0;
+
 	while (true) {
 		int len = end-buf;
 		switch (reqParseState) {
@@ -317,7 +359,7 @@ const Byte* HTTPMsg::parseRequest(const Byte* buf, const Byte* end, const TCPPac
 				}
 			}
 
-			if (findCRLF(buf, end) == end) {
+			if (findCRLF(std::max(buf, scanned), end) == end) {
 				// For rationale for the 16*1024 see
 				// http://stackoverflow.com/questions/2659952/maximum-length-of-http-get-request
 				if (len > 16*1024) {
@@ -326,6 +368,7 @@ const Byte* HTTPMsg::parseRequest(const Byte* buf, const Byte* end, const TCPPac
 					return NULL; // Does not look like a HTTP request.
 				} else {
 					// Need more data.
+					reqScannedLen_ = end-buf;
 					CHECKED_RETURN(buf);
 				}
 			}
@@ -364,36 +407,42 @@ const Byte* HTTPMsg::parseRequest(const Byte* buf, const Byte* end, const TCPPac
 
 		case REQ_PARSE_HEADERS:
 		{
-			const Byte* crlf = findCRLF(buf, end);
-			if (crlf == end) {
+			// Find the ends of the header lines (and of the
+			// header block) in one pass and parse the
+			// complete lines.
+			const Byte* lines[LINE_INDEX_SIZE];
+			int n = findLineEnds(buf, std::max(buf, scanned), end, lines, LINE_INDEX_SIZE);
+			int i;
+			for (i = 0; i < n && lines[i] != buf; i++) {
+				HTTPHeaderId id;
+				HTTPRange value(buf, buf);
+				if (parseHeaderLine(buf, lines[i], &id, &value) == NULL)
+					WARN("HTTPMsg::parseRequest: Strange header, ignoring. ",
+					     quoteString(buf, end), ' ', packet);
+				else if (id != HEADER_NUM)
+					parseReqHeader(id, value.start, value.end);
+				buf = lines[i]+2;
+			}
+
+			if (i == LINE_INDEX_SIZE) {
+				// Look for more headers.
+				break;
+			} else if (i == n) {
 				// FIXME is 16*1024 appropriate? Look in HTTP RFC.
-				if (len > 16*1024) {
+				if (end-buf > 16*1024) {
 					// Does not look like a HTTP request.
 					WARN("HTTPMsg::parseRequest: Not HTTP request? Headers never end. ",
 					     quoteString(buf, end), ' ', packet);
 					return NULL;
 				} else {
 					// Need more data.
+					reqScannedLen_ = end-buf;
 					CHECKED_RETURN(buf);
 				}
 			}
 
-			if (crlf == buf) {
-				reqParseState = REQ_PARSE_BODY;
-				buf += 2;
-			} else {
-				const Byte* newBuf = parseHeader(buf, end, &reqHeaders);
-				if (newBuf == NULL) {
-					WARN("HTTPMsg::parseRequest: Strange header, ignoring. ",
-					     quoteString(buf, end), ' ', packet);
-					buf = crlf+2;
-				} else {
-					buf = newBuf;
-				}
-
-				// Look for more headers.
-				break;
-			}
+			reqParseState = REQ_PARSE_BODY;
+			buf += 2;
 
 			parseReqHeaders();
 
@@ -540,28 +589,27 @@ static bool isContentTypeToken(char c)
 		 iscntrl(c));
 }
 
-/* Take a content-type, remove parameters, and convert it to lower
+/* Return the length of the content-type without parameters. The
+ * pretty content-type is this prefix of it converted to lower
  * case. */
-static string prettifyContentType(const string& contentType)
+static size_t prettyContentTypeLength(StringView contentType)
 {
-	string ret;
+	const char* s = contentType.c_str();
 	bool haveSlash = false;
-	for (size_t i = 0; i < contentType.size(); i++) {
-		char c = contentType[i];
+	size_t i;
+	for (i = 0; i < contentType.size(); i++) {
+		char c = s[i];
 		if (c == '/') {
 			if (haveSlash)
 				break;
 			else
 				haveSlash = true;
-			ret.push_back(tolower(c));
-		} else if (isContentTypeToken(c)) {
-			ret.push_back(tolower(c));
-		} else {
+		} else if (!isContentTypeToken(c)) {
 			break;
 		}
 	}
 
-	return ret;
+	return i;
 }
 
 // Our own simple content-type sniffer which only uses the URI. The
@@ -569,12 +617,12 @@ static string prettifyContentType(const string& contentType)
 // parsed the response, see parseResponse below. This code is
 // important when the resource is cached and the content based sniffer
 // is useless.
-string HTTPMsg::sniffContentType(const string& prettyContentType) const
+const char* HTTPMsg::sniffContentType(StringView prettyContentType) const
 {
 	if (!prettyContentType.empty())
-		return prettyContentType;
+		return prettyContentType.c_str();
 
-	const char* uri = reqURI.c_str();
+	const char* uri = getRequestURI().c_str();
 
 	if (iends_with(uri, ".css"))
 		return "text/css";
@@ -596,34 +644,57 @@ string HTTPMsg::sniffContentType(const string& prettyContentType) const
 		return "";
 }
 
-/* Iterate through rspHeaders and parse the ones we are interested in. */
-void HTTPMsg::parseRspHeaders()
+/* Store a response header value and parse it if we are interested
+ * in it. Called for each header line we parse. */
+void HTTPMsg::parseRspHeader(HTTPHeaderId id, const Byte* start, const Byte* end)
 {
-	for (vector<HTTPHeader>::iterator it = rspHeaders.begin();
-	     it != rspHeaders.end();
-	     it++) {
-		const char* s = it->name;
-		if (!strcmp("content-length", s)) {
-			rspLength = parseContentLength(it->value);
-		} else if (!strcmp("transfer-encoding", s)) {
-			rspTransferEnc = parseTransferEncoding(it->value);
-			if (rspTransferEnc == TE_UNKNOWN)
-				WARN("HTTPMsg::parseRspHeaders: Unknown transfer-encoding: ", it->value);
-		} else if (!strcmp("content-encoding", s)) {
-			rspContentEnc = parseContentEncoding(it->value);
-			if (rspContentEnc == CE_UNKNOWN)
-				WARN("HTTPMsg: Unknown content-encoding: ", it->value);
-		} else if (!strcmp("content-type", s)) {
-			rspContentType = it->value;
-			rspPrettyContentType = prettifyContentType(rspContentType);
-		} else if (!strcmp("location", s)) {
-			rspLocation = it->value;
-		}
+	StringRef ref = arena_.store(start, end);
+	rspHeaders.add(id, ref);
+	StringView value = arena_.view(ref);
+	switch (id) {
+	case HEADER_CONTENT_LENGTH:
+		rspLength = parseContentLength(value);
+		break;
+	case HEADER_TRANSFER_ENCODING:
+		rspTransferEnc = parseTransferEncoding(value);
+		if (rspTransferEnc == TE_UNKNOWN)
+			WARN("HTTPMsg::parseRspHeaders: Unknown transfer-encoding: ", value);
+		break;
+	case HEADER_CONTENT_ENCODING:
+		rspContentEnc = parseContentEncoding(value);
+		if (rspContentEnc == CE_UNKNOWN)
+			WARN("HTTPMsg: Unknown content-encoding: ", value);
+		break;
+	case HEADER_CONTENT_TYPE:
+	{
+		rspContentType = ref;
+		size_t len = prettyContentTypeLength(value);
+		rspPrettyContentType = arena_.allocate(len);
+		// Look up the content-type again, allocate may
+		// have moved it.
+		const char* contentType = getRealContentType().c_str();
+		char* pretty = arena_.data(rspPrettyContentType);
+		for (size_t i = 0; i < len; i++)
+			pretty[i] = tolower(contentType[i]);
+		break;
+	}
+	case HEADER_LOCATION:
+		rspLocation = ref;
+		break;
+	default:
+		break;
 	}
+}
 
-	rspPrettyContentType = sniffContentType(rspPrettyContentType);
-	mimeSniffer.init(rspPrettyContentType.c_str(),
-			 starts_with(rspPrettyContentType.c_str(), "image/"));
+/* Called at the end of the response headers. */
+void HTTPMsg::parseRspHeaders()
+{
+	if (rspPrettyContentType.size == 0) {
+		const char* sniffed = sniffContentType(getContentType());
+		rspPrettyContentType = arena_.store(sniffed, sniffed + strlen(sniffed));
+	}
+	mimeSniffer.init(getContentType().c_str(),
+			 starts_with(getContentType().c_str(), "image/"));
 
 	// Ignore content-length header if we get transfer-encoding:
 	// chunked.
@@ -631,28 +702,24 @@ void HTTPMsg::parseRspHeaders()
 		rspLength = -1;
 }
 
-const string& HTTPMsg::getReqHeader(const string& name) const
+StringView HTTPMsg::findHeader(const HTTPHeaders& headers, const string& name) const
 {
-	for (HTTPHeaders::const_iterator it = reqHeaders.begin(); it != reqHeaders.end(); ++it) {
-		if (iequals(it->name, name.c_str()))
-			return it->value;
-	}
-
-	if (!isHeaderParsed(name))
-		WARN("HTTPMsg::getReqHeader: header not parsed: ", name);
-	return emptyString;
+	HTTPHeaderId id = headerId(name);
+	if (id == HEADER_NUM)
+		WARN("HTTPMsg::findHeader: header not parsed: ", name);
+	else if (headers.has(id))
+		return arena_.view(headers.get(id));
+	return StringView();
 }
 
-const std::string& HTTPMsg::getRspHeader(const std::string& name) const
+StringView HTTPMsg::getReqHeader(const string& name) const
 {
-	for (HTTPHeaders::const_iterator it = rspHeaders.begin(); it != rspHeaders.end(); ++it) {
-		if (iequals(it->name, name.c_str()))
-			return it->value;
-	}
+	return findHeader(reqHeaders, name);
+}
 
-	if (!isHeaderParsed(name))
-		WARN("HTTPMsg::getRspHeader: header not parsed: ", name);
-	return emptyString;
+StringView HTTPMsg::getRspHeader(const std::string& name) const
+{
+	return findHeader(rspHeaders, name);
 }
 
 /*
@@ -684,6 +751,11 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 	int len = end-buf;
 	const Byte* newBuf;
 
+	// Where the search for CRLF can resume, see reqScannedLen_. A CR
+	// may end the scanned part.
+	const Byte* scanned = buf + std::max(rspScannedLen_ - 1, 0);
+	rspScannedLen_ = 0;
+
 	while (true) {
 		if (resyncNeeded_)
 			assert(rspParseState == RSP_PARSE_BODY);
@@ -711,7 +783,7 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 				     *this, quoteString(buf, end), packet);
 				return NULL;
 			}
-			if (findCRLF(buf, end) == end) {
+			if (findCRLF(std::max(buf, scanned), end) == end) {
 				// FIXME is 1024 appropriate? Look in HTTP RFC.
 				if (len > 1024) {
 					WARN("HTTPMsg::parseResponse: CRLF Not found in status-line. ",
@@ -719,6 +791,7 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 					return NULL; // Does not look like a HTTP response.
 				} else {
 					// Need more data.
+					rspScannedLen_ = end-buf;
 					CHECKED_RETURN(buf);
 				}
 			}
@@ -735,9 +808,29 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 
 		case RSP_PARSE_HEADERS:
 		{
+			// Find the ends of the header lines (and of the
+			// header block) in one pass and parse the
+			// complete lines.
+			const Byte* lines[LINE_INDEX_SIZE];
+			int n = findLineEnds(buf, std::max(buf, scanned), end, lines, LINE_INDEX_SIZE);
+			int i;
+			for (i = 0; i < n && lines[i] != buf; i++) {
+				HTTPHeaderId id;
+				HTTPRange value(buf, buf);
+				if (parseHeaderLine(buf, lines[i], &id, &value) == NULL)
+					WARN("HTTPMsg::parseResponse: Strange header, ignoring. ",
+					     quoteString(buf, end), packet);
+				else if (id != HEADER_NUM)
+					parseRspHeader(id, value.start, value.end);
+				buf = lines[i]+2;
+			}
+
 			len = end-buf;
-			const Byte* crlf = findCRLF(buf, end);
-			if (crlf == end) {
+			if (i == LINE_INDEX_SIZE) {
+				// Look for more headers, break out of
+				// switch to while loop.
+				break;
+			} else if (i == n) {
 				// FIXME is 4096 appropriate? Look in HTTP RFC.
 				if (len > 4096) {
 					// Does not look like a HTTP response.
@@ -746,27 +839,13 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 					return NULL;
 				} else {
 					// Need more data.
+					rspScannedLen_ = end-buf;
 					CHECKED_RETURN(buf);
 				}
 			}
 
-			if (crlf == buf) {
-				rspParseState = RSP_PARSE_BODY;
-				buf += 2;
-			} else {
-				newBuf = parseHeader(buf, end, &rspHeaders);
-				if (newBuf == NULL) {
-					WARN("HTTPMsg::parseResponse: Strange header, ignoring. ",
-					     quoteString(buf, end), packet);
-					buf = crlf+2;
-				} else {
-					buf = newBuf;
-				}
-
-				// Look for more headers, break out of
-				// switch to while loop.
-				break;
-			}
+			rspParseState = RSP_PARSE_BODY;
+			buf += 2;
 
 			parseRspHeaders();
 
@@ -787,7 +866,7 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 				rspParseState = RSP_PARSE_BODY;
 			} else if (rspLength != -1) {
 				rspParseState = RSP_PARSE_BODY;
-			} else if (rspContentType == "multipart/byteranges") {
+			} else if (getRealContentType() == "multipart/byteranges") {
 				// FIXME
 				WARN("HTTPMsg::parseResponse: Cannot parse body with content-type multipart/byteranges resync needed",
 				    *this, packet);
@@ -867,12 +946,12 @@ const Byte* HTTPMsg::parseResponse(const Byte* buf, const Byte* end, const TCPPa
 			     rspParseState == RSP_PARSE_COMPLETE)) {
 				const char* sniffed = mimeSniffer.sniff(reinterpret_cast<char*>(&rspBody[0]),
 									rspBody.size());
-				if (sniffed && rspPrettyContentType != sniffed) {
+				if (sniffed && getContentType() != sniffed) {
 					COUNTER_INCREASE("HTTPMsg::parseResponse: sniffed MIME type != advertised MIME type");
 					log(staple_, "Sniffed mime type: ", sniffed,
-					    " old type: ", rspPrettyContentType, ' ',
+					    " old type: ", getContentType(), ' ',
 					    packet);
-					rspPrettyContentType = sniffed;
+					rspPrettyContentType = arena_.store(sniffed, sniffed + strlen(sniffed));
 				}
 			}
 
@@ -910,7 +989,7 @@ int HTTPMsg::processPacket(const TCPPacket& packet, int offset, bool request, bo
 {
 	COUNTER_INCREASE("HTTPMsg::processPacket called");
 
-	vector<Byte>& buf = request ? reqBuf : rspBuf;
+	ParseBuffer& buf = request ? reqBuf : rspBuf;
 	const Byte* end;
 	int unparsed;
 	bool done;
@@ -927,6 +1006,7 @@ int HTTPMsg::processPacket(const TCPPacket& packet, int offset, bool request, bo
 		LOG_AND_COUNT("HTTPMsg::processPacket: Doing resync, skipping response packet.",
 			      quoteString(payload, payloadEnd), packet);
 		buf.clear();
+		rspScannedLen_ = 0;
 		return 0;
 	}
 
@@ -976,13 +1056,13 @@ int HTTPMsg::processPacket(const TCPPacket& packet, int offset, bool request, bo
 			// into buf and return 0.
 			unparsed = 0;
 			if (end != payloadEnd)
-				buf.insert(buf.end(), end, payloadEnd);
+				buf.append(end, payloadEnd);
 		}
 	} else {
 		// Slow path. We need to copy the payload data into buf.
 		if (offset < packet.payloadSavedLen) {
 			Byte* payloadEnd = packet.payload+packet.payloadSavedLen;
-			buf.insert(buf.end(), packet.payload + offset, payloadEnd);
+			buf.append(packet.payload + offset, payloadEnd);
 		}
 
 		if (packet.payloadSavedLen < packet.TCPPLLen) {
@@ -992,18 +1072,18 @@ int HTTPMsg::processPacket(const TCPPacket& packet, int offset, bool request, bo
 				len = packet.TCPPLLen - packet.payloadSavedLen;
 			else
 				len = packet.TCPPLLen - offset;
-			buf.insert(buf.end(), len, 0);
+			buf.append(len, 0);
 		}
 
 		if (request)
-			end = parseRequest(&buf[0], &buf[0]+buf.size(), packet);
+			end = parseRequest(buf.begin(), buf.end(), packet);
 		else
-			end = parseResponse(&buf[0], &buf[0]+buf.size(), packet);
+			end = parseResponse(buf.begin(), buf.end(), packet);
 
-		if (!(end == NULL || (&buf[0] <= end && end <= &buf[0]+buf.size()))) {
+		if (!(end == NULL || (buf.begin() <= end && end <= buf.end()))) {
 			error(staple_, "HTTPMsg::processPacket:"
 			      " request: ", request,
-			      " payload: ", quoteString(&buf[0], &buf[0]+buf.size()),
+			      " payload: ", quoteString(buf.begin(), buf.end()),
 			      " offset: ", offset,
 			      " packet: ", packet,
 			      ' ', *this);
@@ -1023,14 +1103,12 @@ int HTTPMsg::processPacket(const TCPPacket& packet, int offset, bool request, bo
 			done = responseParsed();
 
 		if (done)
-			unparsed = &buf[0]+buf.size() - end;
+			unparsed = buf.end() - end;
 		else
 			unparsed = 0;
 
-		// Remove already parsed data. We would like to write just
-		// 'end' in the second argument, but that isn't possible due
-		// to typing issues.
-		buf.erase(buf.begin(), buf.begin() + (end - &buf[0])); 
+		// Remove already parsed data.
+		buf.consume(end);
 	}
 
 	assert(0 <= unparsed);
@@ -1115,7 +1193,7 @@ void HTTPMsg::print(ostream& o, bool printAddress) const
 		o << " state: " << reqParseState;
 	if (reqMethod != HTTPMsg::GET)
 		o << " method: " << reqMethod;
-	o << " URL: " << host << ' ' << reqURI
+	o << " URL: " << getHost() << ' ' << getRequestURI()
 	  << " Rsp:";
 	if (rspParseState != HTTPMsg::RSP_PARSE_COMPLETE)
 		o << " state: " << rspParseState;
@@ -1138,7 +1216,7 @@ ostream& operator<<(ostream& o, const HTTPMsg& m)
 	return o;
 }
 
-static const char* methodToString(HTTPMsg::Method m)
+const char* methodToString(HTTPMsg::Method m)
 {
 	switch (m) {
 	// Method not yet parsed.
@@ -1229,7 +1307,7 @@ std::istream& operator>>(std::istream& o, HTTPMsg::ContentEncoding& ce)
 {
 	string s;
 	o >> s;
-	ce = parseContentEncoding(s);
+	ce = parseContentEncoding(StringView(s.data(), s.size()));
 	return o;
 }
 
@@ -1332,8 +1410,8 @@ void HTTPMsg::printReqTestOutput(std::ostream& o) const
 	// Sometimes useful for debugging
 	// o << getReqStartTime().tv_sec << '.' << getReqStartTime().tv_usec << '\t';
 	o << reqMethod << '\t';
-	o << host << '\t';
-	o << reqURI << '\t';
+	o << getHost() << '\t';
+	o << getRequestURI() << '\t';
 	o /* << rspStatusCode  */ << '\t';
 	o /* << rspTransferEnc */ << '\t';
 	if (reqLength > 0)
@@ -9,22 +9,54 @@
 #include <staple/http/Timeval.h>
 #include "MIMESniffing.h"
 #include "ChunkedParser.h"
+#include "StringArena.h"
+#include "ParseBuffer.h"
 
 class TCPPacket;
 class Staple;
 
 const char* statusCodeToString(int code);
 
-// An HTTP header. Examples include User-Agent, Cache-Control, etc.
-struct HTTPHeader
+// The headers parsed from requests and responses (see
+// parseHeaderLine). The rest are skipped.
+enum HTTPHeaderId {
+	HEADER_HOST,
+	HEADER_REFERER,
+	HEADER_LOCATION,
+	HEADER_USER_AGENT,
+	HEADER_CONTENT_TYPE,
+	HEADER_CACHE_CONTROL,
+	HEADER_CONTENT_LENGTH,
+	HEADER_CONTENT_ENCODING,
+	HEADER_TRANSFER_ENCODING,
+	HEADER_NUM
+};
+
+// The parsed headers of a request or a response: the value of the
+// first occurrence of each header (see HTTPMsg::getReqHeader). The
+// values are stored in the StringArena of the message.
+class HTTPHeaders
 {
-	HTTPHeader(const char* n, const std::string& v) : name(n), value(v)
+public:
+	HTTPHeaders() : seen_(0)
 		{ }
 
-	const char* name;
-	std::string value;
+	// Keep 'value' unless the header has already been seen.
+	void add(HTTPHeaderId id, StringRef value)
+	{
+		if (!has(id)) {
+			value_[id] = value;
+			seen_ |= 1 << id;
+		}
+	}
+
+	bool has(HTTPHeaderId id) const { return (seen_ & (1 << id)) != 0; }
+	StringRef get(HTTPHeaderId id) const { return value_[id]; }
+
+private:
+	StringRef value_[HEADER_NUM];
+	unsigned short seen_;
 };
-typedef std::vector<HTTPHeader> HTTPHeaders;
 
 // HTTP message class. A message consists of a request and a response.
 class HTTPMsg {
@@ -131,9 +163,9 @@ public:
 		}
 	}
 
-	const std::string& getRequestURL() const
+	StringView getRequestURL() const
 	{
-		return requestURL_;
+		return arena_.view(requestURL_);
 	}
 
 	bool resyncNeeded() const { return resyncNeeded_; }
@@ -149,18 +181,18 @@ public:
 	Timeval getRspStartTime() const;
 	Timeval getRspEndTime() const;
 
-	const std::string& getHost() const { return host; }
-	const std::string& getRequestURI() const { return reqURI; }
-	const std::string& getContentType() const { return rspPrettyContentType; }
-	const std::string& getRealContentType() const { return rspContentType; }
-	const std::string& getLocation() const { return rspLocation; }
+	StringView getHost() const { return arena_.view(host); }
+	StringView getRequestURI() const { return arena_.view(reqURI); }
+	StringView getContentType() const { return arena_.view(rspPrettyContentType); }
+	StringView getRealContentType() const { return arena_.view(rspContentType); }
+	StringView getLocation() const { return arena_.view(rspLocation); }
 	ContentEncoding getContentEncoding() const { return rspContentEnc; }
-	const std::string& getReferer() const { return referer; }
-	const std::string& getReqHeader(const std::string& name) const;
-	const std::string& getRspHeader(const std::string& name) const;
+	StringView getReferer() const { return arena_.view(referer); }
+	StringView getReqHeader(const std::string& name) const;
+	StringView getRspHeader(const std::string& name) const;
 
 	Method getReqMethod() const { return reqMethod; }
-	const std::string& getReqURI() const { return reqURI; }
+	StringView getReqURI() const { return arena_.view(reqURI); }
 	Version getReqVersion() const { return reqVersion; }
 
 	const HTTPHeaders& getReqHeaders() const { return reqHeaders; }
@@ -168,6 +200,11 @@ public:
 	int getRspStatusCode() const { return rspStatusCode; }
 	const HTTPHeaders& getRspHeaders() const { return rspHeaders; }
 
+	// Release the memory only needed while the message is parsed
+	// (buffers, spare arena capacity). Called when the message is
+	// kept after the parsing, no more packets may be processed.
+	void compact();
+
 	// Print the HTTPMsg in a way that is useful for debugging.
 	friend std::ostream& operator<<(std::ostream& o, const HTTPMsg& m);
 
@@ -189,15 +226,18 @@ public:
 private:
 	Staple& staple_;
 
+	// Number of header lines indexed per call to findLineEnds.
+	static const int LINE_INDEX_SIZE = 32;
+
 	enum ReqParseState {REQ_PARSE_START, REQ_PARSE_REQ_LINE, REQ_PARSE_HEADERS, REQ_PARSE_BODY, REQ_PARSE_COMPLETE};
 	enum RspParseState {RSP_PARSE_START, RSP_PARSE_STATUS_LINE, RSP_PARSE_HEADERS, RSP_PARSE_BODY, RSP_PARSE_COMPLETE};
 
-	// Empty string constant used in getReqHeader and
-	// getRspHeader.
-	static const std::string emptyString;
-
 	TCPConnId connId_;
 
+	// Storage of the URI, headers and other strings parsed from
+	// the request and the response.
+	StringArena arena_;
+
         /* If true, we either failed to identify the end of a response
 	 * (this happens if we see a transfer-encoding that we don't
 	 * understand) or some parse error occurred. We need to use
@@ -233,11 +273,11 @@ private:
 	// Request
 	Version     reqVersion;                // HTTP version (HTTP_UNDEF if not present)
 	Method      reqMethod;                 // Request method (GET, POST, etc.)
-	std::string reqURI;                    // Request URI
+	StringRef   reqURI;                    // Request URI
 	bool        reqURIComplete;            // True, if the entire request URI was present in the packet
-	std::string host;                      // Host
-	std::string referer;
-	std::string requestURL_;
+	StringRef   host;                      // Host
+	StringRef   referer;
+	StringRef   requestURL_;
 	enum ReqParseState reqParseState;
 	enum TransferEncoding reqTransferEnc;
 	long reqLength; // Content length of request body
@@ -248,16 +288,15 @@ private:
 	int reqNextSeqNo; // Expected seq no of next request packet.
 	bool reqComplete; // True, if we have the entire request.
 
-	// FIXME should this be std::deque instead? It is a quite big
-	// change, introduce typedef std::deque<Byte>::const_iterator
-	// BufIt, change lots of const Byte* to BufIt.
-	//
-        // Pros: more efficient removal from front.
-	//
-        // Cons: The current zero-copy optimization when we don't have
-        // anything in the buffer wont work anymore. (This should be
-        // the common case.)
-	std::vector<Byte> reqBuf;
+	// Request data not parsed yet. Empty in the common case, where
+	// the packet payload is parsed directly (see processPacket).
+	ParseBuffer reqBuf;
+
+	// Length of the data at the start of reqBuf that the last
+	// call to parseRequest scanned for a CRLF without finding
+	// one. The next call resumes the scan there, so that a long
+	// line split in many packets is only scanned once.
+	int reqScannedLen_;
 
 	// These two can be used to measure server processing time.
 
@@ -279,8 +318,8 @@ private:
 	long rspLength; // Content length, -1 if unknown.
 	enum TransferEncoding rspTransferEnc;
 	enum ContentEncoding rspContentEnc;
-	std::string rspContentType, rspPrettyContentType;
-	std::string rspLocation;
+	StringRef   rspContentType, rspPrettyContentType;
+	StringRef   rspLocation;
 
 	enum RspParseState rspParseState;
 	int rspGotBodyLen; // Length of response body we have received so far.
@@ -293,8 +332,9 @@ private:
 	int respNextSeqNo; // Expected seq no of next response packet.
 	bool respComplete; // True, if we have the entire response.
 
-        // FIXME should maybe be std::deque. See reqBuf above for pros/cons.
-	std::vector<Byte> rspBuf;
+	// See reqBuf and reqScannedLen_ above.
+	ParseBuffer rspBuf;
+	int rspScannedLen_;
 
         /* Time of the first TCP packet belonging to the response
 	 */
@@ -326,20 +366,24 @@ private:
 	const Byte* parseRequest(const Byte* buf, const Byte* end, const TCPPacket& packet);
 	static const Byte* parseReqMethod(const Byte* buf, const Byte* end, Method*);
 	const Byte* parseReqURI(const Byte* buf, const Byte* end);
+	void parseReqHeader(HTTPHeaderId id, const Byte* start, const Byte* end);
 	void parseReqHeaders();
 
 	const Byte* parseResponse(const Byte* buf, const Byte* end, const TCPPacket& packet);
 	const Byte* parseRspStatus(const Byte* buf, const Byte* end);
+	void parseRspHeader(HTTPHeaderId id, const Byte* start, const Byte* end);
 	void parseRspHeaders();
 	void print(std::ostream& o, bool printAddress) const;
-	int parseContentLength(const std::string& value);
+	int parseContentLength(StringView value);
+	StringView findHeader(const HTTPHeaders& headers, const std::string& name) const;
 
-	std::string sniffContentType(const std::string& prettyContentType) const;
+	const char* sniffContentType(StringView prettyContentType) const;
 	friend std::istream& operator>>(std::istream& in, HTTPMsg::Method& m);
 };
 
 std::ostream& operator<<(std::ostream& o, const HTTPMsg& m);
 std::ostream& operator<<(std::ostream& o, HTTPMsg::Method m);
+const char* methodToString(HTTPMsg::Method m);
 std::istream& operator>>(std::istream& in, HTTPMsg::Method& m);
 std::ostream& operator<<(std::ostream& o, HTTPMsg::TransferEncoding te);
 std::ostream& operator<<(std::ostream& o, HTTPMsg::ContentEncoding ce);
@@ -16,7 +16,7 @@ using std::ostream;
 using std::cout;
 using std::endl;
 using std::string;
-using std::list;
+using std::vector;
 
 HTTPUser::HTTPUser(Staple& staple,
 		   const IPAddress& ip,
@@ -25,6 +25,7 @@ HTTPUser::HTTPUser(Staple& staple,
 		   HTTPMsgTester* msgTester) :
 	staple_(staple),
 	firstStoredTime_(Timeval::endOfTime()),
+	nextSeq_(0),
 	srcIP_(ip),
 	printer_(printer),
 	pageTester_(pageTester),
@@ -215,6 +216,32 @@ static bool isNonEmbeddableContentType(const string& ct)
 		return false;
 }
 
+static string removeURLFragment(StringView url)
+{
+	const char* pos = static_cast<const char*>(memchr(url.c_str(), '#', url.size()));
+	return string(url.c_str(), pos ? pos - url.c_str() : url.size());
+}
+
+/* Return 'url' without fragment. The common case, no fragment,
+ * returns 'url' itself and needs no copy. Otherwise the result is
+ * stored in 'buf'.
+ */
+static const string& removeURLFragment(const string& url, string* buf)
+{
+	size_t pos = url.find('#');
+	if (pos == string::npos)
+		return url;
+	buf->assign(url, 0, pos);
+	return *buf;
+}
+
+// Key of a resource in the referer indexes of earlySubs_ and
+// possibleFrames_.
+static string refererKey(const Resource* r)
+{
+	return removeURLFragment(r->getMain()->getReferer());
+}
+
 Resource* HTTPUser::createResource(HTTPMsg* msg)
 {
 	if (isContainerContentType(msg->getContentType()))
@@ -242,20 +269,27 @@ Resource* HTTPUser::createAggregateResource(HTTPMsg* msg)
 	}
 */
 	pageMap_[reqURL] = r;
-	for (ResourceList::iterator eIt = earlySubs_.begin(); eIt != earlySubs_.end(); ) {
-		Resource* early = *eIt;
+	treePages_[r].push_back(r);
+
+	if (earlySubs_.empty())
+		return r;
+	string buf;
+	const ResourceQueue::SeqSet* earlyIndex = earlySubs_.findKey(removeURLFragment(reqURL, &buf));
+	if (earlyIndex == NULL)
+		return r;
+
+	// Copied, the index changes when early subresources are added.
+	const ResourceQueue::SeqSet earlySeqs(*earlyIndex);
+	for (ResourceQueue::SeqSet::const_iterator eIt = earlySeqs.begin(); eIt != earlySeqs.end(); ++eIt) {
+		Resource* early = earlySubs_.find(*eIt);
 		HTTPMsg* earlyMain = early->getMain();
 
 		if (earlyMain->getReferer() == reqURL) {
 			if (addSubResource(r, early)) {
 				LOG_AND_COUNT("HTTPUser: Adding early subresource.",
 					      " IP: ", srcIP_, " referer: ", reqURL, " msg: ", *earlyMain);
-				eIt = earlySubs_.erase(eIt);
-			} else {
-				++eIt;
+				earlySubs_.erase(*eIt);
 			}
-		} else {
-			++eIt;
 		}
 	}
 
@@ -317,24 +351,28 @@ static bool cmpRedirectionURLs(const string& source, const string& target)
 	}
 }
 
-static string removeURLFragment(const string& url)
-{
-	size_t pos = url.find('#');
-	if (pos == string::npos)
-		return url;
-	else
-		return url.substr(0, pos);
-}
-
+/* Only redirections whose Location without fragment equals the
+ * request URL without fragment can match, see cmpRedirectionURLs.
+ */
 bool HTTPUser::addRedirectionTarget(Resource* target)
 {
-	for (ResourceSet::iterator it = redirectSources_.begin();
-	     it != redirectSources_.end();
-	     ++it) {
+	if (redirectSources_.empty())
+		return false;
+
+	const string url(target->getMain()->getRequestURL());
+	string buf;
+	RedirectMap::iterator mIt = redirectSources_.find(removeURLFragment(url, &buf));
+	if (mIt == redirectSources_.end())
+		return false;
+
+	ResourceSet& sources = mIt->second;
+	for (ResourceSet::iterator it = sources.begin(); it != sources.end(); ++it) {
 		Resource* src = *it;
-		if (cmpRedirectionURLs(src->getMain()->getLocation(), target->getMain()->getRequestURL()) &&
+		if (cmpRedirectionURLs(src->getMain()->getLocation(), url) &&
 		    addSubResource(src, target)) {
-			redirectSources_.erase(it);
+			sources.erase(it);
+			if (sources.empty())
+				redirectSources_.erase(mIt);
 			return true;
 		}
 	}
@@ -345,11 +383,24 @@ bool HTTPUser::addRedirectionTarget(Resource* target)
 HTTPUser::PageMap::iterator HTTPUser::pageMapFind(const string& referer)
 {
 	PageMap::iterator it = pageMap_.find(referer);
-	if (it == pageMap_.end())
-		it = pageMap_.find(removeURLFragment(referer));
+	if (it == pageMap_.end()) {
+		// Only a referer with a fragment gives another key.
+		string buf;
+		const string& url = removeURLFragment(referer, &buf);
+		if (&url == &buf)
+			it = pageMap_.find(url);
+	}
 	return it;
 }
 
+void HTTPUser::findFrames(const string& url, ResourceQueue::SeqSet* frames) const
+{
+	string buf;
+	const ResourceQueue::SeqSet* index = possibleFrames_.findKey(removeURLFragment(url, &buf));
+	if (index != NULL)
+		frames->insert(index->begin(), index->end());
+}
+
 /* FIXME:
 
    * MIME type for fonts? (there is none, auto detect based on
@@ -367,14 +418,14 @@ void HTTPUser::associateWithPageView(HTTPMsg* msg)
 		stats_.rspNum++;
 
 	const string ct(msg->getContentType());
-	const string referer(msg->getReferer());
+	const StringView referer(msg->getReferer());
 	checkTimeout(msg->getRspEndTime());
 	Resource* r = createResource(msg);
 
 	if (isRedirection(msg)) {
 		LOG_AND_COUNT("HTTPUser: Found redirection.",
 			      " IP: ", srcIP_, " msg: ", *msg);
-		redirectSources_.insert(r);
+		redirectSources_[removeURLFragment(msg->getLocation())].insert(r);
 	}
 
 	if (addRedirectionTarget(r)) {
@@ -491,9 +542,22 @@ bool HTTPUser::addSubResourceImpl(Resource* r, Resource* sub)
 	if (!r->add(sub)) {
 		LOG_AND_COUNT("HTTPUser::addSubResource: Not adding because of cycles.");
 		return false;
-	} else {
-		return true;
 	}
+
+	// The pages in the tree of 'sub' now belong to the tree of 'r'.
+	TreePages::iterator tIt = treePages_.find(sub);
+	if (tIt != treePages_.end()) {
+		vector<Resource*> subPages;
+		subPages.swap(tIt->second);
+		treePages_.erase(tIt);
+
+		vector<Resource*>& pages = treePages_[r->getRootOwner()];
+		if (pages.size() < subPages.size())
+			pages.swap(subPages);
+		pages.insert(pages.end(), subPages.begin(), subPages.end());
+	}
+
+	return true;
 }
 
 bool HTTPUser::addSubResource(Resource* r, Resource* sub)
@@ -518,11 +582,16 @@ bool HTTPUser::addSubResource(Resource* r, Resource* sub)
 	const Resource* root = r->getRootOwner();
 	Timeval endTime(root->getEndTime());
 
+	if (possibleFrames_.empty())
+		return true;
+
 	/* Now check if there are other possible frames that finished
 	 * after 'endTime'.
 	 */
-	for (ResourceList::iterator it = possibleFrames_.begin(); it != possibleFrames_.end(); ++it) {
-		Resource* frame = *it;
+	ResourceQueue::SeqSet frames;
+	findFrames(reqURL, &frames);
+	for (ResourceQueue::SeqSet::const_iterator it = frames.begin(); it != frames.end(); ++it) {
+		Resource* frame = possibleFrames_.find(*it);
 		if (frame->getMain()->getReferer() == reqURL) {
 			Timeval t(frame->getMain()->getRspEndTime());
 			if (endTime < t)
@@ -530,34 +599,51 @@ bool HTTPUser::addSubResource(Resource* r, Resource* sub)
 		}
 	}
 
-	for (ResourceList::iterator it = possibleFrames_.begin(); it != possibleFrames_.end(); ) {
-		Resource* frame = *it;
+	/* The frames below can only be added to a page in the tree of
+	 * 'root', so only the frames that refer to one of those pages
+	 * are visited (in the order they were added).
+	 */
+	TreePages::const_iterator tIt = treePages_.find(root);
+	if (tIt != treePages_.end()) {
+		const vector<Resource*>& pages = tIt->second;
+		for (vector<Resource*>::const_iterator pIt = pages.begin(); pIt != pages.end(); ++pIt)
+			findFrames((*pIt)->getMain()->getRequestURL(), &frames);
+	}
+
+	for (ResourceQueue::SeqSet::const_iterator it = frames.begin(); it != frames.end(); ++it) {
+		Resource* frame = possibleFrames_.find(*it);
 		HTTPMsg* frameMsg = frame->getMain();
-		bool erasedIt = false;
+		const string frameReferer(frameMsg->getReferer());
 
-		string frameURL(frameMsg->getRequestURL());
-		PageMap::iterator pIt = pageMapFind(frameMsg->getReferer());
+		PageMap::iterator pIt = pageMapFind(frameReferer);
 		Resource* parent = NULL;
 
-		if (frameMsg->getReferer() == reqURL)
+		if (frameReferer == reqURL)
 			parent = r;
 		else if (pIt != pageMap_.end() && pIt->second->getRootOwner() == root)
 			parent = pIt->second;
 		else
-			goto next;
+			continue;
 
 		if (endTime < frame->getStartTime())
-			goto next;
+			continue;
+
+		vector<Resource*> framePages;
+		TreePages::const_iterator fIt = treePages_.find(frame);
+		if (fIt != treePages_.end())
+			framePages = fIt->second;
 
 		if (addSubResourceImpl(parent, frame)) {
-			it = possibleFrames_.erase(it);
-			erasedIt = true;
+			possibleFrames_.erase(*it);
 			LOG_AND_COUNT("HTTPUser::addSubResource: Adding frame (other resource later) ", *frameMsg);
-		}
 
-	next:
-		if (!erasedIt)
-			++it;
+			/* The pages of the frame are now in the tree of
+			 * 'root' too. Frames added before this one are
+			 * not visited again.
+			 */
+			for (vector<Resource*>::const_iterator pIt = framePages.begin(); pIt != framePages.end(); ++pIt)
+				findFrames((*pIt)->getMain()->getRequestURL(), &frames);
+		}
 	}
 
 	return true;
@@ -565,19 +651,19 @@ bool HTTPUser::addSubResource(Resource* r, Resource* sub)
 
 void HTTPUser::pagesAdd(Resource* r)
 {
-	pages_.push_back(r);
+	pages_.push(nextSeq_++, r, string());
 	updateFirstStoredTime(r);
 }
 
 void HTTPUser::possibleFramesAdd(Resource* r)
 {
-	possibleFrames_.push_back(r);
+	possibleFrames_.push(nextSeq_++, r, refererKey(r));
 	updateFirstStoredTime(r);
 }
 
 void HTTPUser::earlySubsAdd(Resource* r)
 {
-	earlySubs_.push_back(r);
+	earlySubs_.push(nextSeq_++, r, refererKey(r));
 	updateFirstStoredTime(r);
 }
 
@@ -592,14 +678,19 @@ void HTTPUser::checkTimeout(const Timeval& curTime)
 	if (curTime.diff(firstStoredTime_) <= TIMEOUT)
 		return;
 
-	firstStoredTime_ = Timeval::endOfTime();
-	for (ResourceList::iterator it = possibleFrames_.begin();
-	     it != possibleFrames_.end(); ) {
-		Resource* r = *it;
+	/* Only the resources older than TIMEOUT/2 (possible frames)
+	 * or TIMEOUT (the others) are taken from the queues, the
+	 * rest is not touched.
+	 */
+	vector<ResourceQueue::Entry> expired;
+	possibleFrames_.takeExpired(curTime, TIMEOUT/2.0, &expired);
+	for (vector<ResourceQueue::Entry>::const_iterator it = expired.begin();
+	     it != expired.end(); ++it) {
+		Resource* r = it->second;
 		HTTPMsg* main = r->getMain();
 		Timeval startTime(r->getStartTime());
 		Timeval endTime(main->getRspEndTime());
-		const string referer(main->getReferer());
+		const StringView referer(main->getReferer());
 
 		/* Possible frames that are about to timeout and only
 		 * have a few subresources are added as frames
@@ -609,8 +700,7 @@ void HTTPUser::checkTimeout(const Timeval& curTime)
 		 * timeout in case the timing is not so precise.
 		 */
 		if (!referer.empty() &&
-		    r->getParts().size() < RESOURCES_IN_FRAME &&
-		    curTime.diff(startTime) > TIMEOUT/2.0) {
+		    r->getParts().size() < RESOURCES_IN_FRAME) {
 			PageMap::iterator pageIt = pageMapFind(referer);
 
 			if (pageIt != pageMap_.end()) {
@@ -619,7 +709,6 @@ void HTTPUser::checkTimeout(const Timeval& curTime)
 					if (addSubResourceImpl(owner, r)) {
 						LOG_AND_COUNT("HTTPUser::checkTimeout: Adding as frame (few resources in frame) ",
 							      *main);
-						it = possibleFrames_.erase(it);
 						continue;
 					}
 				}
@@ -629,43 +718,33 @@ void HTTPUser::checkTimeout(const Timeval& curTime)
 		if (curTime.diff(startTime) > TIMEOUT) {
 			LOG_AND_COUNT("HTTPUser: Possible frame timeout. ", *r->getMain());
 			consumeResource(r);
-			it = possibleFrames_.erase(it);
 		} else {
-			if (startTime < firstStoredTime_)
-				firstStoredTime_ = startTime;
-			++it;
+			possibleFrames_.push(it->first, r, refererKey(r));
 		}
 	}
 
-	for (ResourceList::iterator it = pages_.begin();
-	     it != pages_.end(); ) {
-		Resource* r = *it;
-		Timeval startTime(r->getStartTime());
+	expired.clear();
+	pages_.takeExpired(curTime, TIMEOUT, &expired);
+	for (vector<ResourceQueue::Entry>::const_iterator it = expired.begin();
+	     it != expired.end(); ++it) {
+		LOG_AND_COUNT("HTTPUser: timeout. ", *it->second->getMain());
+		consumeResource(it->second);
+	}
 
-		if (curTime.diff(startTime) > TIMEOUT) {
-			LOG_AND_COUNT("HTTPUser: timeout. ", *r->getMain());
-			consumeResource(r);
-			it = pages_.erase(it);
-		} else {
-			if (startTime < firstStoredTime_)
-				firstStoredTime_ = startTime;
-			++it;
-		}
+	expired.clear();
+	earlySubs_.takeExpired(curTime, TIMEOUT, &expired);
+	for (vector<ResourceQueue::Entry>::const_iterator it = expired.begin();
+	     it != expired.end(); ++it) {
+		LOG_AND_COUNT("HTTPUser: Early subresource timeout. ", *it->second->getMain());
+		consumeResource(it->second);
 	}
 
-	for (ResourceList::iterator it = earlySubs_.begin();
-	     it != earlySubs_.end(); ) {
-		Resource* r = *it;
-		Timeval startTime(r->getStartTime());
-		if (curTime.diff(startTime) > TIMEOUT) {
-			LOG_AND_COUNT("HTTPUser: Early subresource timeout. ", *r->getMain());
-			consumeResource(r);
-			it = earlySubs_.erase(it);
-		} else {
-			if (startTime < firstStoredTime_)
-				firstStoredTime_ = startTime;
-			++it;
-		}
+	firstStoredTime_ = Timeval::endOfTime();
+	ResourceQueue* queues[] = { &possibleFrames_, &pages_, &earlySubs_ };
+	for (size_t i = 0; i < sizeof(queues)/sizeof(queues[0]); i++) {
+		Timeval startTime;
+		if (queues[i]->firstStartTime(&startTime) && startTime < firstStoredTime_)
+			firstStoredTime_ = startTime;
 	}
 }
 
@@ -675,7 +754,14 @@ void HTTPUser::closeResource(Resource* r)
 	if (mIt != pageMap_.end() && mIt->second == r)
 		pageMap_.erase(mIt);
 
-	redirectSources_.erase(r);
+	if (isRedirection(r->getMain())) {
+		RedirectMap::iterator rIt = redirectSources_.find(removeURLFragment(r->getMain()->getLocation()));
+		if (rIt != redirectSources_.end()) {
+			rIt->second.erase(r);
+			if (rIt->second.empty())
+				redirectSources_.erase(rIt);
+		}
+	}
 	const Resource::ResourceList& parts = r->getParts();
 	for (Resource::ResourceList::const_iterator it = parts.begin(); it != parts.end(); ++it)
 		closeResource(*it);
@@ -699,6 +785,7 @@ void HTTPUser::consumeResource(Resource* r)
 {
 	assert(!r->getOwner());
 	closeResource(r);
+	treePages_.erase(r);
 
 	if (isPage(r)) {
 		LOG_AND_COUNT("HTTPUser::consumeResource called, page ", *r->getMain());
@@ -1,15 +1,17 @@
 #ifndef HTTPUSER_H
 #define HTTPUSER_H
 
-#include <map>
 #include <string>
-#include <list>
 #include <set>
+#include <vector>
+#include <unordered_map>
 
 #include <staple/TCPConn.h>
+#include <staple/FlowTable.h>
 #include <staple/http/globals.h>
 #include <staple/http/IPAddress.h>
 #include <staple/http/Timeval.h>
+#include "ResourceQueue.h"
 
 class HTTPMsg;
 class HTTPPageViewTester;
@@ -75,7 +77,7 @@ private:
 
 	Stats stats_;
 	Staple& staple_;
-	typedef std::unordered_map<TCPConnId, HTTPConnection*> ConnMap;
+	typedef FlowTable<TCPConnId, HTTPConnection*> ConnMap;
 	ConnMap connections_;
 	Timeval lastAct_;
 
@@ -140,19 +142,27 @@ private:
 	// Map URL of main resource to Resource. This data structure
 	// doesn't own its contents. When an entry is removed the
 	// Resource should _not_ be deleted!
-
-	// FIXME Use unordered_map instead?
-	typedef std::map<std::string, Resource*> PageMap;
+	typedef std::unordered_map<std::string, Resource*> PageMap;
 	PageMap pageMap_;
 
-	typedef std::list<Resource*> ResourceList;
+	// The resources of pageMap_ in each tree of resources, keyed
+	// by the root of the tree. Used to find the possible frames
+	// that refer to some page in a tree without traversing all of
+	// possibleFrames_. The lists are merged when a tree is added
+	// to another one, and they may contain resources that were
+	// replaced in pageMap_ since.
+	typedef std::unordered_map<const Resource*, std::vector<Resource*> > TreePages;
+	TreePages treePages_;
+
 	typedef std::set<Resource*> ResourceSet;
 
-	/* This list holds resources with status code 3xx that has a
-	 * Location header. This list does _not_ own the resources
-	 * contained in it.
+	/* This map holds resources with status code 3xx that has a
+	 * Location header, keyed by the Location without
+	 * fragment. This map does _not_ own the resources contained
+	 * in it.
 	 */
-	ResourceSet redirectSources_;
+	typedef std::unordered_map<std::string, ResourceSet> RedirectMap;
+	RedirectMap redirectSources_;
 
 	/* Look in redirectSources_ to see if there is a suitable
 	 * redirection that matches 'target'. That is, look for a
@@ -172,6 +182,10 @@ private:
 	void updateFirstStoredTime(const Resource* r);
 	PageMap::iterator pageMapFind(const std::string& referer);
 
+	// Add the possible frames whose referer may refer to 'url' to
+	// 'frames'.
+	void findFrames(const std::string& url, ResourceQueue::SeqSet* frames) const;
+
 	/* The minimum of all start times of the resources stored in
 	 * pages_, possibleFrames_, and earlySubs_. By keeping track
 	 * of the minimum start time checkTimeout is often very
@@ -181,29 +195,29 @@ private:
 	 */
 	 Timeval firstStoredTime_;
 
-	// The three lists below, pages_, earlySubs_, and
+	// The three queues below, pages_, earlySubs_, and
 	// possibleFrames_ own the resources they contain. When a
-	// resource is removed from these lists either it has to be
+	// resource is removed from these queues either it has to be
 	// deleted or the ownership should be transfered to someone
-	// else. New resources are added at the back, old ones are
-	// removed when they time out, see checkTimeout.
-
-	// FIXME These should probably be maps from referer to
-	// list<Resource*>, or something like that.
+	// else. New resources are added at the back (with the
+	// sequence number nextSeq_), old ones are removed when they
+	// time out, see checkTimeout. earlySubs_ and possibleFrames_
+	// are indexed by referer without fragment.
+	unsigned long nextSeq_;
 
 	// Resources of main content-type with empty referer are
-	// push_back on this list. These are typically text/html
-	// pages which are not frames.
-	ResourceList pages_;
+	// added to this queue. These are typically text/html pages
+	// which are not frames.
+	ResourceQueue pages_;
 
 	// Sometimes we see a request for a subresource _before_ the
 	// response for the main resource is complete. We store such
-	// potential early subresources in this list.
-	ResourceList earlySubs_;
+	// potential early subresources in this queue.
+	ResourceQueue earlySubs_;
 
-	// This list holds possible frames. It typically contains
+	// This queue holds possible frames. It typically contains
 	// text/html that have a referer.
-	ResourceList possibleFrames_;
+	ResourceQueue possibleFrames_;
 
 	IPAddress srcIP_;
 	PageViewPrinter* printer_;
@@ -1,36 +1,39 @@
 #include <iostream>
 #include <string>
 #include <stdio.h>
+#include <arpa/inet.h>
 
 #include <staple/http/IPAddress.h>
+#include <staple/IPv6Registry.h>
 
 using std::ostream;
 using std::istream;
 using std::string;
 
-IPAddress::IPAddress(const DoubleWord& ip) : IP(ip)
+IPAddress::IPAddress(const DoubleWord& ip, Byte ipVersion) : IP(ip), ipVersion(ipVersion)
 { }
 
-IPAddress::IPAddress()
+IPAddress::IPAddress() : ipVersion(4)
 {
 	memset(&IP, 0, sizeof(IP));
 }
 
 bool IPAddress::operator<(const IPAddress& o) const
 {
+	if (getIPVersion() != o.getIPVersion())
+		return getIPVersion() < o.getIPVersion();
 	return getIP().data < o.getIP().data;
 }
 
 bool operator==(const IPAddress& a, const IPAddress& b)
 {
-	return a.getIP().data == b.getIP().data;
+	return a.getIP().data == b.getIP().data && a.getIPVersion() == b.getIPVersion();
 }
 
 // FIXME: Does this work on big-endian machines?
 ostream& operator<<(ostream& o, const IPAddress& ip)
 {
-	o << (unsigned)ip.getIP().byte[3] << "." << (unsigned)ip.getIP().byte[2] << "." << (unsigned)ip.getIP().byte[1] << "." << (unsigned)ip.getIP().byte[0];
-	return o;
+	return PrintIPAddress(o, ip.getIPVersion(), ip.getIP());
 }
 
 // FIXME: Does this work on big-endian machines?
@@ -38,6 +41,19 @@ istream& operator>>(istream& in, IPAddress& ip)
 {
 	string s;
 	in >> s;
+
+	/* IPv6 addresses get their handle from the IPv6 registry. */
+	if (s.find(':') != string::npos) {
+		unsigned char addr[16];
+		if (inet_pton(AF_INET6, s.c_str(), addr) != 1) {
+			in.setstate(istream::failbit);
+			return in;
+		}
+		ip.IP.data = ipv6Registry.Intern(addr);
+		ip.ipVersion = 6;
+		return in;
+	}
+
 	int a, b, c, d;
 	int ret = sscanf(s.c_str(), "%d.%d.%d.%d", &a, &b, &c, &d);
 	if (ret != 4) {
@@ -49,6 +65,7 @@ istream& operator>>(istream& in, IPAddress& ip)
 	ip.IP.byte[2] = b;
 	ip.IP.byte[1] = c;
 	ip.IP.byte[0] = d;
+	ip.ipVersion = 4;
 	return in;
 }
 
@@ -1,5 +1,7 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <assert.h>
@@ -28,15 +30,50 @@ void makeLeadingDirs(const string& path)
 }
 
 RotatingLogFile::RotatingLogFile(Staple& staple, const string& name)
-	: staple_(staple), name_(name),  ROPEnd_(0), autoRotate_(true)
+	: staple_(staple), name_(name), rotation_(RotationService::Instance()),
+	  autoRotate_(true), fd_(-1), rop_(0), bufLen_(0),
+	  opened_(false), next_(-1), retired_(-1), retiredROP_(0)
 {
-	fout_.exceptions(fstream::failbit | fstream::badbit);
+	rotation_.Register(this);
+}
+
+RotatingLogFile::~RotatingLogFile()
+{
+	// The service thread does not touch this file after this
+	rotation_.Unregister(this);
+
+	writeBuffer();
+	Retire();
+	int next = next_.exchange(-1);
+	if (next >= 0) {
+		close(next);
+		unlink(getNextFilename().c_str());
+	}
+	// The last file is left under its temporary name
+	if (fd_ >= 0)
+		close(fd_);
 }
 
 void RotatingLogFile::flush()
 {
-	if (fout_.is_open())
-		fout_.flush();
+	writeBuffer();
+}
+
+void RotatingLogFile::writeBuffer()
+{
+	size_t written = 0;
+	while (fd_ >= 0 && written < bufLen_) {
+		ssize_t n = write(fd_, buf_ + written, bufLen_ - written);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error(staple_, "RotatingLogFile::writeBuffer: Failed to write log file '",
+			      getTempFilename(), "': ", strerror(errno));
+			break;
+		}
+		written += n;
+	}
+	bufLen_ = 0;
 }
 
 void RotatingLogFile::setAutoRotate(bool enable)
@@ -54,6 +91,17 @@ string RotatingLogFile::getTempFilename() const
 	return buf;
 }
 
+string RotatingLogFile::getNextFilename() const
+{
+	return getTempFilename() + ".next";
+}
+
+// The name of the file of the given ROP (named after the end of the ROP).
+string RotatingLogFile::getFilename(unsigned long rop) const
+{
+	return getFilename(Timeval((rop + 1) * HTTP_ROP));
+}
+
 string RotatingLogFile::getFilename(const Timeval& cur) const
 {
 	char buf[PATH_MAX];
@@ -84,19 +132,46 @@ string RotatingLogFile::getFilename(const Timeval& cur) const
 	return buf;
 }
 
-Timeval RotatingLogFile::openNewLogFile()
+void RotatingLogFile::openNewLogFile()
 {
-	Timeval cur(Timeval::getCurrentTime());
-	openNewLogFile(cur);
-	return cur;
+	writeBuffer();
+
+	// Switch to the file prepared by the rotation service (it is
+	// only prepared after the previous old file was retired).
+	int next = next_.exchange(-1, std::memory_order_acquire);
+	if (next >= 0) {
+		retiredROP_ = rop_;
+		retired_.store(fd_, std::memory_order_release);
+		fd_ = next;
+		rop_ = rotation_.ROP();
+		rotation_.Notify();
+		return;
+	}
+
+	// No file is prepared (e.g., this is the first one): rotate
+	// synchronously.
+	rotation_.Lock();
+	openSync();
+	rotation_.Unlock();
 }
 
-void RotatingLogFile::openNewLogFile(const Timeval& cur)
+// Close and rename the open file and open a new one (the rotation
+// service is locked).
+void RotatingLogFile::openSync()
 {
+	// Finish the hand-over to the service if it is still pending,
+	// and drop a file prepared in the meantime.
+	Retire();
+	int next = next_.exchange(-1);
+	if (next >= 0) {
+		close(next);
+		unlink(getNextFilename().c_str());
+	}
+
 	string tmpName(getTempFilename());
-	if (fout_.is_open()) {
-		fout_.close();
-		string newName(getFilename(ROPEnd_));
+	if (fd_ >= 0) {
+		close(fd_);
+		string newName(getFilename(rop_));
 		if (rename(tmpName.c_str(), newName.c_str())) {
 			error(staple_, "RotatingLogFile::openNewLogFile: Failed to rename log file '",
 			      tmpName, "' -> '", newName, "': ", strerror(errno));
@@ -106,33 +181,62 @@ void RotatingLogFile::openNewLogFile(const Timeval& cur)
 	}
 
 	makeLeadingDirs(tmpName);
-	fout_.open(tmpName.c_str(), fstream::out|fstream::trunc);
-	if (!fout_.is_open()) {
+	fd_ = open(tmpName.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd_ < 0) {
 		error(staple_, "RotatingLogFile::openNewLogFile: Failed to open log file: '",
 		      tmpName, "': ", strerror(errno));
 		// FIXME do something more sensible here?
 		assert(false);
 	}
-	ROPEnd_ = Timeval(ROPEnd_.getSec() + HTTP_ROP);
-
-	/* ROPEnd_ is initialized to 0 in the constructor so in the
-	 * first call to this method the condition below will be
-	 * true. It will also be true if we didn't log anything for an
-	 * entire ROP.
-	 */
-	if (ROPEnd_ < cur) {
-		long secs = cur.getSec();
-		ROPEnd_ = Timeval(secs + HTTP_ROP - secs % HTTP_ROP);
+	rop_ = rotation_.ROP();
+	opened_.store(true);
+}
+
+void RotatingLogFile::PrepareROP(unsigned long rop)
+{
+	// Only one file is prepared, even if the writer has been idle
+	// for more than an ROP.
+	if (!opened_.load() || next_.load() >= 0 || retired_.load() >= 0)
+		return;
+
+	string nextName(getNextFilename());
+	int fd = open(nextName.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fd < 0) {
+		// The writer will open the file itself.
+		error(staple_, "RotatingLogFile::PrepareROP: Failed to open log file: '",
+		      nextName, "': ", strerror(errno));
+		return;
 	}
+	next_.store(fd, std::memory_order_release);
 }
 
-bool RotatingLogFile::openNewLogFileIfNecessary()
+void RotatingLogFile::Retire()
 {
-	Timeval cur(Timeval::getCurrentTime());
+	int fd = retired_.load(std::memory_order_acquire);
+	if (fd < 0)
+		return;
+
+	close(fd);
+	string tmpName(getTempFilename());
+	string newName(getFilename(retiredROP_));
+	if (rename(tmpName.c_str(), newName.c_str())) {
+		error(staple_, "RotatingLogFile::Retire: Failed to rename log file '",
+		      tmpName, "' -> '", newName, "': ", strerror(errno));
+	}
+	// The file being written gets the temporary name.
+	string nextName(getNextFilename());
+	if (rename(nextName.c_str(), tmpName.c_str())) {
+		error(staple_, "RotatingLogFile::Retire: Failed to rename log file '",
+		      nextName, "' -> '", tmpName, "': ", strerror(errno));
+	}
+	retired_.store(-1, std::memory_order_release);
+}
 
-	if (!fout_.is_open() ||
-	    (autoRotate_ && ROPEnd_ < cur)) {
-		openNewLogFile(cur);
+bool RotatingLogFile::openNewLogFileIfNecessary()
+{
+	if (fd_ < 0 ||
+	    (autoRotate_ && rop_ != rotation_.ROP())) {
+		openNewLogFile();
 		return true;
 	} else {
 		return false;
@@ -141,21 +245,38 @@ bool RotatingLogFile::openNewLogFileIfNecessary()
 
 void RotatingLogFile::writeLine(const string& s)
 {
-	/* FIXME: We can avoid calling openNewLogFileIfNecessary
-	 * (which calls gettimeofday) here by creating a thread which
-	 * waits for HTTP_ROP seconds and then rotates all log files.
-	 *
-	 * As all use of fout_ goes through writeLine the locking will
-	 * be simple and contained within the RotatingLogFile class.
-	 */
-
+	// No system call here: the ROP number is kept up to date by
+	// the rotation service.
 	openNewLogFileIfNecessary();
-	fout_ << s << '\n';
+
+	if (bufLen_ + s.size() + 1 > BUFFER_SIZE)
+		writeBuffer();
+	if (s.size() + 1 > BUFFER_SIZE) {
+		// Longer than the buffer: write it directly.
+		string line(s + '\n');
+		ssize_t n = 0;
+		for (size_t written = 0; written < line.size(); written += n) {
+			n = write(fd_, line.data() + written, line.size() - written);
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			if (n < 0) {
+				error(staple_, "RotatingLogFile::writeLine: Failed to write log file '",
+				      getTempFilename(), "': ", strerror(errno));
+				break;
+			}
+		}
+		return;
+	}
+	memcpy(buf_ + bufLen_, s.data(), s.size());
+	bufLen_ += s.size();
+	buf_[bufLen_++] = '\n';
 }
 
 bool RotatingLogFile::shouldRotate() const
 {
-	return ROPEnd_ < Timeval::getCurrentTime();
+	return fd_ < 0 || rop_ != rotation_.ROP();
 }
 
 StreamLogFile::StreamLogFile(ostream& o) : out_(o)
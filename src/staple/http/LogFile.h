@@ -3,9 +3,11 @@
 
 #include <string>
 #include <fstream>
+#include <atomic>
 
 #include <staple/http/Timeval.h>
 #include <staple/http/globals.h>
+#include <staple/RotationService.h>
 
 class Staple;
 
@@ -33,21 +35,32 @@ public:
 /* A rotating log file changes name every HTTP_ROP seconds. The name
  * is 'name'_xxx.log where xxx is the number of seconds since the Unix
  * epoch.
+ *
+ * The rotation is driven by the RotationService: writeLine only
+ * compares the ROP number published by the service with the ROP of
+ * the open file. At the ROP boundary the service has already opened
+ * the file of the new ROP (under the temporary name with a ".next"
+ * suffix), so the writer just switches to it and hands the old file
+ * back to the service, which closes and renames both files.
  */
-class RotatingLogFile : public LogFile
+class RotatingLogFile : public LogFile, public RotatingSink
 {
 public:
 	RotatingLogFile(Staple&, const std::string& name);
+	~RotatingLogFile();
 
         // New log files are opened after HTTP_ROP seconds.
 	static const int HTTP_ROP;
 
+	// Size of the write buffer.
+	static const size_t BUFFER_SIZE = 65536;
+
 	/* Disable/enable auto rotate. Default: enabled.
 	 */
 	void setAutoRotate(bool enable);
 
-        /* Create a new log file if HTTP_ROP seconds has elapsed since
-	 * the last time a new file was created. The file will be
+        /* Create a new log file if the ROP has changed since the
+	 * last time a new file was created. The file will be
 	 * created in ProgramArgs::getPerfmonDirName() and will be
 	 * named after creation time and 'name'.
 	 *
@@ -55,9 +68,10 @@ public:
 	 */
 	bool openNewLogFileIfNecessary();
 
-	/* Create a new log file. Timestamp of creation is returned.
+	/* Create a new log file (the file prepared by the rotation
+	 * service if there is one).
 	 */
-	Timeval openNewLogFile();
+	void openNewLogFile();
 
 	/* Write one line to the log file and rotate the log file if
 	 * necessary (unless setAutoRotate(false) have been called).
@@ -72,20 +86,38 @@ public:
 
 	void flush();
 
+	/* Called by the rotation service thread. */
+	void PrepareROP(unsigned long rop);
+	void Retire();
+
 private:
 	DISALLOW_COPY_AND_ASSIGN(RotatingLogFile);
 
-	void openNewLogFile(const Timeval&);
+	void writeBuffer();
+	void openSync();
 	std::string getTempFilename() const;
+	std::string getNextFilename() const;
 	std::string getFilename(const Timeval& cur) const;
+	std::string getFilename(unsigned long rop) const;
 
 	Staple& staple_;
 	std::string name_;
-
-	// End time of the current ROP.
-	Timeval ROPEnd_;
-	std::fstream fout_;
+	RotationService& rotation_;
 	bool autoRotate_;
+
+	// The open file and its ROP (used by the writer only).
+	int fd_;
+	unsigned long rop_;
+	char buf_[BUFFER_SIZE];
+	size_t bufLen_;
+
+	// Hand-over between the writer and the rotation service: the
+	// file prepared for the next ROP and the old file to be
+	// closed and renamed (-1 if none).
+	std::atomic<bool> opened_;
+	std::atomic<int> next_;
+	std::atomic<int> retired_;
+	unsigned long retiredROP_;
 };
 
 /* A StreamLogFile is just a thin wrapper around a std::ostream.
@@ -15,8 +15,9 @@ using std::stringstream;
 
 void MessageInfo::createRecur(std::vector<MessageInfo>* res, const Resource* r, int pageId, int depth)
 {
-	MessageInfo mi(*r->getMain(), pageId, depth);
-	res->push_back(mi);
+	// Constructed in place of a copy, so that the strings are moved
+	// into the vector instead of copied.
+	res->push_back(MessageInfo(*r->getMain(), pageId, depth));
 	const vector<Resource*>& subs = r->getParts();
 	for (vector<Resource*>::const_iterator it = subs.begin(); it != subs.end(); ++it)
 		createRecur(res, *it, pageId, depth+1);
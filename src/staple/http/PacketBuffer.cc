@@ -5,8 +5,6 @@
 #include <staple/http/log.h>
 #include "PacketBuffer.h"
 
-using std::deque;
-
 static const bool PBUF_DEBUG = false;
 const uint32_t PacketBuffer::INSANELY_LARGE_SEQ_ACK = 10*1024*1024;
 
@@ -25,8 +23,8 @@ PacketBuffer::~PacketBuffer()
 	if (PBUF_DEBUG)
 		log(staple_, "PacketBuffer::~PacketBuffer ", this, " nextSeqNo: ", nextSeqNo_, " size: ", packets_.size());
 
-	for (deque<TCPPacket*>::iterator it = packets_.begin(); it != packets_.end(); ++it)
-		delete *it;
+	for (PacketMap::iterator it = packets_.begin(); it != packets_.end(); ++it)
+		delete it->second;
 }
 
 /* Return true if x+y overflows and otherwise false. */
@@ -67,9 +65,10 @@ bool PacketBuffer::tryAddGet(const TCPPacket& p)
 		return false;
 
 	if (!packets_.empty()) {
-		if (p.seq < packets_.front()->seq) {
+		uint32_t frontSeq = packets_.begin()->first;
+		if (p.seq < frontSeq) {
 			// Check for overlapping packet.
-			if (p.seq + p.TCPPLLen > packets_.front()->seq)
+			if (p.seq + p.TCPPLLen > frontSeq)
 				return false;
 
 			// Front of list is correct place! Continue.
@@ -103,10 +102,7 @@ bool PacketBuffer::add(const TCPPacket& p)
 	assert(alive_);
 	checkInvariant();
 
-	TCPPacket* packet = new TCPPacket(p);
-	packet->pL2Packet = p.pL2Packet->clone();
-
-	deque<TCPPacket*>::iterator it;
+	TCPPacket* packet = new BufferedTCPPacket(p);
 
 	if (PBUF_DEBUG)
 		log(staple_, "PacketBuffer::add ", this,
@@ -122,30 +118,28 @@ bool PacketBuffer::add(const TCPPacket& p)
 		return true;
 	}
 
-	for (it = packets_.begin(); it != packets_.end(); ++it) {
-		// Find the correct place in the packets_ list for the
-		// new packet.
-		if (packet->seq < (*it)->seq) {
-			if (packet->seq + packet->TCPPLLen > (*it)->seq) {
-				WARN("PacketBuffer::add Overlapping packet ",
-				     " next seq: ", (*it)->seq, ' ',
-				     *packet);
-				delete packet;
-				return true;
-			}
-
-			// Correct place found! Break out of the loop.
-			break;
-		} else if (packet->seq == (*it)->seq) {
-			if (packet->TCPPLLen != (*it)->TCPPLLen)
+	// Find the correct place in packets_ for the new packet:
+	// right before the first packet with seq >= the new one.
+	PacketMap::iterator it = packets_.lower_bound(packet->seq);
+	if (it != packets_.end()) {
+		TCPPacket* next = it->second;
+		if (packet->seq == next->seq) {
+			if (packet->TCPPLLen != next->TCPPLLen)
 				WARN("PacketBuffer::add Duplicate seq no, but not same length."
-				     " next seq: ", (*it)->seq,
-				     " next TCPPLLen: ", (*it)->TCPPLLen, ' ',
+				     " next seq: ", next->seq,
+				     " next TCPPLLen: ", next->TCPPLLen, ' ',
 				     *packet);
 			delete packet;
 			return true;
 		}
-		// else we try the next packet in the list.
+
+		if (packet->seq + packet->TCPPLLen > next->seq) {
+			WARN("PacketBuffer::add Overlapping packet ",
+			     " next seq: ", next->seq, ' ',
+			     *packet);
+			delete packet;
+			return true;
+		}
 	}
 
 	uint32_t prevSeq;
@@ -153,7 +147,8 @@ bool PacketBuffer::add(const TCPPacket& p)
 		// Not really the previous seq, but close enough.
 		prevSeq = nextSeqNo_;
 	} else {
-		TCPPacket* prev = *(it-1);
+		PacketMap::iterator prevIt = it;
+		TCPPacket* prev = (--prevIt)->second;
 		if (prev->seq + prev->TCPPLLen > packet->seq) {
 			WARN("PacketBuffer::add Overlapping packet (with previous)",
 			     " prev seq: ", prev->seq, " prev len: ", prev->TCPPLLen, ' ',
@@ -178,7 +173,7 @@ bool PacketBuffer::add(const TCPPacket& p)
 		return false;
 	}
 
-	packets_.insert(it, packet);
+	packets_.insert(it, PacketMap::value_type(packet->seq, packet));
 	bytesUsed_ += packet->payloadSavedLen;
 
 	if (!gotFirstPacket_) {
@@ -192,14 +187,15 @@ bool PacketBuffer::add(const TCPPacket& p)
 void PacketBuffer::checkInvariant()
 {
 	if (!packets_.empty()) {
-		assert(nextSeqNo_ <= packets_.front()->seq);
+		assert(nextSeqNo_ <= packets_.begin()->first);
 		if (PBUF_DEBUG) {
 			/* This check is a bit expensive if packets_
 			 * is large, so we only do it if PBUF_DEBUG is
 			 * true.
 			 */
-			for (size_t i = 1; i < packets_.size(); i++) {
-				assert(packets_[i-1]->seq + packets_[i-1]->TCPPLLen <= packets_[i]->seq);
+			PacketMap::const_iterator prev = packets_.begin(), it = prev;
+			for (++it; it != packets_.end(); prev = it++) {
+				assert(prev->second->seq + prev->second->TCPPLLen <= it->second->seq);
 			}
 		}
 	}
@@ -214,9 +210,9 @@ TCPPacket* PacketBuffer::get(/*int offset* */)
 		return NULL;
 	}
 
-	TCPPacket* p = packets_.front();
+	TCPPacket* p = packets_.begin()->second;
 	if (p->seq == nextSeqNo_) {
-		packets_.pop_front();
+		packets_.erase(packets_.begin());
 
 		if (p->TCPPLLen != p->payloadSavedLen) {
 			WARN("PacketBuffer::get TCPPLen != payloadSavedLen ",
@@ -242,20 +238,20 @@ TCPPacket* PacketBuffer::get(/*int offset* */)
 		 * TCP stream that we don't care about (such as in the
 		 * middle of a HTTP response).
 		 */
-		TCPPacket* ret = new TCPPacket(p->staple);
+		TCPPacket* ret = new BufferedTCPPacket(p->staple, *p->pL2Packet);
 		ret->Init();
 
 		ret->payload = new Byte[0];
 		ret->payloadSavedLen = 0;
-		ret->pL2Packet = p->pL2Packet->clone();
 		ret->pL2Packet->l2SavedLen = 0;
-		ret->pL2Packet->pL3Packet = ret;
 
 		/* Try to set rest of IPPacket and TCPPacket fields to
 		 * something reasonable.
 		 */
 		ret->srcIP = p->srcIP;
 		ret->dstIP = p->dstIP;
+		ret->IPVersion = p->IPVersion;
+		ret->tunnelId = p->tunnelId;
 		ret->match = p->match;
 		ret->direction = p->direction;
 		ret->IPPktLen = 0; // Set below.
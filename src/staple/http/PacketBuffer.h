@@ -1,13 +1,46 @@
 #ifndef PACKETBUFFER_H
 #define PACKETBUFFER_H
 
-#include <deque>
+#include <map>
 #include <stdint.h>
 
 #include <staple/Staple.h>
+#include <staple/Packet.h>
 #include <staple/http/globals.h>
 
-class TCPPacket;
+/* A packet kept by a PacketBuffer. Its L2 header (the capture time
+ * and length, all that the HTTP code reads) lives in the same
+ * allocation instead of a clone() of the original L2 packet: the
+ * original packets are pooled and reused, so the copy can't refer
+ * to them. The payload is shared with the original (see L3Packet).
+ */
+class BufferedTCPPacket : public TCPPacket
+{
+public:
+	/* Copy of a packet. */
+	explicit BufferedTCPPacket(const TCPPacket& p) : TCPPacket(p), frame_(*p.pL2Packet)
+	{
+		pL2Packet = &frame_;
+		frame_.pL3Packet = this;
+	}
+	/* Empty packet with the L2 header of 'l2' (the caller fills in the rest). */
+	BufferedTCPPacket(Staple& staple, const L2Packet& l2) : TCPPacket(staple), frame_(l2)
+	{
+		pL2Packet = &frame_;
+		frame_.pL3Packet = this;
+	}
+	virtual ~BufferedTCPPacket()
+	{
+		/* The frame is a member, neither destructor may delete the other. */
+		frame_.pL3Packet = NULL;
+		pL2Packet = NULL;
+	}
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(BufferedTCPPacket);
+
+	L2Packet frame_;
+};
 
 /* A PacketBuffer contains a sequence of TCP packets ordered by their
    sequence number.  The packet buffer makes it possible to compensate
@@ -60,7 +93,9 @@ public:
 
 	/* Copy the packet and add it to the packet buffer. Return
 	 * false if there isn't room for the packet in the buffer and
-	 * true otherwise.
+	 * true otherwise. The copy shares the payload slab of 'p'
+	 * (see L3Packet), so the payload itself is normally not
+	 * copied, and carries its L2 header (see BufferedTCPPacket).
 	 */
 	bool add(const TCPPacket& p);
 
@@ -115,8 +150,12 @@ private:
 	static const uint32_t INSANELY_LARGE_SEQ_ACK;
 	void updateNextSeqNo(uint32_t inc);
 
-	/* Ordered according to seq no. */
-	std::deque<TCPPacket*> packets_;
+	/* Keyed (and thereby ordered) by seq no, so that a reordered
+	 * packet is inserted in O(log n) however many packets are
+	 * buffered.
+	 */
+	typedef std::map<uint32_t, TCPPacket*> PacketMap;
+	PacketMap packets_;
 
         /* seq no of next non-NULL get. */
 	uint32_t nextSeqNo_;
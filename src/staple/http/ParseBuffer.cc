@@ -0,0 +1,24 @@
+#include "ParseBuffer.h"
+
+/* Drop the consumed data, if there is at least as much of it as
+ * there is data left.
+ */
+void ParseBuffer::reclaim()
+{
+	if (start_ != 0 && start_ >= data_.size() - start_) {
+		data_.erase(data_.begin(), data_.begin() + start_);
+		start_ = 0;
+	}
+}
+
+void ParseBuffer::append(const Byte* start, const Byte* end)
+{
+	reclaim();
+	data_.insert(data_.end(), start, end);
+}
+
+void ParseBuffer::append(size_t len, Byte b)
+{
+	reclaim();
+	data_.insert(data_.end(), len, b);
+}
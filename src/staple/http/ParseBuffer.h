@@ -0,0 +1,64 @@
+#ifndef PARSEBUFFER_H
+#define PARSEBUFFER_H
+
+#include <assert.h>
+#include <vector>
+
+#include <staple/Type.h>
+
+/* A ParseBuffer holds the data of a HTTP message that could not be
+ * parsed yet (e.g., a header line continued in the next packet). New
+ * data is appended at the end and parsed data is consumed from the
+ * front. Consuming only moves a start offset, the consumed bytes are
+ * reclaimed by append once they are at least as many as the
+ * remaining ones. Each byte is therefore moved a bounded number of
+ * times, however many packets a message is split into.
+ */
+class ParseBuffer
+{
+public:
+	ParseBuffer() : start_(0) { }
+
+	bool empty() const { return start_ == data_.size(); }
+	size_t size() const { return data_.size() - start_; }
+
+	/* The unconsumed data is [begin(), end()). Only valid until
+	 * the next call to append.
+	 */
+	const Byte* begin() const { return data_.data() + start_; }
+	const Byte* end() const { return data_.data() + data_.size(); }
+
+	void append(const Byte* start, const Byte* end);
+	/* Append 'len' copies of 'b'. */
+	void append(size_t len, Byte b);
+
+	/* Consume the data before 'pos', which is in [begin(), end()]. */
+	void consume(const Byte* pos)
+	{
+		assert(begin() <= pos && pos <= end());
+		start_ = pos - data_.data();
+		if (start_ == data_.size())
+			clear();
+	}
+
+	void clear()
+	{
+		data_.clear();
+		start_ = 0;
+	}
+
+	/* Clear and free the memory held. */
+	void release()
+	{
+		std::vector<Byte>().swap(data_);
+		start_ = 0;
+	}
+
+private:
+	void reclaim();
+
+	std::vector<Byte> data_;
+	size_t start_;
+};
+
+#endif
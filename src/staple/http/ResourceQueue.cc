@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "ResourceQueue.h"
+#include "Resource.h"
+
+using std::string;
+using std::vector;
+
+void ResourceQueue::push(unsigned long seq, Resource* r, const string& key)
+{
+	Stored& s = entries_[seq];
+	assert(s.r == NULL);
+	s.r = r;
+	if (!key.empty()) {
+		std::unordered_map<string, SeqSet>::iterator iIt = index_.find(key);
+		if (iIt == index_.end())
+			iIt = index_.insert(std::make_pair(key, SeqSet())).first;
+		iIt->second.insert(seq);
+		s.key = &iIt->first;
+	}
+
+	Start start = { r->getStartTime(), seq };
+	starts_.push(start);
+}
+
+Resource* ResourceQueue::find(unsigned long seq) const
+{
+	std::map<unsigned long, Stored>::const_iterator it = entries_.find(seq);
+	return it == entries_.end() ? NULL : it->second.r;
+}
+
+void ResourceQueue::erase(unsigned long seq)
+{
+	std::map<unsigned long, Stored>::iterator it = entries_.find(seq);
+	if (it == entries_.end())
+		return;
+
+	if (it->second.key != NULL) {
+		std::unordered_map<string, SeqSet>::iterator iIt = index_.find(*it->second.key);
+		iIt->second.erase(seq);
+		if (iIt->second.empty())
+			index_.erase(iIt);
+	}
+	entries_.erase(it);
+}
+
+const ResourceQueue::SeqSet* ResourceQueue::findKey(const string& key) const
+{
+	std::unordered_map<string, SeqSet>::const_iterator it = index_.find(key);
+	return it == index_.end() ? NULL : &it->second;
+}
+
+/* Pop the heap entries of resources that are no longer in the queue.
+ */
+void ResourceQueue::dropRemoved()
+{
+	while (!starts_.empty() && entries_.find(starts_.top().seq) == entries_.end())
+		starts_.pop();
+}
+
+void ResourceQueue::takeExpired(const Timeval& curTime, double age, vector<Entry>* expired)
+{
+	size_t first = expired->size();
+	for (dropRemoved(); !starts_.empty(); dropRemoved()) {
+		const Start& start = starts_.top();
+		if (curTime.diff(start.time) <= age)
+			break;
+
+		expired->push_back(Entry(start.seq, find(start.seq)));
+		erase(start.seq);
+		starts_.pop();
+	}
+
+	/* The heap returns them by start time, but the callers
+	 * process them in the order they were added.
+	 */
+	std::sort(expired->begin() + first, expired->end());
+}
+
+bool ResourceQueue::firstStartTime(Timeval* start)
+{
+	dropRemoved();
+	if (starts_.empty())
+		return false;
+
+	*start = starts_.top().time;
+	return true;
+}
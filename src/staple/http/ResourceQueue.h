@@ -0,0 +1,96 @@
+#ifndef RESOURCEQUEUE_H
+#define RESOURCEQUEUE_H
+
+#include <map>
+#include <set>
+#include <queue>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <staple/http/globals.h>
+#include <staple/http/Timeval.h>
+
+class Resource;
+
+/* Resources waiting for a page view (see HTTPUser::pages_,
+ * earlySubs_, and possibleFrames_). The resources are kept in arrival
+ * order, given by a sequence number chosen by the caller, so that
+ * they are always processed in the same order as they were added.
+ *
+ * Besides that two indexes are kept, so that a user with thousands of
+ * open page views (typically a proxy or a NAT gateway) is not
+ * traversed linearly for every new resource:
+ *
+ *   - An index from a key (a normalized referer) to the resources
+ *     added with that key.
+ *
+ *   - A min-heap ordered by start time. Entries of resources that
+ *     were removed are left in the heap and skipped when they reach
+ *     the top.
+ *
+ * The queue does not own the resources, ownership stays with the
+ * HTTPUser.
+ */
+class ResourceQueue
+{
+public:
+	typedef std::pair<unsigned long, Resource*> Entry;
+	typedef std::set<unsigned long> SeqSet;
+
+	bool empty() const { return entries_.empty(); }
+	size_t size() const { return entries_.size(); }
+
+	/* Add 'r' with sequence number 'seq', which must be larger
+	 * than the sequence number of any resource in the queue
+	 * (unless it is re-added after takeExpired). 'key' is indexed
+	 * unless it is empty.
+	 */
+	void push(unsigned long seq, Resource* r, const std::string& key);
+
+	/* Return the resource with sequence number 'seq', or NULL. */
+	Resource* find(unsigned long seq) const;
+
+	/* Remove the resource with sequence number 'seq'. */
+	void erase(unsigned long seq);
+
+	/* Sequence numbers of the resources added with 'key', or NULL
+	 * if there is none.
+	 */
+	const SeqSet* findKey(const std::string& key) const;
+
+	/* Remove the resources started more than 'age' seconds before
+	 * 'curTime' and append them to 'expired' in arrival order.
+	 */
+	void takeExpired(const Timeval& curTime, double age, std::vector<Entry>* expired);
+
+	/* Set 'start' to the earliest start time in the queue and
+	 * return true, or return false if the queue is empty.
+	 */
+	bool firstStartTime(Timeval* start);
+
+private:
+	struct Stored {
+		Stored() : r(NULL), key(NULL) { }
+
+		Resource* r;
+		// The key in index_ (the nodes of index_ don't move),
+		// NULL if not indexed.
+		const std::string* key;
+	};
+
+	struct Start {
+		Timeval time;
+		unsigned long seq;
+
+		bool operator>(const Start& o) const { return o.time < time; }
+	};
+
+	void dropRemoved();
+
+	std::map<unsigned long, Stored> entries_;
+	std::unordered_map<std::string, SeqSet> index_;
+	std::priority_queue<Start, std::vector<Start>, std::greater<Start> > starts_;
+};
+
+#endif
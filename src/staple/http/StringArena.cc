@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <staple/Staple.h>
+#include <staple/http/Counter.h>
+#include "StringArena.h"
+
+StringArena::StringArena(Staple& staple) :
+	staple_(staple),
+	heap_(NULL),
+	size_(0),
+	capacity_(INLINE_SIZE)
+{ }
+
+StringArena::StringArena(const StringArena& a) :
+	staple_(a.staple_),
+	heap_(NULL),
+	size_(a.size_),
+	capacity_(INLINE_SIZE)
+{
+	/* The copy gets no spare capacity. */
+	if (size_ > INLINE_SIZE) {
+		COUNTER_INCREASE("StringArena: heap allocation");
+		capacity_ = size_;
+		heap_ = (char*) malloc(capacity_);
+	}
+	memcpy(base(), a.base(), size_);
+}
+
+StringArena::~StringArena()
+{
+	free(heap_);
+}
+
+StringRef StringArena::allocate(size_t size)
+{
+	StringRef r;
+	if (size == 0)
+		return r;
+
+	/* Room for the string and its NUL. */
+	size_t need = size_ + size + 1;
+	if (need > capacity_) {
+		COUNTER_INCREASE("StringArena: heap allocation");
+		size_t capacity = heap_ ? 2*capacity_ : HEAP_SIZE;
+		while (capacity < need)
+			capacity *= 2;
+		char* heap = (char*) malloc(capacity);
+		memcpy(heap, base(), size_);
+		free(heap_);
+		heap_ = heap;
+		capacity_ = capacity;
+	}
+
+	r.offset = size_;
+	r.size = size;
+	base()[size_ + size] = 0;
+	size_ = need;
+	return r;
+}
+
+StringRef StringArena::store(const char* start, const char* end)
+{
+	assert(start <= end);
+	StringRef r = allocate(end - start);
+	memcpy(data(r), start, r.size);
+	return r;
+}
+
+void StringArena::shrink()
+{
+	if (!heap_ || size_ == capacity_)
+		return;
+
+	if (size_ <= INLINE_SIZE) {
+		memcpy(inline_, heap_, size_);
+		free(heap_);
+		heap_ = NULL;
+		capacity_ = INLINE_SIZE;
+	} else {
+		/* Normally shrunk in place, keep the old buffer if not. */
+		char* heap = (char*) realloc(heap_, size_);
+		if (heap) {
+			heap_ = heap;
+			capacity_ = size_;
+		}
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef STRINGARENA_H
+#define STRINGARENA_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <iostream>
+
+#include <staple/Type.h>
+
+class Staple;
+
+/* A read-only view of a NUL-terminated string owned by someone else
+ * (typically a StringArena). It is only valid as long as the owner
+ * is not modified or destroyed, so copy it to a std::string to keep
+ * it.
+ */
+class StringView
+{
+public:
+	StringView() : data_(""), size_(0) { }
+	StringView(const char* d, size_t n) : data_(d), size_(n) { }
+
+	const char* c_str() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	std::string str() const { return std::string(data_, size_); }
+	operator std::string() const { return str(); }
+
+	bool operator==(const StringView& s) const
+	{
+		return size_ == s.size_ && memcmp(data_, s.data_, size_) == 0;
+	}
+	bool operator==(const std::string& s) const { return *this == StringView(s.data(), s.size()); }
+	bool operator==(const char* s) const { return *this == StringView(s, strlen(s)); }
+	template<typename T>
+	bool operator!=(const T& s) const { return !(*this == s); }
+
+private:
+	const char* data_;
+	size_t size_;
+};
+
+inline bool operator==(const std::string& s1, const StringView& s2) { return s2 == s1; }
+inline bool operator!=(const std::string& s1, const StringView& s2) { return !(s2 == s1); }
+
+inline std::ostream& operator<<(std::ostream& o, const StringView& s)
+{
+	return o.write(s.c_str(), s.size());
+}
+
+/* Reference to a string stored in a StringArena. It holds an offset
+ * rather than a pointer, so that it stays valid when the arena grows
+ * or is copied along with its owner. The default value is the empty
+ * string.
+ */
+struct StringRef
+{
+	StringRef() : offset(0), size(0) { }
+
+	uint32_t offset;
+	uint32_t size;
+};
+
+/* Append-only storage for the strings of one HTTPMsg (request URI,
+ * header values, etc.). The strings are stored back to back, each
+ * followed by a NUL, in a small buffer held inline in the arena.
+ * When that is exhausted the strings move to a heap buffer (counted
+ * by the "StringArena: heap allocation" counter), which grows by
+ * doubling while the message is parsed. shrink() fits it to the
+ * strings once the message is complete, and a copy is always fitted,
+ * so a retained message holds no spare capacity.
+ */
+class StringArena
+{
+public:
+	/* Size of the inline buffer. Enough for a request without
+	 * user-agent and referer; a larger one would be wasted in the
+	 * retained messages that do not need it.
+	 */
+	static const size_t INLINE_SIZE = 192;
+
+	/* Size of the first heap buffer. Enough for the strings of
+	 * the vast majority of messages, so that a message spills
+	 * (i.e., allocates) at most once.
+	 */
+	static const size_t HEAP_SIZE = 1024;
+
+	/* The 'staple' argument is only used for the counters. */
+	StringArena(Staple& staple);
+	StringArena(const StringArena&);
+	~StringArena();
+
+	/* Copy [start, end) (which must not be in the arena) to the
+	 * arena. */
+	StringRef store(const char* start, const char* end);
+	StringRef store(const Byte* start, const Byte* end)
+	{
+		return store(reinterpret_cast<const char*>(start), reinterpret_cast<const char*>(end));
+	}
+
+	/* Reserve room for a string of 'size' bytes. The caller fills
+	 * it in through data() before the next call to store or
+	 * allocate (which may move the strings).
+	 */
+	StringRef allocate(size_t size);
+
+	char* data(StringRef r) { return base() + r.offset; }
+	StringView view(StringRef r) const
+	{
+		return r.size ? StringView(base() + r.offset, r.size) : StringView();
+	}
+
+	/* Number of bytes used. */
+	size_t size() const { return size_; }
+
+	/* Release the unused capacity (moving the strings back inline
+	 * if they fit). */
+	void shrink();
+
+private:
+	void operator=(const StringArena&);
+
+	char* base() { return heap_ ? heap_ : inline_; }
+	const char* base() const { return heap_ ? heap_ : inline_; }
+
+	Staple& staple_;
+	char* heap_;
+	uint32_t size_, capacity_;
+	char inline_[INLINE_SIZE];
+};
+
+#endif
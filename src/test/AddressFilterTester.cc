@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#include <staple/AddressFilter.h>
+#include "Tester.h"
+
+// Differential test of the compiled network filters against the former linear scan of the filters (kept below as the
+// reference): random IPv4 and IPv6 filter sets with nested, overlapping and repeated prefixes of any length have to give
+// the same match, filter number and direction for both nets, and a benchmark of the filter cost per packet as a
+// function of the number of prefixes ("AddressFilterTester bench")
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static uint32_t Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (uint32_t)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+// Filter classification of a packet
+class Match {
+public:
+   bool  matchNet[2];
+   long  matchNum[2];
+   int   direction;                                         // -1: no net matched
+
+   bool operator==(const Match& p_other) const
+   {
+      return (matchNet[0] == p_other.matchNet[0]) && (matchNet[1] == p_other.matchNet[1]) && (matchNum[0] == p_other.matchNum[0]) &&
+             (matchNum[1] == p_other.matchNum[1]) && (direction == p_other.direction);
+   }
+};
+
+static void InitMatch(Match& p_match)
+{
+   p_match.matchNet[0] = false;
+   p_match.matchNet[1] = false;
+   p_match.matchNum[0] = -1;
+   p_match.matchNum[1] = -1;
+   p_match.direction = -1;
+}
+
+// IPv4 filters of a net
+class Filters4 {
+public:
+   std::vector<uint32_t>   IP;
+   std::vector<uint32_t>   mask;
+};
+
+// IPv6 filters of a net
+class Filters6 {
+public:
+   std::vector< std::vector<uint8_t> > IP;
+   std::vector<unsigned short>         prefixLen;
+};
+
+// Reference: the former linear scan (the source address is checked first against each filter)
+// --------------------------------------------------------------------------------------------
+static Match ScanMatch(const Filters4* p_filters, uint32_t p_srcIP, uint32_t p_dstIP)
+{
+   Match match;
+   InitMatch(match);
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      for (unsigned long actFilter=0;actFilter<p_filters[netId].IP.size();actFilter++)
+      {
+         uint32_t mask = p_filters[netId].mask[actFilter];
+         if ((p_srcIP & mask) == (p_filters[netId].IP[actFilter] & mask))
+         {
+            match.matchNet[netId] = true;
+            match.matchNum[netId] = actFilter;
+            match.direction = netId;
+            break;
+         }
+         else if ((p_dstIP & mask) == (p_filters[netId].IP[actFilter] & mask))
+         {
+            match.matchNet[netId] = true;
+            match.matchNum[netId] = actFilter;
+            match.direction = 1-netId;
+            break;
+         }
+      }
+   }
+   return match;
+}
+
+static bool PrefixMatch(const uint8_t* p_IP, const std::vector<uint8_t>& p_prefix, unsigned short p_prefixLen)
+{
+   for (unsigned short bit=0;bit<p_prefixLen;bit++)
+   {
+      if (((p_IP[bit >> 3] ^ p_prefix[bit >> 3]) >> (7 - (bit & 7))) & 1) return false;
+   }
+   return true;
+}
+
+static Match ScanMatch(const Filters6* p_filters, const uint8_t* p_srcIP, const uint8_t* p_dstIP)
+{
+   Match match;
+   InitMatch(match);
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      for (unsigned long actFilter=0;actFilter<p_filters[netId].IP.size();actFilter++)
+      {
+         if (PrefixMatch(p_srcIP, p_filters[netId].IP[actFilter], p_filters[netId].prefixLen[actFilter]))
+         {
+            match.matchNet[netId] = true;
+            match.matchNum[netId] = actFilter;
+            match.direction = netId;
+            break;
+         }
+         else if (PrefixMatch(p_dstIP, p_filters[netId].IP[actFilter], p_filters[netId].prefixLen[actFilter]))
+         {
+            match.matchNet[netId] = true;
+            match.matchNum[netId] = actFilter;
+            match.direction = 1-netId;
+            break;
+         }
+      }
+   }
+   return match;
+}
+
+// The compiled filters as DecodeIPPacket uses them
+// ------------------------------------------------
+static Match TrieMatch(uint32_t p_srcFilter[2], uint32_t p_dstFilter[2])
+{
+   Match match;
+   InitMatch(match);
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      if (p_srcFilter[netId] != AddressFilter::NONE || p_dstFilter[netId] != AddressFilter::NONE)
+      {
+         match.matchNet[netId] = true;
+         if (p_srcFilter[netId] <= p_dstFilter[netId])
+         {
+            match.matchNum[netId] = p_srcFilter[netId];
+            match.direction = netId;
+         }
+         else
+         {
+            match.matchNum[netId] = p_dstFilter[netId];
+            match.direction = 1-netId;
+         }
+      }
+   }
+   return match;
+}
+
+static Match TrieMatch(const AddressFilter* p_filter, uint32_t p_srcIP, uint32_t p_dstIP)
+{
+   uint32_t srcFilter[2] = {p_filter[0].Find(p_srcIP), p_filter[1].Find(p_srcIP)};
+   uint32_t dstFilter[2] = {p_filter[0].Find(p_dstIP), p_filter[1].Find(p_dstIP)};
+   return TrieMatch(srcFilter, dstFilter);
+}
+
+static Match TrieMatch(const AddressFilter* p_filter, const uint8_t* p_srcIP, const uint8_t* p_dstIP)
+{
+   uint32_t srcFilter[2] = {p_filter[0].Find(p_srcIP), p_filter[1].Find(p_srcIP)};
+   uint32_t dstFilter[2] = {p_filter[0].Find(p_dstIP), p_filter[1].Find(p_dstIP)};
+   return TrieMatch(srcFilter, dstFilter);
+}
+
+// Random filter sets and addresses
+// --------------------------------
+static uint32_t PrefixMask(unsigned short p_prefixLen)
+{
+   return (p_prefixLen == 0) ? 0 : (0xffffffff << (32 - p_prefixLen));
+}
+
+// A prefix inside, around or apart from the earlier ones (also repeated ones, and address bits after the prefix set)
+static void MakeFilters(Filters4& p_filters, unsigned long p_filterNum, unsigned short p_minPrefixLen, unsigned short p_maxPrefixLen)
+{
+   p_filters.IP.clear();
+   p_filters.mask.clear();
+   for (unsigned long i=0;i<p_filterNum;i++)
+   {
+      unsigned short prefixLen = p_minPrefixLen + Random() % (p_maxPrefixLen - p_minPrefixLen + 1);
+      uint32_t IP = Random();
+      if ((i > 0) && (Random() % 2 == 0))
+      {
+         unsigned long base = Random() % i;
+         IP = (p_filters.IP[base] & p_filters.mask[base]) | (IP & ~p_filters.mask[base]);
+         if (Random() % 8 == 0) prefixLen = __builtin_popcount(p_filters.mask[base]);
+      }
+      p_filters.IP.push_back(IP);
+      p_filters.mask.push_back(PrefixMask(prefixLen));
+   }
+}
+
+// An address of a prefix (with random bits after the prefix, or just outside it), or a random address
+static uint32_t MakeAddress(const Filters4& p_filters)
+{
+   if (p_filters.IP.empty() || (Random() % 4 == 0)) return Random();
+   unsigned long i = Random() % p_filters.IP.size();
+   uint32_t IP = (p_filters.IP[i] & p_filters.mask[i]) | (Random() & ~p_filters.mask[i]);
+   // Flip the last bit of the prefix
+   if ((Random() % 4 == 0) && (p_filters.mask[i] != 0)) IP ^= p_filters.mask[i] & -p_filters.mask[i];
+   return IP;
+}
+
+static void MakeFilters(Filters6& p_filters, unsigned long p_filterNum)
+{
+   p_filters.IP.clear();
+   p_filters.prefixLen.clear();
+   for (unsigned long i=0;i<p_filterNum;i++)
+   {
+      unsigned short prefixLen = (Random() % 4 == 0) ? Random() % 129 : 16 + Random() % 49;
+      std::vector<uint8_t> IP(16);
+      for (unsigned short j=0;j<16;j++) IP[j] = (uint8_t) Random();
+      if ((i > 0) && (Random() % 2 == 0))
+      {
+         unsigned long base = Random() % i;
+         for (unsigned short bit=0;bit<p_filters.prefixLen[base];bit++)
+         {
+            uint8_t bitMask = 0x80 >> (bit & 7);
+            IP[bit >> 3] = (IP[bit >> 3] & ~bitMask) | (p_filters.IP[base][bit >> 3] & bitMask);
+         }
+         if (Random() % 8 == 0) prefixLen = p_filters.prefixLen[base];
+      }
+      p_filters.IP.push_back(IP);
+      p_filters.prefixLen.push_back(prefixLen);
+   }
+}
+
+static void MakeAddress(const Filters6& p_filters, uint8_t* p_IP)
+{
+   for (unsigned short j=0;j<16;j++) p_IP[j] = (uint8_t) Random();
+   if (p_filters.IP.empty() || (Random() % 4 == 0)) return;
+   unsigned long i = Random() % p_filters.IP.size();
+   unsigned short prefixLen = p_filters.prefixLen[i];
+   memcpy(p_IP, &p_filters.IP[i][0], prefixLen >> 3);
+   if (prefixLen & 7)
+   {
+      uint8_t bitMask = 0xff << (8 - (prefixLen & 7));
+      p_IP[prefixLen >> 3] = (p_IP[prefixLen >> 3] & ~bitMask) | (p_filters.IP[i][prefixLen >> 3] & bitMask);
+   }
+   // Flip the last bit of the prefix
+   if ((Random() % 4 == 0) && (prefixLen > 0)) p_IP[(prefixLen-1) >> 3] ^= 0x80 >> ((prefixLen-1) & 7);
+}
+
+static void Compile(const Filters4* p_filters, AddressFilter* p_filter)
+{
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      p_filter[netId].Clear();
+      for (unsigned long actFilter=0;actFilter<p_filters[netId].IP.size();actFilter++)
+      {
+         p_filter[netId].AddPrefix(p_filters[netId].IP[actFilter], p_filters[netId].mask[actFilter], actFilter);
+      }
+   }
+}
+
+static void Compile(const Filters6* p_filters, AddressFilter* p_filter)
+{
+   for (unsigned short netId=0;netId<=1;netId++)
+   {
+      p_filter[netId].Clear();
+      for (unsigned long actFilter=0;actFilter<p_filters[netId].IP.size();actFilter++)
+      {
+         p_filter[netId].AddPrefix(&p_filters[netId].IP[actFilter][0], p_filters[netId].prefixLen[actFilter], actFilter);
+      }
+   }
+}
+
+static unsigned long mismatches = 0;
+
+static bool SameMatch(const Match& p_match, const Match& p_reference)
+{
+   if (p_match == p_reference) return true;
+   if (mismatches++ < 10)
+   {
+      std::cerr << "net A " << p_match.matchNum[0] << " instead of " << p_reference.matchNum[0] << ", net B " << p_match.matchNum[1]
+                << " instead of " << p_reference.matchNum[1] << ", direction " << p_match.direction << " instead of " << p_reference.direction << "\n";
+   }
+   return false;
+}
+
+// Random IPv4 filter sets (the same trie objects recompiled, as after a restart through JNI)
+static void TestRandom4()
+{
+   Filters4 filters[2];
+   AddressFilter filter[2];
+   bool same = true;
+   unsigned long matched = 0;
+   for (unsigned long set=0;set<2000;set++)
+   {
+      MakeFilters(filters[0], Random() % 12, 0, 32);
+      MakeFilters(filters[1], Random() % ((set % 10 == 0) ? 200 : 12), 0, 32);
+      Compile(filters, filter);
+      for (unsigned long i=0;i<2000;i++)
+      {
+         uint32_t srcIP = MakeAddress(filters[Random() & 1]);
+         uint32_t dstIP = MakeAddress(filters[Random() & 1]);
+         Match reference = ScanMatch(filters, srcIP, dstIP);
+         same = SameMatch(TrieMatch(filter, srcIP, dstIP), reference) && same;
+         if (reference.direction >= 0) matched++;
+      }
+   }
+   CHECK(same);
+   // Most of the addresses have to match a filter for the test to mean anything
+   CHECK(matched > 2000*2000/2);
+}
+
+static void TestRandom6()
+{
+   Filters6 filters[2];
+   AddressFilter filter[2];
+   bool same = true;
+   for (unsigned long set=0;set<500;set++)
+   {
+      MakeFilters(filters[0], Random() % 12);
+      MakeFilters(filters[1], Random() % 12);
+      Compile(filters, filter);
+      for (unsigned long i=0;i<2000;i++)
+      {
+         uint8_t srcIP[16];
+         uint8_t dstIP[16];
+         MakeAddress(filters[Random() & 1], srcIP);
+         MakeAddress(filters[Random() & 1], dstIP);
+         same = SameMatch(TrieMatch(filter, srcIP, dstIP), ScanMatch(filters, srcIP, dstIP)) && same;
+      }
+   }
+   CHECK(same);
+}
+
+// Fixed cases: a later, longer prefix does not win over an earlier, shorter one (first filter in configuration order),
+// /0 and /32 prefixes, and the source address decides on equal filters
+static void TestFixed()
+{
+   AddressFilter filter;
+   CHECK(filter.Find(0x0a000001) == AddressFilter::NONE);
+   filter.AddPrefix(0x0a000000, 0xff000000, 0);
+   filter.AddPrefix(0x0a010203, 0xffffffff, 1);
+   filter.AddPrefix(0xc0a80101, 0xffffffff, 2);
+   CHECK(filter.Find(0x0a010203) == 0);
+   CHECK(filter.Find(0xc0a80101) == 2);
+   CHECK(filter.Find(0xc0a80100) == AddressFilter::NONE);
+   CHECK(filter.NodeNum() == 1 + 2*3);
+   filter.AddPrefix((uint32_t) 0, (uint32_t) 0, 3);
+   CHECK((filter.Find(0xc0a80100) == 3) && (filter.Find(0xc0a80101) == 2) && (filter.Find(0xffffffff) == 3));
+   filter.Clear();
+   CHECK((filter.Find(0x0a000001) == AddressFilter::NONE) && (filter.NodeNum() == 1));
+}
+
+// Benchmark
+// ---------
+static double Now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Classification of packets between the two nets (best of 3) [ns/packet]
+template <class F>
+static double Replay(const std::vector<uint32_t>& p_addresses, F p_classify)
+{
+   double best = 0;
+   long sum = 0;
+   for (int round=0;round<3;round++)
+   {
+      double start = Now();
+      for (unsigned long i=0;i+1<p_addresses.size();i+=2)
+      {
+         Match match = p_classify(p_addresses[i], p_addresses[i+1]);
+         sum += match.matchNum[0] + match.direction;
+      }
+      double ns = (Now() - start)*1e9/(p_addresses.size()/2);
+      if ((round == 0) || (ns < best)) best = ns;
+   }
+   if (sum == 0) std::cerr << "no matches\n";
+   return best;
+}
+
+static Filters4 benchFilters[2];
+static AddressFilter benchFilter[2];
+
+static Match BenchScan(uint32_t p_srcIP, uint32_t p_dstIP) {return ScanMatch(benchFilters, p_srcIP, p_dstIP);}
+static Match BenchTrie(uint32_t p_srcIP, uint32_t p_dstIP) {return TrieMatch(benchFilter, p_srcIP, p_dstIP);}
+
+static void RunBenchmark()
+{
+   std::cout << "Classification of a packet (both nets, source and destination), best of 3 [ns/packet]\n"
+             << std::setw(16) << "prefixes/net" << std::setw(12) << "linear" << std::setw(12) << "trie" << std::setw(12) << "trie nodes" << "\n";
+   const unsigned long prefixNums[] = {1, 10, 90, 100, 1000, 10000};
+   for (unsigned long n=0;n<sizeof(prefixNums)/sizeof(prefixNums[0]);n++)
+   {
+      // Operator prefixes (/12 to /24) on both sides; the packets go between the two nets
+      MakeFilters(benchFilters[0], prefixNums[n], 12, 24);
+      MakeFilters(benchFilters[1], prefixNums[n], 12, 24);
+      Compile(benchFilters, benchFilter);
+      std::vector<uint32_t> addresses;
+      unsigned long packetNum = (prefixNums[n] > 100) ? 100000 : 1000000;
+      for (unsigned long i=0;i<packetNum;i++)
+      {
+         addresses.push_back(MakeAddress(benchFilters[0]));
+         addresses.push_back(MakeAddress(benchFilters[1]));
+      }
+      std::cout << std::setw(16) << prefixNums[n] << std::fixed << std::setprecision(1) << std::setw(12) << Replay(addresses, BenchScan)
+                << std::setw(12) << Replay(addresses, BenchTrie) << std::setw(12) << benchFilter[0].NodeNum() + benchFilter[1].NodeNum() << "\n";
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      RunBenchmark();
+      return 0;
+   }
+   TestFixed();
+   TestRandom4();
+   TestRandom6();
+   return TesterResult("AddressFilterTester");
+}
@@ -0,0 +1,756 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#include <staple/Staple.h>
+#include <staple/PacketDumpFile.h>
+#include "Tester.h"
+
+// Differential test of the IP decoder against the former one (kept below as the reference), which assembled every
+// field byte by byte in the byte order of the platform: the same IPv4 TCP (with MSS, window scale, SACK-permitted,
+// SACK and timestamp options), UDP, ICMP and other packets, also truncated and with corrupted header bytes, have to
+// decode to the same fields and payload under both byte order settings; and a decode-only benchmark of the two in
+// packets/s ("DecoderTester bench")
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+// Reference: the former decoder (without the address and port filters, which are not configured here)
+// ----------------------------------------------------------------------------------------------------
+static L3Packet* FormerDecodeIPPacket(char* p_pBuffer, unsigned short p_len, Staple& staple)
+{
+   Byte tmpByte;
+   Word tmpWord;
+   DoubleWord tmpDoubleWord;
+   unsigned short actPos = 0;
+   // Check whether we have captured the first byte of the IP packet
+   bool decodable = true;
+   if (p_len < 1) decodable=false;
+   // Read IP version & IP header length if possible
+   unsigned short IPHLen;
+   if (decodable==true)
+   {
+      tmpByte = p_pBuffer[actPos++];
+
+      // Non-IPv4 packets will not be decoded
+      if ((tmpByte&0xf0) != 0x40)
+      {
+         decodable=false;
+      }
+      // IPv4 packet
+      else
+      {
+         // IP header length
+         IPHLen = 4*(tmpByte&0x0f);
+         // Sanity check of IPHLen
+         if (IPHLen < 20)
+         {
+            if (staple.logLevel>=5) staple.logStream << "IP header length too low!\n";
+            return NULL;
+         }
+         // Check whether we have captured the entire IP header
+         if ((p_len-actPos) < (IPHLen-1)) decodable=false;
+      }
+   }
+
+   // Non-IPv4 or too short packets are not decoded
+   // ---------------------------------------------
+   if (decodable==false) return NULL;
+
+   // Skip ToS
+   actPos++;
+
+   // Read full IP packet length
+   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   unsigned short IPPktLen = tmpWord.data;
+
+   // Sanity check of IPHLen vs. IPPktLen
+   if (IPHLen > IPPktLen)
+   {
+      if (staple.logLevel>=5) staple.logStream << "IP header length too high!\n";
+      return NULL;
+   }
+
+   // Read IP Id
+   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   unsigned short IPId = tmpWord.data;
+
+   // Read IP flags and fragmentation info
+   tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpWord.byte[1 - staple.byteOrderPlatform] = p_pBuffer[actPos++];
+
+   unsigned char IPFlags = (tmpWord.data&0xe000)>>13;
+   unsigned short fragOffset = (tmpWord.data&0x1fff)<<3;
+
+   // Skip TTL
+   actPos++;
+
+   // Read protocol
+   unsigned char protocol = p_pBuffer[actPos++];
+
+   // Skip IP CRC
+   actPos += 2;
+
+   // Read source IP address
+   tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+   DoubleWord srcIP = tmpDoubleWord;
+
+   // Read destination IP address
+   tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+   tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+   DoubleWord dstIP = tmpDoubleWord;
+
+   // No address filters
+   bool matchNet[2] = {false, false};
+   unsigned char direction = 0;
+
+   // Skip IP options
+   actPos += IPHLen-20;
+
+   // TCP packet (check snaplength)
+   // -----------------------------
+   if ((protocol == 6) && ((p_len-actPos) >= 20))
+   {
+      // Create TCP return packet
+      TCPPacket* pL3Packet = staple.packetPool.NewTCPPacket();
+      pL3Packet->IPPktLen = IPPktLen;
+      pL3Packet->IPId = IPId;
+      pL3Packet->IPFlags = IPFlags;
+      pL3Packet->fragOffset = fragOffset;
+      pL3Packet->srcIP = srcIP;
+      pL3Packet->dstIP = dstIP;
+      pL3Packet->match = (matchNet[0] || matchNet[1]);
+      pL3Packet->direction = direction;
+
+      // Read TCP source port
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->srcPort = tmpWord.data;
+
+      // Read TCP destination port
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->dstPort = tmpWord.data;
+
+      // Read TCP sequence number
+      tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+      pL3Packet->seq = tmpDoubleWord.data;
+
+      // Read TCP acknowledgement number
+      tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+      pL3Packet->ack = tmpDoubleWord.data;
+
+      // Read TCP header length
+      tmpByte = p_pBuffer[actPos++];
+      unsigned short TCPHLen = (tmpByte&0xf0)>>2;
+
+      // Sanity check of TCPHLen
+      if (TCPHLen < 20)
+      {
+         if (staple.logLevel>=5) staple.logStream << "TCP header length too low!\n";
+         staple.packetPool.Release(pL3Packet);
+         return NULL;
+      }
+
+      // Sanity check of IPHLen+TCPHLen vs. IPPktLen
+      if ((IPHLen+TCPHLen) > IPPktLen)
+      {
+         if (staple.logLevel>=5) staple.logStream << "TCP header length too high!\n";
+         staple.packetPool.Release(pL3Packet);
+         return NULL;
+      }
+
+      // Calculate TCP payload length
+      pL3Packet->TCPPLLen = pL3Packet->IPPktLen - IPHLen - TCPHLen;
+
+      // Read TCP flags
+      pL3Packet->TCPFlags = p_pBuffer[actPos++];
+
+      // Read TCP receiver window size
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->rwnd = tmpWord.data;
+
+      // Skip CRC & urgent pointer
+      actPos += 4;
+
+      // Process TCP options (if snaplength is enough to process ALL options [no partial processing])
+      pL3Packet->options = TCPPacket::NONE;
+      pL3Packet->sackBlockNum = 0;
+      pL3Packet->tsValue = 0;
+      pL3Packet->tsEcho = 0;
+      pL3Packet->wndScaleVal = 0;
+      if ((p_len-actPos) >= (TCPHLen-20))
+      {
+         unsigned short optBytesRead = 0;
+         bool optionLenOK;
+         Byte optionType;
+         Byte optionLen;
+         while ((optBytesRead < (TCPHLen-20)))
+         {
+            // Read option type
+            optionType = p_pBuffer[actPos++];
+            optBytesRead++;
+            // End of option list
+            if (optionType == 0x00) break;
+            // NOP option
+            if (optionType == 0x01) continue;
+            switch (optionType)
+            {
+               // MSS option
+               case 0x02: pL3Packet->options |= TCPPacket::MSS;break;
+               // Window scale option
+               case 0x03: pL3Packet->options |= TCPPacket::WNDSCALE;break;
+               // SACK permitted option
+               case 0x04: pL3Packet->options |= TCPPacket::SACKPERM;break;
+               // SACK option
+               case 0x05: pL3Packet->options |= TCPPacket::SACK;break;
+               // Timestamp option
+               case 0x08: pL3Packet->options |= TCPPacket::TIMESTAMP;break;
+            }
+            // Check whether we have captured the option length (because of buggy TCP options/TCP hlen)
+            if (optBytesRead < (TCPHLen-20)) optionLenOK=true;
+            else optionLenOK=false;
+            // Read option length if possible
+            if (optionLenOK==true)
+            {
+               optionLen = p_pBuffer[actPos++];
+               optBytesRead++;
+               // Sanity check of option length
+               if ((optionLen < 2) || (optBytesRead+optionLen-2) > (TCPHLen-20)) optionLenOK=false;
+            }
+            // Return if option length is wrong
+            if (optionLenOK==false)
+            {
+               if (staple.logLevel>=5) staple.logStream << "Bad TCP option length!\n";
+               staple.packetPool.Release(pL3Packet);
+               return NULL;
+            }
+            // Process option content
+            switch (optionType)
+            {
+               // SACK option
+               case 0x05:
+               {
+                  // Check SACK option length (must be multiples of 8 bytes)
+                  if ((((optionLen-2)%8) != 0) && ((optionLen-2) > 0))
+                  {
+                     if (staple.logLevel>=5) staple.logStream << "Bad SACK option length!\n";
+                     staple.packetPool.Release(pL3Packet);
+                     return NULL;
+                  }
+                  // Process SACK info
+                  pL3Packet->sackBlockNum = (optionLen-2)/8;
+                  for (int i=0;i<pL3Packet->sackBlockNum;i++)
+                  {
+                     tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+                     pL3Packet->sackLeftEdge[i] = tmpDoubleWord.data;
+                     tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                     tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+                     pL3Packet->sackRightEdge[i] = tmpDoubleWord.data;
+                     optBytesRead += 8;
+                  }
+                  break;
+               }
+               // Timestamp option
+               case 0x08:
+               {
+                  // Sanity check of timestamp option length
+                  if (optionLen!=10)
+                  {
+                     if (staple.logLevel>=5) staple.logStream << "Bad TCP timestamp option length!\n";
+                     staple.packetPool.Release(pL3Packet);
+                     return NULL;
+                  }
+                  // Read TS Value and TS Echo
+                  tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+                  pL3Packet->tsValue = tmpDoubleWord.data;
+                  tmpDoubleWord.byte[3*staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[1+staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[2-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+                  tmpDoubleWord.byte[3*(1-staple.byteOrderPlatform)] = p_pBuffer[actPos++];
+                  pL3Packet->tsEcho = tmpDoubleWord.data;
+                  optBytesRead += 8;
+                  break;
+               }
+               case 0x03:
+               {
+                  // Sanity check of window scale option length
+                  if (optionLen!=3)
+                  {
+                     if (staple.logLevel>=5) staple.logStream << "Bad TCP window scale option length!\n";
+                     staple.packetPool.Release(pL3Packet);
+                     return NULL;
+                  }
+                  // Read window scale value
+                  pL3Packet->wndScaleVal = p_pBuffer[actPos++];
+                  optBytesRead += 1;
+                  break;
+               }
+               // Other options will not be processed
+               default:
+               {
+                  actPos += optionLen-2;
+                  optBytesRead += optionLen-2;
+               }
+            }
+         }
+         // Skip option padding
+         actPos += (TCPHLen-20)-optBytesRead;
+         // Read the TCP packet payload
+         unsigned short PLdumped = (pL3Packet->TCPPLLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->TCPPLLen;
+         if (PLdumped > 0)
+         {
+            pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
+            pL3Packet->payloadSavedLen = PLdumped;
+            memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
+            actPos += PLdumped;
+         }
+      }
+      // Not enough snaplen
+      else
+      {
+         // Skip options (=skip the rest of the packet)
+         actPos = p_len;
+      }
+
+      // Skip rest of the packet (e.g., link layer padding)
+      actPos = p_len;
+      return pL3Packet;
+   }
+
+   // UDP packet
+   // ----------
+   if ((protocol == 17) && ((p_len-actPos) >= 8))
+   {
+      // Create UDP return packet
+      UDPPacket* pL3Packet = staple.packetPool.NewUDPPacket();
+      pL3Packet->IPPktLen = IPPktLen;
+      pL3Packet->IPId = IPId;
+      pL3Packet->IPFlags = IPFlags;
+      pL3Packet->fragOffset = fragOffset;
+      pL3Packet->srcIP = srcIP;
+      pL3Packet->dstIP = dstIP;
+      pL3Packet->match = (matchNet[0] || matchNet[1]);
+      pL3Packet->direction = direction;
+
+      // Read UDP source port
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->srcPort = tmpWord.data;
+
+      // Read UDP destination port
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->dstPort = tmpWord.data;
+
+      // Read UDP length
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->UDPPLLen = tmpWord.data;
+      pL3Packet->UDPPLLen -= 8;
+
+      // Skip checksum
+      actPos += 2;
+
+      // Read the UDP packet payload
+      unsigned short PLdumped = (pL3Packet->UDPPLLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->UDPPLLen;
+      if (PLdumped > 0)
+      {
+         pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
+         pL3Packet->payloadSavedLen = PLdumped;
+         memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
+         actPos += PLdumped;
+      }
+
+      // Skip rest of the packet (e.g., link layer padding)
+      actPos = p_len;
+      return pL3Packet;
+   }
+
+   // ICMP packet
+   // ----------
+   if ((protocol == 1) && ((p_len-actPos) >= 2))
+   {
+      // Create ICMP return packet
+      ICMPPacket* pL3Packet = staple.packetPool.NewICMPPacket();
+      pL3Packet->IPPktLen = IPPktLen;
+      pL3Packet->IPId = IPId;
+      pL3Packet->IPFlags = IPFlags;
+      pL3Packet->fragOffset = fragOffset;
+      pL3Packet->srcIP = srcIP;
+      pL3Packet->dstIP = dstIP;
+      pL3Packet->match = (matchNet[0] || matchNet[1]);
+      pL3Packet->direction = direction;
+
+      // Read ICMP type code
+      tmpWord.byte[staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      tmpWord.byte[1-staple.byteOrderPlatform] = p_pBuffer[actPos++];
+      pL3Packet->typeCode = tmpWord.data;
+
+      // Skip rest of the packet (incl. link layer padding)
+      actPos = p_len;
+      return pL3Packet;
+   }
+
+   // Non-TCP/non-UDP/non-ICMP (e.g. IGMP) or too short snaplength packet
+   // -------------------------------------------------------------------
+   // Create IP return packet
+   IPPacket* pL3Packet = staple.packetPool.NewIPPacket();
+   pL3Packet->IPPktLen = IPPktLen;
+   pL3Packet->IPId = IPId;
+   pL3Packet->IPFlags = IPFlags;
+   pL3Packet->fragOffset = fragOffset;
+   pL3Packet->srcIP = srcIP;
+   pL3Packet->dstIP = dstIP;
+   pL3Packet->match = (matchNet[0] || matchNet[1]);
+   pL3Packet->direction = direction;
+
+   // Read the IP packet payload
+   unsigned short PLdumped = (pL3Packet->IPPktLen > (p_len-actPos)) ? (p_len-actPos) : pL3Packet->IPPktLen;
+   if (PLdumped > 0)
+   {
+      pL3Packet->payload = staple.packetPool.PayloadSlab(pL3Packet, PLdumped);
+      pL3Packet->payloadSavedLen = PLdumped;
+      memcpy((char*)pL3Packet->payload, (char*)&p_pBuffer[actPos], PLdumped);
+      actPos += PLdumped;
+   }
+
+   // Skip rest of the packet (incl. link layer padding)
+   actPos = p_len;
+   return pL3Packet;}
+
+// Loads
+// -----
+// Load16/Load32 give the words the former byte shuffling gave, in both byte orders
+static void TestLoads()
+{
+   bool same = true;
+   for (unsigned long i=0;i<100000;i++)
+   {
+      Byte bytes[4];
+      for (int j=0;j<4;j++) bytes[j] = (Byte) Random();
+      for (unsigned short order=0;order<=1;order++)
+      {
+         Word tmpWord;
+         tmpWord.byte[order] = bytes[0];
+         tmpWord.byte[1-order] = bytes[1];
+         DoubleWord tmpDoubleWord;
+         tmpDoubleWord.byte[3*order] = bytes[0];
+         tmpDoubleWord.byte[1+order] = bytes[1];
+         tmpDoubleWord.byte[2-order] = bytes[2];
+         tmpDoubleWord.byte[3*(1-order)] = bytes[3];
+         bool networkOrder = (order == HOST_LITTLE_ENDIAN);
+         u_int16_t word = networkOrder ? Load16<true>(bytes) : Load16<false>(bytes);
+         u_int32_t doubleWord = networkOrder ? Load32<true>(bytes) : Load32<false>(bytes);
+         same = same && (word == tmpWord.data) && (doubleWord == tmpDoubleWord.data);
+      }
+   }
+   CHECK(same);
+   Byte bytes[6] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc};
+   CHECK((Load16<true>(bytes+1) == 0x3456) && (Load32<true>(bytes+1) == 0x3456789a) && (Load32<false>(bytes+2) == 0xbc9a7856));
+}
+
+// Packets
+// -------
+static void Append16(std::vector<Byte>& p_packet, unsigned short p_value)
+{
+   p_packet.push_back((Byte)(p_value >> 8));
+   p_packet.push_back((Byte)p_value);
+}
+
+static void Append32(std::vector<Byte>& p_packet, unsigned long p_value)
+{
+   Append16(p_packet, (unsigned short)(p_value >> 16));
+   Append16(p_packet, (unsigned short)p_value);
+}
+
+// Random TCP options (well-formed most of the time), padded to a multiple of 4 bytes
+static void AppendTCPOptions(std::vector<Byte>& p_packet)
+{
+   std::vector<Byte> options;
+   unsigned long optionNum = Random() % 6;
+   for (unsigned long i=0;i<optionNum;i++)
+   {
+      switch (Random() % 8)
+      {
+         case 0: options.push_back(2); options.push_back(4); Append16(options, Random()); break;
+         case 1: options.push_back(1); options.push_back(3); options.push_back(3); options.push_back(Random() % 15); break;
+         case 2: options.push_back(1); options.push_back(1); options.push_back(4); options.push_back(2); break;
+         case 3:
+         {
+            unsigned long blocks = 1 + Random() % 4;
+            options.push_back(1);
+            options.push_back(1);
+            options.push_back(5);
+            options.push_back(2 + 8*blocks);
+            for (unsigned long j=0;j<2*blocks;j++) Append32(options, Random());
+            break;
+         }
+         case 4: options.push_back(1); options.push_back(1); options.push_back(8); options.push_back(10); Append32(options, Random()); Append32(options, Random()); break;
+         // Unknown option
+         case 5: options.push_back(30); options.push_back(4); Append16(options, Random()); break;
+         // End of option list
+         case 6: options.push_back(0); break;
+         // Bad option length
+         default: options.push_back(1 + Random() % 9); options.push_back(Random() % 12); break;
+      }
+   }
+   while (options.size() % 4 != 0) options.push_back(0);
+   if (options.size() > 40) options.resize(40);
+   p_packet.insert(p_packet.end(), options.begin(), options.end());
+}
+
+// An IPv4 packet (with IP options sometimes)
+static std::vector<Byte> MakePacket()
+{
+   std::vector<Byte> packet;
+   unsigned short IPHLen = (Random() % 8 == 0) ? 20 + 4*(1 + Random() % 3) : 20;
+   unsigned long kind = Random() % 10;
+   Byte protocol = (kind < 6) ? 6 : (kind < 8) ? 17 : (kind < 9) ? 1 : 47;
+   packet.push_back(0x40 | (IPHLen/4));
+   packet.push_back(Random());
+   Append16(packet, 0);
+   Append16(packet, Random());
+   Append16(packet, (Random() % 4 == 0) ? Random() : 0x4000);
+   packet.push_back(Random());
+   packet.push_back(protocol);
+   Append16(packet, Random());
+   Append32(packet, Random());
+   Append32(packet, Random());
+   while (packet.size() < IPHLen) packet.push_back(1);
+   if (protocol == 6)
+   {
+      Append16(packet, Random());
+      Append16(packet, Random());
+      Append32(packet, Random());
+      Append32(packet, Random());
+      unsigned long optionPos = packet.size() + 8;
+      Append16(packet, 0);
+      Append16(packet, Random());
+      Append32(packet, Random());
+      AppendTCPOptions(packet);
+      packet[optionPos-8] = (Byte)(((packet.size() - optionPos + 20)/4) << 4);
+      packet[optionPos-7] = Random();
+   }
+   else if (protocol == 17)
+   {
+      Append16(packet, Random());
+      Append16(packet, Random());
+      Append16(packet, 0);
+      Append16(packet, Random());
+   }
+   else if (protocol == 1)
+   {
+      Append16(packet, Random());
+      Append16(packet, Random());
+   }
+   unsigned long payloadLen = (Random() % 3 == 0) ? 0 : Random() % 1400;
+   for (unsigned long i=0;i<payloadLen;i++) packet.push_back(Random());
+   // IP packet length, UDP length
+   unsigned short IPPktLen = packet.size();
+   if (Random() % 10 == 0) IPPktLen = Random() % 1600;
+   packet[2] = IPPktLen >> 8;
+   packet[3] = IPPktLen;
+   if (protocol == 17)
+   {
+      unsigned short UDPLen = packet.size() - IPHLen;
+      if (Random() % 10 == 0) UDPLen = Random() % 1600;
+      packet[IPHLen+4] = UDPLen >> 8;
+      packet[IPHLen+5] = UDPLen;
+   }
+   return packet;
+}
+
+// Comparison of the decoded packets
+// ---------------------------------
+static unsigned long mismatches = 0;
+
+static bool SameIP(const IPPacket* p_packet, const IPPacket* p_reference)
+{
+   return (p_packet->l3Type == p_reference->l3Type) && (p_packet->IPPktLen == p_reference->IPPktLen) && (p_packet->IPId == p_reference->IPId) &&
+          (p_packet->IPFlags == p_reference->IPFlags) && (p_packet->fragOffset == p_reference->fragOffset) &&
+          (p_packet->srcIP.data == p_reference->srcIP.data) && (p_packet->dstIP.data == p_reference->dstIP.data) &&
+          (p_packet->payloadSavedLen == p_reference->payloadSavedLen) &&
+          ((p_packet->payloadSavedLen == 0) || (memcmp(p_packet->payload, p_reference->payload, p_packet->payloadSavedLen) == 0));
+}
+
+static bool SameTCP(const TCPPacket* p_packet, const TCPPacket* p_reference)
+{
+   if ((p_packet->srcPort != p_reference->srcPort) || (p_packet->dstPort != p_reference->dstPort) || (p_packet->TCPFlags != p_reference->TCPFlags) ||
+       (p_packet->seq != p_reference->seq) || (p_packet->ack != p_reference->ack) || (p_packet->rwnd != p_reference->rwnd) ||
+       (p_packet->options != p_reference->options) || (p_packet->TCPPLLen != p_reference->TCPPLLen) ||
+       (p_packet->sackBlockNum != p_reference->sackBlockNum) || (p_packet->tsValue != p_reference->tsValue) ||
+       (p_packet->tsEcho != p_reference->tsEcho) || (p_packet->wndScaleVal != p_reference->wndScaleVal))
+   {
+      return false;
+   }
+   for (int i=0;i<p_reference->sackBlockNum;i++)
+   {
+      if ((p_packet->sackLeftEdge[i] != p_reference->sackLeftEdge[i]) || (p_packet->sackRightEdge[i] != p_reference->sackRightEdge[i])) return false;
+   }
+   return true;
+}
+
+static bool SameDecoded(const L3Packet* p_packet, const L3Packet* p_reference)
+{
+   if ((p_packet == NULL) || (p_reference == NULL)) return p_packet == p_reference;
+   if (!SameIP((const IPPacket*)p_packet, (const IPPacket*)p_reference)) return false;
+   if (p_reference->l3Type & L3Packet::TCP) return SameTCP((const TCPPacket*)p_packet, (const TCPPacket*)p_reference);
+   if (p_reference->l3Type & L3Packet::UDP)
+   {
+      const UDPPacket* udp = (const UDPPacket*)p_packet;
+      const UDPPacket* refUdp = (const UDPPacket*)p_reference;
+      return (udp->srcPort == refUdp->srcPort) && (udp->dstPort == refUdp->dstPort) && (udp->UDPPLLen == refUdp->UDPPLLen);
+   }
+   if (p_reference->l3Type & L3Packet::ICMP) return ((const ICMPPacket*)p_packet)->typeCode == ((const ICMPPacket*)p_reference)->typeCode;
+   return true;
+}
+
+// Decode the packet with both decoders (counting the decoded TCP packets with options)
+static bool SameDecoded(Staple& p_staple, std::vector<Byte>& p_packet, unsigned short p_len, unsigned long& p_optionPackets)
+{
+   L3Packet* pPacket = DecodeIPPacket((char*)&p_packet[0], p_len, 0, p_staple);
+   L3Packet* pReference = FormerDecodeIPPacket((char*)&p_packet[0], p_len, p_staple);
+   bool same = SameDecoded(pPacket, pReference);
+   if (!same && (mismatches++ < 10))
+   {
+      std::cerr << "packet of " << p_len << " bytes decoded " << ((pPacket != NULL) ? "" : "to NULL ") << "instead of "
+                << ((pReference != NULL) ? "" : "NULL") << "\n";
+   }
+   if ((pReference != NULL) && (pReference->l3Type & L3Packet::TCP) && (((TCPPacket*)pReference)->options != TCPPacket::NONE)) p_optionPackets++;
+   if (pPacket != NULL) p_staple.packetPool.Release(pPacket);
+   if (pReference != NULL) p_staple.packetPool.Release(pReference);
+   return same;
+}
+
+// Each packet as captured, truncated and with corrupted header bytes (the version nibble stays 4: the former decoder
+// did not decode IPv6)
+static void TestRandomPackets(unsigned short p_byteOrderPlatform)
+{
+   Staple staple;
+   staple.decapGTP = false;
+   staple.byteOrderPlatform = p_byteOrderPlatform;
+   bool same = true;
+   unsigned long optionPackets = 0;
+   for (unsigned long i=0;i<100000;i++)
+   {
+      std::vector<Byte> packet = MakePacket();
+      same = SameDecoded(staple, packet, packet.size(), optionPackets) && same;
+      for (int variant=0;variant<3;variant++)
+      {
+         std::vector<Byte> changed = packet;
+         unsigned short len = Random() % (packet.size() + 1);
+         unsigned long corruptions = Random() % 3;
+         for (unsigned long j=0;j<corruptions;j++)
+         {
+            unsigned long pos = Random() % ((packet.size() < 80) ? packet.size() : 80);
+            changed[pos] = Random();
+         }
+         changed[0] = 0x40 | (changed[0] & 0x0f);
+         same = SameDecoded(staple, changed, len, optionPackets) && same;
+      }
+   }
+   CHECK(same);
+   // The packets have to exercise the option decoding for the test to mean anything
+   CHECK(optionPackets > 50000);
+}
+
+// Benchmark
+// ---------
+static double Now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Decode (and release) each packet, best of 20 [Mpackets/s]
+static double Replay(Staple& p_staple, std::vector< std::vector<Byte> >& p_packets, bool p_former)
+{
+   double best = 0;
+   unsigned long decoded = 0;
+   for (int round=0;round<20;round++)
+   {
+      double start = Now();
+      for (unsigned long i=0;i<p_packets.size();i++)
+      {
+         char* pBuffer = (char*)&p_packets[i][0];
+         L3Packet* pPacket = p_former ? FormerDecodeIPPacket(pBuffer, p_packets[i].size(), p_staple) : DecodeIPPacket(pBuffer, p_packets[i].size(), 0, p_staple);
+         if (pPacket != NULL)
+         {
+            decoded++;
+            p_staple.packetPool.Release(pPacket);
+         }
+      }
+      double rate = p_packets.size()/(Now() - start)/1e6;
+      if (rate > best) best = rate;
+   }
+   if (decoded == 0) std::cerr << "nothing decoded\n";
+   return best;
+}
+
+static void RunBenchmark()
+{
+   Staple staple;
+   staple.decapGTP = false;
+   std::vector< std::vector<Byte> > packets;
+   std::vector< std::vector<Byte> > headers;
+   for (unsigned long i=0;i<20000;i++)
+   {
+      std::vector<Byte> packet = MakePacket();
+      // Decode the headers only as well (a snaplength of 96 bytes)
+      headers.push_back(std::vector<Byte>(packet.begin(), packet.begin() + ((packet.size() < 96) ? packet.size() : 96)));
+      packets.push_back(packet);
+   }
+   std::cout << "Decoding, best of 20 [Mpackets/s]\n" << std::setw(24) << "" << std::setw(12) << "former" << std::setw(12) << "current" << "\n"
+             << std::fixed << std::setprecision(2)
+             << std::setw(24) << std::left << "full packets" << std::right << std::setw(12) << Replay(staple, packets, true)
+             << std::setw(12) << Replay(staple, packets, false) << "\n"
+             << std::setw(24) << std::left << "96 byte snaplength" << std::right << std::setw(12) << Replay(staple, headers, true)
+             << std::setw(12) << Replay(staple, headers, false) << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      RunBenchmark();
+      return 0;
+   }
+   TestLoads();
+   TestRandomPackets(0);
+   TestRandomPackets(1);
+   return TesterResult("DecoderTester");
+}
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <iomanip>
+
+#include <staple/FlowTable.h>
+#include <staple/TCPConn.h>
+#include "Tester.h"
+
+// Tests of the flow table against std::map, and a benchmark of the flow lookups per packet against std::unordered_map
+// with the former (XOR of the fields) and the current hash of the TCP connection keys ("FlowTableTester bench")
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+// Hash that puts every key into the same probe sequence
+struct ConstantHash {
+   size_t operator()(unsigned long) const {return 7;}
+};
+
+typedef FlowTable<unsigned long, unsigned long>                Table;
+typedef FlowTable<unsigned long, unsigned long, ConstantHash>  CollidingTable;
+
+template <class T>
+static bool SameContent(T& p_table, const std::map<unsigned long,unsigned long>& p_reference)
+{
+   if (p_table.size() != p_reference.size()) return false;
+   unsigned long visited = 0;
+   for (typename T::iterator it=p_table.begin();it!=p_table.end();++it)
+   {
+      std::map<unsigned long,unsigned long>::const_iterator ref = p_reference.find(it->first);
+      if ((ref == p_reference.end()) || (ref->second != it->second)) return false;
+      visited++;
+   }
+   if (visited != p_reference.size()) return false;
+   for (std::map<unsigned long,unsigned long>::const_iterator ref=p_reference.begin();ref!=p_reference.end();++ref)
+   {
+      typename T::iterator it = p_table.find(ref->first);
+      if ((it == p_table.end()) || (it->second != ref->second)) return false;
+   }
+   return true;
+}
+
+// Random inserts, updates and erases give the same content as std::map (also when every key collides)
+template <class T>
+static void TestRandom(unsigned long p_keyNum, unsigned long p_opNum)
+{
+   T table;
+   std::map<unsigned long,unsigned long> reference;
+   bool same = true;
+   for (unsigned long i=0;i<p_opNum;i++)
+   {
+      unsigned long key = Random() % p_keyNum;
+      switch (Random() % 4)
+      {
+      case 0:
+         table[key] += i;
+         reference[key] += i;
+         break;
+      case 1:
+         table.insert(std::make_pair(key, i));
+         reference.insert(std::make_pair(key, i));
+         break;
+      case 2:
+         if (table.erase(key) != reference.erase(key)) same = false;
+         break;
+      default:
+         {
+            typename T::iterator it = table.find(key);
+            if (it != table.end())
+            {
+               table.erase(it);
+               reference.erase(key);
+            }
+         }
+      }
+      if ((i % 1000) == 0) same = same && SameContent(table, reference);
+   }
+   CHECK(same);
+   CHECK(SameContent(table, reference));
+   table.clear();
+   CHECK(table.empty() && (table.begin() == table.end()) && (table.find(1) == table.end()));
+   table[1] = 2;
+   CHECK((table.size() == 1) && (table.find(1)->second == 2));
+}
+
+// References and iterators stay valid while other entries are inserted and erased (and the table grows and shrinks)
+static void TestStability()
+{
+   Table table;
+   table[0] = 100;
+   unsigned long* value = &table[0];
+   Table::iterator it = table.find(0);
+   for (unsigned long i=1;i<100000;i++) table[i] = i;
+   for (unsigned long i=1;i<100000;i++) table.erase(i);
+   CHECK(&table[0] == value);
+   CHECK((it->first == 0) && (it->second == 100) && (it == table.find(0)));
+   CHECK(table.size() == 1);
+}
+
+// Entries can be erased during the iteration (the iterator is advanced before its entry is erased)
+static void TestEraseWhileIterating()
+{
+   Table table;
+   for (unsigned long i=0;i<10000;i++) table[i] = i;
+   unsigned long visited = 0;
+   for (Table::iterator it=table.begin();it!=table.end();)
+   {
+      Table::iterator actIt = it++;
+      if ((actIt->first % 3) != 0) table.erase(actIt);
+      visited++;
+   }
+   CHECK(visited == 10000);
+   CHECK(table.size() == 3334);
+   bool kept = true;
+   for (unsigned long i=0;i<10000;i++) kept = kept && ((table.find(i) != table.end()) == ((i % 3) == 0));
+   CHECK(kept);
+}
+
+// After a burst the table gives back its memory, and the iteration visits the live entries only
+static void TestShrink()
+{
+   Table table;
+   unsigned long long empty = table.MemoryUsage();
+   for (unsigned long i=0;i<200000;i++) table[i] = i;
+   unsigned long long full = table.MemoryUsage();
+   for (unsigned long i=10;i<200000;i++) table.erase(i);
+   unsigned long long sparse = table.MemoryUsage();
+   CHECK(sparse*1000 < full);
+   CHECK(sparse <= 8*10*sizeof(void*) + 10*(sizeof(unsigned long)*2 + 3*sizeof(void*)));
+   unsigned long visited = 0;
+   for (Table::iterator it=table.begin();it!=table.end();++it) visited++;
+   CHECK(visited == 10);
+   for (unsigned long i=0;i<10;i++) table.erase(i);
+   CHECK(table.MemoryUsage() <= FLOWTABLE_MIN_CELLS*sizeof(void*));
+   table.clear();
+   CHECK(table.MemoryUsage() == empty);
+}
+
+// Benchmark
+// ---------
+// Former hash of the TCP connection keys (XOR of the addresses and ports)
+struct XorHash {
+   size_t operator()(const TCPConnId& x) const
+   {
+      return std::hash< u_int32_t >()((u_int32_t)x.netAIP.data ^ (u_int32_t)x.netBIP.data ^ (u_int32_t)x.netAPort ^ (u_int32_t)x.netBPort);
+   }
+};
+
+typedef std::unordered_map<TCPConnId,unsigned long,XorHash,TCPConnIdTraits>            XorMap;
+typedef std::unordered_map<TCPConnId,unsigned long,TCPConnIdTraits,TCPConnIdTraits>    MixMap;
+typedef FlowTable<TCPConnId,unsigned long,TCPConnIdTraits,TCPConnIdTraits>             MixTable;
+
+static TCPConnId MakeConn(u_int32_t p_aIP, u_int16_t p_aPort, u_int32_t p_bIP, u_int16_t p_bPort)
+{
+   TCPConnId id;
+   id.netAIP.data = p_aIP;
+   id.netAPort = p_aPort;
+   id.netBIP.data = p_bIP;
+   id.netBPort = p_bPort;
+   return id;
+}
+
+// Packets of the given flows (the flow of each packet is drawn uniformly)
+static std::vector<TCPConnId> MakePackets(const std::vector<TCPConnId>& p_flows, unsigned long p_packetNum)
+{
+   std::vector<TCPConnId> packets;
+   packets.reserve(p_packetNum);
+   for (unsigned long i=0;i<p_packetNum;i++) packets.push_back(p_flows[Random() % p_flows.size()]);
+   return packets;
+}
+
+static double Now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Insert-or-find of each packet's flow in a fresh table (best of 3) [ns/packet]
+template <class M>
+static double Replay(const std::vector<TCPConnId>& p_packets)
+{
+   double best = 0;
+   unsigned long sum = 0;
+   for (int round=0;round<3;round++)
+   {
+      M table;
+      double start = Now();
+      for (unsigned long i=0;i<p_packets.size();i++) table[p_packets[i]]++;
+      double ns = (Now() - start)*1e9/p_packets.size();
+      if ((round == 0) || (ns < best)) best = ns;
+      sum += table.size();
+   }
+   if (sum == 0) std::cerr << "no flows\n";
+   return best;
+}
+
+static void Bench(const char* p_name, const std::vector<TCPConnId>& p_flows, unsigned long p_packetNum)
+{
+   std::vector<TCPConnId> packets = MakePackets(p_flows, p_packetNum);
+   std::cout << std::setw(24) << std::left << p_name << std::right << std::fixed << std::setprecision(1)
+             << std::setw(12) << Replay<XorMap>(packets)
+             << std::setw(12) << Replay<MixMap>(packets)
+             << std::setw(12) << Replay<MixTable>(packets) << "\n";
+}
+
+static void RunBenchmark()
+{
+   std::cout << "Insert-or-find per packet, best of 3 [ns/packet]\n"
+             << std::setw(24) << "" << std::setw(12) << "XOR+umap" << std::setw(12) << "mix+umap" << std::setw(12) << "FlowTable" << "\n";
+   std::vector<TCPConnId> flows;
+   // Clients of a mobile network towards a few hundred servers
+   for (unsigned long i=0;i<5000;i++) flows.push_back(MakeConn(0x0a000000 + (Random() & 0xffffff), 1024 + Random() % 64000, 0xc0a80000 + Random() % 300, (i & 1) ? 80 : 443));
+   Bench("pcap, 5000 flows", flows, 4000000);
+   // Clients behind one NAT address (sequential ports) towards one server
+   flows.clear();
+   for (unsigned long i=0;i<60000;i++) flows.push_back(MakeConn(0x0a000001, 1024 + i, 0xc0a80001, 443));
+   Bench("NAT, 60000 flows", flows, 4000000);
+   // Two hosts with mirrored ports (same XOR for every flow)
+   flows.clear();
+   for (unsigned long i=0;i<5000;i++) flows.push_back(MakeConn(0x0a000001, 1024 + i, 0xc0a80001, 1024 + i));
+   Bench("mirrored, 5000 flows", flows, 200000);
+   // Iteration after most of the flows ended
+   MixTable table;
+   for (unsigned long i=0;i<1000000;i++) table[MakeConn(0x0a000000 + i, 1024, 0xc0a80001, 443)] = i;
+   for (unsigned long i=1000;i<1000000;i++) table.erase(MakeConn(0x0a000000 + i, 1024, 0xc0a80001, 443));
+   double start = Now();
+   unsigned long visited = 0;
+   for (int round=0;round<1000;round++)
+   {
+      for (MixTable::iterator it=table.begin();it!=table.end();++it) visited += it->second & 1;
+   }
+   std::cout << "Iteration over 1000 flows left of 1000000: " << (Now() - start)*1e6/1000 << " us, " << table.MemoryUsage() << " bytes (" << visited << ")\n";
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      RunBenchmark();
+      return 0;
+   }
+   TestRandom<Table>(5000, 200000);
+   TestRandom<CollidingTable>(200, 20000);
+   TestStability();
+   TestEraseWhileIterating();
+   TestShrink();
+   return TesterResult("FlowTableTester");
+}
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <iostream>
+
+#include <staple/IPv6Registry.h>
+#include <staple/Staple.h>
+#include "Tester.h"
+
+// Tests of the IPv6 address registry, and a benchmark of the memory per flow of both address families
+// ("IPv6RegistryTester bench")
+
+static void MakeAddress(u_int8_t* p_address, unsigned long p_n)
+{
+   memset(p_address, 0, 16);
+   p_address[0] = 0x20;
+   p_address[1] = 0x01;
+   p_address[2] = 0x0d;
+   p_address[3] = 0xb8;
+   for (int i=0;i<8;i++) p_address[15-i] = (u_int8_t)(p_n >> (8*i));
+}
+
+static bool Known(IPv6Registry& p_registry, u_int32_t p_handle)
+{
+   IPv6Address address;
+   return p_registry.Lookup(p_handle, address);
+}
+
+// An address is forgotten IPV6_ADDRESS_TIMEOUT after it was seen last, not before
+static void TestTimeout()
+{
+   IPv6Registry registry;
+   u_int8_t a[16], b[16];
+   MakeAddress(a, 1);
+   MakeAddress(b, 2);
+   time_t t = 1600000000 - 1600000000 % STATUS_LOG_PERIOD;
+   // Interned before the first expiry: counted from it
+   u_int32_t ha = registry.Intern(a);
+   u_int32_t hb = registry.Intern(b);
+   CHECK(ha != 0);
+   CHECK(ha != hb);
+   CHECK(registry.Intern(a) == ha);
+   for (time_t now=t;now<=t+IPV6_ADDRESS_TIMEOUT;now+=STATUS_LOG_PERIOD)
+   {
+      registry.Expire(now);
+      registry.Intern(b);
+   }
+   CHECK(Known(registry, ha));
+   registry.Expire(t + IPV6_ADDRESS_TIMEOUT + STATUS_LOG_PERIOD);
+   CHECK(!Known(registry, ha));
+   CHECK(Known(registry, hb));
+   CHECK(registry.AddressNum() == 1);
+   // A forgotten address gets a new handle
+   u_int32_t ha2 = registry.Intern(a);
+   CHECK((ha2 != ha) && (ha2 != hb));
+}
+
+// Several callers in the same period advance the epoch once (as a single caller does)
+static void TestCallersPerPeriod()
+{
+   IPv6Registry single, multi;
+   u_int8_t a[16];
+   MakeAddress(a, 7);
+   u_int32_t hs = single.Intern(a);
+   u_int32_t hm = multi.Intern(a);
+   time_t t = 1600000000 - 1600000000 % STATUS_LOG_PERIOD;
+   unsigned long lastSingle = 0, lastMulti = 0;
+   for (unsigned long period=0;period<3*IPV6_ADDRESS_TIMEOUT/STATUS_LOG_PERIOD;period++)
+   {
+      time_t now = t + period*STATUS_LOG_PERIOD;
+      single.Expire(now);
+      for (int caller=0;caller<8;caller++) multi.Expire(now + caller);
+      if (Known(single, hs)) lastSingle = period;
+      if (Known(multi, hm)) lastMulti = period;
+   }
+   CHECK(lastSingle == IPV6_ADDRESS_TIMEOUT/STATUS_LOG_PERIOD);
+   CHECK(lastMulti == lastSingle);
+}
+
+// The addresses are stamped with the time of their packets: a decoder ahead of the expiring parser does not make
+// them expire early
+static void TestDecoderAhead()
+{
+   IPv6Registry registry;
+   u_int8_t a[16], b[16];
+   MakeAddress(a, 1);
+   MakeAddress(b, 2);
+   time_t t = 1600000000 - 1600000000 % STATUS_LOG_PERIOD;
+   registry.Expire(t);
+   // The decoder is at t+2000 already, the parser goes on from t
+   u_int32_t ha, hb;
+   registry.Intern(a, b, ha, hb, t + 2000);
+   for (time_t now=t;now<=t+2000+IPV6_ADDRESS_TIMEOUT;now+=STATUS_LOG_PERIOD) registry.Expire(now);
+   CHECK(Known(registry, ha));
+   registry.Expire(t + 2000 + IPV6_ADDRESS_TIMEOUT + STATUS_LOG_PERIOD);
+   CHECK(!Known(registry, ha));
+   // Reordered packets do not move the last time back
+   registry.Intern(a, b, ha, hb, t + 5000);
+   registry.Intern(a, b, ha, hb, t + 4000);
+   registry.Expire(t + 5000 + IPV6_ADDRESS_TIMEOUT - STATUS_LOG_PERIOD);
+   CHECK(Known(registry, ha));
+}
+
+// Threads intern and expire at the same time (as the decoder and the status logs of several instances do)
+static IPv6Registry concurrentRegistry;
+static const unsigned long CONCURRENT_ROUNDS = 200;
+
+static void* ConcurrentWorker(void* arg)
+{
+   unsigned long id = (unsigned long)arg;
+   u_int8_t address[16], server[16];
+   MakeAddress(server, 0xffffffffUL);
+   time_t t = 1600000000;
+   for (unsigned long round=0;round<CONCURRENT_ROUNDS;round++)
+   {
+      time_t now = t + round*STATUS_LOG_PERIOD/4;
+      for (unsigned long i=0;i<2000;i++)
+      {
+         MakeAddress(address, id*1000000000UL + round*2000 + i);
+         u_int32_t src, dst;
+         concurrentRegistry.Intern(address, server, src, dst, now);
+      }
+      concurrentRegistry.Expire(now);
+   }
+   return NULL;
+}
+
+static void TestConcurrent()
+{
+   const unsigned long threadNum = 4;
+   pthread_t threads[threadNum];
+   for (unsigned long i=0;i<threadNum;i++) pthread_create(&threads[i], NULL, ConcurrentWorker, (void*)i);
+   for (unsigned long i=0;i<threadNum;i++) pthread_join(threads[i], NULL);
+   // The last addresses of each thread are still known, the first ones have been forgotten
+   u_int8_t address[16];
+   for (unsigned long id=0;id<threadNum;id++)
+   {
+      MakeAddress(address, id*1000000000UL + (CONCURRENT_ROUNDS-1)*2000);
+      u_int32_t handle = concurrentRegistry.Intern(address);
+      IPv6Address found;
+      CHECK(concurrentRegistry.Lookup(handle, found) && (memcmp(found.byte, address, 16) == 0));
+   }
+   // 200 rounds of a quarter period: 50 periods, so at most the last ~11 periods of addresses are kept
+   CHECK(concurrentRegistry.AddressNum() < threadNum*2000*CONCURRENT_ROUNDS/2);
+}
+
+// Memory per TCP connection for both families: the registry entry comes on top of the same flow table entry
+static void Benchmark()
+{
+   const unsigned long flowNum = 200000;
+   IPv6Registry registry;
+   TCPConnReg v4Reg, v6Reg;
+   u_int8_t client[16], server[16];
+   MakeAddress(server, 0xffffffffUL);
+   time_t now = 1600000000;
+   for (unsigned long i=0;i<flowNum;i++)
+   {
+      TCPConnId id;
+      id.netAIP.data = 0x0a000000 + i;
+      id.netBIP.data = 0xc0a80001;
+      id.netAPort = 10000 + i%50000;
+      id.netBPort = 80;
+      v4Reg[id];
+      // One client address per connection: the worst case for the registry
+      MakeAddress(client, i);
+      id.IPVersion = 6;
+      registry.Intern(client, server, id.netAIP.data, id.netBIP.data, now);
+      v6Reg[id];
+   }
+   double v4Table = (double)v4Reg.MemoryUsage()/v4Reg.size();
+   double v6Table = (double)v6Reg.MemoryUsage()/v6Reg.size();
+   double v6Registry = (double)registry.MemoryUsage()/registry.AddressNum();
+   std::cout << "TCP connections per family: " << flowNum << " (one client address each)\n";
+   std::cout << "IPv4: " << v4Table << " bytes/connection (connection table)\n";
+   std::cout << "IPv6: " << v6Table << " bytes/connection (connection table) + " << v6Registry << " bytes/address (registry)\n";
+   std::cout << "sizeof(TCPConnId) " << sizeof(TCPConnId) << ", sizeof(TCPConn) " << sizeof(TCPConn) << " (both in the connection table entries)\n";
+}
+
+int main(int argc, char** argv)
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      Benchmark();
+      return 0;
+   }
+   TestTimeout();
+   TestCallersPerPeriod();
+   TestDecoderAhead();
+   TestConcurrent();
+   return TesterResult("IPv6RegistryTester");
+}
@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <map>
+#include <list>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#include <staple/L2DuplicateFilter.h>
+#include "Tester.h"
+
+// Differential test of the L2 duplicate filter against the former CRC-32 multimap and aging list (kept below as the
+// reference): the same mirrored frame sequences (copies within and after L2_DUPLICATE_TDIFF, same content with another
+// original length, time gaps) have to give the same duplicate decisions and dupCounts, and a benchmark of the two on a
+// mirrored-port stream ("L2DuplicateFilterTester bench")
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static double TimeDiff(const struct timeval& p_a, const struct timeval& p_b)
+{
+   double diff = (p_a.tv_sec - p_b.tv_sec) + (double)(p_a.tv_usec - p_b.tv_usec)/1000000;
+   return (diff < 0) ? -diff : diff;
+}
+
+// Reference: the former implementation (byte-at-a-time CRC-32, multimap of frame copies and aging list)
+// -------------------------------------------------------------------------------------------------------
+class MultimapDuplicateFilter {
+
+   struct RawPacket {
+      unsigned long  savedL2PacketLength;
+      unsigned long  origL2PacketLength;
+      Byte*          data;
+      unsigned short dupCount;
+   };
+
+   struct ListEntry {
+      struct timeval time;
+      std::multimap<unsigned long, RawPacket>::iterator regIndex;
+   };
+
+   unsigned long                             crcTable[256];
+   std::multimap<unsigned long, RawPacket>   reg;
+   std::list<ListEntry>                      list;
+
+public:
+   MultimapDuplicateFilter()
+   {
+      for (unsigned long i=0;i<256;i++)
+      {
+         unsigned long crc = i;
+         for (int j=8;j>0;j--) crc = (crc & 1) ? ((crc>>1) ^ 0xedb88320) : (crc>>1);
+         crcTable[i] = crc;
+      }
+   }
+
+   ~MultimapDuplicateFilter()
+   {
+      while (!list.empty()) RemoveOldest();
+   }
+
+   void Expire(const struct timeval& p_time)
+   {
+      while ((!list.empty()) && (TimeDiff(list.front().time, p_time) > L2_DUPLICATE_TDIFF)) RemoveOldest();
+   }
+
+   // dupCount of the earlier copy after this one (0: new frame, stored)
+   unsigned short Process(const Byte* p_data, unsigned long p_savedLen, unsigned long p_origLen, const struct timeval& p_time)
+   {
+      unsigned long crc = 0xffffffff;
+      for (unsigned long i=0;i<p_savedLen;i++) crc = ((crc>>8) & 0x00ffffff) ^ crcTable[(crc^p_data[i]) & 0xff];
+      crc ^= 0xffffffff;
+      for (std::multimap<unsigned long, RawPacket>::iterator it=reg.find(crc);(it!=reg.end()) && (it->first==crc);++it)
+      {
+         RawPacket& old = it->second;
+         if ((old.origL2PacketLength == p_origLen) && (old.savedL2PacketLength == p_savedLen) && (memcmp(old.data, p_data, p_savedLen) == 0))
+         {
+            return ++old.dupCount;
+         }
+      }
+      RawPacket packet;
+      packet.savedL2PacketLength = p_savedLen;
+      packet.origL2PacketLength = p_origLen;
+      packet.data = new Byte[p_savedLen];
+      memcpy(packet.data, p_data, p_savedLen);
+      packet.dupCount = 0;
+      ListEntry entry;
+      entry.time = p_time;
+      entry.regIndex = reg.insert(std::make_pair(crc, packet));
+      list.push_back(entry);
+      return 0;
+   }
+
+private:
+   void RemoveOldest()
+   {
+      delete [] list.front().regIndex->second.data;
+      reg.erase(list.front().regIndex);
+      list.pop_front();
+   }
+};
+
+// The filter as PacketDumpFile::ReadPacket uses it
+static unsigned short Process(L2DuplicateFilter& p_filter, const Byte* p_data, unsigned long p_savedLen, unsigned long p_origLen, const struct timeval& p_time)
+{
+   L2DuplicateRecord* pRecord = p_filter.Find(p_data, p_savedLen, p_origLen);
+   if (pRecord != NULL) return ++pRecord->dupCount;
+   p_filter.Insert(p_data, p_savedLen, p_origLen, p_time);
+   return 0;
+}
+
+// Frame streams
+// -------------
+class Frame {
+public:
+   std::vector<Byte> data;
+   unsigned long     origLen;
+   struct timeval    time;
+};
+
+static void Advance(struct timeval& p_time, unsigned long p_usec)
+{
+   p_time.tv_usec += p_usec;
+   p_time.tv_sec += p_time.tv_usec / 1000000;
+   p_time.tv_usec %= 1000000;
+}
+
+// Mirrored-port capture: every packet is captured 1-3 times within a few hundred microseconds; some packets are
+// retransmitted with the same content later (possibly after L2_DUPLICATE_TDIFF) or captured with another original
+// length; the packets of a flow share their headers (so the frames differ only late in the content)
+static std::vector<Frame> MakeStream(unsigned long p_packetNum, unsigned long p_meanGapUs, unsigned long p_maxLen)
+{
+   std::vector<Frame> frames;
+   std::vector<Frame> pending;
+   std::vector<Byte> header(54);
+   for (unsigned long j=0;j<header.size();j++) header[j] = (Byte) Random();
+   struct timeval time = {1000, 0};
+   for (unsigned long i=0;i<p_packetNum;i++)
+   {
+      Advance(time, Random() % (2*p_meanGapUs + 1));
+      if (Random() % 5000 == 0) Advance(time, 50000 + Random() % 200000);
+      Frame frame;
+      if ((!frames.empty()) && (Random() % 20 == 0))
+      {
+         // Retransmission or another capture of an earlier frame
+         frame = frames[frames.size() - 1 - Random() % ((frames.size() < 3000) ? frames.size() : 3000)];
+         if (Random() % 4 == 0) frame.origLen += 1 + Random() % 3;
+      }
+      else
+      {
+         unsigned long len = 14 + Random() % (p_maxLen - 13);
+         if (Random() % 3 == 0) len = (Random() & 1) ? 60 : p_maxLen;
+         frame.data.resize(len);
+         for (unsigned long j=0;j<len;j++) frame.data[j] = (j < header.size()) ? header[j] : (Byte) Random();
+         // Same frame up to the last byte
+         if ((len > header.size()) && (Random() % 8 == 0)) frame.data[len-1] ^= 1;
+         frame.origLen = (Random() % 10 == 0) ? len + Random() % 1000 : len;
+         if (Random() % 50 == 0) header[Random() % header.size()] = (Byte) Random();
+      }
+      frame.time = time;
+      frames.push_back(frame);
+      unsigned long copies = Random() % 3;
+      for (unsigned long c=0;c<copies;c++)
+      {
+         Advance(frame.time, 1 + Random() % 300);
+         pending.push_back(frame);
+      }
+      // Emit the copies that are due (the stream stays in time order)
+      for (unsigned long p=0;p<pending.size();)
+      {
+         if (!timercmp(&pending[p].time, &time, >))
+         {
+            pending[p].time = time;
+            frames.push_back(pending[p]);
+            pending.erase(pending.begin() + p);
+         }
+         else p++;
+      }
+   }
+   for (unsigned long p=0;p<pending.size();p++) frames.push_back(pending[p]);
+   return frames;
+}
+
+// The same dupCount for each frame of the stream as the reference
+static bool SameDecisions(const std::vector<Frame>& p_frames, L2DuplicateFilter& p_filter)
+{
+   MultimapDuplicateFilter reference;
+   unsigned long mismatches = 0;
+   unsigned long duplicates = 0;
+   for (unsigned long i=0;i<p_frames.size();i++)
+   {
+      const Frame& frame = p_frames[i];
+      p_filter.Expire(frame.time);
+      reference.Expire(frame.time);
+      unsigned short dupCount = Process(p_filter, &frame.data[0], frame.data.size(), frame.origLen, frame.time);
+      unsigned short refDupCount = reference.Process(&frame.data[0], frame.data.size(), frame.origLen, frame.time);
+      if (dupCount != refDupCount)
+      {
+         if (mismatches++ < 10) std::cerr << "frame " << i << ": dupCount " << dupCount << " instead of " << refDupCount << "\n";
+      }
+      if (refDupCount != 0) duplicates++;
+   }
+   // The streams have to contain duplicates for the test to mean anything
+   return (mismatches == 0) && (duplicates*10 > p_frames.size());
+}
+
+static void TestMirroredStream()
+{
+   L2DuplicateFilter filter;
+   std::vector<Frame> frames = MakeStream(100000, 40, 1514);
+   CHECK(SameDecisions(frames, filter));
+   CHECK(filter.evictions == 0);
+   CHECK(filter.probes < filter.lookups);
+   // The filter is reusable after Clear() (next input file)
+   filter.Clear();
+   frames = MakeStream(20000, 100, 200);
+   CHECK(SameDecisions(frames, filter));
+}
+
+// Short frames only (the hash tail of less than 8 bytes) and frames differing in one byte only
+static void TestShortFrames()
+{
+   L2DuplicateFilter filter;
+   struct timeval time = {1, 0};
+   Byte data[16];
+   memset(data, 0xaa, sizeof(data));
+   bool same = true;
+   for (unsigned long len=1;len<=sizeof(data);len++) same = same && (Process(filter, data, len, len, time) == 0);
+   for (unsigned long len=1;len<=sizeof(data);len++) same = same && (Process(filter, data, len, len, time) == 1);
+   for (unsigned long j=0;j<sizeof(data);j++)
+   {
+      data[j] ^= 0x10;
+      same = same && (Process(filter, data, sizeof(data), sizeof(data), time) == 0);
+      data[j] ^= 0x10;
+   }
+   CHECK(same);
+}
+
+// A frame is forgotten only after L2_DUPLICATE_TDIFF (measured from its first copy)
+static void TestExpiry()
+{
+   L2DuplicateFilter filter;
+   Byte data[100];
+   for (unsigned long j=0;j<sizeof(data);j++) data[j] = (Byte) j;
+   struct timeval time = {1, 950000};
+   filter.Expire(time);
+   CHECK(Process(filter, data, sizeof(data), sizeof(data), time) == 0);
+   Advance(time, (unsigned long)(L2_DUPLICATE_TDIFF*1000000) - 1);
+   filter.Expire(time);
+   CHECK(Process(filter, data, sizeof(data), sizeof(data), time) == 1);
+   Advance(time, 2);
+   filter.Expire(time);
+   CHECK(Process(filter, data, sizeof(data), sizeof(data), time) == 0);
+}
+
+// If the rings are full within L2_DUPLICATE_TDIFF the oldest frames are dropped early (and counted), the newer ones
+// are still found
+static void TestFullRings()
+{
+   L2DuplicateFilter filter;
+   struct timeval time = {1, 0};
+   Byte data[8];
+   // Record ring
+   unsigned long frameNum = L2DUP_MAX_RECORDS + 1000;
+   for (unsigned long i=0;i<frameNum;i++)
+   {
+      memcpy(data, &i, sizeof(data));
+      Process(filter, data, sizeof(data), sizeof(data), time);
+   }
+   CHECK(filter.evictions == 1000);
+   bool found = true;
+   for (unsigned long i=0;i<frameNum;i++)
+   {
+      memcpy(data, &i, sizeof(data));
+      found = found && ((filter.Find(data, sizeof(data), sizeof(data)) != NULL) == (i >= 1000));
+   }
+   CHECK(found);
+   // Storage ring
+   filter.Clear();
+   filter.evictions = 0;
+   std::vector<Byte> frame(1514);
+   unsigned long storedNum = L2DUP_STORAGE_SIZE / frame.size();
+   for (unsigned long i=0;i<storedNum+100;i++)
+   {
+      memcpy(&frame[0], &i, sizeof(i));
+      Process(filter, &frame[0], frame.size(), frame.size(), time);
+   }
+   CHECK((filter.evictions >= 100) && (filter.evictions <= 101));
+   memcpy(&frame[0], &storedNum, sizeof(storedNum));
+   unsigned long newest = storedNum + 99;
+   CHECK(filter.Find(&frame[0], frame.size(), frame.size()) != NULL);
+   memcpy(&frame[0], &newest, sizeof(newest));
+   CHECK(filter.Find(&frame[0], frame.size(), frame.size()) != NULL);
+   unsigned long oldest = 0;
+   memcpy(&frame[0], &oldest, sizeof(oldest));
+   CHECK(filter.Find(&frame[0], frame.size(), frame.size()) == NULL);
+}
+
+// Benchmark
+// ---------
+static double Now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Expire + lookup (+ store) of each frame (best of 3) [ns/frame]
+template <class F>
+static double Replay(const std::vector<Frame>& p_frames, unsigned short (*p_process)(F&, const Frame&))
+{
+   double best = 0;
+   unsigned long duplicates = 0;
+   for (int round=0;round<3;round++)
+   {
+      F filter;
+      double start = Now();
+      for (unsigned long i=0;i<p_frames.size();i++)
+      {
+         filter.Expire(p_frames[i].time);
+         if (p_process(filter, p_frames[i]) != 0) duplicates++;
+      }
+      double ns = (Now() - start)*1e9/p_frames.size();
+      if ((round == 0) || (ns < best)) best = ns;
+   }
+   if (duplicates == 0) std::cerr << "no duplicates\n";
+   return best;
+}
+
+static unsigned short ProcessReference(MultimapDuplicateFilter& p_filter, const Frame& p_frame)
+{
+   return p_filter.Process(&p_frame.data[0], p_frame.data.size(), p_frame.origLen, p_frame.time);
+}
+
+static unsigned short ProcessFilter(L2DuplicateFilter& p_filter, const Frame& p_frame)
+{
+   return Process(p_filter, &p_frame.data[0], p_frame.data.size(), p_frame.origLen, p_frame.time);
+}
+
+static void Bench(const char* p_name, unsigned long p_packetNum, unsigned long p_meanGapUs, unsigned long p_maxLen)
+{
+   std::vector<Frame> frames = MakeStream(p_packetNum, p_meanGapUs, p_maxLen);
+   std::cout << std::setw(28) << std::left << p_name << std::right << std::fixed << std::setprecision(1)
+             << std::setw(12) << Replay<MultimapDuplicateFilter>(frames, ProcessReference)
+             << std::setw(12) << Replay<L2DuplicateFilter>(frames, ProcessFilter) << "\n";
+}
+
+static void RunBenchmark()
+{
+   std::cout << "Expire and look up (store) per frame, best of 3 [ns/frame]\n"
+             << std::setw(28) << "" << std::setw(12) << "multimap" << std::setw(12) << "filter" << "\n";
+   Bench("mirrored, 1514 bytes max", 300000, 20, 1514);
+   Bench("mirrored, 128 bytes max", 300000, 20, 128);
+   Bench("mirrored, 128 bytes max, 2 us", 300000, 2, 128);
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      RunBenchmark();
+      return 0;
+   }
+   TestMirroredStream();
+   TestShortFrames();
+   TestExpiry();
+   TestFullRings();
+   return TesterResult("L2DuplicateFilterTester");
+}
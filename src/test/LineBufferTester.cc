@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#include <staple/LineBuffer.h>
+#include "Tester.h"
+
+// Differential test of the fixed-6 formatting of the log records against the former formatting (printf "%f" in the
+// HTTP logs and std::fixed with precision 6 in the perfmon records): negative values, ties at the sixth decimal,
+// values around 2^32 and the limit of the fast path, huge values, NaN and infinity
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static unsigned long long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return randomState * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned long mismatches = 0;
+
+// The value formatted by a LineBuffer, by printf and by an iostream are the same text
+static bool SameAsBefore(double p_value)
+{
+   LineBuffer line;
+   line << p_value;
+   char text[512];
+   snprintf(text, sizeof(text), "%f", p_value);
+   std::ostringstream stream;
+   stream << std::fixed << std::setprecision(6) << p_value;
+   bool same = (line.Str() == text) && (stream.str() == text);
+   if (!same && (mismatches++ < 10))
+   {
+      std::cerr << std::setprecision(17) << p_value << ": \"" << line.Str() << "\" instead of \"" << text << "\"\n";
+   }
+   return same;
+}
+
+static bool SameAsBefore(long double p_value)
+{
+   LineBuffer line;
+   line << p_value;
+   char text[8192];
+   snprintf(text, sizeof(text), "%.6Lf", p_value);
+   bool same = (line.Str() == text);
+   if (!same && (mismatches++ < 10))
+   {
+      std::cerr << std::setprecision(21) << p_value << ": \"" << line.Str() << "\" instead of \"" << text << "\"\n";
+   }
+   return same;
+}
+
+// The value and its nearest neighbours on both sides, also negated
+static bool SameAround(double p_value)
+{
+   bool same = true;
+   double below = nextafter(p_value, -std::numeric_limits<double>::infinity());
+   double above = nextafter(p_value, std::numeric_limits<double>::infinity());
+   const double values[] = {p_value, below, above, -p_value, -below, -above};
+   for (unsigned long i=0;i<sizeof(values)/sizeof(values[0]);i++) same = SameAsBefore(values[i]) && same;
+   return same;
+}
+
+static void TestSpecialValues()
+{
+   const double inf = std::numeric_limits<double>::infinity();
+   const double nan = std::numeric_limits<double>::quiet_NaN();
+   const double values[] = {0.0, -0.0, 1.0, -1.0, 0.5, 0.1, 1e-7, 4.9e-7, 5e-7, 5.1e-7, 1.5e-6, 2.5e-6, 0.0000015,
+                            0.9999995, 0.99999949999, 9.9999995, 123.4567895, 1e-300, DBL_MIN, 4.9406564584124654e-324, DBL_MAX,
+                            inf, -inf, nan, -nan};
+   bool same = true;
+   for (unsigned long i=0;i<sizeof(values)/sizeof(values[0]);i++) same = SameAsBefore(values[i]) && same;
+   CHECK(same);
+   CHECK(SameAsBefore(std::numeric_limits<long double>::infinity()) && SameAsBefore(-std::numeric_limits<long double>::quiet_NaN()));
+   CHECK(SameAsBefore(LDBL_MAX) && SameAsBefore(-LDBL_MAX) && SameAsBefore((long double) 0.0000005L));
+}
+
+// Ties at the sixth decimal (k + 0.5 microunits) and their neighbours
+static void TestRounding()
+{
+   bool same = true;
+   for (unsigned long i=0;i<200000;i++)
+   {
+      unsigned long long microunits = Random() % 100000000000ULL;
+      same = SameAround((microunits + 0.5) / 1e6) && same;
+      same = SameAround(microunits / 1e6) && same;
+      same = SameAsBefore((long double) microunits / 1e6L + 5e-7L) && same;
+   }
+   CHECK(same);
+}
+
+// Values above 2^32 (also around the limit of the fast path at 2^53 microunits) and huge values
+static void TestLargeValues()
+{
+   bool same = true;
+   for (int exponent=30;exponent<=64;exponent++)
+   {
+      double power = ldexp(1.0, exponent);
+      same = SameAround(power) && same;
+      same = SameAround(power + 0.5e-6) && same;
+      same = SameAround(power - 0.1234565) && same;
+   }
+   same = SameAround(9007199254.740992) && same;
+   same = SameAround(9007199254.7409915) && same;
+   same = SameAround(4294967296.0000005) && same;
+   for (unsigned long i=0;i<100000;i++)
+   {
+      double value = ldexp((double) (Random() >> 11), -(int) (Random() % 40));
+      same = SameAround(value) && same;
+   }
+   for (int exponent=60;exponent<=1020;exponent+=7) same = SameAround(ldexp(1.3, exponent)) && same;
+   CHECK(same);
+}
+
+// Random bit patterns (any finite or non-finite double)
+static void TestRandomBits()
+{
+   bool same = true;
+   for (unsigned long i=0;i<200000;i++)
+   {
+      unsigned long long bits = Random();
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      // Most of the huge values are printed with hundreds of digits: keep one in 16 of them
+      if ((fabs(value) > 1e20) && (i % 16 != 0)) continue;
+      same = SameAsBefore(value) && same;
+   }
+   CHECK(same);
+}
+
+// Several fields appended to the same line
+static void TestLine()
+{
+   LineBuffer line;
+   line << 1.5 << '\t' << -2.0000005 << '\t' << (long long) -42 << '\t' << 4294967296.25 << '\t' << (unsigned long) 7;
+   char text[128];
+   snprintf(text, sizeof(text), "%f\t%f\t%lld\t%f\t%lu", 1.5, -2.0000005, -42LL, 4294967296.25, 7UL);
+   CHECK(line.Str() == text);
+   line.Clear();
+   line << 0.0;
+   CHECK(line.Str() == "0.000000");
+}
+
+int main()
+{
+   TestSpecialValues();
+   TestRounding();
+   TestLargeValues();
+   TestRandomBits();
+   TestLine();
+   return TesterResult("LineBufferTester");
+}
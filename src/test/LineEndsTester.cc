@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#include "../staple/http/HTTP-helpers.h"
+#include "Tester.h"
+
+// Differential test of the line end kernels of the HTTP parser (scalar, SSE2 and AVX2, as far as the CPU supports
+// them) against a naive scan: random buffers with CRLFs anywhere (also straddling the 16 and 32 byte block edges and
+// at the last bytes), lone CRs and LFs, empty lines and limits of the number of lines; each buffer ends at a
+// protected page, so reading past its end fails. And a benchmark of the kernels against the former per-line CRLF
+// search on HTTP header blocks ("LineEndsTester bench")
+
+static unsigned long long randomState = 0x2545f4914f6cdd1dULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static const LineEndsKernelId kernels[] = {LINE_ENDS_SCALAR, LINE_ENDS_SSE2, LINE_ENDS_AVX2};
+static const char* kernelNames[] = {"scalar", "SSE2", "AVX2"};
+static const unsigned long kernelNum = sizeof(kernels)/sizeof(kernels[0]);
+
+// Reference: the CRLFs of [p_from, p_end) in order, up to p_maxLines of them or up to the one of the first empty line
+static int NaiveLineEnds(const Byte* p_buf, const Byte* p_from, const Byte* p_end, const Byte** p_lines, int p_maxLines)
+{
+   int n = 0;
+   const Byte* lineStart = p_buf;
+   for (const Byte* p=p_from;p+1<p_end;p++)
+   {
+      if ((p[0] != '\r') || (p[1] != '\n')) continue;
+      p_lines[n++] = p;
+      if ((p == lineStart) || (n == p_maxLines)) break;
+      lineStart = p + 2;
+      p++;
+   }
+   return n;
+}
+
+// Buffer of up to 4 pages followed by a protected page (the data is placed at its end)
+class GuardedBuffer {
+public:
+   GuardedBuffer()
+   {
+      pageSize = sysconf(_SC_PAGESIZE);
+      base = (Byte*) mmap(NULL, 5*pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      mprotect(base + 4*pageSize, pageSize, PROT_NONE);
+   }
+   ~GuardedBuffer() {munmap(base, 5*pageSize);}
+
+   // Copy the data to the end of the buffer
+   Byte* Place(const std::vector<Byte>& p_data)
+   {
+      Byte* start = base + 4*pageSize - p_data.size();
+      if (!p_data.empty()) memcpy(start, &p_data[0], p_data.size());
+      return start;
+   }
+
+private:
+   Byte*          base;
+   unsigned long  pageSize;
+};
+
+static unsigned long mismatches = 0;
+
+// All the supported kernels find the same CRLFs as the naive scan
+static bool SameLineEnds(GuardedBuffer& p_buffer, const std::vector<Byte>& p_data, unsigned long p_fromPos, int p_maxLines)
+{
+   const Byte* buf = p_buffer.Place(p_data);
+   const Byte* end = buf + p_data.size();
+   std::vector<const Byte*> expected(p_maxLines);
+   int expectedNum = NaiveLineEnds(buf, buf + p_fromPos, end, &expected[0], p_maxLines);
+   bool same = true;
+   for (unsigned long k=0;k<kernelNum;k++)
+   {
+      if (!hasLineEndsKernel(kernels[k])) continue;
+      std::vector<const Byte*> lines(p_maxLines);
+      int num = findLineEndsWith(kernels[k], buf, buf + p_fromPos, end, &lines[0], p_maxLines);
+      if ((num != expectedNum) || !std::equal(lines.begin(), lines.begin() + num, expected.begin()))
+      {
+         if (mismatches++ < 10)
+         {
+            std::cerr << kernelNames[k] << ": " << num << " CRLFs instead of " << expectedNum << " in " << p_data.size() << " bytes from "
+                      << p_fromPos << "\n";
+         }
+         same = false;
+      }
+   }
+   return same;
+}
+
+// Random bytes, with the given share of CRs and LFs (in 1/256)
+static std::vector<Byte> RandomData(unsigned long p_len, unsigned long p_density)
+{
+   std::vector<Byte> data(p_len);
+   for (unsigned long i=0;i<p_len;i++)
+   {
+      unsigned long r = Random() & 0xff;
+      if (r < p_density/2) data[i] = '\r';
+      else if (r < p_density) data[i] = (Random() & 3) ? '\n' : '\r';
+      else data[i] = 'a' + (Random() % 26);
+   }
+   return data;
+}
+
+// Random buffers, random scan starts and line limits
+static void TestRandom()
+{
+   GuardedBuffer buffer;
+   bool same = true;
+   for (unsigned long i=0;i<300000;i++)
+   {
+      unsigned long len = Random() % ((i % 10 == 0) ? 4000 : 300);
+      unsigned long density = (i % 3 == 0) ? 128 : (i % 3 == 1) ? 24 : 4;
+      std::vector<Byte> data = RandomData(len, density);
+      unsigned long fromPos = (len == 0) ? 0 : Random() % (len + 1);
+      // [buf, from) has no CRLF
+      for (unsigned long j=1;j<fromPos;j++) if ((data[j-1] == '\r') && (data[j] == '\n')) data[j] = 'x';
+      int maxLines = (Random() % 4 == 0) ? 1 + Random() % 4 : 1000;
+      same = SameLineEnds(buffer, data, fromPos, maxLines) && same;
+   }
+   CHECK(same);
+}
+
+// A CRLF at every position of the buffer relative to the start of the scan (across the block edges), alone or
+// after another line, also with the CR or the LF as the last byte
+static void TestBlockEdges()
+{
+   GuardedBuffer buffer;
+   bool same = true;
+   for (unsigned long len=2;len<=100;len++)
+   {
+      for (unsigned long fromPos=0;fromPos<3;fromPos++)
+      {
+         for (unsigned long pos=fromPos;pos+1<=len;pos++)
+         {
+            std::vector<Byte> data(len, 'a');
+            data[pos] = '\r';
+            if (pos+1 < len) data[pos+1] = '\n';
+            same = SameLineEnds(buffer, data, fromPos, 1000) && same;
+            // Another CRLF right before it (an empty line) or one line earlier
+            if (pos >= fromPos+2)
+            {
+               data[pos-2] = '\r';
+               data[pos-1] = '\n';
+               same = SameLineEnds(buffer, data, fromPos, 1000) && same;
+               same = SameLineEnds(buffer, data, fromPos, 1) && same;
+               data[pos-2] = 'a';
+               data[pos-1] = 'a';
+            }
+            if (pos >= fromPos+5)
+            {
+               data[pos-5] = '\r';
+               data[pos-4] = '\n';
+               same = SameLineEnds(buffer, data, fromPos, 1000) && same;
+            }
+         }
+      }
+   }
+   // Only CRLFs, CRLF CRLF at the end, a lone CR at the end
+   for (unsigned long len=1;len<=100;len++)
+   {
+      std::vector<Byte> data(len, 'b');
+      for (unsigned long i=0;i+1<len;i+=2)
+      {
+         data[i] = '\r';
+         data[i+1] = '\n';
+      }
+      same = SameLineEnds(buffer, data, 0, 1000) && same;
+      data.assign(len, 'c');
+      if (len >= 4) memcpy(&data[len-4], "\r\n\r\n", 4);
+      same = SameLineEnds(buffer, data, 0, 1000) && same;
+      data.assign(len, 'd');
+      data[len-1] = '\r';
+      same = SameLineEnds(buffer, data, 0, 1000) && same;
+   }
+   CHECK(same);
+}
+
+// A header block gives the ends of its lines and of the empty line (and nothing of the body after it)
+static void TestHeaderBlock()
+{
+   const char* message = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: tester\r\nAccept: */*\r\n\r\nbody\r\nmore\r\n";
+   std::vector<Byte> data(message, message + strlen(message));
+   GuardedBuffer buffer;
+   const Byte* buf = buffer.Place(data);
+   bool ok = true;
+   for (unsigned long k=0;k<kernelNum;k++)
+   {
+      if (!hasLineEndsKernel(kernels[k])) continue;
+      const Byte* lines[16];
+      int num = findLineEndsWith(kernels[k], buf, buf, buf + data.size(), lines, 16);
+      ok = ok && (num == 5) && (lines[4] == buf + strlen("GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: tester\r\nAccept: */*\r\n"));
+   }
+   CHECK(ok);
+   CHECK(hasLineEndsKernel(LINE_ENDS_SCALAR));
+}
+
+// Benchmark
+// ---------
+static double Now()
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// Former search: each line end separately
+static int SearchLineEnds(const Byte* p_buf, const Byte* p_end, const Byte** p_lines, int p_maxLines)
+{
+   const Byte crlf[] = {'\r', '\n'};
+   int n = 0;
+   for (const Byte* lineStart=p_buf;n<p_maxLines;)
+   {
+      const Byte* p = std::search(lineStart, p_end, crlf, crlf+2);
+      if (p == p_end) break;
+      p_lines[n++] = p;
+      if (p == lineStart) break;
+      lineStart = p + 2;
+   }
+   return n;
+}
+
+// All the line ends of the header block (best of 5) [ns/block]
+static double Replay(const std::vector<Byte>& p_block, int p_kernel)
+{
+   const Byte* buf = &p_block[0];
+   const Byte* end = buf + p_block.size();
+   const Byte* lines[64];
+   const unsigned long rounds = 200000;
+   double best = 0;
+   unsigned long sum = 0;
+   for (int round=0;round<5;round++)
+   {
+      double start = Now();
+      for (unsigned long i=0;i<rounds;i++)
+      {
+         sum += (p_kernel < 0) ? SearchLineEnds(buf, end, lines, 64) : findLineEndsWith(kernels[p_kernel], buf, buf, end, lines, 64);
+      }
+      double ns = (Now() - start)*1e9/rounds;
+      if ((round == 0) || (ns < best)) best = ns;
+   }
+   if (sum == 0) std::cerr << "no lines\n";
+   return best;
+}
+
+static void Bench(const char* p_name, const char* p_block)
+{
+   std::vector<Byte> block(p_block, p_block + strlen(p_block));
+   std::cout << std::setw(12) << std::left << p_name << std::right << std::setw(6) << block.size() << " bytes" << std::fixed << std::setprecision(1) << std::setw(10) << Replay(block, -1);
+   for (unsigned long k=0;k<kernelNum;k++)
+   {
+      if (hasLineEndsKernel(kernels[k])) std::cout << std::setw(10) << Replay(block, k);
+      else std::cout << std::setw(10) << "-";
+   }
+   std::cout << "\n";
+}
+
+static void RunBenchmark()
+{
+   std::cout << "Line ends of a header block, best of 5 [ns/block]\n" << std::setw(24) << "" << std::setw(10) << "search";
+   for (unsigned long k=0;k<kernelNum;k++) std::cout << std::setw(10) << kernelNames[k];
+   std::cout << "\n";
+   Bench("request",
+         "GET /images/branding/googlelogo/2x/googlelogo_color_272x92dp.png HTTP/1.1\r\n"
+         "Host: www.google.com\r\n"
+         "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+         "Accept: image/avif,image/webp,*/*\r\n"
+         "Accept-Language: en-US,en;q=0.5\r\n"
+         "Accept-Encoding: gzip, deflate, br\r\n"
+         "Referer: https://www.google.com/search?q=staple+tcp+analysis&client=firefox\r\n"
+         "Connection: keep-alive\r\n"
+         "Cookie: NID=511=abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz0123456789\r\n"
+         "Sec-Fetch-Dest: image\r\n"
+         "Sec-Fetch-Mode: no-cors\r\n"
+         "\r\n");
+   Bench("response",
+         "HTTP/1.1 200 OK\r\n"
+         "Content-Type: image/png\r\n"
+         "Content-Length: 13504\r\n"
+         "Date: Sat, 17 Oct 2026 12:00:00 GMT\r\n"
+         "Cache-Control: private, max-age=31536000\r\n"
+         "Server: sffe\r\n"
+         "X-XSS-Protection: 0\r\n"
+         "Last-Modified: Tue, 22 Oct 2019 18:30:00 GMT\r\n"
+         "\r\n");
+}
+
+int main(int argc, char* argv[])
+{
+   if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+   {
+      RunBenchmark();
+      return 0;
+   }
+   TestHeaderBlock();
+   TestBlockEdges();
+   TestRandom();
+   return TesterResult("LineEndsTester");
+}
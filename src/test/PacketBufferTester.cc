@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <limits>
+#include <iostream>
+
+#include <staple/Staple.h>
+#include <staple/Packet.h>
+#include <staple/PacketPool.h>
+#include "../staple/http/PacketBuffer.h"
+#include "Tester.h"
+
+// Replay test of the TCP reorder buffer of the HTTP parser against the former implementation (kept below as the
+// reference: deque of deep copies, each with a clone of the L2 packet): the same reordered, duplicated, overlapping
+// and lost packets, fed as the decoder does (pooled packets whose payload slabs are recycled), have to give the
+// same duplicate and overlap decisions and the same packets back (also the fake ones filling the holes)
+
+// Reference: the former implementation (without the warnings)
+// -------------------------------------------------------------
+class DequePacketBuffer {
+public:
+   DequePacketBuffer(int p_maxSize) : nextSeqNo(0), ack(0), maxSize(p_maxSize), bytesUsed(0), gotFirstPacket(false), alive(true) {}
+   ~DequePacketBuffer()
+   {
+      for (std::deque<TCPPacket*>::iterator it=packets.begin();it!=packets.end();++it) delete *it;
+   }
+
+   bool tryAddGet(const TCPPacket& p)
+   {
+      if (gotFirstPacket && p.seq < nextSeqNo) return false;
+      if (!packets.empty())
+      {
+         if (p.seq < packets.front()->seq)
+         {
+            if (p.seq + p.TCPPLLen > packets.front()->seq) return false;
+         }
+         else
+         {
+            return false;
+         }
+      }
+      if (p.TCPPLLen != p.payloadSavedLen) return false;
+      if (!gotFirstPacket)
+      {
+         nextSeqNo = p.seq;
+         gotFirstPacket = true;
+      }
+      else if (p.seq != nextSeqNo)
+      {
+         return false;
+      }
+      UpdateNextSeqNo(p.TCPPLLen);
+      return true;
+   }
+
+   bool add(const TCPPacket& p)
+   {
+      TCPPacket* packet = new TCPPacket(p);
+      packet->pL2Packet = p.pL2Packet->clone();
+      std::deque<TCPPacket*>::iterator it;
+      if (gotFirstPacket && packet->seq < nextSeqNo)
+      {
+         delete packet;
+         return true;
+      }
+      for (it=packets.begin();it!=packets.end();++it)
+      {
+         if (packet->seq < (*it)->seq)
+         {
+            if (packet->seq + packet->TCPPLLen > (*it)->seq)
+            {
+               delete packet;
+               return true;
+            }
+            break;
+         }
+         else if (packet->seq == (*it)->seq)
+         {
+            delete packet;
+            return true;
+         }
+      }
+      uint32_t prevSeq;
+      if (it == packets.begin())
+      {
+         prevSeq = nextSeqNo;
+      }
+      else
+      {
+         TCPPacket* prev = *(it-1);
+         if (prev->seq + prev->TCPPLLen > packet->seq)
+         {
+            delete packet;
+            return true;
+         }
+         prevSeq = prev->seq;
+      }
+      if (packet->seq - prevSeq > 10*1024*1024)
+      {
+         delete packet;
+         return true;
+      }
+      if (bytesUsed > maxSize)
+      {
+         delete packet;
+         return false;
+      }
+      packets.insert(it, packet);
+      bytesUsed += packet->payloadSavedLen;
+      if (!gotFirstPacket)
+      {
+         nextSeqNo = packet->seq;
+         gotFirstPacket = true;
+      }
+      return true;
+   }
+
+   TCPPacket* get()
+   {
+      if (packets.empty()) return NULL;
+      TCPPacket* p = packets.front();
+      if (p->seq == nextSeqNo)
+      {
+         packets.pop_front();
+         UpdateNextSeqNo(p->TCPPLLen);
+         bytesUsed -= p->payloadSavedLen;
+         return p;
+      }
+      else if (!alive || maxSize < bytesUsed || nextSeqNo < ack)
+      {
+         TCPPacket* ret = new TCPPacket(p->staple);
+         ret->Init();
+         ret->payload = new Byte[0];
+         ret->payloadSavedLen = 0;
+         ret->pL2Packet = p->pL2Packet->clone();
+         ret->pL2Packet->l2SavedLen = 0;
+         ret->pL2Packet->pL3Packet = ret;
+         ret->seq = nextSeqNo;
+         ret->ack = p->ack;
+         uint32_t holeLen = std::numeric_limits<uint32_t>::max();
+         if (nextSeqNo < ack) holeLen = ack - nextSeqNo;
+         if (p->seq - nextSeqNo < holeLen) holeLen = p->seq - nextSeqNo;
+         if (0xffff - 20 - 20 < holeLen) holeLen = 0xffff - 20 - 20;
+         ret->TCPPLLen = holeLen;
+         ret->IPPktLen = ret->TCPPLLen + 20 + 20;
+         UpdateNextSeqNo(ret->TCPPLLen);
+         return ret;
+      }
+      return NULL;
+   }
+
+   void finishTCPSession() {alive = false;}
+   bool hasPackets() const {return !packets.empty();}
+   int numPackets() const {return packets.size();}
+   int getNextSeqNo() const {return nextSeqNo;}
+
+   void updateAck(uint32_t p_ack)
+   {
+      if ((ack < p_ack) && !((10*1024*1024 < p_ack - ack) && (nextSeqNo < p_ack) && (10*1024*1024 < p_ack - nextSeqNo))) ack = p_ack;
+   }
+
+private:
+   std::deque<TCPPacket*> packets;
+   uint32_t nextSeqNo;
+   uint32_t ack;
+   int maxSize;
+   int bytesUsed;
+   bool gotFirstPacket;
+   bool alive;
+
+   void UpdateNextSeqNo(uint32_t p_inc)
+   {
+      if (nextSeqNo + p_inc >= nextSeqNo) nextSeqNo += p_inc;
+   }
+};
+
+// Replay
+// ------
+static unsigned long long randomState = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+// Payload byte of the given stream position (so that any mix-up of the payloads shows)
+static Byte PayloadByte(unsigned long p_seq)
+{
+   return (Byte)((p_seq * 131) ^ (p_seq >> 8));
+}
+
+// A packet of the stream read into pooled objects, as the decoder does
+static TCPPacket* NewPacket(Staple& p_staple, unsigned long p_seq, unsigned short p_len, unsigned short p_savedLen, unsigned long p_ack, long p_time)
+{
+   p_seq &= 0xffffffffUL;
+   EthernetPacket* eth = p_staple.packetPool.NewEthernetPacket();
+   TCPPacket* tcp = p_staple.packetPool.NewTCPPacket();
+   eth->pL3Packet = tcp;
+   tcp->pL2Packet = eth;
+   eth->time.tv_sec = p_time;
+   eth->time.tv_usec = p_seq % 1000000;
+   eth->l2SavedLen = 54 + p_savedLen;
+   tcp->payload = p_staple.packetPool.PayloadSlab(tcp, p_savedLen);
+   for (unsigned short i=0;i<p_savedLen;i++) tcp->payload[i] = PayloadByte(p_seq + i);
+   tcp->payloadSavedLen = p_savedLen;
+   tcp->seq = p_seq;
+   tcp->ack = p_ack;
+   tcp->TCPPLLen = p_len;
+   tcp->IPPktLen = p_len + 40;
+   tcp->srcPort = 80;
+   tcp->dstPort = 40000;
+   return tcp;
+}
+
+// The same packet (or both NULL)
+static bool SamePacket(const TCPPacket* p_packet, const TCPPacket* p_reference)
+{
+   if ((p_packet == NULL) || (p_reference == NULL)) return p_packet == p_reference;
+   return (p_packet->seq == p_reference->seq) && (p_packet->ack == p_reference->ack) && (p_packet->TCPPLLen == p_reference->TCPPLLen) &&
+          (p_packet->IPPktLen == p_reference->IPPktLen) && (p_packet->payloadSavedLen == p_reference->payloadSavedLen) &&
+          (memcmp(p_packet->payload, p_reference->payload, p_packet->payloadSavedLen) == 0) &&
+          (p_packet->pL2Packet->pL3Packet == p_packet) && (p_packet->pL2Packet->time.tv_sec == p_reference->pL2Packet->time.tv_sec) &&
+          (p_packet->pL2Packet->time.tv_usec == p_reference->pL2Packet->time.tv_usec) &&
+          (p_packet->pL2Packet->l2SavedLen == p_reference->pL2Packet->l2SavedLen);
+}
+
+// The payload of a buffered packet is still the one it was added with (its slab was not recycled under it)
+static bool IntactPayload(const TCPPacket* p_packet)
+{
+   if (p_packet->payloadSavedLen == 0) return true;
+   for (unsigned short i=0;i<p_packet->payloadSavedLen;i++)
+   {
+      if (p_packet->payload[i] != PayloadByte(p_packet->seq + i)) return false;
+   }
+   return true;
+}
+
+struct ReplayResult {
+   bool           same;
+   bool           intact;
+   unsigned long  gets;                       // Packets got (to check that the replays get somewhere)
+   unsigned long  fakes;                      // Fake packets got
+};
+
+// Take the available packets out of both buffers
+static void Drain(PacketBuffer& p_buffer, DequePacketBuffer& p_reference, ReplayResult& p_result)
+{
+   while (true)
+   {
+      TCPPacket* packet = p_buffer.get();
+      TCPPacket* reference = p_reference.get();
+      if (!SamePacket(packet, reference)) p_result.same = false;
+      if (packet != NULL)
+      {
+         p_result.gets++;
+         if (packet->pL2Packet->l2SavedLen == 0) p_result.fakes++;
+         if (!IntactPayload(packet)) p_result.intact = false;
+      }
+      delete packet;
+      delete reference;
+      if ((packet == NULL) || (reference == NULL)) break;
+   }
+}
+
+// One TCP stream: segments sent in order, then reordered, retransmitted (as duplicates or overlapping with other
+// segments), lost or truncated by the capture, with the ACKs of the other direction every now and then
+static void Replay(Staple& p_staple, unsigned long p_firstSeq, int p_maxSize, ReplayResult& p_result)
+{
+   PacketBuffer buffer(p_staple, p_maxSize);
+   DequePacketBuffer reference(p_maxSize);
+   unsigned long nextSeq = p_firstSeq;
+   std::deque<TCPPacket*> sent;
+   for (int i=0;i<400;i++)
+   {
+      // The next segment (small and large payloads: the large ones share the slab of the pooled packet)
+      unsigned short len = (Random() % 4 == 0) ? Random() % 200 : 200 + Random() % 1300;
+      unsigned long seq = nextSeq;
+      unsigned long action = Random() % 16;
+      if (action == 0) seq = nextSeq - Random() % 3000;                            // Retransmission (duplicate or overlap)
+      else if (action == 1) seq = nextSeq + Random() % 3000;                       // Segment after a lost one
+      else if (action == 2) seq = nextSeq + 11*1024*1024 + Random() % 1000;        // Insane SEQ
+      else nextSeq += len;
+      if (seq < p_firstSeq) seq = p_firstSeq;
+      unsigned short savedLen = (Random() % 10 == 0) ? len / 2 : len;              // Truncated by the capture
+      TCPPacket* packet = NewPacket(p_staple, seq, len, savedLen, Random(), i);
+      // Reordering: some of the segments are held back a few places
+      sent.push_back(packet);
+      if ((sent.size() < 4) && (Random() % 3 != 0)) continue;
+      while (!sent.empty())
+      {
+         unsigned long index = Random() % sent.size();
+         TCPPacket* p = sent[index];
+         sent.erase(sent.begin() + index);
+         // The HTTP parser uses the packet right away if it can, otherwise it buffers a copy of it
+         bool direct = buffer.tryAddGet(*p);
+         if (direct != reference.tryAddGet(*p)) p_result.same = false;
+         if (!direct)
+         {
+            if (buffer.add(*p) != reference.add(*p)) p_result.same = false;
+         }
+         p_staple.packetPool.Release(p);
+         if (Random() % 4 != 0) break;
+      }
+      if (Random() % 20 == 0)
+      {
+         uint32_t ack = nextSeq - Random() % 5000;
+         buffer.updateAck(ack);
+         reference.updateAck(ack);
+      }
+      if ((buffer.getNextSeqNo() != reference.getNextSeqNo()) || (buffer.numPackets() != reference.numPackets()) ||
+          (buffer.hasPackets() != reference.hasPackets())) p_result.same = false;
+      if (Random() % 3 == 0) Drain(buffer, reference, p_result);
+   }
+   for (unsigned long i=0;i<sent.size();i++) p_staple.packetPool.Release(sent[i]);
+   // End of the session: the holes are filled with fake packets
+   buffer.finishTCPSession();
+   reference.finishTCPSession();
+   Drain(buffer, reference, p_result);
+   if (buffer.hasPackets() || reference.hasPackets()) p_result.same = false;
+}
+
+static void TestReplay(Staple& p_staple, unsigned long p_firstSeq, int p_maxSize)
+{
+   ReplayResult result = {true, true, 0, 0};
+   for (int i=0;i<200;i++) Replay(p_staple, p_firstSeq + Random() % 100000, p_maxSize, result);
+   CHECK(result.same);
+   CHECK(result.intact);
+   CHECK((result.gets > 0) && (result.fakes > 0));
+}
+
+// Duplicates of a buffered packet (same SEQ, or overlapping it) are dropped, whatever their length
+static void TestDuplicates(Staple& p_staple)
+{
+   PacketBuffer buffer(p_staple);
+   DequePacketBuffer reference(1024*250);
+   const unsigned long seqs[] = {1000, 3000, 3000, 2000, 3500, 2999, 1000, 2500, 4000, 4000};
+   const unsigned short lens[] = {1000, 1000, 500, 1000, 500, 2, 1000, 600, 300, 300};
+   bool same = true;
+   for (unsigned long i=0;i<sizeof(seqs)/sizeof(seqs[0]);i++)
+   {
+      TCPPacket* packet = NewPacket(p_staple, seqs[i], lens[i], lens[i], 0, i);
+      if (buffer.add(*packet) != reference.add(*packet)) same = false;
+      if (buffer.numPackets() != reference.numPackets()) same = false;
+      p_staple.packetPool.Release(packet);
+   }
+   CHECK(same);
+   CHECK(buffer.numPackets() == 4);
+   ReplayResult result = {true, true, 0, 0};
+   Drain(buffer, reference, result);
+   CHECK(result.same && result.intact);
+   CHECK((result.gets == 4) && (buffer.getNextSeqNo() == 4300));
+}
+
+int main()
+{
+   Staple staple;
+   TestDuplicates(staple);
+   TestReplay(staple, 1000, 1024*250);
+   TestReplay(staple, 1000, 8000);
+   TestReplay(staple, 0xffffffffUL - 1500000, 8000);
+   return TesterResult("PacketBufferTester");
+}
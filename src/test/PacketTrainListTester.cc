@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <list>
+#include <vector>
+#include <iostream>
+
+#include <staple/PacketTrainList.h>
+#include "Tester.h"
+
+// Differential test of the packet history ring against the former list of packet trains (kept below as the
+// reference): the same reordered, duplicated and overlapping packet sequences, also across the 2^32 SEQ
+// wraparound, have to give the same results, contents, packet trains and firstSeq/lastSeq
+
+// Reference: the former implementation (list of packet trains, each a list of packets)
+// -------------------------------------------------------------------------------------
+class ListPacketTrain {
+public:
+   unsigned long     firstSeq;
+   unsigned long     lastSeq;
+   std::list<PacketTrainTCPPacket> packetList;
+
+   void Init()
+   {
+      firstSeq = 0;
+      lastSeq = 0;
+      packetList.clear();
+   }
+
+   bool TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq)
+   {
+      return !(((p_firstSeq < firstSeq) && (p_lastSeq <= firstSeq)) || ((p_firstSeq >= lastSeq) && (p_lastSeq > lastSeq)));
+   }
+
+   std::list<PacketTrainTCPPacket>::iterator TestPacket (unsigned long p_firstSeq, unsigned long p_lastSeq)
+   {
+      if (TestPartialOverlap(p_firstSeq, p_lastSeq) == false) return packetList.end();
+      std::list<PacketTrainTCPPacket>::iterator index = packetList.begin();
+      while ((index != packetList.end()) && !((p_firstSeq == (*index).seq) && (p_lastSeq == (*index).seq+(*index).len))) index++;
+      return index;
+   }
+
+   std::list<PacketTrainTCPPacket>::iterator TestPacketSeq (unsigned long p_seq)
+   {
+      if (TestPartialOverlap(p_seq, p_seq) == false) return packetList.end();
+      std::list<PacketTrainTCPPacket>::iterator index = packetList.begin();
+      while ((index != packetList.end()) && (p_seq != (*index).seq)) index++;
+      return index;
+   }
+
+   bool InsertPacketToBack (PacketTrainTCPPacket& p_packet)
+   {
+      if (p_packet.len == 0) return false;
+      if (packetList.empty() == true)
+      {
+         packetList.push_back(p_packet);
+         firstSeq = p_packet.seq;
+         lastSeq = p_packet.seq + p_packet.len;
+         return true;
+      }
+      if (p_packet.seq == lastSeq)
+      {
+         packetList.push_back(p_packet);
+         lastSeq += p_packet.len;
+         return true;
+      }
+      return false;
+   }
+
+   bool InsertPacketToFront (PacketTrainTCPPacket& p_packet)
+   {
+      if (p_packet.len == 0) return false;
+      if (packetList.empty() == true)
+      {
+         packetList.push_front(p_packet);
+         firstSeq = p_packet.seq;
+         lastSeq = p_packet.seq + p_packet.len;
+         return true;
+      }
+      if ((p_packet.seq + p_packet.len) == firstSeq)
+      {
+         packetList.push_front(p_packet);
+         firstSeq -= p_packet.len;
+         return true;
+      }
+      return false;
+   }
+
+   bool RemoveFirstPacket()
+   {
+      if (packetList.empty() == true) return false;
+      firstSeq += packetList.front().len;
+      packetList.pop_front();
+      return true;
+   }
+};
+
+class ListPacketTrainList {
+public:
+   unsigned long          firstSeq;
+   unsigned long          lastSeq;
+   std::list<ListPacketTrain> packetTrainList;
+
+   void Init()
+   {
+      firstSeq = 0;
+      lastSeq = 0;
+      packetTrainList.clear();
+   }
+
+   std::list<ListPacketTrain>::iterator TestPartialOverlap (unsigned long p_firstSeq, unsigned long p_lastSeq)
+   {
+      std::list<ListPacketTrain>::iterator index = packetTrainList.begin();
+      while ((index != packetTrainList.end()) && ((*index).TestPartialOverlap(p_firstSeq, p_lastSeq) == false)) index++;
+      return index;
+   }
+
+   bool InsertPacket (PacketTrainTCPPacket& p_packet)
+   {
+      if (p_packet.len == 0) return false;
+      ListPacketTrain packetTrain;
+      packetTrain.Init();
+      // First packet in the list?
+      if (packetTrainList.empty() == true)
+      {
+         packetTrain.InsertPacketToFront(p_packet);
+         packetTrainList.push_back(packetTrain);
+         firstSeq = p_packet.seq;
+         lastSeq = p_packet.seq + p_packet.len;
+         return true;
+      }
+      // CONSECUTIVE packet at the END?
+      if (p_packet.seq == lastSeq)
+      {
+         packetTrainList.back().InsertPacketToBack(p_packet);
+         lastSeq = p_packet.seq + p_packet.len;
+         return true;
+      }
+      // NON-CONSECUTIVE packet past the END?
+      if (p_packet.seq > lastSeq)
+      {
+         packetTrain.InsertPacketToFront(p_packet);
+         packetTrainList.push_back(packetTrain);
+         lastSeq = p_packet.seq + p_packet.len;
+         return true;
+      }
+      // NON-OVERLAPPING packet somewhere else?
+      std::list<ListPacketTrain>::iterator trainIndex = TestPartialOverlap(p_packet.seq,p_packet.seq+p_packet.len);
+      if (trainIndex != packetTrainList.end()) return false;
+      for (trainIndex=packetTrainList.begin();trainIndex!=packetTrainList.end();trainIndex++)
+      {
+         if ((p_packet.seq+p_packet.len) > (*trainIndex).firstSeq) continue;
+         std::list<ListPacketTrain>::iterator nextTrain = trainIndex;
+         if (nextTrain == packetTrainList.begin())
+         {
+            if ((p_packet.seq+p_packet.len) == (*nextTrain).firstSeq)
+            {
+               (*nextTrain).InsertPacketToFront(p_packet);
+            }
+            else
+            {
+               packetTrain.InsertPacketToFront(p_packet);
+               packetTrainList.push_front(packetTrain);
+            }
+            firstSeq = p_packet.seq;
+            return true;
+         }
+         std::list<ListPacketTrain>::iterator lastTrain = --trainIndex;
+         bool toLast = (p_packet.seq == (*lastTrain).lastSeq);
+         bool toNext = ((p_packet.seq+p_packet.len) == (*nextTrain).firstSeq);
+         if (!toLast && !toNext)
+         {
+            packetTrain.InsertPacketToFront(p_packet);
+            packetTrainList.insert(nextTrain,packetTrain);
+         }
+         if (toLast && !toNext) (*lastTrain).InsertPacketToBack(p_packet);
+         if (!toLast && toNext) (*nextTrain).InsertPacketToFront(p_packet);
+         if (toLast && toNext)
+         {
+            // Merge the two trains by the new packet
+            if ((*lastTrain).packetList.size() > (*nextTrain).packetList.size())
+            {
+               (*lastTrain).InsertPacketToBack(p_packet);
+               while ((*nextTrain).packetList.empty() != true)
+               {
+                  (*lastTrain).packetList.push_back((*nextTrain).packetList.front());
+                  (*nextTrain).packetList.pop_front();
+               }
+               (*lastTrain).lastSeq = (*nextTrain).lastSeq;
+               packetTrainList.erase(nextTrain);
+            }
+            else
+            {
+               (*nextTrain).InsertPacketToFront(p_packet);
+               while ((*lastTrain).packetList.empty() != true)
+               {
+                  (*nextTrain).packetList.push_front((*lastTrain).packetList.back());
+                  (*lastTrain).packetList.pop_back();
+               }
+               (*nextTrain).firstSeq = (*lastTrain).firstSeq;
+               packetTrainList.erase(lastTrain);
+            }
+         }
+         return true;
+      }
+      return false;
+   }
+
+   bool RemoveFirstPacket()
+   {
+      bool success = false;
+      std::list<ListPacketTrain>::iterator index = packetTrainList.begin();
+      while (index != packetTrainList.end())
+      {
+         if ((*index).RemoveFirstPacket() == true)
+         {
+            success = true;
+            if ((*index).firstSeq == (*index).lastSeq) packetTrainList.pop_front();
+            break;
+         }
+         packetTrainList.pop_front();
+         index = packetTrainList.begin();
+      }
+      if (packetTrainList.empty() == true) firstSeq = lastSeq = 0;
+      else firstSeq = packetTrainList.front().firstSeq;
+      return success;
+   }
+};
+
+// Differential test
+// -----------------
+static unsigned long long randomState = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long Random()
+{
+   randomState ^= randomState >> 12;
+   randomState ^= randomState << 25;
+   randomState ^= randomState >> 27;
+   return (unsigned long)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static PacketTrainTCPPacket MakePacket(unsigned long p_seq, unsigned long p_len, unsigned long p_n)
+{
+   PacketTrainTCPPacket packet;
+   packet.Init();
+   packet.seq = p_seq;
+   packet.len = (unsigned short)p_len;
+   packet.t.tv_sec = 1600000000 + p_n/1000;
+   packet.t.tv_usec = p_n%1000;
+   return packet;
+}
+
+// Same packets, packet trains and sequence range
+static bool SameContent(const ListPacketTrainList& p_reference, const PacketTrainList& p_list)
+{
+   if ((p_reference.firstSeq != p_list.firstSeq) || (p_reference.lastSeq != p_list.lastSeq)) return false;
+   unsigned long i = 0;
+   for (std::list<ListPacketTrain>::const_iterator train=p_reference.packetTrainList.begin();train!=p_reference.packetTrainList.end();++train)
+   {
+      for (std::list<PacketTrainTCPPacket>::const_iterator packet=train->packetList.begin();packet!=train->packetList.end();++packet)
+      {
+         if (i >= p_list.Size()) return false;
+         const PacketTrainTCPPacket& actPacket = p_list.Packet(i);
+         if ((actPacket.seq != packet->seq) || (actPacket.len != packet->len) || (actPacket.t.tv_sec != packet->t.tv_sec) || (actPacket.t.tv_usec != packet->t.tv_usec)) return false;
+         // The train ends at the same packet
+         bool last = (packet == --train->packetList.end());
+         if (p_list.IsTrainEnd(i) != last) return false;
+         i++;
+      }
+   }
+   return (i == p_list.Size());
+}
+
+// The lookups done by the parser give the same answers (overlap test, then the packet in the overlapping train)
+static bool SameLookup(ListPacketTrainList& p_reference, const PacketTrainList& p_list, unsigned long p_firstSeq, unsigned long p_lastSeq)
+{
+   std::list<ListPacketTrain>::iterator train = p_reference.TestPartialOverlap(p_firstSeq, p_lastSeq);
+   bool overlap = (train != p_reference.packetTrainList.end());
+   if (p_list.TestPartialOverlap(p_firstSeq, p_lastSeq) != overlap) return false;
+   if (!overlap) return true;
+   // Packet with the exact range
+   std::list<PacketTrainTCPPacket>::iterator packet = train->TestPacket(p_firstSeq, p_lastSeq);
+   unsigned long index = p_list.FindPacket(p_firstSeq, p_lastSeq);
+   if ((packet != train->packetList.end()) != (index != PacketTrainList::NONE)) return false;
+   if ((index != PacketTrainList::NONE) && (p_list.Packet(index).seq != packet->seq)) return false;
+   // Packet starting at the first SEQ (as the parser looks it up, with a zero-length overlap test)
+   train = p_reference.TestPartialOverlap(p_firstSeq, p_firstSeq);
+   overlap = (train != p_reference.packetTrainList.end());
+   if (p_list.TestPartialOverlap(p_firstSeq, p_firstSeq) != overlap) return false;
+   if (!overlap) return true;
+   packet = train->TestPacketSeq(p_firstSeq);
+   index = p_list.FindPacketSeq(p_firstSeq);
+   if ((packet != train->packetList.end()) != (index != PacketTrainList::NONE)) return false;
+   return ((index == PacketTrainList::NONE) || (p_list.Packet(index).seq == packet->seq));
+}
+
+// Replays a random mix of in-order, reordered, duplicated and overlapping packets, front removals and lookups
+// on both implementations, starting from the given SEQ (the SEQs are 32-bit TCP sequence numbers)
+static bool Replay(unsigned long p_startSeq, unsigned long p_opNum)
+{
+   ListPacketTrainList reference;
+   reference.Init();
+   PacketTrainList list;
+   // The segments of the stream (sent in a reordered way, some of them lost or sent again)
+   std::vector<PacketTrainTCPPacket> segments;
+   unsigned long offset = 0;
+   for (unsigned long n=0;n<p_opNum;n++)
+   {
+      unsigned long len = (Random() % 4 == 0) ? 1 + Random() % 100 : 1460;
+      segments.push_back(MakePacket((p_startSeq + offset) & 0xffffffffUL, len, n));
+      offset += len;
+   }
+   unsigned long next = 0;
+   for (unsigned long n=0;n<p_opNum;n++)
+   {
+      PacketTrainTCPPacket packet;
+      unsigned long action = Random() % 16;
+      if (action < 8)
+      {
+         // Next segment, or one of the recent ones (reordering or duplicate)
+         unsigned long k = next;
+         if ((Random() % 3 == 0) && (next > 0)) k = next - 1 - Random() % ((next < 20) ? next : 20);
+         else if (next < segments.size()) next++;
+         if (k >= segments.size()) continue;
+         packet = segments[k];
+      }
+      else if (action < 10)
+      {
+         // A segment a bit ahead (hole in the stream)
+         unsigned long k = next + 1 + Random() % 8;
+         if (k >= segments.size()) continue;
+         packet = segments[k];
+      }
+      else if (action < 12)
+      {
+         // Overlapping range (repacketized retransmission) or an empty packet
+         if (next == 0) continue;
+         const PacketTrainTCPPacket& base = segments[next - 1 - Random() % ((next < 10) ? next : 10)];
+         packet = MakePacket((base.seq + Random() % 2000 - 1000) & 0xffffffffUL, Random() % 3000, n);
+      }
+      else if (action < 14)
+      {
+         bool removed = reference.RemoveFirstPacket();
+         if (list.RemoveFirstPacket() != removed) return false;
+         if (!SameContent(reference, list)) return false;
+         continue;
+      }
+      else
+      {
+         // Lookups around the packets seen (exact packets, packet starts, arbitrary ranges and zero-length ranges)
+         for (int j=0;j<8;j++)
+         {
+            unsigned long firstSeq, lastSeq;
+            if ((list.Size() > 0) && (j < 4))
+            {
+               const PacketTrainTCPPacket& seen = list.Packet(Random() % list.Size());
+               firstSeq = seen.seq;
+               lastSeq = (j < 2) ? seen.seq + seen.len : seen.seq + Random() % 3000;
+            }
+            else
+            {
+               unsigned long base = (next > 0) ? segments[next - 1].seq : p_startSeq;
+               firstSeq = (base + Random() % 40000 - 30000) & 0xffffffffUL;
+               lastSeq = firstSeq + ((j % 2 == 0) ? 0 : Random() % 3000);
+            }
+            if (!SameLookup(reference, list, firstSeq, lastSeq)) return false;
+         }
+         continue;
+      }
+      bool inserted = reference.InsertPacket(packet);
+      if (list.InsertPacket(packet) != inserted) return false;
+      if (!SameContent(reference, list)) return false;
+   }
+   // A copy keeps the content
+   PacketTrainList copy(list);
+   return SameContent(reference, copy);
+}
+
+// Reordered arrival of a whole window, first in reverse order, then even/odd (many trains merged by one packet)
+static bool ReplayWindow(unsigned long p_startSeq)
+{
+   ListPacketTrainList reference;
+   reference.Init();
+   PacketTrainList list;
+   std::vector<PacketTrainTCPPacket> segments;
+   for (unsigned long n=0;n<64;n++) segments.push_back(MakePacket((p_startSeq + n*1000) & 0xffffffffUL, 1000, n));
+   for (unsigned long n=0;n<32;n++)
+   {
+      PacketTrainTCPPacket packet = segments[31-n];
+      reference.InsertPacket(packet);
+      list.InsertPacket(packet);
+   }
+   for (unsigned long n=0;n<32;n++)
+   {
+      PacketTrainTCPPacket packet = segments[32 + ((n < 16) ? 2*n : 2*(n-16)+1)];
+      reference.InsertPacket(packet);
+      list.InsertPacket(packet);
+      if (!SameContent(reference, list)) return false;
+   }
+   while (list.Size() > 0)
+   {
+      reference.RemoveFirstPacket();
+      list.RemoveFirstPacket();
+      if (!SameContent(reference, list)) return false;
+   }
+   return (list.firstSeq == 0) && (list.lastSeq == 0);
+}
+
+int main()
+{
+   // Start points: low SEQs, random ones, and ones shortly before the 2^32 wraparound
+   bool same = true;
+   for (int i=0;i<2000;i++)
+   {
+      unsigned long startSeq;
+      switch (i % 3)
+      {
+      case 0: startSeq = Random() % 100000; break;
+      case 1: startSeq = Random(); break;
+      default: startSeq = 0x100000000UL - 1 - Random() % 200000;
+      }
+      same = same && Replay(startSeq, 300);
+   }
+   CHECK(same);
+   CHECK(ReplayWindow(1000));
+   CHECK(ReplayWindow(0x100000000UL - 20500));
+   return TesterResult("PacketTrainListTester");
+}
@@ -0,0 +1,28 @@
+#ifndef TESTER_H
+#define TESTER_H
+
+#include <iostream>
+
+// Minimal check helpers of the stand-alone testers (each tester is a program: 0 exit code if all checks passed)
+
+static unsigned long testerChecks = 0;
+static unsigned long testerFailures = 0;
+
+#define CHECK(cond)                                                                             \
+   do {                                                                                         \
+      testerChecks++;                                                                           \
+      if (!(cond))                                                                              \
+      {                                                                                         \
+         testerFailures++;                                                                      \
+         std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n";             \
+      }                                                                                         \
+   } while (0)
+
+// Print the summary and give the exit code of the tester
+inline int TesterResult(const char* p_name)
+{
+   std::cout << p_name << ": " << testerChecks << " checks, " << testerFailures << " failed\n";
+   return (testerFailures == 0) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <vector>
+
+#include <staple/TimerWheel.h>
+#include "Tester.h"
+
+// Tests of the TCP/IP timeout wheel (TimerWheel)
+
+typedef TimerWheel<int> Wheel;
+
+// Entry of the "registry" of the test: its link and the second of its last activity
+struct Entry {
+   TimerWheelLink<int>  link;
+   long                 sec;
+};
+
+// One timeout check as in Parser::CheckTimeouts: the collected entries are expired if they are old enough
+static unsigned long ExpireEntries(Wheel& wheel, std::vector<Entry>& entries, long now, long timeout)
+{
+   std::vector<int> keys;
+   wheel.Expire(now - timeout - 1, keys);
+   unsigned long expired = 0;
+   for (unsigned long i=0;i<keys.size();i++)
+   {
+      Entry& entry = entries[keys[i]];
+      if (entry.link.sec < 0) continue;
+      long age = (now > entry.sec) ? now - entry.sec : entry.sec - now;
+      if (age > timeout)
+      {
+         wheel.Unlink(entry.link);
+         expired++;
+      }
+   }
+   return expired;
+}
+
+static void Touch(Wheel& wheel, std::vector<Entry>& entries, int key, long sec)
+{
+   entries[key].sec = sec;
+   wheel.Link(entries[key].link, key, sec);
+}
+
+// Entries are expired one timeout after their last activity, and not before
+static void TestForward()
+{
+   const long timeout = 30;
+   Wheel wheel;
+   std::vector<Entry> entries(100);
+   for (int i=0;i<100;i++) Touch(wheel, entries, i, 1000 + i/10);
+   unsigned long expired = 0;
+   for (long now=1000;now<=1040;now++) expired += ExpireEntries(wheel, entries, now, timeout);
+   // Entries of the seconds 1000..1009 are older than 30 s at 1040 only up to 1009
+   CHECK(expired == 100);
+   // An entry touched again is not expired at its old second
+   Wheel wheel2;
+   std::vector<Entry> entries2(2);
+   Touch(wheel2, entries2, 0, 2000);
+   Touch(wheel2, entries2, 1, 2000);
+   Touch(wheel2, entries2, 1, 2020);
+   unsigned long expired2 = 0;
+   for (long now=2000;now<=2040;now++) expired2 += ExpireEntries(wheel2, entries2, now, timeout);
+   CHECK(expired2 == 1);
+   CHECK(entries2[1].link.sec == 2020);
+   for (long now=2041;now<=2060;now++) expired2 += ExpireEntries(wheel2, entries2, now, timeout);
+   CHECK(expired2 == 2);
+}
+
+// After a backward time jump the entries active after the jump are expired at the (earlier) time of the trace
+static void TestBackwardJump(bool p_fullScan)
+{
+   const long timeout = 30;
+   Wheel wheel;
+   std::vector<Entry> entries(200);
+   // Activity up to 10000, everything old expired on the way
+   for (int i=0;i<100;i++) Touch(wheel, entries, i, 9990 + i/10);
+   for (long now=9990;now<=10000;now++) ExpireEntries(wheel, entries, now, timeout);
+
+   // Jump back by an hour
+   long jump = 10000 - 3600;
+   if (p_fullScan)
+   {
+      // The parser checks all the entries at once at the jump, then the wheel continues from the actual time
+      for (int i=0;i<100;i++)
+      {
+         long age = entries[i].sec - jump;
+         if ((entries[i].link.sec >= 0) && (age > timeout)) wheel.Unlink(entries[i].link);
+      }
+      wheel.Restart(jump - timeout);
+   }
+   // New entries after the jump
+   for (int i=100;i<200;i++) Touch(wheel, entries, i, jump + (i-100)/10);
+   unsigned long expired = 0;
+   for (long now=jump;now<=jump+timeout+20;now++) expired += ExpireEntries(wheel, entries, now, timeout);
+   // All the entries of the new timeline are expired well before the trace time catches up again
+   unsigned long live = 0;
+   for (int i=100;i<200;i++) if (entries[i].link.sec >= 0) live++;
+   CHECK(live == 0);
+   CHECK(expired >= 100);
+}
+
+// Slots are visited once per round even if the check is late by more than the wheel
+static void TestLongGap()
+{
+   const long timeout = 30;
+   Wheel wheel;
+   std::vector<Entry> entries(TIMERWHEEL_SLOTS*2);
+   for (int i=0;i<TIMERWHEEL_SLOTS*2;i++) Touch(wheel, entries, i, 5000 + i);
+   unsigned long expired = ExpireEntries(wheel, entries, 5000 + 10*TIMERWHEEL_SLOTS, timeout);
+   CHECK(expired == (unsigned long)TIMERWHEEL_SLOTS*2);
+}
+
+int main()
+{
+   TestForward();
+   TestBackwardJump(true);
+   TestBackwardJump(false);
+   TestLongGap();
+   return TesterResult("TimerWheelTester");
+}